@@ -6095,6 +6095,68 @@ fil_io(
 	return(err);
 }
 
+/** Advises the operating system to read a range of pages of a tablespace
+into the file system cache. This does not wait for the read, and the pages
+are not read into the buffer pool: it only makes reading them later cheaper.
+Pages beyond the end of the tablespace and files that are not open are
+skipped.
+@param[in]	space_id	tablespace id
+@param[in]	page_no		first page number
+@param[in]	n_pages		number of pages */
+void
+fil_space_readahead(
+	ulint	space_id,
+	ulint	page_no,
+	ulint	n_pages)
+{
+#ifdef POSIX_FADV_WILLNEED
+	fil_space_t*	space = fil_space_get(space_id);
+
+	if (space == NULL || space->purpose == FIL_TYPE_LOG) {
+		return;
+	}
+
+	fil_space_open_if_needed(space);
+
+	mutex_enter(&fil_system->mutex);
+
+	/* The tablespace may have been dropped meanwhile */
+	space = fil_space_get_by_id(space_id);
+
+	if (space == NULL || space->size == 0) {
+		mutex_exit(&fil_system->mutex);
+		return;
+	}
+
+	const ulint	page_bytes = page_size_t(space->flags).physical();
+	ulint		node_start = 0;
+
+	for (fil_node_t* node = UT_LIST_GET_FIRST(space->chain);
+	     node != NULL && n_pages > 0;
+	     node = UT_LIST_GET_NEXT(chain, node)) {
+
+		if (page_no < node_start + node->size) {
+			ulint	first = page_no - node_start;
+			ulint	n = ut_min(n_pages, node->size - first);
+
+			if (node->is_open) {
+				posix_fadvise(node->handle.m_file,
+					      (os_offset_t) first * page_bytes,
+					      (os_offset_t) n * page_bytes,
+					      POSIX_FADV_WILLNEED);
+			}
+
+			page_no += n;
+			n_pages -= n;
+		}
+
+		node_start += node->size;
+	}
+
+	mutex_exit(&fil_system->mutex);
+#endif /* POSIX_FADV_WILLNEED */
+}
+
 #ifndef UNIV_HOTBACKUP
 /**********************************************************************//**
 Waits for an aio operation to complete. This function is used to write the
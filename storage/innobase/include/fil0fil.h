@@ -1369,6 +1369,17 @@ fil_io(
 	void*			buf,
 	void*			message);
 
+/** Advises the operating system to read a range of pages of a tablespace
+into the file system cache, without waiting for the read.
+@param[in]	space_id	tablespace id
+@param[in]	page_no		first page number
+@param[in]	n_pages		number of pages */
+void
+fil_space_readahead(
+	ulint	space_id,
+	ulint	page_no,
+	ulint	n_pages);
+
 /**********************************************************************//**
 Waits for an aio operation to complete. This function is used to write the
 handler for completed requests. The aio array of pending requests is divided
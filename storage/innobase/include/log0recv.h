@@ -255,7 +255,6 @@ struct recv_addr_t{
 	unsigned	page_no:32;/*!< page number */
 	UT_LIST_BASE_NODE_T(recv_t)
 			rec_list;/*!< list of log records for this page */
-	hash_node_t	addr_hash;/*!< hash node in the hash bucket chain */
 };
 
 struct recv_dblwr_t {
@@ -350,7 +349,14 @@ struct recv_sys_t{
 				record, or 0 if none was parsed */
 	mem_heap_t*	heap;	/*!< memory heap of log records and file
 				addresses*/
-	hash_table_t*	addr_hash;/*!< hash table of file addresses of pages */
+	recv_addr_t**	addrs;	/*!< hash table of file addresses of pages,
+				with open addressing and linear probing;
+				empty cells are NULL */
+	ulint		n_cells;/*!< number of cells in addrs, a power
+				of 2 */
+	ulint		n_used;	/*!< number of file addresses in addrs */
+	ulint		n_recs;	/*!< number of log records in the hash
+				table */
 	ulint		n_addrs;/*!< number of not processed hashed file
 				addresses in the hash table */
 
@@ -455,6 +461,26 @@ use these free frames to read in pages when we start applying the
 log records to the database. */
 extern ulint	recv_n_pool_free_frames;
 
+/** Number of threads that apply the hashed log records */
+extern ulint	recv_n_apply_threads;
+
+/** Whether the parsed log records that do not fit into the buffer pool are
+spilled to temporary files */
+extern bool	recv_spill_log_recs;
+
+/** Whether the log is scanned through a memory mapping of the log file */
+extern bool	recv_map_log_file;
+
+/** Whether the log records of tablespaces that are not in the tablespace
+cache are discarded when they are parsed */
+extern bool	recv_skip_missing_spaces;
+
+/** Flags a corrupt log record found while parsing a log record body. The
+threads that parse the log ahead of the log scan flag their own segment,
+other threads set recv_sys->found_corrupt_log. */
+void
+recv_report_corrupt_log();
+
 /** Check the 4-byte checksum to the trailer checksum field of a log
 block.
 @param[in]	log block
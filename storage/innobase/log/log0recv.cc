@@ -26,10 +26,16 @@ Created 9/20/1997 Heikki Tuuri
 
 #include "ha_prototypes.h"
 
+#include <algorithm>
 #include <vector>
 #include <map>
+#include <queue>
 #include <string>
 
+#ifndef _WIN32
+# include <sys/mman.h>
+#endif /* !_WIN32 */
+
 #include "log0recv.h"
 
 #ifdef UNIV_NONINL
@@ -37,6 +43,7 @@ Created 9/20/1997 Heikki Tuuri
 #endif
 
 #include <my_aes.h>
+#include <my_thread_local.h>
 
 #include "mem0mem.h"
 #include "buf0buf.h"
@@ -88,6 +95,9 @@ this must be less than UNIV_PAGE_SIZE as it is stored in the buffer pool */
 /** Read-ahead area in applying log records to file pages */
 #define RECV_READ_AHEAD_AREA	32
 
+/** Initial number of cells in the hash table of page file addresses */
+#define RECV_ADDRS_MIN_CELLS	1024
+
 /** The recovery system */
 recv_sys_t*	recv_sys = NULL;
 /** TRUE when applying redo log records during crash recovery; FALSE
@@ -158,6 +168,58 @@ This is the default value. If the actual size of the buffer pool is
 larger than 10 MB we'll set this value to 512. */
 ulint	recv_n_pool_free_frames;
 
+/** Number of threads that apply the hashed log records. Each thread applies
+a contiguous slice of the pages sorted by (space, page). When the log file is
+mapped, as many threads parse the log ahead of the log scan. */
+ulint	recv_n_apply_threads = 1;
+
+/** Whether the parsed log records that do not fit into the buffer pool are
+written to sorted runs in temporary files, instead of being applied in
+batches during the scan */
+bool	recv_spill_log_recs = false;
+
+/** Whether the log is scanned through a read-only memory mapping of the log
+file instead of being read into log_sys->buf, when the log group consists of
+a single file */
+bool	recv_map_log_file = false;
+
+/** Whether the log records of the tablespaces that are not in the tablespace
+cache are discarded when they are parsed, instead of being stored and
+discarded in recv_init_crash_recovery_spaces() */
+bool	recv_skip_missing_spaces = false;
+
+/** Key of the flag of the log segment that the current thread parses ahead
+of the log scan, unset in the other threads */
+static thread_local_key_t	recv_parse_corrupt_key;
+/** Whether recv_parse_corrupt_key has been created */
+static bool			recv_parse_corrupt_key_created;
+
+/** Flags a corrupt log record found while parsing a log record body. The
+threads that parse the log ahead of the log scan flag their own segment,
+other threads set recv_sys->found_corrupt_log. */
+void
+recv_report_corrupt_log()
+{
+	if (recv_parse_corrupt_key_created) {
+		bool*	corrupt = static_cast<bool*>(
+			my_get_thread_local(recv_parse_corrupt_key));
+
+		if (corrupt != NULL) {
+			*corrupt = true;
+			return;
+		}
+	}
+
+	recv_sys->found_corrupt_log = true;
+}
+
+/** The tablespace that was last looked up by recv_space_is_missing() */
+static ulint	recv_last_space_id = ULINT_UNDEFINED;
+/** Whether recv_last_space_id is missing */
+static bool	recv_last_space_missing;
+/** Number of log records discarded because of a missing tablespace */
+static ulint	recv_n_skipped_recs;
+
 /** The maximum lsn we see for a page during the recovery process. If this
 is bigger than the lsn we are able to scan up to, that is an indication that
 the recovery failed and the database may be corrupt. */
@@ -236,6 +298,11 @@ fil_name_process(
 {
 	bool	processed = true;
 
+#ifndef UNIV_HOTBACKUP
+	/* The tablespace may be loaded or deleted here */
+	recv_last_space_id = ULINT_UNDEFINED;
+#endif /* !UNIV_HOTBACKUP */
+
 	/* store remote tablespaces inside the backup directory */
 
 	if (*name == '/') {
@@ -832,7 +899,7 @@ recv_sys_create(void)
 	mutex_create(LATCH_ID_RECV_WRITER, &recv_sys->writer_mutex);
 
 	recv_sys->heap = NULL;
-	recv_sys->addr_hash = NULL;
+	recv_sys->addrs = NULL;
 }
 
 /********************************************************//**
@@ -842,9 +909,7 @@ recv_sys_close(void)
 /*================*/
 {
 	if (recv_sys != NULL) {
-		if (recv_sys->addr_hash != NULL) {
-			hash_table_free(recv_sys->addr_hash);
-		}
+		ut_free(recv_sys->addrs);
 
 		if (recv_sys->heap != NULL) {
 			mem_heap_free(recv_sys->heap);
@@ -882,9 +947,7 @@ recv_sys_mem_free(void)
 /*===================*/
 {
 	if (recv_sys != NULL) {
-		if (recv_sys->addr_hash != NULL) {
-			hash_table_free(recv_sys->addr_hash);
-		}
+		ut_free(recv_sys->addrs);
 
 		if (recv_sys->heap != NULL) {
 			mem_heap_free(recv_sys->heap);
@@ -982,6 +1045,32 @@ DECLARE_THREAD(recv_writer_thread)(
 }
 #endif /* !UNIV_HOTBACKUP */
 
+/** Creates an empty hash table of page file addresses.
+@param[in]	n_cells	number of cells, a power of 2 */
+static
+void
+recv_addrs_create(
+	ulint	n_cells)
+{
+	ut_ad(ut_is_2pow(n_cells));
+
+	recv_sys->addrs = static_cast<recv_addr_t**>(
+		ut_zalloc_nokey(n_cells * sizeof *recv_sys->addrs));
+	recv_sys->n_cells = n_cells;
+	recv_sys->n_used = 0;
+}
+
+/** Gets the memory used by the hashed log records, including the hash table
+of file addresses, to be checked against the memory available for them.
+@return memory used in bytes */
+static
+ulint
+recv_sys_mem_used()
+{
+	return(mem_heap_get_size(recv_sys->heap)
+	       + recv_sys->n_cells * sizeof *recv_sys->addrs);
+}
+
 /************************************************************
 Inits the recovery system for a recovery operation. */
 void
@@ -1020,8 +1109,9 @@ recv_sys_init(
 	recv_sys->len = 0;
 	recv_sys->recovered_offset = 0;
 
-	recv_sys->addr_hash = hash_create(available_memory / 512);
+	recv_addrs_create(RECV_ADDRS_MIN_CELLS);
 	recv_sys->n_addrs = 0;
+	recv_sys->n_recs = 0;
 
 	recv_sys->apply_log_recs = FALSE;
 	recv_sys->apply_batch_on = FALSE;
@@ -1059,10 +1149,26 @@ recv_sys_empty_hash(void)
 			" were left unprocessed!";
 	}
 
-	hash_table_free(recv_sys->addr_hash);
-	mem_heap_empty(recv_sys->heap);
+	/* Size the table for a batch like this one, instead of clearing all
+	cells of a table that may have grown for a bigger batch. A zeroed
+	allocation of a large table gets fresh pages from the system, which
+	do not need to be cleared. */
+	ulint	n_cells = RECV_ADDRS_MIN_CELLS;
+
+	while (4 * recv_sys->n_used > 3 * n_cells) {
+		n_cells *= 2;
+	}
+
+	if (recv_sys->n_cells == RECV_ADDRS_MIN_CELLS) {
+		memset(recv_sys->addrs, 0, n_cells * sizeof *recv_sys->addrs);
+		recv_sys->n_used = 0;
+	} else {
+		ut_free(recv_sys->addrs);
+		recv_addrs_create(n_cells);
+	}
 
-	recv_sys->addr_hash = hash_create(buf_pool_get_curr_size() / 512);
+	recv_sys->n_recs = 0;
+	mem_heap_empty(recv_sys->heap);
 }
 
 #ifndef UNIV_HOTBACKUP
@@ -1075,14 +1181,14 @@ recv_sys_debug_free(void)
 {
 	mutex_enter(&(recv_sys->mutex));
 
-	hash_table_free(recv_sys->addr_hash);
+	ut_free(recv_sys->addrs);
 	mem_heap_free(recv_sys->heap);
 	ut_free(recv_sys->buf);
 	ut_free(recv_sys->last_block_buf_start);
 
 	recv_sys->buf = NULL;
 	recv_sys->heap = NULL;
-	recv_sys->addr_hash = NULL;
+	recv_sys->addrs = NULL;
 	recv_sys->last_block_buf_start = NULL;
 
 	/* wake page cleaner up to progress */
@@ -2208,7 +2314,7 @@ recv_parse_or_apply_log_rec_body(
 		break;
 	default:
 		ptr = NULL;
-		recv_sys->found_corrupt_log = true;
+		recv_report_corrupt_log();
 	}
 
 	if (index) {
@@ -2235,18 +2341,22 @@ recv_fold(
 	return(ut_fold_ulint_pair(space, page_no));
 }
 
-/*********************************************************************//**
-Calculates the hash value of a page file address: used in inserting or
-searching for a log record in the hash table.
-@return folded value */
+/** Calculates the first cell of a page file address in the hash table. The
+fold value is multiplied by a large odd constant, so that the addresses of
+consecutive pages do not form long runs of occupied cells.
+@param[in]	space	space id
+@param[in]	page_no	page number
+@return cell number */
 UNIV_INLINE
 ulint
 recv_hash(
-/*======*/
-	ulint	space,	/*!< in: space */
-	ulint	page_no)/*!< in: page number */
+	ulint	space,
+	ulint	page_no)
 {
-	return(hash_calc_hash(recv_fold(space, page_no), recv_sys->addr_hash));
+	ib_uint64_t	h = recv_fold(space, page_no)
+		* 0x9E3779B97F4A7C15ULL;
+
+	return(static_cast<ulint>(h >> 32) & (recv_sys->n_cells - 1));
 }
 
 /*********************************************************************//**
@@ -2261,12 +2371,9 @@ recv_get_fil_addr_struct(
 {
 	recv_addr_t*	recv_addr;
 
-	for (recv_addr = static_cast<recv_addr_t*>(
-			HASH_GET_FIRST(recv_sys->addr_hash,
-				       recv_hash(space, page_no)));
-	     recv_addr != 0;
-	     recv_addr = static_cast<recv_addr_t*>(
-		     HASH_GET_NEXT(addr_hash, recv_addr))) {
+	for (ulint i = recv_hash(space, page_no);
+	     (recv_addr = recv_sys->addrs[i]) != NULL;
+	     i = (i + 1) & (recv_sys->n_cells - 1)) {
 
 		if (recv_addr->space == space
 		    && recv_addr->page_no == page_no) {
@@ -2278,6 +2385,62 @@ recv_get_fil_addr_struct(
 	return(NULL);
 }
 
+/** Inserts a page file address that is not in the hash table yet.
+@param[in]	recv_addr	file address struct */
+static
+void
+recv_insert_fil_addr_struct(
+	recv_addr_t*	recv_addr)
+{
+	ulint	i = recv_hash(recv_addr->space, recv_addr->page_no);
+
+	while (recv_sys->addrs[i] != NULL) {
+		i = (i + 1) & (recv_sys->n_cells - 1);
+	}
+
+	recv_sys->addrs[i] = recv_addr;
+	recv_sys->n_used++;
+}
+
+/** Doubles the size of the hash table of file addresses. */
+static
+void
+recv_addrs_grow()
+{
+	recv_addr_t**	old_addrs = recv_sys->addrs;
+	ulint		old_n_cells = recv_sys->n_cells;
+
+	recv_addrs_create(2 * old_n_cells);
+
+	for (ulint i = 0; i < old_n_cells; i++) {
+		if (old_addrs[i] != NULL) {
+			recv_insert_fil_addr_struct(old_addrs[i]);
+		}
+	}
+
+	ut_free(old_addrs);
+}
+
+#ifndef UNIV_HOTBACKUP
+/** Checks if a tablespace is missing from the tablespace cache. Consecutive
+log records are mostly for the same tablespace, so the last answer is
+remembered until a MLOG_FILE_* record is processed.
+@param[in]	space_id	tablespace id
+@return whether the tablespace is missing */
+static
+bool
+recv_space_is_missing(
+	ulint	space_id)
+{
+	if (space_id != recv_last_space_id) {
+		recv_last_space_missing = fil_space_get(space_id) == NULL;
+		recv_last_space_id = space_id;
+	}
+
+	return(recv_last_space_missing);
+}
+#endif /* !UNIV_HOTBACKUP */
+
 /*******************************************************************//**
 Adds a new log record to the hash table of log records. */
 static
@@ -2307,10 +2470,32 @@ recv_add_to_hash_table(
 	ut_ad(type != MLOG_INDEX_LOAD);
 	ut_ad(type != MLOG_TRUNCATE);
 
+#ifndef UNIV_HOTBACKUP
+	/* All tablespaces of a backup are loaded before the log is
+	scanned, so the records of the tablespaces that are not in the
+	backup cannot be applied */
+	if (recv_skip_missing_spaces && recv_space_is_missing(space)) {
+		recv_n_skipped_recs++;
+		return;
+	}
+#endif /* !UNIV_HOTBACKUP */
+
 	len = rec_end - body;
 
-	recv = static_cast<recv_t*>(
-		mem_heap_alloc(recv_sys->heap, sizeof(recv_t)));
+	if (len <= RECV_DATA_BLOCK_SIZE - sizeof(recv_t)) {
+		/* Allocate the body in one piece right after the record,
+		it is then read in the same cache lines */
+		recv = static_cast<recv_t*>(
+			mem_heap_alloc(recv_sys->heap, sizeof(recv_t)
+				       + sizeof(recv_data_t) + len));
+		recv_data = reinterpret_cast<recv_data_t*>(recv + 1);
+		recv_data->next = NULL;
+		memcpy(recv_data + 1, body, len);
+	} else {
+		recv = static_cast<recv_t*>(
+			mem_heap_alloc(recv_sys->heap, sizeof(recv_t)));
+		recv_data = NULL;
+	}
 
 	recv->type = type;
 	recv->len = rec_end - body;
@@ -2329,8 +2514,12 @@ recv_add_to_hash_table(
 
 		UT_LIST_INIT(recv_addr->rec_list, &recv_t::rec_list);
 
-		HASH_INSERT(recv_addr_t, addr_hash, recv_sys->addr_hash,
-			    recv_fold(space, page_no), recv_addr);
+		/* Keep the load factor at most 3/4 */
+		if (4 * (recv_sys->n_used + 1) > 3 * recv_sys->n_cells) {
+			recv_addrs_grow();
+		}
+
+		recv_insert_fil_addr_struct(recv_addr);
 		recv_sys->n_addrs++;
 #if 0
 		fprintf(stderr, "Inserting log rec for space %lu, page %lu\n",
@@ -2340,6 +2529,13 @@ recv_add_to_hash_table(
 
 	UT_LIST_ADD_LAST(recv_addr->rec_list, recv);
 
+	recv_sys->n_recs++;
+
+	if (recv_data != NULL) {
+		recv->data = recv_data;
+		return;
+	}
+
 	prev_field = &(recv->data);
 
 	/* Store the log record body in chunks of less than UNIV_PAGE_SIZE:
@@ -2666,16 +2862,20 @@ recv_recover_page_func(
 /** Reads in pages which have hashed log records, from an area around a given
 page number.
 @param[in]	page_id	page id
+@param[in]	sync	true if page_id is to be read synchronously, so that
+its log records are applied by the calling thread
 @return number of pages found */
 static
 ulint
 recv_read_in_area(
-	const page_id_t&	page_id)
+	const page_id_t&	page_id,
+	bool			sync)
 {
 	recv_addr_t* recv_addr;
 	ulint	page_nos[RECV_READ_AHEAD_AREA];
 	ulint	low_limit;
 	ulint	n;
+	bool	found = false;
 
 	low_limit = page_id.page_no()
 		- (page_id.page_no() % RECV_READ_AHEAD_AREA);
@@ -2699,6 +2899,10 @@ recv_read_in_area(
 
 				page_nos[n] = page_no;
 
+				if (page_no == page_id.page_no()) {
+					found = true;
+				}
+
 				n++;
 			}
 
@@ -2706,243 +2910,857 @@ recv_read_in_area(
 		}
 	}
 
-	buf_read_recv_pages(FALSE, page_id.space(), page_nos, n);
+	if (sync && found) {
+		/* buf_read_recv_pages() reads the last page synchronously */
+		for (ulint i = 0; i + 1 < n; i++) {
+			if (page_nos[i] == page_id.page_no()) {
+				page_nos[i] = page_nos[n - 1];
+				page_nos[n - 1] = page_id.page_no();
+				break;
+			}
+		}
+	}
+
+	buf_read_recv_pages(sync && found, page_id.space(), page_nos, n);
 	/*
 	fprintf(stderr, "Recv pages at %lu n %lu\n", page_nos[0], n);
 	*/
 	return(n);
 }
 
-/*******************************************************************//**
-Empties the hash table of stored log records, applying them to appropriate
-pages. */
-void
-recv_apply_hashed_log_recs(
-/*=======================*/
-	ibool	allow_ibuf)	/*!< in: if TRUE, also ibuf operations are
-				allowed during the application; if FALSE,
-				no ibuf operations are allowed, and after
-				the application all file pages are flushed to
-				disk and invalidated in buffer pool: this
-				alternative means that no new log records
-				can be generated during the application;
-				the caller must in this case own the log
-				mutex */
-{
-	recv_addr_t* recv_addr;
-	ulint	i;
-	ibool	has_printed	= FALSE;
-	mtr_t	mtr;
-loop:
-	mutex_enter(&(recv_sys->mutex));
-
-	if (recv_sys->apply_batch_on) {
+/** Number of pages with log records that are read ahead at a time */
+#define RECV_READAHEAD_WINDOW	1024
 
-		mutex_exit(&(recv_sys->mutex));
+/** Pages of a tablespace that are at most this far apart are read ahead
+in the same request, together with the pages between them */
+#define RECV_READAHEAD_MERGE_GAP	8
 
-		os_thread_sleep(500000);
+/** Pages with hashed log records */
+typedef std::vector<recv_addr_t*, ut_allocator<recv_addr_t*> >
+	recv_addr_vec_t;
 
-		goto loop;
+/** Orders pages by tablespace and page number */
+struct recv_addr_less {
+	bool operator()(const recv_addr_t* a, const recv_addr_t* b) const
+	{
+		return(a->space < b->space
+		       || (a->space == b->space && a->page_no < b->page_no));
 	}
+};
 
-	ut_ad(!allow_ibuf == log_mutex_own());
+/** State of an apply batch */
+struct recv_apply_batch_t {
+	/** pages with log records, sorted by (space, page) */
+	recv_addr_vec_t	addrs;
+	/** number of threads applying the batch */
+	ulint		n_threads;
+	/** number of threads that have not finished yet, protected by
+	recv_sys->mutex */
+	ulint		n_running;
+	/** set when all threads have finished */
+	os_event_t	done;
+	/** whether the start of the batch was reported, protected by
+	recv_sys->mutex */
+	ibool		has_printed;
+};
 
-	if (!allow_ibuf) {
-		recv_no_ibuf_operations = true;
-	}
+/** A contiguous range of the pages of an apply batch, applied by one
+thread */
+struct recv_apply_slice_t {
+	recv_apply_batch_t*	batch;
+	/** index of the first page of the slice in batch->addrs */
+	ulint			begin;
+	/** index after the last page of the slice in batch->addrs */
+	ulint			end;
+	/** the pages of the slice before this index have been read ahead */
+	ulint			readahead_end;
+};
 
-	recv_sys->apply_log_recs = TRUE;
-	recv_sys->apply_batch_on = TRUE;
+/** Reads ahead the pages of a slice that follow the apply cursor when the
+cursor gets close to the end of the pages already read ahead. The pages are
+read into the file system cache asynchronously, adjacent pages with a single
+request. Called and returns with recv_sys->mutex held.
+@param[in,out]	slice	slice of an apply batch
+@param[in]	pos	apply cursor, an index in slice->batch->addrs */
+static
+void
+recv_apply_readahead(
+	recv_apply_slice_t*	slice,
+	ulint			pos)
+{
+	const recv_addr_vec_t&	addrs = slice->batch->addrs;
+	ulint			start = slice->readahead_end;
+	ulint			end;
 
-	for (i = 0; i < hash_get_n_cells(recv_sys->addr_hash); i++) {
+	ut_ad(mutex_own(&recv_sys->mutex));
 
-		for (recv_addr = static_cast<recv_addr_t*>(
-				HASH_GET_FIRST(recv_sys->addr_hash, i));
-		     recv_addr != 0;
-		     recv_addr = static_cast<recv_addr_t*>(
-				HASH_GET_NEXT(addr_hash, recv_addr))) {
+	if (start >= slice->end
+	    || pos + RECV_READAHEAD_WINDOW / 2 < start) {
+		return;
+	}
 
-			if (srv_is_tablespace_truncated(recv_addr->space)) {
-				/* Avoid applying REDO log for the tablespace
-				that is schedule for TRUNCATE. */
-				ut_a(recv_sys->n_addrs);
-				recv_addr->state = RECV_DISCARDED;
-				recv_sys->n_addrs--;
-				continue;
-			}
+	end = ut_min(slice->end, ut_max(start, pos) + RECV_READAHEAD_WINDOW);
+	slice->readahead_end = end;
 
-			if (recv_addr->state == RECV_DISCARDED) {
-				ut_a(recv_sys->n_addrs);
-				recv_sys->n_addrs--;
-				continue;
-			}
+	mutex_exit(&(recv_sys->mutex));
 
-			const page_id_t		page_id(recv_addr->space,
-							recv_addr->page_no);
-			bool			found;
-			const page_size_t&	page_size
-				= fil_space_get_page_size(recv_addr->space,
-							  &found);
+	for (ulint i = start; i < end; ) {
+		ulint	space = addrs[i]->space;
+		ulint	first = addrs[i]->page_no;
+		ulint	last = first;
 
-			// ut_ad(found);
+		for (i++;
+		     i < end && addrs[i]->space == space
+		     && addrs[i]->page_no - last <= RECV_READAHEAD_MERGE_GAP;
+		     i++) {
+			last = addrs[i]->page_no;
+		}
 
-			/* By now we have replayed all DDL log records from the
-			current batch. Check if the space ID is still valid in
-			the entry being processed, and ignore it if it is not.*/
-			mutex_enter(&(fil_system->mutex));
+		fil_space_readahead(space, first, last - first + 1);
+	}
 
-			if (fil_space_get_by_id(recv_addr->space) == NULL) {
+	mutex_enter(&(recv_sys->mutex));
+}
 
-				ut_a(recv_sys->n_addrs);
+/** Applies the hashed log records of a page. Called and returns with
+recv_sys->mutex held.
+@param[in,out]	recv_addr	page with log records
+@param[in]	sync	true if the page is to be read and applied by the
+calling thread when it is not in the buffer pool
+@param[in,out]	has_printed	whether the start of the batch was reported */
+static
+void
+recv_apply_hashed_log_rec(
+	recv_addr_t*	recv_addr,
+	bool		sync,
+	ibool*		has_printed)
+{
+	mtr_t		mtr;
 
-				mutex_exit(&(fil_system->mutex));
+	ut_ad(mutex_own(&recv_sys->mutex));
 
-				recv_addr->state = RECV_PROCESSED;
-				recv_sys->n_addrs--;
+	if (srv_is_tablespace_truncated(recv_addr->space)) {
+		/* Avoid applying REDO log for the tablespace
+		that is schedule for TRUNCATE. */
+		ut_a(recv_sys->n_addrs);
+		recv_addr->state = RECV_DISCARDED;
+		recv_sys->n_addrs--;
+		return;
+	}
 
-				continue;
-			}
+	if (recv_addr->state == RECV_DISCARDED) {
+		ut_a(recv_sys->n_addrs);
+		recv_sys->n_addrs--;
+		return;
+	}
 
-			mutex_exit(&(fil_system->mutex));
+	const page_id_t		page_id(recv_addr->space,
+					recv_addr->page_no);
+	bool			found;
+	const page_size_t&	page_size
+		= fil_space_get_page_size(recv_addr->space,
+					  &found);
 
-			if (recv_addr->state == RECV_NOT_PROCESSED) {
-				if (!has_printed) {
-					ib::info() << "Starting an apply batch"
-						" of log records"
-						" to the database...";
-					fputs("InnoDB: Progress in percent: ",
-					      stderr);
-					has_printed = TRUE;
-				}
+	// ut_ad(found);
 
-				mutex_exit(&(recv_sys->mutex));
+	/* By now we have replayed all DDL log records from the
+	current batch. Check if the space ID is still valid in
+	the entry being processed, and ignore it if it is not.*/
+	mutex_enter(&(fil_system->mutex));
 
-				if (buf_page_peek(page_id)) {
-					buf_block_t*	block;
+	if (fil_space_get_by_id(recv_addr->space) == NULL) {
 
-					mtr_start(&mtr);
+		ut_a(recv_sys->n_addrs);
 
-					block = buf_page_get(
-						page_id, page_size,
-						RW_X_LATCH, &mtr);
+		mutex_exit(&(fil_system->mutex));
 
-					buf_block_dbg_add_level(
-						block, SYNC_NO_ORDER_CHECK);
+		recv_addr->state = RECV_PROCESSED;
+		recv_sys->n_addrs--;
 
-					recv_recover_page(FALSE, block);
-					mtr_commit(&mtr);
-				} else {
-					recv_read_in_area(page_id);
-				}
+		return;
+	}
 
-				mutex_enter(&(recv_sys->mutex));
-			}
+	mutex_exit(&(fil_system->mutex));
+
+	if (recv_addr->state == RECV_NOT_PROCESSED) {
+		if (!*has_printed) {
+			ib::info() << "Starting an apply batch"
+				" of log records"
+				" to the database...";
+			fputs("InnoDB: Progress in percent: ",
+			      stderr);
+			*has_printed = TRUE;
 		}
 
-		if (has_printed
-		    && (i * 100) / hash_get_n_cells(recv_sys->addr_hash)
-		    != ((i + 1) * 100)
-		    / hash_get_n_cells(recv_sys->addr_hash)) {
+		mutex_exit(&(recv_sys->mutex));
 
-			fprintf(stderr, "%lu ", (ulong)
-				((i * 100)
-				 / hash_get_n_cells(recv_sys->addr_hash)));
-		}
-	}
+		if (buf_page_peek(page_id)) {
+			buf_block_t*	block;
 
-	/* Wait until all the pages have been processed */
+			mtr_start(&mtr);
 
-	while (recv_sys->n_addrs != 0) {
+			block = buf_page_get(
+				page_id, page_size,
+				RW_X_LATCH, &mtr);
 
-		mutex_exit(&(recv_sys->mutex));
+			buf_block_dbg_add_level(
+				block, SYNC_NO_ORDER_CHECK);
 
-		os_thread_sleep(500000);
+			recv_recover_page(FALSE, block);
+			mtr_commit(&mtr);
+		} else {
+			recv_read_in_area(page_id, sync);
+		}
 
 		mutex_enter(&(recv_sys->mutex));
 	}
+}
 
-	if (has_printed) {
+/** Prints the progress of an apply batch after a page is done.
+@param[in]	pos	index of the page in the batch
+@param[in]	n	number of pages in the batch */
+static
+void
+recv_apply_print_progress(
+	ulint	pos,
+	ulint	n)
+{
+	if ((pos * 100) / n != ((pos + 1) * 100) / n) {
 
-		fprintf(stderr, "\n");
+		fprintf(stderr, "%lu ", (ulong) ((pos * 100) / n));
 	}
+}
 
-	if (!allow_ibuf) {
-
-		/* Flush all the file pages to disk and invalidate them in
-		the buffer pool */
-
-		ut_d(recv_no_log_write = true);
-		mutex_exit(&(recv_sys->mutex));
-		log_mutex_exit();
-
-		/* Stop the recv_writer thread from issuing any LRU
-		flush batches. */
-		mutex_enter(&recv_sys->writer_mutex);
+/** Applies the hashed log records of a slice of the pages, reading ahead
+the pages of the slice in the sorted order. The pages that are not in the
+buffer pool are read and applied by this thread, the neighbouring pages that
+are read with them are applied by the I/O handler threads.
+@return a dummy parameter */
+extern "C"
+os_thread_ret_t
+DECLARE_THREAD(recv_apply_thread)(
+	void*	arg)	/*!< in: recv_apply_slice_t */
+{
+	recv_apply_slice_t*	slice = static_cast<recv_apply_slice_t*>(arg);
+	recv_apply_batch_t*	batch = slice->batch;
 
-		/* Wait for any currently run batch to end. */
-		buf_flush_wait_LRU_batch_end();
+	my_thread_init();
 
-		os_event_reset(recv_sys->flush_end);
-		recv_sys->flush_type = BUF_FLUSH_LIST;
-		os_event_set(recv_sys->flush_start);
-		os_event_wait(recv_sys->flush_end);
+	mutex_enter(&(recv_sys->mutex));
 
-		buf_pool_invalidate();
+	for (ulint i = slice->begin; i < slice->end; i++) {
 
-		/* Allow batches from recv_writer thread. */
-		mutex_exit(&recv_sys->writer_mutex);
+		recv_apply_readahead(slice, i);
 
-		log_mutex_enter();
-		mutex_enter(&(recv_sys->mutex));
-		ut_d(recv_no_log_write = false);
+		recv_apply_hashed_log_rec(batch->addrs[i], true,
+					  &batch->has_printed);
 
-		recv_no_ibuf_operations = false;
+		/* Only the first thread reports the progress */
+		if (batch->has_printed && slice->begin == 0) {
+			recv_apply_print_progress(i, slice->end);
+		}
 	}
 
-	recv_sys->apply_log_recs = FALSE;
-	recv_sys->apply_batch_on = FALSE;
-
-	recv_sys_empty_hash();
-
-	if (has_printed) {
-		ib::info() << "Apply batch completed";
+	ut_a(batch->n_running > 0);
+	if (--batch->n_running == 0) {
+		os_event_set(batch->done);
 	}
 
 	mutex_exit(&(recv_sys->mutex));
+
+	my_thread_end();
+	os_thread_exit();
+
+	OS_THREAD_DUMMY_RETURN;
 }
-#else /* !UNIV_HOTBACKUP */
-/*******************************************************************//**
-Applies log records in the hash table to a backup. */
+
+/** Applies the pages of a batch with batch->n_threads threads. The sorted
+batch is split once into contiguous slices of about the same number of
+pages, one per thread. Called and returns with recv_sys->mutex held.
+@param[in,out]	batch	apply batch */
+static
 void
-recv_apply_log_recs_for_backup(void)
-/*================================*/
+recv_apply_batch_parallel(
+	recv_apply_batch_t*	batch)
 {
-	recv_addr_t*	recv_addr;
-	ulint		n_hash_cells;
-	buf_block_t*	block;
-	bool		success;
-	ulint		error;
-	ulint		i;
-	fil_space_t*	space = NULL;
-	page_id_t	page_id;
-	recv_sys->apply_log_recs = TRUE;
-	recv_sys->apply_batch_on = TRUE;
+	recv_apply_slice_t*	slices;
+	ulint			n = batch->addrs.size();
 
-	block = back_block1;
+	ut_ad(mutex_own(&recv_sys->mutex));
 
-	ib::info() << "Starting an apply batch of log records to the"
-		" database...\n";
+	batch->n_running = batch->n_threads;
+	batch->done = os_event_create(0);
 
-	fputs("InnoDB: Progress in percent: ", stderr);
+	slices = static_cast<recv_apply_slice_t*>(
+		ut_malloc_nokey(batch->n_threads * sizeof(*slices)));
 
-	n_hash_cells = hash_get_n_cells(recv_sys->addr_hash);
+	mutex_exit(&(recv_sys->mutex));
 
-	for (i = 0; i < n_hash_cells; i++) {
-		/* The address hash table is externally chained */
-		recv_addr = static_cast<recv_addr_t*>(hash_get_nth_cell(
-					recv_sys->addr_hash, i)->node);
+	for (ulint i = 0; i < batch->n_threads; i++) {
+		slices[i].batch = batch;
+		slices[i].begin = n * i / batch->n_threads;
+		slices[i].end = n * (i + 1) / batch->n_threads;
+		slices[i].readahead_end = slices[i].begin;
 
-		while (recv_addr != NULL) {
+		os_thread_create(recv_apply_thread, &slices[i], NULL);
+	}
+
+	os_event_wait(batch->done);
+
+	mutex_enter(&(recv_sys->mutex));
+
+	os_event_destroy(batch->done);
+	ut_free(slices);
+}
+
+/** Size of the header of a log record in a spill run: space id (4 bytes),
+page number (4), record type (1), body length (4), start lsn (8) and end lsn
+(8), all in the big-endian byte order */
+#define RECV_SPILL_REC_HEADER_SIZE	(4 + 4 + 1 + 4 + 8 + 8)
+
+/** Header of a log record in a spill run, followed by the record body */
+struct recv_spill_rec_t {
+	ulint		space;
+	ulint		page_no;
+	ulint		type;
+	ulint		len;
+	lsn_t		start_lsn;
+	lsn_t		end_lsn;
+};
+
+/** A run of spilled log records, sorted by (space, page) and by lsn within
+a page. Each run holds the records parsed after the ones of the previous
+run. */
+struct recv_spill_run_t {
+	/** temporary file */
+	FILE*			file;
+	/** number of the run, the runs are numbered in the order they
+	were written */
+	ulint			id;
+	/** header of the current record during the merge */
+	recv_spill_rec_t	rec;
+	/** whether all records have been read */
+	bool			eof;
+};
+
+typedef std::vector<recv_spill_run_t, ut_allocator<recv_spill_run_t> >
+	recv_spill_runs_t;
+
+/** Runs of spilled log records */
+static recv_spill_runs_t	recv_spill_runs;
+
+/** Orders the runs by the page of their current record, and the runs with
+records of the same page by age, for the heap of the merge */
+struct recv_spill_run_greater {
+	bool operator()(const recv_spill_run_t* a,
+			const recv_spill_run_t* b) const
+	{
+		if (a->rec.space != b->rec.space) {
+			return(a->rec.space > b->rec.space);
+		}
+
+		if (a->rec.page_no != b->rec.page_no) {
+			return(a->rec.page_no > b->rec.page_no);
+		}
+
+		return(a->id > b->id);
+	}
+};
+
+/** Heap of the runs that have records left, the run with the first page
+on the top */
+typedef std::priority_queue<
+	recv_spill_run_t*,
+	std::vector<recv_spill_run_t*, ut_allocator<recv_spill_run_t*> >,
+	recv_spill_run_greater>	recv_spill_heap_t;
+
+/** Checks whether the log records of a tablespace must be discarded because
+the tablespace was deleted or is missing, the same way as
+recv_init_crash_recovery_spaces() discards the hashed log records.
+@param[in]	space	tablespace id
+@return true if the log records of the tablespace must be discarded */
+static
+bool
+recv_spill_space_discarded(
+	ulint	space)
+{
+	if (is_predefined_tablespace(space)) {
+		return(false);
+	}
+
+	recv_spaces_t::const_iterator	i = recv_spaces.find(space);
+
+	return(i != recv_spaces.end()
+	       && (i->second.deleted || i->second.space == NULL));
+}
+
+/** Writes the header of a log record to a spill run.
+@param[in]	file	temporary file of the run
+@param[in]	rec	record header
+@return true on success */
+static
+bool
+recv_spill_write_header(
+	FILE*			file,
+	const recv_spill_rec_t*	rec)
+{
+	byte	buf[RECV_SPILL_REC_HEADER_SIZE];
+	byte*	ptr = buf;
+
+	ut_ad(rec->type <= 0xFF);
+	ut_ad(rec->len <= 0xFFFFFFFFUL);
+
+	mach_write_to_4(ptr, rec->space);
+	ptr += 4;
+	mach_write_to_4(ptr, rec->page_no);
+	ptr += 4;
+	mach_write_to_1(ptr, rec->type);
+	ptr += 1;
+	mach_write_to_4(ptr, rec->len);
+	ptr += 4;
+	mach_write_to_8(ptr, rec->start_lsn);
+	ptr += 8;
+	mach_write_to_8(ptr, rec->end_lsn);
+
+	return(fwrite(buf, sizeof(buf), 1, file) == 1);
+}
+
+/** Writes the hashed log records to a new sorted run and empties the hash
+table, so that the scan can go on storing log records. The records already
+discarded by recv_init_crash_recovery_spaces() are not written.
+@return true on success, false if the run could not be written */
+static
+bool
+recv_spill_hashed_log_recs()
+{
+	recv_addr_vec_t		addrs;
+	recv_spill_run_t	run;
+	bool			failed = false;
+
+	mutex_enter(&(recv_sys->mutex));
+
+	addrs.reserve(recv_sys->n_addrs);
+
+	for (ulint i = 0; i < recv_sys->n_cells; i++) {
+		if (recv_sys->addrs[i] != NULL) {
+			addrs.push_back(recv_sys->addrs[i]);
+		}
+	}
+
+	std::sort(addrs.begin(), addrs.end(), recv_addr_less());
+
+	run.file = os_file_create_tmpfile(NULL);
+	run.id = recv_spill_runs.size();
+	run.eof = false;
+
+	if (run.file == NULL) {
+		mutex_exit(&(recv_sys->mutex));
+		ib::error() << "Cannot create a temporary file for spilling"
+			" log records";
+		return(false);
+	}
+
+	for (recv_addr_vec_t::iterator it = addrs.begin();
+	     it != addrs.end() && !failed; ++it) {
+
+		if ((*it)->state == RECV_DISCARDED) {
+			continue;
+		}
+
+		ut_ad((*it)->state == RECV_NOT_PROCESSED);
+
+		for (recv_t* recv = UT_LIST_GET_FIRST((*it)->rec_list);
+		     recv != NULL && !failed;
+		     recv = UT_LIST_GET_NEXT(rec_list, recv)) {
+			recv_spill_rec_t	rec;
+			recv_data_t*		recv_data = recv->data;
+			ulint			len = recv->len;
+
+			rec.space = (*it)->space;
+			rec.page_no = (*it)->page_no;
+			rec.type = recv->type;
+			rec.len = recv->len;
+			rec.start_lsn = recv->start_lsn;
+			rec.end_lsn = recv->end_lsn;
+
+			failed = !recv_spill_write_header(run.file, &rec);
+
+			/* The body is stored in chunks, see
+			recv_add_to_hash_table() */
+			while (len > 0 && !failed) {
+				ulint	part_len = ut_min(
+					len, static_cast<ulint>(
+						RECV_DATA_BLOCK_SIZE));
+
+				failed = fwrite(recv_data + 1, part_len, 1,
+						run.file) != 1;
+
+				len -= part_len;
+				recv_data = recv_data->next;
+			}
+		}
+	}
+
+	if (failed || fflush(run.file) != 0) {
+		mutex_exit(&(recv_sys->mutex));
+		ib::error() << "Cannot write spilled log records to a"
+			" temporary file, errno " << errno;
+		fclose(run.file);
+		return(false);
+	}
+
+	rewind(run.file);
+
+	recv_spill_runs.push_back(run);
+
+	ib::info() << "Spilled log records of " << addrs.size()
+		<< " pages to a temporary file, " << recv_spill_runs.size()
+		<< " runs so far";
+
+	recv_sys->n_addrs = 0;
+	recv_sys_empty_hash();
+
+	mutex_exit(&(recv_sys->mutex));
+
+	return(true);
+}
+
+/** Reads the header of the next record of a spill run, or sets run->eof
+at the end of the run.
+@param[in,out]	run	spill run
+@return true on success, false on a read error */
+static
+bool
+recv_spill_read_header(
+	recv_spill_run_t*	run)
+{
+	byte		buf[RECV_SPILL_REC_HEADER_SIZE];
+	const byte*	ptr = buf;
+
+	if (fread(buf, sizeof(buf), 1, run->file) != 1) {
+		if (ferror(run->file)) {
+			ib::error() << "Cannot read spilled log records from"
+				" a temporary file, errno " << errno;
+			return(false);
+		}
+		run->eof = true;
+		return(true);
+	}
+
+	run->rec.space = mach_read_from_4(ptr);
+	ptr += 4;
+	run->rec.page_no = mach_read_from_4(ptr);
+	ptr += 4;
+	run->rec.type = mach_read_from_1(ptr);
+	ptr += 1;
+	run->rec.len = mach_read_from_4(ptr);
+	ptr += 4;
+	run->rec.start_lsn = mach_read_from_8(ptr);
+	ptr += 8;
+	run->rec.end_lsn = mach_read_from_8(ptr);
+
+	return(true);
+}
+
+/** Applies the spilled log records. The runs are merged by (space, page) into
+the hash table, and the hash table is applied whenever it does not fit into
+the buffer pool any more. All log records of a page are stored at the same
+time, so every page is read and written once. The records of the last pages
+are left in the hash table for the final apply batch. The records of the
+tablespaces that were deleted or are missing are skipped, as the runs
+spilled during the scan were written before recv_init_crash_recovery_spaces()
+discarded them. The caller must own the log mutex.
+@return DB_SUCCESS, or DB_ERROR if a run could not be written or read */
+static
+dberr_t
+recv_apply_spilled_log_recs()
+{
+	recv_spill_runs_t	runs;
+	recv_spill_heap_t	heap;
+	dberr_t			err = DB_SUCCESS;
+	byte*			buf = NULL;
+	ulint			buf_size = 0;
+	ulint			available_mem = UNIV_PAGE_SIZE
+		* (buf_pool_get_n_pages()
+		   - (recv_n_pool_free_frames * srv_buf_pool_instances));
+
+	ut_ad(log_mutex_own());
+
+	/* The records in the hash table are the most recent ones */
+	if (recv_sys->n_addrs > 0 && !recv_spill_hashed_log_recs()) {
+		err = DB_ERROR;
+	}
+
+	runs.swap(recv_spill_runs);
+
+	if (err != DB_SUCCESS) {
+		goto func_exit;
+	}
+
+	ib::info() << "Merging " << runs.size() << " runs of spilled log"
+		" records";
+
+	for (recv_spill_runs_t::iterator it = runs.begin();
+	     it != runs.end(); ++it) {
+		if (!recv_spill_read_header(&*it)) {
+			err = DB_ERROR;
+			goto func_exit;
+		}
+
+		if (!it->eof) {
+			heap.push(&*it);
+		}
+	}
+
+	while (!heap.empty()) {
+		ulint	space = heap.top()->rec.space;
+		ulint	page_no = heap.top()->rec.page_no;
+		bool	discarded = recv_spill_space_discarded(space);
+
+		/* Store the records of the page from all runs in the lsn
+		order. The heap yields the runs with records of the same page
+		from the oldest to the newest one. */
+		while (!heap.empty()
+		       && heap.top()->rec.space == space
+		       && heap.top()->rec.page_no == page_no) {
+			recv_spill_run_t*	run = heap.top();
+
+			heap.pop();
+
+			while (!run->eof && run->rec.space == space
+			       && run->rec.page_no == page_no) {
+
+				if (run->rec.len > buf_size) {
+					ut_free(buf);
+					buf_size = run->rec.len;
+					buf = static_cast<byte*>(
+						ut_malloc_nokey(buf_size));
+				}
+
+				if (run->rec.len > 0
+				    && fread(buf, run->rec.len, 1, run->file)
+				    != 1) {
+					ib::error() << "Cannot read spilled"
+						" log records from a"
+						" temporary file, errno "
+						<< errno;
+					err = DB_ERROR;
+					goto func_exit;
+				}
+
+				if (!discarded) {
+					recv_add_to_hash_table(
+						static_cast<mlog_id_t>(
+							run->rec.type),
+						space, page_no, buf,
+						buf + run->rec.len,
+						run->rec.start_lsn,
+						run->rec.end_lsn);
+				}
+
+				if (!recv_spill_read_header(run)) {
+					err = DB_ERROR;
+					goto func_exit;
+				}
+			}
+
+			if (!run->eof) {
+				heap.push(run);
+			}
+		}
+
+		if (recv_sys_mem_used() > available_mem) {
+			recv_apply_hashed_log_recs(FALSE);
+		}
+	}
+
+func_exit:
+	for (recv_spill_runs_t::iterator it = runs.begin();
+	     it != runs.end(); ++it) {
+		fclose(it->file);
+	}
+
+	ut_free(buf);
+
+	return(err);
+}
+
+/*******************************************************************//**
+Empties the hash table of stored log records, applying them to appropriate
+pages. */
+void
+recv_apply_hashed_log_recs(
+/*=======================*/
+	ibool	allow_ibuf)	/*!< in: if TRUE, also ibuf operations are
+				allowed during the application; if FALSE,
+				no ibuf operations are allowed, and after
+				the application all file pages are flushed to
+				disk and invalidated in buffer pool: this
+				alternative means that no new log records
+				can be generated during the application;
+				the caller must in this case own the log
+				mutex */
+{
+	ulint	i;
+	ibool	has_printed	= FALSE;
+loop:
+	mutex_enter(&(recv_sys->mutex));
+
+	if (recv_sys->apply_batch_on) {
+
+		mutex_exit(&(recv_sys->mutex));
+
+		os_thread_sleep(500000);
+
+		goto loop;
+	}
+
+	ut_ad(!allow_ibuf == log_mutex_own());
+
+	if (!allow_ibuf) {
+		recv_no_ibuf_operations = true;
+	}
+
+	recv_sys->apply_log_recs = TRUE;
+	recv_sys->apply_batch_on = TRUE;
+
+	/* Apply the log in the (space, page) order, so that the pages can be
+	read ahead in large sequential requests */
+	recv_apply_batch_t	batch;
+
+	batch.addrs.reserve(recv_sys->n_addrs);
+
+	for (i = 0; i < recv_sys->n_cells; i++) {
+		if (recv_sys->addrs[i] != NULL) {
+			batch.addrs.push_back(recv_sys->addrs[i]);
+		}
+	}
+
+	std::sort(batch.addrs.begin(), batch.addrs.end(), recv_addr_less());
+
+	if (recv_sys->n_recs > 0) {
+		ib::info() << "Applying " << recv_sys->n_recs << " log records"
+			" to " << batch.addrs.size() << " pages, "
+			<< mem_heap_get_size(recv_sys->heap) / recv_sys->n_recs
+			<< " bytes of memory per record";
+	}
+
+	batch.n_threads = recv_n_apply_threads;
+	batch.has_printed = has_printed;
+
+	if (batch.n_threads > 1) {
+		recv_apply_batch_parallel(&batch);
+	} else {
+		ulint			n = batch.addrs.size();
+		recv_apply_slice_t	slice = { &batch, 0, n, 0 };
+
+		for (i = 0; i < n; i++) {
+
+			recv_apply_readahead(&slice, i);
+
+			recv_apply_hashed_log_rec(batch.addrs[i], false,
+						  &batch.has_printed);
+
+			if (batch.has_printed) {
+				recv_apply_print_progress(i, n);
+			}
+		}
+	}
+
+	has_printed = batch.has_printed;
+
+	/* Wait until all the pages have been processed */
+
+	while (recv_sys->n_addrs != 0) {
+
+		mutex_exit(&(recv_sys->mutex));
+
+		os_thread_sleep(500000);
+
+		mutex_enter(&(recv_sys->mutex));
+	}
+
+	if (has_printed) {
+
+		fprintf(stderr, "\n");
+	}
+
+	if (!allow_ibuf) {
+
+		/* Flush all the file pages to disk and invalidate them in
+		the buffer pool */
+
+		ut_d(recv_no_log_write = true);
+		mutex_exit(&(recv_sys->mutex));
+		log_mutex_exit();
+
+		/* Stop the recv_writer thread from issuing any LRU
+		flush batches. */
+		mutex_enter(&recv_sys->writer_mutex);
+
+		/* Wait for any currently run batch to end. */
+		buf_flush_wait_LRU_batch_end();
+
+		os_event_reset(recv_sys->flush_end);
+		recv_sys->flush_type = BUF_FLUSH_LIST;
+		os_event_set(recv_sys->flush_start);
+		os_event_wait(recv_sys->flush_end);
+
+		buf_pool_invalidate();
+
+		/* Allow batches from recv_writer thread. */
+		mutex_exit(&recv_sys->writer_mutex);
+
+		log_mutex_enter();
+		mutex_enter(&(recv_sys->mutex));
+		ut_d(recv_no_log_write = false);
+
+		recv_no_ibuf_operations = false;
+	}
+
+	recv_sys->apply_log_recs = FALSE;
+	recv_sys->apply_batch_on = FALSE;
+
+	recv_sys_empty_hash();
+
+	if (has_printed) {
+		ib::info() << "Apply batch completed";
+	}
+
+	mutex_exit(&(recv_sys->mutex));
+}
+#else /* !UNIV_HOTBACKUP */
+/*******************************************************************//**
+Applies log records in the hash table to a backup. */
+void
+recv_apply_log_recs_for_backup(void)
+/*================================*/
+{
+	recv_addr_t*	recv_addr;
+	ulint		n_hash_cells;
+	buf_block_t*	block;
+	bool		success;
+	ulint		error;
+	ulint		i;
+	fil_space_t*	space = NULL;
+	page_id_t	page_id;
+	recv_sys->apply_log_recs = TRUE;
+	recv_sys->apply_batch_on = TRUE;
+
+	block = back_block1;
+
+	ib::info() << "Starting an apply batch of log records to the"
+		" database...\n";
+
+	fputs("InnoDB: Progress in percent: ", stderr);
+
+	n_hash_cells = recv_sys->n_cells;
+
+	for (i = 0; i < n_hash_cells; i++) {
+		/* The address hash table is open addressed */
+		recv_addr = recv_sys->addrs[i];
+
+		while (recv_addr != NULL) {
 
 			ib::trace() << "recv_addr {State: " << recv_addr->state
 				<< ", Space id: " << recv_addr->space
@@ -3054,8 +3872,8 @@ recv_apply_log_recs_for_backup(void)
 					block->frame, NULL);
 			}
 skip_this_recv_addr:
-			recv_addr = static_cast<recv_addr_t*>(HASH_GET_NEXT(
-					addr_hash, recv_addr));
+			/* A cell holds at most one address */
+			recv_addr = NULL;
 		}
 
 		if ((100 * i) / n_hash_cells
@@ -3073,6 +3891,484 @@ skip_this_recv_addr:
 }
 #endif /* !UNIV_HOTBACKUP */
 
+#ifndef UNIV_HOTBACKUP
+/** Amount of log that each thread parses ahead of the log scan */
+#define RECV_PARSE_AHEAD_SIZE	(16 * 1024 * 1024)
+
+/** A log record whose body was parsed ahead of the log scan */
+struct recv_parsed_rec_t {
+	/** start lsn of the record */
+	lsn_t		lsn;
+	/** length of the record, excluding log block headers and trailers */
+	ib_uint32_t	len;
+	/** type of the record */
+	mlog_id_t	type;
+};
+
+typedef std::vector<recv_parsed_rec_t, ut_allocator<recv_parsed_rec_t> >
+	recv_parsed_recs_t;
+
+/** Orders parsed log records by lsn */
+struct recv_parsed_lsn_less {
+	bool operator()(
+		const recv_parsed_rec_t&	a,
+		const recv_parsed_rec_t&	b) const
+	{
+		return(a.lsn < b.lsn);
+	}
+};
+
+/** Log records parsed ahead of the log scan, in lsn order */
+static recv_parsed_recs_t	recv_parsed_recs;
+
+/** Position in recv_parsed_recs where the next lookup starts */
+static ulint			recv_parsed_pos;
+
+struct recv_parse_pool_t;
+
+/** A segment of the log that is parsed by one thread */
+struct recv_parse_seg_t {
+	/** mapped log blocks, starting at start_lsn */
+	const byte*		blocks;
+	/** start of the segment, aligned to a log block */
+	lsn_t			start_lsn;
+	/** records that start from this lsn on belong to the next
+	segment */
+	lsn_t			end_lsn;
+	/** log blocks up to this lsn can be read */
+	lsn_t			limit_lsn;
+	/** the records parsed in this segment */
+	recv_parsed_recs_t	recs;
+	/** set when a corrupt log record was found in this segment */
+	bool			corrupt;
+	/** set when the thread is to parse the segment */
+	os_event_t		start;
+	/** the threads that parse the log ahead */
+	recv_parse_pool_t*	pool;
+};
+
+/** Threads that parse the log ahead of the log scan. The threads are created
+once for a log scan, and each of them parses a segment in every round. */
+struct recv_parse_pool_t {
+	/** the segments, one per thread */
+	recv_parse_seg_t*	segs;
+	/** number of threads */
+	ulint			n_threads;
+	/** number of threads that are still parsing in the current round,
+	or that are still running after the shutdown */
+	ulint			n_running;
+	/** set when n_running drops to 0 */
+	os_event_t		done;
+	/** set when the threads are to exit */
+	bool			shutdown;
+	/** number of rounds run so far */
+	ulint			n_rounds;
+};
+
+static
+lsn_t
+recv_calc_lsn_on_data_add(
+	lsn_t		lsn,
+	ib_uint64_t	len);
+
+/** Checks if the body of a log record can be parsed ahead of the log scan.
+The records that change the tablespace cache or the recovery state when
+they are parsed must be parsed by the scan itself.
+@param[in]	type	log record type
+@param[in]	page_no	page number
+@return whether the record can be parsed by a parse-ahead thread */
+static
+bool
+recv_parse_ahead_type(
+	mlog_id_t	type,
+	ulint		page_no)
+{
+	switch (type) {
+	case MLOG_1BYTE: case MLOG_2BYTES: case MLOG_4BYTES: case MLOG_8BYTES:
+	case MLOG_REC_INSERT: case MLOG_COMP_REC_INSERT:
+	case MLOG_REC_CLUST_DELETE_MARK: case MLOG_COMP_REC_CLUST_DELETE_MARK:
+	case MLOG_REC_SEC_DELETE_MARK: case MLOG_COMP_REC_SEC_DELETE_MARK:
+	case MLOG_REC_UPDATE_IN_PLACE: case MLOG_COMP_REC_UPDATE_IN_PLACE:
+	case MLOG_LIST_END_DELETE: case MLOG_COMP_LIST_END_DELETE:
+	case MLOG_LIST_START_DELETE: case MLOG_COMP_LIST_START_DELETE:
+	case MLOG_LIST_END_COPY_CREATED: case MLOG_COMP_LIST_END_COPY_CREATED:
+	case MLOG_PAGE_REORGANIZE: case MLOG_COMP_PAGE_REORGANIZE:
+	case MLOG_ZIP_PAGE_REORGANIZE:
+	case MLOG_PAGE_CREATE: case MLOG_COMP_PAGE_CREATE:
+	case MLOG_PAGE_CREATE_RTREE: case MLOG_COMP_PAGE_CREATE_RTREE:
+	case MLOG_UNDO_INSERT: case MLOG_UNDO_ERASE_END: case MLOG_UNDO_INIT:
+	case MLOG_UNDO_HDR_DISCARD: case MLOG_UNDO_HDR_CREATE:
+	case MLOG_UNDO_HDR_REUSE:
+	case MLOG_REC_MIN_MARK: case MLOG_COMP_REC_MIN_MARK:
+	case MLOG_REC_DELETE: case MLOG_COMP_REC_DELETE:
+	case MLOG_IBUF_BITMAP_INIT:
+	case MLOG_INIT_FILE_PAGE: case MLOG_INIT_FILE_PAGE2:
+	case MLOG_ZIP_WRITE_NODE_PTR: case MLOG_ZIP_WRITE_BLOB_PTR:
+	case MLOG_ZIP_WRITE_HEADER: case MLOG_ZIP_PAGE_COMPRESS:
+	case MLOG_ZIP_PAGE_COMPRESS_NO_DATA:
+		return(true);
+	case MLOG_WRITE_STRING:
+		/* Page 0 may carry the encryption key */
+		return(page_no != 0);
+	default:
+		return(false);
+	}
+}
+
+/** Parses a log record ahead of the log scan.
+@param[in]	ptr	start of the record
+@param[in]	end_ptr	end of the parsed data
+@param[out]	type	log record type
+@return length of the record, or 0 if the record is incomplete or must be
+parsed by the log scan */
+static
+ulint
+recv_parse_ahead_rec(
+	byte*		ptr,
+	byte*		end_ptr,
+	mlog_id_t*	type)
+{
+	ulint	space;
+	ulint	page_no;
+	byte*	body;
+
+	switch (*ptr) {
+	case MLOG_MULTI_REC_END:
+	case MLOG_DUMMY_RECORD:
+		*type = static_cast<mlog_id_t>(*ptr);
+		return(1);
+	case MLOG_CHECKPOINT:
+		*type = MLOG_CHECKPOINT;
+		return(end_ptr < ptr + SIZE_OF_MLOG_CHECKPOINT
+		       ? 0 : SIZE_OF_MLOG_CHECKPOINT);
+	}
+
+	body = mlog_parse_initial_log_record(ptr, end_ptr, type, &space,
+					     &page_no);
+
+	if (body == NULL || !recv_parse_ahead_type(*type, page_no)) {
+		return(0);
+	}
+
+	body = recv_parse_or_apply_log_rec_body(
+		*type, body, end_ptr, space, page_no, NULL, NULL);
+
+	return(body == NULL ? 0 : body - ptr);
+}
+
+/** Parses the records of a log segment. The parsing starts from the first
+mini-transaction that starts in the segment, as indicated by
+LOG_BLOCK_FIRST_REC_GROUP. When a record cannot be parsed here, the parsing
+continues from the next mini-transaction start.
+@param[in,out]	seg	log segment */
+static
+void
+recv_parse_ahead_seg(
+	recv_parse_seg_t*	seg)
+{
+	typedef std::pair<lsn_t, ulint>	start_t;
+	typedef std::vector<start_t, ut_allocator<start_t> >	starts_t;
+
+	/* Mini-transaction starts and their offsets in buf */
+	starts_t	starts;
+	byte*		buf = static_cast<byte*>(ut_malloc_nokey(
+		static_cast<ulint>(seg->limit_lsn - seg->start_lsn)));
+	ulint		len = 0;
+	const byte*	block = seg->blocks;
+
+	/* Copy the record data of the blocks to a contiguous buffer */
+	for (lsn_t lsn = seg->start_lsn; lsn < seg->limit_lsn;
+	     lsn += OS_FILE_LOG_BLOCK_SIZE, block += OS_FILE_LOG_BLOCK_SIZE) {
+
+		if (log_block_get_hdr_no(block)
+		    != log_block_convert_lsn_to_no(lsn)
+		    || !log_block_checksum_is_ok(block)) {
+			break;
+		}
+
+		ulint	data_len = log_block_get_data_len(block);
+		ulint	first_rec = log_block_get_first_rec_group(block);
+		ulint	data_end = ut_min(data_len, static_cast<ulint>(
+			OS_FILE_LOG_BLOCK_SIZE - LOG_BLOCK_TRL_SIZE));
+
+		if (first_rec >= LOG_BLOCK_HDR_SIZE && first_rec < data_end
+		    && lsn + first_rec < seg->end_lsn) {
+			starts.push_back(start_t(
+				lsn + first_rec,
+				len + first_rec - LOG_BLOCK_HDR_SIZE));
+		}
+
+		if (data_end > LOG_BLOCK_HDR_SIZE) {
+			memcpy(buf + len, block + LOG_BLOCK_HDR_SIZE,
+			       data_end - LOG_BLOCK_HDR_SIZE);
+			len += data_end - LOG_BLOCK_HDR_SIZE;
+		}
+
+		if (data_len < OS_FILE_LOG_BLOCK_SIZE) {
+			/* The end of the log */
+			break;
+		}
+	}
+
+	for (starts_t::iterator it = starts.begin(); it != starts.end(); ) {
+		lsn_t	lsn = it->first;
+		byte*	ptr = buf + it->second;
+
+		while (ptr < buf + len && lsn < seg->end_lsn) {
+			mlog_id_t	type;
+			ulint		rec_len = recv_parse_ahead_rec(
+				ptr, buf + len, &type);
+
+			if (rec_len == 0) {
+				break;
+			}
+
+			if (recv_parse_ahead_type(type, FIL_NULL)) {
+				recv_parsed_rec_t	rec;
+
+				rec.lsn = lsn;
+				rec.len = static_cast<ib_uint32_t>(rec_len);
+				rec.type = type;
+
+				seg->recs.push_back(rec);
+			}
+
+			ptr += rec_len;
+			lsn = recv_calc_lsn_on_data_add(lsn, rec_len);
+		}
+
+		/* Continue from the next mini-transaction start */
+		while (it != starts.end() && it->first <= lsn) {
+			++it;
+		}
+	}
+
+	ut_free(buf);
+}
+
+/** Parses a log segment in each round of the parse-ahead threads, until
+the threads are shut down.
+@return a dummy parameter */
+extern "C"
+os_thread_ret_t
+DECLARE_THREAD(recv_parse_ahead_thread)(
+	void*	arg)	/*!< in: recv_parse_seg_t */
+{
+	recv_parse_seg_t*	seg = static_cast<recv_parse_seg_t*>(arg);
+	recv_parse_pool_t*	pool = seg->pool;
+
+	my_thread_init();
+
+	/* Corrupt records are flagged in the segment, they are reported
+	by the log scan */
+	my_set_thread_local(recv_parse_corrupt_key, &seg->corrupt);
+
+	for (;;) {
+		os_event_wait(seg->start);
+		os_event_reset(seg->start);
+
+		if (pool->shutdown) {
+			break;
+		}
+
+		recv_parse_ahead_seg(seg);
+
+		if (os_atomic_decrement_ulint(&pool->n_running, 1) == 0) {
+			os_event_set(pool->done);
+		}
+	}
+
+	my_set_thread_local(recv_parse_corrupt_key, NULL);
+
+	if (os_atomic_decrement_ulint(&pool->n_running, 1) == 0) {
+		os_event_set(pool->done);
+	}
+
+	my_thread_end();
+	os_thread_exit();
+
+	OS_THREAD_DUMMY_RETURN;
+}
+
+/** Starts the threads that parse the log ahead of the log scan.
+@param[in]	n_threads	number of threads
+@return the threads */
+static
+recv_parse_pool_t*
+recv_parse_pool_create(
+	ulint	n_threads)
+{
+	recv_parse_pool_t*	pool = UT_NEW_NOKEY(recv_parse_pool_t());
+
+	if (!recv_parse_corrupt_key_created) {
+		ut_a(!my_create_thread_local_key(&recv_parse_corrupt_key,
+						 NULL));
+		recv_parse_corrupt_key_created = true;
+	}
+
+	pool->segs = UT_NEW_ARRAY_NOKEY(recv_parse_seg_t, n_threads);
+	pool->n_threads = n_threads;
+	pool->n_running = 0;
+	pool->done = os_event_create(0);
+	pool->shutdown = false;
+	pool->n_rounds = 0;
+
+	for (ulint i = 0; i < n_threads; i++) {
+		pool->segs[i].start = os_event_create(0);
+		pool->segs[i].pool = pool;
+
+		os_thread_create(recv_parse_ahead_thread, &pool->segs[i],
+				 NULL);
+	}
+
+	return(pool);
+}
+
+/** Stops the threads that parse the log ahead of the log scan and frees
+them.
+@param[in,out]	pool	threads */
+static
+void
+recv_parse_pool_free(
+	recv_parse_pool_t*	pool)
+{
+	ib::info() << "Parsed the log ahead of the log scan in "
+		<< pool->n_rounds << " rounds of " << pool->n_threads
+		<< " threads";
+
+	os_event_reset(pool->done);
+	pool->n_running = pool->n_threads;
+	pool->shutdown = true;
+
+	for (ulint i = 0; i < pool->n_threads; i++) {
+		os_event_set(pool->segs[i].start);
+	}
+
+	os_event_wait(pool->done);
+
+	for (ulint i = 0; i < pool->n_threads; i++) {
+		os_event_destroy(pool->segs[i].start);
+	}
+
+	os_event_destroy(pool->done);
+	UT_DELETE_ARRAY(pool->segs);
+	UT_DELETE(pool);
+}
+
+/** Parses the log records that follow start_lsn with the parse-ahead
+threads, each parsing a segment of the mapped log. The records are merged in
+lsn order into recv_parsed_recs, where recv_parse_log_rec() finds the length
+of the records without parsing their body again.
+@param[in,out]	pool		parse-ahead threads
+@param[in]	group		log group
+@param[in]	map		mapped log file
+@param[in]	map_size	size of the mapping
+@param[in]	start_lsn	lsn to start from, aligned to a log block
+@return lsn up to which the log was parsed ahead */
+static
+lsn_t
+recv_parse_ahead(
+	recv_parse_pool_t*	pool,
+	const log_group_t*	group,
+	const byte*		map,
+	ulint			map_size,
+	lsn_t			start_lsn)
+{
+	ulint	n_threads = pool->n_threads;
+	lsn_t	offset = log_group_calc_lsn_offset(start_lsn, group);
+	lsn_t	size = ut_min(
+		static_cast<lsn_t>(n_threads) * RECV_PARSE_AHEAD_SIZE,
+		ut_uint64_align_down(map_size - offset,
+				     OS_FILE_LOG_BLOCK_SIZE));
+	lsn_t	seg_size = ut_uint64_align_down(size / n_threads,
+						OS_FILE_LOG_BLOCK_SIZE);
+
+	recv_parsed_recs.clear();
+	recv_parsed_pos = 0;
+
+	if (seg_size < RECV_SCAN_SIZE) {
+		/* Too close to the end of the file, the log wraps around */
+		return(start_lsn + RECV_SCAN_SIZE);
+	}
+
+	os_event_reset(pool->done);
+	pool->n_running = n_threads;
+	pool->n_rounds++;
+
+	for (ulint i = 0; i < n_threads; i++) {
+		recv_parse_seg_t*	seg = &pool->segs[i];
+
+		seg->start_lsn = start_lsn + i * seg_size;
+		seg->end_lsn = i + 1 < n_threads
+			? seg->start_lsn + seg_size : start_lsn + size;
+		/* Records that continue in the next segment are parsed
+		too, unless they are very long */
+		seg->limit_lsn = ut_min(start_lsn + size,
+					seg->end_lsn + RECV_PARSING_BUF_SIZE);
+		seg->blocks = map + offset + i * seg_size;
+		seg->recs.clear();
+		seg->corrupt = false;
+
+		os_event_set(seg->start);
+	}
+
+	os_event_wait(pool->done);
+
+	for (ulint i = 0; i < n_threads; i++) {
+		recv_parsed_recs.insert(recv_parsed_recs.end(),
+					pool->segs[i].recs.begin(),
+					pool->segs[i].recs.end());
+
+		if (pool->segs[i].corrupt) {
+			/* The log scan stops at the corrupt record, the
+			records of the following segments are never looked
+			up */
+			return(pool->segs[i].end_lsn);
+		}
+	}
+
+	return(start_lsn + size);
+}
+
+/** Looks up a log record that was parsed ahead of the log scan.
+@param[in]	lsn	start lsn of the record
+@param[in]	type	log record type
+@return length of the record, or 0 if it was not parsed ahead */
+static
+ulint
+recv_parsed_rec_len(
+	lsn_t		lsn,
+	mlog_id_t	type)
+{
+	ulint	pos = recv_parsed_pos;
+
+	/* The records are mostly looked up in lsn order */
+	if (pos >= recv_parsed_recs.size()
+	    || recv_parsed_recs[pos].lsn != lsn) {
+		recv_parsed_rec_t	key;
+
+		key.lsn = lsn;
+
+		pos = std::lower_bound(
+			recv_parsed_recs.begin(), recv_parsed_recs.end(), key,
+			recv_parsed_lsn_less()) - recv_parsed_recs.begin();
+
+		if (pos >= recv_parsed_recs.size()
+		    || recv_parsed_recs[pos].lsn != lsn) {
+			return(0);
+		}
+	}
+
+	if (recv_parsed_recs[pos].type != type) {
+		return(0);
+	}
+
+	recv_parsed_pos = pos + 1;
+
+	return(recv_parsed_recs[pos].len);
+}
+#endif /* !UNIV_HOTBACKUP */
+
 /** Tries to parse a single log record.
 @param[out]	type		log record type
 @param[in]	ptr		pointer to a buffer
@@ -3148,6 +4444,24 @@ recv_parse_log_rec(
 		return(0);
 	}
 
+#ifndef UNIV_HOTBACKUP
+	if (!recv_parsed_recs.empty()) {
+		/* The lsn of the record, counted from the start of the
+		unparsed part of the parsing buffer */
+		ulint	len = recv_parsed_rec_len(
+			recv_calc_lsn_on_data_add(
+				recv_sys->recovered_lsn,
+				ptr - recv_sys->buf
+				- recv_sys->recovered_offset),
+			*type);
+
+		if (len != 0) {
+			return(len <= static_cast<ulint>(end_ptr - ptr)
+			       ? len : 0);
+		}
+	}
+#endif /* !UNIV_HOTBACKUP */
+
 	new_ptr = recv_parse_or_apply_log_rec_body(
 		*type, new_ptr, end_ptr, *space, *page_no, NULL, NULL);
 
@@ -3904,7 +5218,17 @@ recv_scan_log_recs(
 		}
 
 		if (*store_to_hash != STORE_NO
-		    && mem_heap_get_size(recv_sys->heap) > available_memory) {
+		    && recv_sys_mem_used() > available_memory) {
+#ifndef UNIV_HOTBACKUP
+			if (recv_spill_log_recs) {
+				/* Keep storing the records, they are applied
+				by a merge of the runs after the scan */
+				if (!recv_spill_hashed_log_recs()) {
+					recv_sys->found_corrupt_fs = true;
+					return(true);
+				}
+			} else
+#endif /* !UNIV_HOTBACKUP */
 			*store_to_hash = STORE_NO;
 		}
 
@@ -3919,6 +5243,74 @@ recv_scan_log_recs(
 }
 
 #ifndef UNIV_HOTBACKUP
+/** Maps the log file of a log group into memory for scanning. The kernel is
+advised that the mapping is read sequentially.
+@param[in]	group	log group
+@param[out]	size	size of the mapping
+@return start of the mapping, or NULL if the log is not to be mapped */
+static
+const byte*
+recv_log_map_open(
+	const log_group_t*	group,
+	ulint*			size)
+{
+#ifndef _WIN32
+	if (!recv_map_log_file || group->n_files != 1) {
+		return(NULL);
+	}
+
+	char*	path = fil_space_get_first_path(group->space_id);
+
+	if (path == NULL) {
+		return(NULL);
+	}
+
+	int		fd = open(path, O_RDONLY);
+	struct stat	st;
+	void*		ptr = MAP_FAILED;
+
+	if (fd >= 0 && fstat(fd, &st) == 0
+	    && st.st_size >= static_cast<off_t>(group->file_size)) {
+		*size = static_cast<ulint>(group->file_size);
+		ptr = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+
+	if (ptr == MAP_FAILED) {
+		ib::warn() << "Cannot map the log file " << path
+			<< ", errno " << errno << ". Reading it instead.";
+		ptr = NULL;
+	} else {
+		madvise(ptr, *size, MADV_SEQUENTIAL);
+	}
+
+	if (fd >= 0) {
+		close(fd);
+	}
+
+	ut_free(path);
+
+	return(static_cast<const byte*>(ptr));
+#else
+	return(NULL);
+#endif /* !_WIN32 */
+}
+
+/** Unmaps the log file mapped by recv_log_map_open().
+@param[in]	map	start of the mapping, or NULL
+@param[in]	size	size of the mapping */
+static
+void
+recv_log_map_close(
+	const byte*	map,
+	ulint		size)
+{
+#ifndef _WIN32
+	if (map != NULL) {
+		munmap(const_cast<byte*>(map), size);
+	}
+#endif /* !_WIN32 */
+}
+
 /** Scans log from a buffer and stores new log data to the parsing buffer.
 Parses and hashes the log records if new data found.
 @param[in,out]	group			log group
@@ -3962,6 +5354,16 @@ recv_group_scan_log_recs(
 		* (buf_pool_get_n_pages()
 		   - (recv_n_pool_free_frames * srv_buf_pool_instances));
 
+	ulint		map_size = 0;
+	const byte*	map = recv_log_map_open(group, &map_size);
+	const byte*	buf;
+	lsn_t		parsed_ahead_lsn = 0;
+	recv_parse_pool_t*	parse_pool = NULL;
+
+	if (map != NULL && recv_n_apply_threads > 1) {
+		parse_pool = recv_parse_pool_create(recv_n_apply_threads);
+	}
+
 	end_lsn = *contiguous_lsn = ut_uint64_align_down(
 		*contiguous_lsn, OS_FILE_LOG_BLOCK_SIZE);
 
@@ -3978,14 +5380,42 @@ recv_group_scan_log_recs(
 		start_lsn = end_lsn;
 		end_lsn += RECV_SCAN_SIZE;
 
-		log_group_read_log_seg(
-			log_sys->buf, group, start_lsn, end_lsn);
+		if (parse_pool != NULL && start_lsn >= parsed_ahead_lsn) {
+			parsed_ahead_lsn = recv_parse_ahead(
+				parse_pool, group, map, map_size, start_lsn);
+		}
+
+		lsn_t	offset = log_group_calc_lsn_offset(start_lsn, group);
+
+		if (map != NULL && offset + RECV_SCAN_SIZE <= map_size) {
+			/* Scan the mapped blocks in place */
+			buf = map + offset;
+		} else {
+			/* The segment wraps around the end of the file */
+			log_group_read_log_seg(
+				log_sys->buf, group, start_lsn, end_lsn);
+			buf = log_sys->buf;
+		}
 	} while (!recv_scan_log_recs(
-			 available_mem, &store_to_hash, log_sys->buf,
+			 available_mem, &store_to_hash, buf,
 			 RECV_SCAN_SIZE,
 			 checkpoint_lsn,
 			 start_lsn, contiguous_lsn, &group->scanned_lsn));
 
+	if (parse_pool != NULL) {
+		recv_parse_pool_free(parse_pool);
+	}
+
+	recv_parsed_recs_t().swap(recv_parsed_recs);
+	recv_log_map_close(map, map_size);
+
+	if (recv_n_skipped_recs > 0) {
+		ib::info() << "Discarded " << recv_n_skipped_recs
+			<< " log records of tablespaces that are not in"
+			" the backup";
+		recv_n_skipped_recs = 0;
+	}
+
 	if (recv_sys->found_corrupt_log || recv_sys->found_corrupt_fs) {
 		DBUG_RETURN(false);
 	}
@@ -4085,16 +5515,10 @@ recv_init_crash_recovery_spaces(void)
 	if (flag_deleted) {
 		dberr_t err = DB_SUCCESS;
 
-		for (ulint h = 0;
-		     h < hash_get_n_cells(recv_sys->addr_hash);
-		     h++) {
-			for (recv_addr_t* recv_addr
-				     = static_cast<recv_addr_t*>(
-					     HASH_GET_FIRST(
-						     recv_sys->addr_hash, h));
-			     recv_addr != 0;
-			     recv_addr = static_cast<recv_addr_t*>(
-				     HASH_GET_NEXT(addr_hash, recv_addr))) {
+		for (ulint h = 0; h < recv_sys->n_cells; h++) {
+			recv_addr_t*	recv_addr = recv_sys->addrs[h];
+
+			if (recv_addr != NULL) {
 				const ulint space = recv_addr->space;
 
 				if (is_predefined_tablespace(space)) {
@@ -4384,6 +5808,17 @@ recv_recovery_from_checkpoint_start(
 				return(DB_ERROR);
 			}
 		}
+
+		if (!recv_spill_runs.empty()) {
+			/* The spilled records must be applied before any
+			page is read in */
+			err = recv_apply_spilled_log_recs();
+
+			if (err != DB_SUCCESS) {
+				log_mutex_exit();
+				return(err);
+			}
+		}
 	} else {
 		ut_ad(!rescan || recv_sys->n_addrs == 0);
 	}
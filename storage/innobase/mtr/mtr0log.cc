@@ -153,7 +153,7 @@ mlog_parse_nbytes(
 	ptr += 2;
 
 	if (offset >= UNIV_PAGE_SIZE) {
-		recv_sys->found_corrupt_log = TRUE;
+		recv_report_corrupt_log();
 
 		return(NULL);
 	}
@@ -224,7 +224,7 @@ mlog_parse_nbytes(
 		break;
 	default:
 	corrupt:
-		recv_sys->found_corrupt_log = TRUE;
+		recv_report_corrupt_log();
 		ptr = NULL;
 	}
 
@@ -393,7 +393,7 @@ mlog_parse_string(
 	ptr += 2;
 
 	if (offset >= UNIV_PAGE_SIZE || len + offset > UNIV_PAGE_SIZE) {
-		recv_sys->found_corrupt_log = TRUE;
+		recv_report_corrupt_log();
 
 		return(NULL);
 	}
@@ -1186,7 +1186,7 @@ page_cur_parse_insert_rec(
 
 		if (offset >= UNIV_PAGE_SIZE) {
 
-			recv_sys->found_corrupt_log = TRUE;
+			recv_report_corrupt_log();
 
 			return(NULL);
 		}
@@ -1200,7 +1200,7 @@ page_cur_parse_insert_rec(
 	}
 
 	if (end_seg_len >= UNIV_PAGE_SIZE << 1) {
-		recv_sys->found_corrupt_log = TRUE;
+		recv_report_corrupt_log();
 
 		return(NULL);
 	}
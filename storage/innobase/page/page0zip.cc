@@ -3889,7 +3889,7 @@ page_zip_parse_write_blob_ptr(
 	    || offset >= UNIV_PAGE_SIZE
 	    || z_offset >= UNIV_PAGE_SIZE) {
 corrupt:
-		recv_sys->found_corrupt_log = TRUE;
+		recv_report_corrupt_log();
 
 		return(NULL);
 	}
@@ -4033,7 +4033,7 @@ page_zip_parse_write_node_ptr(
 	    || offset >= UNIV_PAGE_SIZE
 	    || z_offset >= UNIV_PAGE_SIZE) {
 corrupt:
-		recv_sys->found_corrupt_log = TRUE;
+		recv_report_corrupt_log();
 
 		return(NULL);
 	}
@@ -4594,7 +4594,7 @@ page_zip_parse_write_header(
 
 	if (len == 0 || offset + len >= PAGE_DATA) {
 corrupt:
-		recv_sys->found_corrupt_log = TRUE;
+		recv_report_corrupt_log();
 
 		return(NULL);
 	}
@@ -4889,7 +4889,7 @@ page_zip_parse_compress(
 	if (page) {
 		if (!page_zip || page_zip_get_size(page_zip) < size) {
 corrupt:
-			recv_sys->found_corrupt_log = TRUE;
+			recv_report_corrupt_log();
 
 			return(NULL);
 		}
@@ -60,7 +60,14 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "common.h"
 #include "backup_copy.h"
 #include "backup_mysql.h"
+#include "ds_decompress.h"
+#include "ds_decrypt.h"
+#include "ds_local.h"
+#include "executor.h"
+#include "xbcrypt_common.h"
 #include "keyring_plugins.h"
+#include "xbstream.h"
+#include "xbstream_extract.h"
 #include "xb0xb.h"
 #include "xtrabackup_version.h"
 #include "xtrabackup_config.h"
@@ -118,13 +125,10 @@ struct datadir_iter_t {
 
 
 /************************************************************************
-Represents the context of the thread processing MySQL data directory. */
+Represents the context of the task processing MySQL data directory. */
 struct datadir_thread_ctxt_t {
 	datadir_iter_t		*it;
 	uint			n_thread;
-	uint			*count;
-	ib_mutex_t		*count_mutex;
-	os_thread_id_t		id;
 	bool			ret;
 };
 
@@ -922,43 +926,46 @@ backup_file_printf(const char *filename, const char *fmt, ...)
 	return(result);
 }
 
+/************************************************************************
+Run n tasks processing the files returned by the iterator on the shared
+executor, and wait for them to complete.
+@return true if all tasks succeeded. */
 static
 bool
-run_data_threads(datadir_iter_t *it, os_thread_func_t func, uint n,
+run_data_threads(datadir_iter_t *it, xb_task_func_t func, uint n,
 		 const char *thread_description)
 {
 	datadir_thread_ctxt_t	*data_threads;
-	uint			i, count;
-	ib_mutex_t		count_mutex;
+	xb_executor_t		*executor;
+	xb_task_group_t		group;
+	uint			i;
 	bool			ret;
 
 	ut_a(thread_description);
+
+	executor = xb_executor_acquire(n);
+	if (executor == NULL) {
+		msg("Error: cannot start the %s threads.\n",
+		    thread_description);
+		return(false);
+	}
+
 	data_threads = (datadir_thread_ctxt_t*)
 			(ut_malloc_nokey(sizeof(datadir_thread_ctxt_t) * n));
 
-	mutex_create(LATCH_ID_XTRA_COUNT_MUTEX, &count_mutex);
-	count = n;
+	xb_task_group_init(&group);
 
 	for (i = 0; i < n; i++) {
 		data_threads[i].it = it;
 		data_threads[i].n_thread = i + 1;
-		data_threads[i].count = &count;
-		data_threads[i].count_mutex = &count_mutex;
-		os_thread_create(func, data_threads + i, &data_threads[i].id);
+		data_threads[i].ret = false;
+		xb_executor_submit(executor, &group, func, data_threads + i);
 	}
 
-	/* Wait for threads to exit */
-	while (1) {
-		os_thread_sleep(100000);
-		mutex_enter(&count_mutex);
-		if (count == 0) {
-			mutex_exit(&count_mutex);
-			break;
-		}
-		mutex_exit(&count_mutex);
-	}
+	xb_task_group_wait(executor, &group);
+	xb_task_group_destroy(&group);
 
-	mutex_free(&count_mutex);
+	xb_executor_release(executor);
 
 	ret = true;
 	for (i = 0; i < n; i++) {
@@ -989,6 +996,7 @@ copy_file(ds_ctxt_t *datasink,
 	datafile_cur_t		 cursor;
 	xb_fil_cur_result_t	 res;
 	const char		*action;
+	int			 rc;
 
 	if (!datafile_open(src_file_path, &cursor, thread_n)) {
 		goto error;
@@ -1009,16 +1017,27 @@ copy_file(ds_ctxt_t *datasink,
 	msg_ts("[%02u] %s %s to %s\n",
 	       thread_n, action, src_file_path, dstfile->path);
 
+	/* Let the datasink clone or copy the file in the kernel. Throttled
+	copies go through the buffer, which counts the I/O operations. */
+	rc = xtrabackup_throttle ? -1
+		: ds_copy_fd(dstfile, cursor.fd, cursor.statinfo.st_size,
+			     FALSE);
+	if (rc > 0) {
+		goto error;
+	}
+
 	/* The main copy loop */
-	while ((res = datafile_read(&cursor)) == XB_FIL_CUR_SUCCESS) {
+	while (rc < 0) {
 
-		if (ds_write(dstfile, cursor.buf, cursor.buf_read)) {
-			goto error;
+		res = datafile_read(&cursor);
+		if (res == XB_FIL_CUR_EOF) {
+			break;
 		}
-	}
 
-	if (res == XB_FIL_CUR_ERROR) {
-		goto error;
+		if (res == XB_FIL_CUR_ERROR
+		    || ds_write(dstfile, cursor.buf, cursor.buf_read)) {
+			goto error;
+		}
 	}
 
 	/* close */
@@ -1783,16 +1802,13 @@ bool should_skip_file_on_copy_back(const char *filepath) {
 	return false;
 }
 
-os_thread_ret_t
+static
+void
 copy_back_thread_func(void* data) {
 	bool ret = false;
 	datadir_thread_ctxt_t* ctx = (datadir_thread_ctxt_t*)data;
 	datadir_node_t node;
 
-	if (my_thread_init()) {
-		goto cleanup;
-	}
-
 	datadir_node_init(&node);
 
 	while (datadir_iter_next(ctx->it, &node)) {
@@ -1840,17 +1856,9 @@ copy_back_thread_func(void* data) {
 		}
 	}
 cleanup:
-	my_thread_end();
 	datadir_node_free(&node);
 
-	mutex_enter(ctx->count_mutex);
-	--(*ctx->count);
-	mutex_exit(ctx->count_mutex);
-
 	ctx->ret = ret;
-
-	os_thread_exit();
-	OS_THREAD_DUMMY_RETURN;
 }
 
 static
@@ -2155,68 +2163,162 @@ cleanup:
 	return(ret);
 }
 
+/* Datasinks used by --decrypt and --decompress */
+static ds_ctxt_t *ds_decrypt_data = NULL;
+static ds_ctxt_t *ds_decompress_data = NULL;
+static ds_ctxt_t *ds_decrypt_decompress_data = NULL;
+
+#define DECRYPT_DECOMPRESS_BUFFER_SIZE (10 * 1024 * 1024)
+
+/************************************************************************
+Create the --decrypt and --decompress datasinks writing to 'ds_dest'. */
+static
+void
+decrypt_decompress_datasinks_init(const char *root, ds_ctxt_t *ds_dest)
+{
+	/* Decryption and decompression share the worker pool */
+	if (xb_executor_threads == 0) {
+		xb_executor_threads = MY_MAX(xtrabackup_decompress_threads,
+					     xtrabackup_encrypt_threads);
+	}
+
+	if (opt_decompress) {
+		ds_decompress_threads = xtrabackup_decompress_threads;
+		ds_decompress_data = ds_create(root, DS_TYPE_DECOMPRESS);
+		ds_set_pipe(ds_decompress_data, ds_dest);
+	}
+
+	if (opt_decrypt) {
+		ds_encrypt_algo = opt_decrypt_algo;
+		ds_encrypt_key = xtrabackup_encrypt_key;
+		ds_encrypt_key_file = xtrabackup_encrypt_key_file;
+		ds_decrypt_encrypt_threads = xtrabackup_encrypt_threads;
+		ds_decrypt_data = ds_create(root, DS_TYPE_DECRYPT);
+		ds_set_pipe(ds_decrypt_data, ds_dest);
+
+		/* Compressed files are encrypted after compression */
+		if (opt_decompress) {
+			ds_decrypt_decompress_data = ds_create(root,
+							DS_TYPE_DECRYPT);
+			ds_set_pipe(ds_decrypt_decompress_data,
+				    ds_decompress_data);
+		}
+	}
+}
+
+static
+void
+decrypt_decompress_datasinks_deinit()
+{
+	if (ds_decrypt_decompress_data != NULL) {
+		ds_destroy(ds_decrypt_decompress_data);
+		ds_decrypt_decompress_data = NULL;
+	}
+
+	if (ds_decrypt_data != NULL) {
+		ds_destroy(ds_decrypt_data);
+		ds_decrypt_data = NULL;
+	}
+
+	if (ds_decompress_data != NULL) {
+		ds_destroy(ds_decompress_data);
+		ds_decompress_data = NULL;
+	}
+}
+
+/************************************************************************
+Choose the datasink that decodes a file according to its extension.
+@return datasink or NULL if the file is not to be decoded. */
+static
+ds_ctxt_t *
+decrypt_decompress_datasink(const char *filepath, const char **action)
+{
+	if (opt_decrypt && opt_decompress
+	    && ends_with(filepath, ".qp.xbcrypt")) {
+		*action = "decrypting and decompressing";
+		return(ds_decrypt_decompress_data);
+	} else if (opt_decrypt && ends_with(filepath, ".xbcrypt")) {
+		*action = "decrypting";
+		return(ds_decrypt_data);
+	} else if (opt_decompress && ends_with(filepath, ".qp")) {
+		*action = "decompressing";
+		return(ds_decompress_data);
+	}
+
+	return(NULL);
+}
+
 bool
 decrypt_decompress_file(const char *filepath, uint thread_n)
 {
-	std::stringstream cmd, message;
-	char *dest_filepath = strdup(filepath);
-	bool needs_action = false;
-
-	cmd << "cat " << filepath;
-
- 	if (ends_with(filepath, ".xbcrypt") && opt_decrypt) {
- 		cmd << " | xbcrypt --decrypt --encrypt-algo="
- 		    << xtrabackup_encrypt_algo_names[opt_decrypt_algo];
- 		if (xtrabackup_encrypt_key) {
- 			cmd << " --encrypt-key=" << xtrabackup_encrypt_key;
- 		} else {
- 			cmd << " --encrypt-key-file="
- 			    << xtrabackup_encrypt_key_file;
- 		}
- 		dest_filepath[strlen(dest_filepath) - 8] = 0;
- 		message << "decrypting";
- 		needs_action = true;
- 	}
-
- 	if (opt_decompress
- 	    && (ends_with(filepath, ".qp")
-		|| (ends_with(filepath, ".qp.xbcrypt")
-		    && opt_decrypt))) {
- 		cmd << " | qpress -dio ";
- 		dest_filepath[strlen(dest_filepath) - 3] = 0;
- 		if (needs_action) {
- 			message << " and ";
- 		}
- 		message << "decompressing";
- 		needs_action = true;
- 	}
-
- 	cmd << " > " << dest_filepath;
- 	message << " " << filepath;
-
- 	free(dest_filepath);
-
- 	if (needs_action) {
-
-		msg_ts("[%02u] %s\n", thread_n, message.str().c_str());
-
-	 	if (system(cmd.str().c_str()) != 0) {
-	 		return(false);
-	 	}
-
-	 	if (opt_remove_original) {
-	 		msg_ts("[%02u] removing %s\n", thread_n, filepath);
-	 		if (my_delete(filepath, MYF(MY_WME)) != 0) {
-	 			return(false);
-	 		}
-	 	}
-	 }
-
- 	return(true);
+	ds_ctxt_t	*ds;
+	ds_file_t	*dstfile = NULL;
+	const char	*action;
+	uchar		*buf = NULL;
+	size_t		bytes;
+	File		fd;
+	bool		ret = false;
+
+	ds = decrypt_decompress_datasink(filepath, &action);
+	if (ds == NULL) {
+		return(true);
+	}
+
+	msg_ts("[%02u] %s %s\n", thread_n, action, filepath);
+
+	fd = my_open(filepath, O_RDONLY, MYF(MY_WME));
+	if (fd < 0) {
+		return(false);
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	/* The file is decoded in-process, the datasinks strip the .xbcrypt
+	and .qp extensions */
+	dstfile = ds_open(ds, filepath, NULL);
+	if (dstfile == NULL) {
+		msg("[%02u] error: cannot open the destination file for %s\n",
+		    thread_n, filepath);
+		goto cleanup;
+	}
+
+	buf = (uchar *) ut_malloc_nokey(DECRYPT_DECOMPRESS_BUFFER_SIZE);
+
+	while ((bytes = my_read(fd, buf, DECRYPT_DECOMPRESS_BUFFER_SIZE,
+				MYF(MY_WME))) > 0) {
+		if (bytes == (size_t) -1) {
+			goto cleanup;
+		}
+		if (ds_write(dstfile, buf, bytes)) {
+			msg("[%02u] error: %s %s failed\n", thread_n, action,
+			    filepath);
+			goto cleanup;
+		}
+	}
+
+	ret = true;
+
+cleanup:
+	if (dstfile != NULL && ds_close(dstfile)) {
+		ret = false;
+	}
+
+	ut_free(buf);
+
+	my_close(fd, MYF(MY_WME));
+
+	if (ret && opt_remove_original) {
+		msg_ts("[%02u] removing %s\n", thread_n, filepath);
+		if (my_delete(filepath, MYF(MY_WME)) != 0) {
+			return(false);
+		}
+	}
+
+	return(ret);
 }
 
 static
-os_thread_ret_t
+void
 decrypt_decompress_thread_func(void *arg)
 {
 	bool ret = true;
@@ -2247,14 +2349,7 @@ cleanup:
 
 	datadir_node_free(&node);
 
-	mutex_enter(ctxt->count_mutex);
-	--(*ctxt->count);
-	mutex_exit(ctxt->count_mutex);
-
 	ctxt->ret = ret;
-
-	os_thread_exit();
-	OS_THREAD_DUMMY_RETURN;
 }
 
 bool
@@ -2274,9 +2369,19 @@ decrypt_decompress()
 		return(false);
 	}
 
+	/* The file tasks run on the pool next to the decryption and
+	decompression tasks */
+	if (xb_executor_threads == 0) {
+		xb_executor_threads = MY_MAX(xtrabackup_decompress_threads,
+					     xtrabackup_encrypt_threads)
+			+ (xtrabackup_parallel ? xtrabackup_parallel : 1);
+	}
+
 	/* copy the rest of tablespaces */
 	ds_data = ds_create(".", DS_TYPE_LOCAL);
 
+	decrypt_decompress_datasinks_init(".", ds_data);
+
 	it = datadir_iter_new(".", false);
 
 	ut_a(xtrabackup_parallel >= 0);
@@ -2289,6 +2394,8 @@ decrypt_decompress()
 		datadir_iter_free(it);
 	}
 
+	decrypt_decompress_datasinks_deinit();
+
 	if (ds_data != NULL) {
 		ds_destroy(ds_data);
 	}
@@ -2302,6 +2409,64 @@ decrypt_decompress()
 	return(ret);
 }
 
+/************************************************************************
+Extract an xbstream read from the standard input into the target directory
+for --prepare --extract-stream, with the same parallel extraction as xbstream
+-x. The prepare only starts once the whole stream has been extracted.
+@return true on success. */
+bool
+extract_stream()
+{
+	xb_rstream_t		*stream;
+	xb_extract_options_t	options;
+	bool			ret;
+
+	stream = xb_stream_read_new();
+	if (stream == NULL) {
+		msg("xtrabackup: error: xb_stream_read_new() failed.\n");
+		return(false);
+	}
+
+	ds_local_drop_cache = FALSE;
+	ds_data = ds_create(xtrabackup_target_dir, DS_TYPE_LOCAL);
+	if (ds_data == NULL) {
+		xb_stream_read_done(stream);
+		return(false);
+	}
+
+	decrypt_decompress_datasinks_init(xtrabackup_target_dir, ds_data);
+
+	/* Compressed and encrypted files cannot be prepared, and the prepare
+	would miss any file cut short by a truncated stream */
+	memset(&options, 0, sizeof(options));
+	options.ds_ctxt = ds_data;
+	options.ds_decrypt_ctxt = ds_decrypt_data;
+	options.ds_decompress_ctxt = ds_decompress_data;
+	options.ds_decrypt_decompress_ctxt = ds_decrypt_decompress_data;
+	options.plain_only = TRUE;
+	options.complete = TRUE;
+
+	msg_ts("xtrabackup: extracting the stream into %s\n",
+	       xtrabackup_target_dir);
+
+	ret = xb_stream_extract(&options, &stream, 1,
+				xtrabackup_parallel > 0
+				? xtrabackup_parallel : 1) == 0;
+
+	if (ret) {
+		msg_ts("xtrabackup: the stream has been extracted\n");
+	}
+
+	xb_stream_read_done(stream);
+
+	decrypt_decompress_datasinks_deinit();
+
+	ds_destroy(ds_data);
+	ds_data = NULL;
+
+	return(ret);
+}
+
 #ifdef HAVE_VERSION_CHECK
 void
 version_check()
@@ -42,6 +42,8 @@ bool
 copy_back(int argc, char **argv);
 bool
 decrypt_decompress();
+bool
+extract_stream();
 #ifdef HAVE_VERSION_CHECK
 void
 version_check();
@@ -26,6 +26,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql_version.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <sys/uio.h>
 
 #define xb_a(expr)							\
 	do {								\
@@ -134,4 +135,63 @@ xb_read_full(File fd, uchar *buf, size_t len)
 	return tlen;
 }
 
+/* Maximum number of buffers passed to a single writev() call */
+#define XB_IOV_MAX 64
+
+/****************************************************************************
+Write all buffers described by 'iov' to 'fd', using as few writev() calls as
+possible and resuming after partial writes.
+@return 0 on success, 1 on error. */
+static inline int
+xb_writev_full(File fd, const struct iovec *iov, uint iovcnt)
+{
+	struct iovec	vec[XB_IOV_MAX];
+	struct iovec	*cur;
+	uint		n;
+	ssize_t		written;
+
+	while (iovcnt > 0) {
+		n = iovcnt < XB_IOV_MAX ? iovcnt : XB_IOV_MAX;
+		memcpy(vec, iov, n * sizeof(struct iovec));
+		iov += n;
+		iovcnt -= n;
+
+		cur = vec;
+		while (n > 0) {
+			my_bool	progress;
+
+			written = writev(fd, cur, n);
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				msg("%s: writev() failed with errno = %d\n",
+				    my_progname, errno);
+				return 1;
+			}
+			progress = written > 0;
+
+			/* Skip the buffers that have been written
+			completely */
+			while (n > 0 && (size_t) written >= cur->iov_len) {
+				written -= cur->iov_len;
+				cur++;
+				n--;
+			}
+			if (n > 0) {
+				if (!progress) {
+					msg("%s: writev() wrote no data\n",
+					    my_progname);
+					return 1;
+				}
+				cur->iov_base = (char *) cur->iov_base +
+					written;
+				cur->iov_len -= written;
+			}
+		}
+	}
+
+	return 0;
+}
+
 #endif
@@ -22,5 +22,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #define XTRABACKUP_CONFIG_H
 
 #cmakedefine HAVE_VERSION_CHECK 1
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+#cmakedefine HAVE_FICLONE 1
 
 #endif
@@ -19,3 +19,4 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 *******************************************************/
 
 #cmakedefine HAVE_CLMUL_INSTRUCTION 1
+#cmakedefine HAVE_CRC32C_INSTRUCTION 1
@@ -24,10 +24,24 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "crc_glue.h"
 #include "crc-intel-pclmul.h"
 
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
 #if __GNUC__ >= 4 && defined(__x86_64__)
 static int pclmul_enabled = 0;
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__) && \
+	defined(HAVE_CRC32C_INSTRUCTION)
+static int sse42_enabled = 0;
+#endif
+
+/* CRC-32C polynomial, reversed */
+#define CRC32C_POLY 0x82f63b78UL
+
+static uint32_t crc32c_table[256];
+
 #if defined(__GNUC__) && defined(__x86_64__)
 static
 uint32_t
@@ -50,13 +64,25 @@ cpuid(uint32_t*	ecx, uint32_t*	edx)
 #endif
 
 void crc_init() {
+	uint32_t	i, j, crc;
 #if defined(__GNUC__) && defined(__x86_64__)
 	uint32_t ecx, edx;
 
 	if (cpuid(&ecx, &edx) > 0) {
 		pclmul_enabled = ((ecx >> 19) & 1) && ((ecx >> 1) & 1);
+#if defined(HAVE_CRC32C_INSTRUCTION)
+		sse42_enabled = (ecx >> 20) & 1;
+#endif
 	}
 #endif
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+		}
+		crc32c_table[i] = crc;
+	}
 }
 
 ulong crc32_iso3309(ulong crc, const uchar *buf, uint len)
@@ -70,3 +96,78 @@ ulong crc32_iso3309(ulong crc, const uchar *buf, uint len)
 #endif
 	return crc32(crc, buf, len);
 }
+
+#if defined(__GNUC__) && defined(__x86_64__) && \
+	defined(HAVE_CRC32C_INSTRUCTION)
+static
+uint32_t
+crc32c_sse42(uint32_t crc, const uchar *buf, uint len)
+{
+	uint64_t	crc64;
+
+	for (; len > 0 && ((uintptr_t) buf & 7); len--, buf++) {
+		asm("crc32b %1, %0" : "+r" (crc) : "rm" (*buf));
+	}
+
+	crc64 = crc;
+	for (; len >= 8; len -= 8, buf += 8) {
+		uint64_t	val;
+
+		memcpy(&val, buf, 8);
+		asm("crc32q %1, %0" : "+r" (crc64) : "rm" (val));
+	}
+	crc = (uint32_t) crc64;
+
+	for (; len > 0; len--, buf++) {
+		asm("crc32b %1, %0" : "+r" (crc) : "rm" (*buf));
+	}
+
+	return crc;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static
+uint32_t
+crc32c_armv8(uint32_t crc, const uchar *buf, uint len)
+{
+	for (; len > 0 && ((uintptr_t) buf & 7); len--, buf++) {
+		crc = __crc32cb(crc, *buf);
+	}
+
+	for (; len >= 8; len -= 8, buf += 8) {
+		uint64_t	val;
+
+		memcpy(&val, buf, 8);
+		crc = __crc32cd(crc, val);
+	}
+
+	for (; len > 0; len--, buf++) {
+		crc = __crc32cb(crc, *buf);
+	}
+
+	return crc;
+}
+#endif
+
+ulong crc32c(ulong crc, const uchar *buf, uint len)
+{
+	uint32_t crc_accum = (uint32_t) crc ^ 0xffffffffUL;
+
+#if defined(__GNUC__) && defined(__x86_64__) && \
+	defined(HAVE_CRC32C_INSTRUCTION)
+	if (sse42_enabled) {
+		return crc32c_sse42(crc_accum, buf, len) ^ 0xffffffffUL;
+	}
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	return crc32c_armv8(crc_accum, buf, len) ^ 0xffffffffUL;
+#endif
+
+	for (; len > 0; len--, buf++) {
+		crc_accum = crc32c_table[(crc_accum ^ *buf) & 0xff] ^
+			(crc_accum >> 8);
+	}
+
+	return crc_accum ^ 0xffffffffUL;
+}
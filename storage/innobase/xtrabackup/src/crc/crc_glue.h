@@ -26,6 +26,8 @@ extern "C" {
 
 void crc_init();
 ulong crc32_iso3309(ulong crc, const uchar *buf, uint len);
+/* CRC-32C (Castagnoli), hardware accelerated where available */
+ulong crc32c(ulong crc, const uchar *buf, uint len);
 
 #ifdef __cplusplus
 }
@@ -29,7 +29,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "ds_tmpfile.h"
 #include "ds_encrypt.h"
 #include "ds_decrypt.h"
+#include "ds_decompress.h"
 #include "ds_buffer.h"
+#include "ds_spool.h"
 
 /************************************************************************
 Create a datasink of the specified type */
@@ -61,12 +63,18 @@ ds_create(const char *root, ds_type_t type)
 	case DS_TYPE_DECRYPT:
 		ds = &datasink_decrypt;
 		break;
+	case DS_TYPE_DECOMPRESS:
+		ds = &datasink_decompress;
+		break;
 	case DS_TYPE_TMPFILE:
 		ds = &datasink_tmpfile;
 		break;
 	case DS_TYPE_BUFFER:
 		ds = &datasink_buffer;
 		break;
+	case DS_TYPE_SPOOL:
+		ds = &datasink_spool;
+		break;
 	default:
 		msg("Unknown datasink type: %d\n", type);
 		xb_ad(0);
@@ -108,6 +116,88 @@ ds_write(ds_file_t *file, const void *buf, size_t len)
 	return file->datasink->write(file, buf, len);
 }
 
+/************************************************************************
+Write a vector of buffers to a datasink file as if they were concatenated.
+Datasinks that do not implement writev() get one write() per buffer.
+@return 0 on success, 1 on error. */
+int
+ds_writev(ds_file_t *file, const struct iovec *iov, uint iovcnt)
+{
+	uint	i;
+
+	if (file->datasink->writev != NULL) {
+		return file->datasink->writev(file, iov, iovcnt);
+	}
+
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > 0 &&
+		    file->datasink->write(file, iov[i].iov_base,
+					  iov[i].iov_len)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/************************************************************************
+Write the first 'len' bytes of a pooled buffer to a datasink file. One
+reference to the buffer is passed to the datasink.
+@return 0 on success, 1 on error. */
+int
+ds_write_buf(ds_file_t *file, ds_buf_t *buf, size_t len)
+{
+	int	rc;
+
+	xb_ad(len <= buf->size);
+
+	if (file->datasink->write_buf != NULL) {
+		return file->datasink->write_buf(file, buf, len);
+	}
+
+	rc = file->datasink->write(file, buf->data, len);
+
+	ds_buf_unref(buf);
+
+	return rc;
+}
+
+/************************************************************************
+Check if a datasink file supports positional writes with ds_pwrite(). */
+my_bool
+ds_can_pwrite(ds_file_t *file)
+{
+	return file->datasink->pwrite != NULL;
+}
+
+/************************************************************************
+Write to a datasink file at the specified offset. Positional writes do not
+move the current file position and may be issued concurrently from several
+threads.
+@return 0 on success, 1 on error. */
+int
+ds_pwrite(ds_file_t *file, const void *buf, size_t len, my_off_t offset)
+{
+	xb_a(file->datasink->pwrite != NULL);
+
+	return file->datasink->pwrite(file, buf, len, offset);
+}
+
+/************************************************************************
+Copy the first 'len' bytes of an open file to an empty datasink file without
+passing them through a user space buffer, or clone the whole file.
+@return 0 on success, 1 on error, -1 if the data has to be copied with
+ds_write(). */
+int
+ds_copy_fd(ds_file_t *file, File src, my_off_t len, my_bool clone)
+{
+	if (file->datasink->copy_fd == NULL) {
+		return -1;
+	}
+
+	return file->datasink->copy_fd(file, src, len, clone);
+}
+
 /************************************************************************
 Close a datasink file.
 @return 0 on success, 1, on error. */
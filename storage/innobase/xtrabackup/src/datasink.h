@@ -23,6 +23,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #include <my_global.h>
 #include <my_dir.h>
+#include <sys/uio.h>
+#include "ds_buf.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -48,6 +50,12 @@ struct datasink_struct {
 	ds_ctxt_t *(*init)(const char *root);
 	ds_file_t *(*open)(ds_ctxt_t *ctxt, const char *path, MY_STAT *stat);
 	int (*write)(ds_file_t *file, const void *buf, size_t len);
+	int (*writev)(ds_file_t *file, const struct iovec *iov, uint iovcnt);
+	int (*write_buf)(ds_file_t *file, ds_buf_t *buf, size_t len);
+	int (*pwrite)(ds_file_t *file, const void *buf, size_t len,
+		      my_off_t offset);
+	int (*copy_fd)(ds_file_t *file, File src, my_off_t len,
+		       my_bool clone);
 	int (*close)(ds_file_t *file);
 	void (*deinit)(ds_ctxt_t *ctxt);
 };
@@ -61,8 +69,10 @@ typedef enum {
 	DS_TYPE_COMPRESS,
 	DS_TYPE_ENCRYPT,
 	DS_TYPE_DECRYPT,
+	DS_TYPE_DECOMPRESS,
 	DS_TYPE_TMPFILE,
-	DS_TYPE_BUFFER
+	DS_TYPE_BUFFER,
+	DS_TYPE_SPOOL
 } ds_type_t;
 
 /************************************************************************
@@ -78,6 +88,40 @@ Write to a datasink file.
 @return 0 on success, 1 on error. */
 int ds_write(ds_file_t *file, const void *buf, size_t len);
 
+/************************************************************************
+Write a vector of buffers to a datasink file as if they were concatenated.
+Datasinks that do not implement writev() get one write() per buffer.
+@return 0 on success, 1 on error. */
+int ds_writev(ds_file_t *file, const struct iovec *iov, uint iovcnt);
+
+/************************************************************************
+Write the first 'len' bytes of a pooled buffer to a datasink file. One
+reference to the buffer is passed to the datasink, which releases it when it
+no longer needs the data, including on error. Datasinks that do not implement
+write_buf() get a plain write() of the buffer contents.
+@return 0 on success, 1 on error. */
+int ds_write_buf(ds_file_t *file, ds_buf_t *buf, size_t len);
+
+/************************************************************************
+Check if a datasink file supports positional writes with ds_pwrite(). */
+my_bool ds_can_pwrite(ds_file_t *file);
+
+/************************************************************************
+Write to a datasink file at the specified offset. Positional writes do not
+move the current file position and may be issued concurrently from several
+threads.
+@return 0 on success, 1 on error. */
+int ds_pwrite(ds_file_t *file, const void *buf, size_t len, my_off_t offset);
+
+/************************************************************************
+Copy the first 'len' bytes of an open file to an empty datasink file without
+passing them through a user space buffer. Neither file position is changed.
+With 'clone' the whole file is only shared with a reflink, replacing what an
+earlier clone wrote to 'file'.
+@return 0 on success, 1 on error, -1 if the datasink or the file systems
+do not support it and the data has to be copied with ds_write(). */
+int ds_copy_fd(ds_file_t *file, File src, my_off_t len, my_bool clone);
+
 /************************************************************************
 Close a datasink file.
 @return 0 on success, 1, on error. */
@@ -50,6 +50,10 @@ datasink_t datasink_archive = {
 	&archive_init,
 	&archive_open,
 	&archive_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
 	&archive_close,
 	&archive_deinit
 };
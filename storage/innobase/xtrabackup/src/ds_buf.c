@@ -0,0 +1,139 @@
+/******************************************************
+Copyright (c) 2018 Percona LLC and/or its affiliates.
+
+Pooled reference-counted buffers for XtraBackup datasinks.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_global.h>
+#include <my_sys.h>
+#include <pthread.h>
+#include "common.h"
+#include "ds_buf.h"
+
+struct ds_buf_pool_struct {
+	pthread_mutex_t	mutex;
+	size_t		size;
+	size_t		align;
+	ds_buf_t	*free_list;
+	uint		n_allocated;	/* buffers handed out and not yet
+					returned to the free list */
+};
+
+/************************************************************************
+Create a pool of buffers of 'size' bytes with data aligned to 'align' bytes,
+which must be a power of 2. */
+ds_buf_pool_t *
+ds_buf_pool_create(size_t size, size_t align)
+{
+	ds_buf_pool_t	*pool;
+
+	xb_a(align > 0 && (align & (align - 1)) == 0);
+
+	pool = (ds_buf_pool_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					   sizeof(ds_buf_pool_t),
+					   MYF(MY_FAE | MY_ZEROFILL));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pool->size = size;
+	pool->align = align;
+
+	return pool;
+}
+
+/************************************************************************
+Free a pool and all buffers in its free list. All buffers obtained from the
+pool must have been released. */
+void
+ds_buf_pool_destroy(ds_buf_pool_t *pool)
+{
+	ds_buf_t	*buf;
+
+	xb_a(pool->n_allocated == 0);
+
+	while ((buf = pool->free_list) != NULL) {
+		pool->free_list = buf->next;
+		my_free(buf);
+	}
+
+	pthread_mutex_destroy(&pool->mutex);
+	my_free(pool);
+}
+
+/************************************************************************
+Get a buffer from the pool, allocating a new one if the free list is empty.
+@return buffer with a reference count of 1. */
+ds_buf_t *
+ds_buf_get(ds_buf_pool_t *pool)
+{
+	ds_buf_t	*buf;
+
+	pthread_mutex_lock(&pool->mutex);
+	buf = pool->free_list;
+	if (buf != NULL) {
+		pool->free_list = buf->next;
+	}
+	pool->n_allocated++;
+	pthread_mutex_unlock(&pool->mutex);
+
+	if (buf == NULL) {
+		/* The header and the data share one allocation */
+		buf = (ds_buf_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					     sizeof(ds_buf_t) +
+					     pool->size + pool->align,
+					     MYF(MY_FAE));
+		buf->data = (uchar *) MY_ALIGN((size_t) (buf + 1),
+					       pool->align);
+		buf->size = pool->size;
+		buf->pool = pool;
+	}
+
+	buf->ref_count = 1;
+	buf->next = NULL;
+
+	return buf;
+}
+
+/************************************************************************
+Acquire an additional reference to a buffer.
+@return the buffer */
+ds_buf_t *
+ds_buf_ref(ds_buf_t *buf)
+{
+	__sync_add_and_fetch(&buf->ref_count, 1);
+
+	return buf;
+}
+
+/************************************************************************
+Release a reference to a buffer, returning it to the pool when the last
+reference is released. */
+void
+ds_buf_unref(ds_buf_t *buf)
+{
+	ds_buf_pool_t	*pool = buf->pool;
+
+	xb_ad(buf->ref_count > 0);
+
+	if (__sync_sub_and_fetch(&buf->ref_count, 1) > 0) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	buf->next = pool->free_list;
+	pool->free_list = buf;
+	pool->n_allocated--;
+	pthread_mutex_unlock(&pool->mutex);
+}
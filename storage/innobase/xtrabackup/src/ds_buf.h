@@ -0,0 +1,74 @@
+/******************************************************
+Copyright (c) 2018 Percona LLC and/or its affiliates.
+
+Pooled reference-counted buffers for XtraBackup datasinks.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_DS_BUF_H
+#define XB_DS_BUF_H
+
+#include <my_global.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A buffer is owned by whoever holds a reference to it. Passing a buffer
+down the datasink chain with ds_write_buf() transfers one reference, so a
+datasink may keep the data instead of copying it. When the last reference is
+dropped the buffer goes back to the free list of its pool. */
+
+typedef struct ds_buf_pool_struct ds_buf_pool_t;
+
+typedef struct ds_buf_struct {
+	uchar			*data;		/* aligned data pointer */
+	size_t			size;		/* usable size of data */
+	uint			ref_count;
+	ds_buf_pool_t		*pool;
+	struct ds_buf_struct	*next;		/* free list link */
+} ds_buf_t;
+
+/************************************************************************
+Create a pool of buffers of 'size' bytes with data aligned to 'align' bytes,
+which must be a power of 2. */
+ds_buf_pool_t *ds_buf_pool_create(size_t size, size_t align);
+
+/************************************************************************
+Free a pool and all buffers in its free list. All buffers obtained from the
+pool must have been released. */
+void ds_buf_pool_destroy(ds_buf_pool_t *pool);
+
+/************************************************************************
+Get a buffer from the pool, allocating a new one if the free list is empty.
+@return buffer with a reference count of 1. */
+ds_buf_t *ds_buf_get(ds_buf_pool_t *pool);
+
+/************************************************************************
+Acquire an additional reference to a buffer.
+@return the buffer */
+ds_buf_t *ds_buf_ref(ds_buf_t *buf);
+
+/************************************************************************
+Release a reference to a buffer, returning it to the pool when the last
+reference is released. */
+void ds_buf_unref(ds_buf_t *buf);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* XB_DS_BUF_H */
@@ -46,6 +46,9 @@ static ds_ctxt_t *buffer_init(const char *root);
 static ds_file_t *buffer_open(ds_ctxt_t *ctxt, const char *path,
 			      MY_STAT *mystat);
 static int buffer_write(ds_file_t *file, const void *buf, size_t len);
+static int buffer_writev(ds_file_t *file, const struct iovec *iov,
+			 uint iovcnt);
+static int buffer_write_buf(ds_file_t *file, ds_buf_t *buf, size_t len);
 static int buffer_close(ds_file_t *file);
 static void buffer_deinit(ds_ctxt_t *ctxt);
 
@@ -53,6 +56,10 @@ datasink_t datasink_buffer = {
 	&buffer_init,
 	&buffer_open,
 	&buffer_write,
+	&buffer_writev,
+	&buffer_write_buf,
+	NULL,
+	NULL,
 	&buffer_close,
 	&buffer_deinit
 };
@@ -124,43 +131,106 @@ static int
 buffer_write(ds_file_t *file, const void *buf, size_t len)
 {
 	ds_buffer_file_t	*buffer_file;
+	struct iovec		vec[2];
 
 	buffer_file = (ds_buffer_file_t *) file->ptr;
 
-	while (len > 0) {
-		if (buffer_file->pos + len > buffer_file->size) {
-			if (buffer_file->pos > 0) {
-				size_t bytes;
-
-				bytes = buffer_file->size - buffer_file->pos;
-				memcpy(buffer_file->buf + buffer_file->pos, buf,
-				       bytes);
-
-				if (ds_write(buffer_file->dst_file,
-					     buffer_file->buf,
-					     buffer_file->size)) {
-					return 1;
-				}
-
-				buffer_file->pos = 0;
-
-				buf = (const char *) buf + bytes;
-				len -= bytes;
-			} else {
-				/* We don't have any buffered bytes, just write
-				the entire source buffer */
-				if (ds_write(buffer_file->dst_file, buf, len)) {
-					return 1;
-				}
-				break;
+	if (buffer_file->pos + len <= buffer_file->size) {
+		memcpy(buffer_file->buf + buffer_file->pos, buf, len);
+		buffer_file->pos += len;
+		return 0;
+	}
+
+	if (buffer_file->pos == 0) {
+		/* We don't have any buffered bytes, just write the entire
+		source buffer */
+		return ds_write(buffer_file->dst_file, buf, len);
+	}
+
+	/* Write the buffered bytes followed by the source buffer without
+	copying the latter */
+	vec[0].iov_base = buffer_file->buf;
+	vec[0].iov_len = buffer_file->pos;
+	vec[1].iov_base = (void *) buf;
+	vec[1].iov_len = len;
+
+	if (ds_writev(buffer_file->dst_file, vec, 2)) {
+		return 1;
+	}
+
+	buffer_file->pos = 0;
+
+	return 0;
+}
+
+static int
+buffer_write_buf(ds_file_t *file, ds_buf_t *buf, size_t len)
+{
+	ds_buffer_file_t	*buffer_file;
+	int			rc;
+
+	buffer_file = (ds_buffer_file_t *) file->ptr;
+
+	if (buffer_file->pos == 0 && len >= buffer_file->size) {
+		/* Nothing to merge with, hand the buffer over to the
+		destination datasink */
+		return ds_write_buf(buffer_file->dst_file, buf, len);
+	}
+
+	rc = buffer_write(file, buf->data, len);
+
+	ds_buf_unref(buf);
+
+	return rc;
+}
+
+static int
+buffer_writev(ds_file_t *file, const struct iovec *iov, uint iovcnt)
+{
+	ds_buffer_file_t	*buffer_file;
+	struct iovec		vec[XB_IOV_MAX];
+	size_t			len = 0;
+	uint			i;
+
+	buffer_file = (ds_buffer_file_t *) file->ptr;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	if (buffer_file->pos + len <= buffer_file->size) {
+		for (i = 0; i < iovcnt; i++) {
+			memcpy(buffer_file->buf + buffer_file->pos,
+			       iov[i].iov_base, iov[i].iov_len);
+			buffer_file->pos += iov[i].iov_len;
+		}
+		return 0;
+	}
+
+	if (iovcnt >= XB_IOV_MAX) {
+		/* Too many buffers to prepend the buffered data */
+		for (i = 0; i < iovcnt; i++) {
+			if (buffer_write(file, iov[i].iov_base,
+					 iov[i].iov_len)) {
+				return 1;
 			}
-		} else {
-			memcpy(buffer_file->buf + buffer_file->pos, buf, len);
-			buffer_file->pos += len;
-			break;
 		}
+		return 0;
 	}
 
+	/* The buffered data followed by the new buffers is at least as large
+	as the buffer, so pass everything down as a single vector instead of
+	copying it */
+	vec[0].iov_base = buffer_file->buf;
+	vec[0].iov_len = buffer_file->pos;
+	memcpy(vec + 1, iov, iovcnt * sizeof(struct iovec));
+
+	if (ds_writev(buffer_file->dst_file, vec, iovcnt + 1)) {
+		return 1;
+	}
+
+	buffer_file->pos = 0;
+
 	return 0;
 }
 
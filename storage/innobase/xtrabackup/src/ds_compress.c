@@ -24,37 +24,38 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <zlib.h>
 #include "common.h"
 #include "datasink.h"
+#include "executor.h"
 
 #define COMPRESS_CHUNK_SIZE ((size_t) (xtrabackup_compress_chunk_size))
 #define MY_QLZ_COMPRESS_OVERHEAD 400
 
+/* "NEWBNEWB" + 8-byte offset + 4-byte adler32 checksum */
+#define COMPRESS_BLOCK_HEADER_SIZE 20
+
 typedef struct {
-	pthread_t		id;
-	uint			num;
-	pthread_mutex_t 	ctrl_mutex;
-	pthread_cond_t		ctrl_cond;
-	pthread_mutex_t		data_mutex;
-	pthread_cond_t  	data_cond;
-	my_bool			started;
-	my_bool			data_avail;
-	my_bool			cancelled;
 	const char 		*from;
 	size_t			from_len;
+	ds_buf_t		*to_buf;
 	char			*to;
 	size_t			to_len;
 	qlz_state_compress	state;
 	ulong			adler;
-} comp_thread_ctxt_t;
+	uchar			header[COMPRESS_BLOCK_HEADER_SIZE];
+} comp_job_t;
 
 typedef struct {
-	comp_thread_ctxt_t	*threads;
-	uint			nthreads;
+	xb_executor_t		*executor;
+	uint			njobs;
+	ds_buf_pool_t		*buf_pool;	/* output buffers, recycled
+						between files */
 } ds_compress_ctxt_t;
 
 typedef struct {
 	ds_file_t		*dest_file;
 	ds_compress_ctxt_t	*comp_ctxt;
 	size_t			bytes_processed;
+	comp_job_t		*jobs;
+	xb_task_group_t		group;
 } ds_compress_file_t;
 
 /* Compression options */
@@ -73,16 +74,17 @@ datasink_t datasink_compress = {
 	&compress_init,
 	&compress_open,
 	&compress_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
 	&compress_close,
 	&compress_deinit
 };
 
-static inline int write_uint32_le(ds_file_t *file, ulong n);
-static inline int write_uint64_le(ds_file_t *file, ulonglong n);
-
-static comp_thread_ctxt_t *create_worker_threads(uint n);
-static void destroy_worker_threads(comp_thread_ctxt_t *threads, uint n);
-static void *compress_worker_thread_func(void *arg);
+static comp_job_t *create_jobs(uint n, ds_buf_pool_t *buf_pool);
+static void destroy_jobs(comp_job_t *jobs, uint n);
+static void compress_job_func(void *arg);
 
 static
 ds_ctxt_t *
@@ -90,11 +92,11 @@ compress_init(const char *root)
 {
 	ds_ctxt_t		*ctxt;
 	ds_compress_ctxt_t	*compress_ctxt;
-	comp_thread_ctxt_t	*threads;
+	xb_executor_t		*executor;
 
-	/* Create and initialize the worker threads */
-	threads = create_worker_threads(xtrabackup_compress_threads);
-	if (threads == NULL) {
+	/* Compression jobs are run by the shared executor */
+	executor = xb_executor_acquire(xtrabackup_compress_threads);
+	if (executor == NULL) {
 		msg("compress: failed to create worker threads.\n");
 		return NULL;
 	}
@@ -105,8 +107,11 @@ compress_init(const char *root)
 				       MYF(MY_FAE));
 
 	compress_ctxt = (ds_compress_ctxt_t *) (ctxt + 1);
-	compress_ctxt->threads = threads;
-	compress_ctxt->nthreads = xtrabackup_compress_threads;
+	compress_ctxt->executor = executor;
+	compress_ctxt->njobs = xtrabackup_compress_threads;
+	compress_ctxt->buf_pool = ds_buf_pool_create(COMPRESS_CHUNK_SIZE +
+						     MY_QLZ_COMPRESS_OVERHEAD,
+						     sizeof(double));
 
 	ctxt->ptr = compress_ctxt;
 	ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
@@ -123,6 +128,9 @@ compress_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
  	ds_file_t		*dest_file;
 	char			new_name[FN_REFLEN];
 	size_t			name_len;
+	uchar			archive_header[16];
+	uchar			file_header[5];
+	struct iovec		vec[3];
 	ds_file_t		*file;
 	ds_compress_file_t	*comp_file;
 
@@ -139,23 +147,28 @@ compress_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 		return NULL;
 	}
 
-	/* Write the qpress archive header */
-	if (ds_write(dest_file, "qpress10", 8) ||
-	    write_uint64_le(dest_file, COMPRESS_CHUNK_SIZE)) {
-		goto err;
-	}
-
 	/* We are going to create a one-file "flat" (i.e. with no
 	subdirectories) archive. So strip the directory part from the path and
 	remove the '.qp' suffix. */
 	fn_format(new_name, path, "", "", MYF(MY_REPLACE_DIR));
-
-	/* Write the qpress file header */
 	name_len = strlen(new_name);
-	if (ds_write(dest_file, "F", 1) ||
-	    write_uint32_le(dest_file, name_len) ||
-	    /* we want to write the terminating \0 as well */
-	    ds_write(dest_file, new_name, name_len + 1)) {
+
+	/* Write the qpress archive header and the file header at once */
+	memcpy(archive_header, "qpress10", 8);
+	int8store(archive_header + 8, COMPRESS_CHUNK_SIZE);
+
+	file_header[0] = 'F';
+	int4store(file_header + 1, name_len);
+
+	vec[0].iov_base = archive_header;
+	vec[0].iov_len = sizeof(archive_header);
+	vec[1].iov_base = file_header;
+	vec[1].iov_len = sizeof(file_header);
+	/* we want to write the terminating \0 as well */
+	vec[2].iov_base = new_name;
+	vec[2].iov_len = name_len + 1;
+
+	if (ds_writev(dest_file, vec, 3)) {
 		goto err;
 	}
 
@@ -167,6 +180,8 @@ compress_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 	comp_file->dest_file = dest_file;
 	comp_file->comp_ctxt = comp_ctxt;
 	comp_file->bytes_processed = 0;
+	comp_file->jobs = create_jobs(comp_ctxt->njobs, comp_ctxt->buf_pool);
+	xb_task_group_init(&comp_file->group);
 
 	file->ptr = comp_file;
 	file->path = dest_file->path;
@@ -184,83 +199,75 @@ compress_write(ds_file_t *file, const void *buf, size_t len)
 {
 	ds_compress_file_t	*comp_file;
 	ds_compress_ctxt_t	*comp_ctxt;
-	comp_thread_ctxt_t	*threads;
-	comp_thread_ctxt_t	*thd;
-	uint			nthreads;
+	comp_job_t		*jobs;
+	comp_job_t		*job;
+	uint			njobs;
 	uint			i;
 	const char		*ptr;
 	ds_file_t		*dest_file;
+	struct iovec		vec[XB_IOV_MAX];
+	uint			nvec;
 
 	comp_file = (ds_compress_file_t *) file->ptr;
 	comp_ctxt = comp_file->comp_ctxt;
 	dest_file = comp_file->dest_file;
 
-	threads = comp_ctxt->threads;
-	nthreads = comp_ctxt->nthreads;
+	jobs = comp_file->jobs;
 
 	ptr = (const char *) buf;
 	while (len > 0) {
-		uint max_thread;
 
-		/* Send data to worker threads for compression */
-		for (i = 0; i < nthreads; i++) {
+		/* Send data to the executor for compression */
+		for (njobs = 0; njobs < comp_ctxt->njobs && len > 0; njobs++) {
 			size_t chunk_len;
 
-			thd = threads + i;
-
-			pthread_mutex_lock(&thd->ctrl_mutex);
+			job = jobs + njobs;
 
 			chunk_len = (len > COMPRESS_CHUNK_SIZE) ?
 				COMPRESS_CHUNK_SIZE : len;
-			thd->from = ptr;
-			thd->from_len = chunk_len;
+			job->from = ptr;
+			job->from_len = chunk_len;
 
-			pthread_mutex_lock(&thd->data_mutex);
-			thd->data_avail = TRUE;
-			pthread_cond_signal(&thd->data_cond);
-			pthread_mutex_unlock(&thd->data_mutex);
+			xb_executor_submit(comp_ctxt->executor,
+					   &comp_file->group,
+					   compress_job_func, job);
 
 			len -= chunk_len;
-			if (len == 0) {
-				break;
-			}
 			ptr += chunk_len;
 		}
 
-		max_thread = (i < nthreads) ? i :  nthreads - 1;
-
-		/* Reap and stream the compressed data */
-		for (i = 0; i <= max_thread; i++) {
-			thd = threads + i;
-
-			pthread_mutex_lock(&thd->data_mutex);
-			while (thd->data_avail == TRUE) {
-				pthread_cond_wait(&thd->data_cond,
-						  &thd->data_mutex);
-			}
-
-			xb_a(threads[i].to_len > 0);
-
-			if (ds_write(dest_file, "NEWBNEWB", 8) ||
-			    write_uint64_le(dest_file,
-					    comp_file->bytes_processed)) {
-				msg("compress: write to the destination stream "
-				    "failed.\n");
-				return 1;
-			}
-
-			comp_file->bytes_processed += threads[i].from_len;
-
-			if (write_uint32_le(dest_file, threads[i].adler) ||
-			    ds_write(dest_file, threads[i].to,
-					   threads[i].to_len)) {
-				msg("compress: write to the destination stream "
-				    "failed.\n");
-				return 1;
+		xb_task_group_wait(comp_ctxt->executor, &comp_file->group);
+
+		/* Stream the compressed data in the original order, gathering
+		block headers and compressed payloads into as few writes as
+		possible */
+		nvec = 0;
+		for (i = 0; i < njobs; i++) {
+			job = jobs + i;
+
+			xb_a(job->to_len > 0);
+
+			memcpy(job->header, "NEWBNEWB", 8);
+			int8store(job->header + 8, comp_file->bytes_processed);
+			int4store(job->header + 16, job->adler);
+
+			comp_file->bytes_processed += job->from_len;
+
+			vec[nvec].iov_base = job->header;
+			vec[nvec].iov_len = sizeof(job->header);
+			nvec++;
+			vec[nvec].iov_base = job->to;
+			vec[nvec].iov_len = job->to_len;
+			nvec++;
+
+			if (nvec + 2 > XB_IOV_MAX || i + 1 == njobs) {
+				if (ds_writev(dest_file, vec, nvec)) {
+					msg("compress: write to the "
+					    "destination stream failed.\n");
+					return 1;
+				}
+				nvec = 0;
 			}
-
-			pthread_mutex_unlock(&threads[i].data_mutex);
-			pthread_mutex_unlock(&threads[i].ctrl_mutex);
 		}
 	}
 
@@ -273,22 +280,28 @@ compress_close(ds_file_t *file)
 {
 	ds_compress_file_t	*comp_file;
 	ds_file_t		*dest_file;
+	uchar			trailer[16];
 	int			rc;
 
 	comp_file = (ds_compress_file_t *) file->ptr;
 	dest_file = comp_file->dest_file;
 
 	/* Write the qpress file trailer */
-	ds_write(dest_file, "ENDSENDS", 8);
+	memcpy(trailer, "ENDSENDS", 8);
 
 	/* Supposedly the number of written bytes should be written as a
 	"recovery information" in the file trailer, but in reality qpress
 	always writes 8 zeros here. Let's do the same */
 
-	write_uint64_le(dest_file, 0);
+	int8store(trailer + 8, 0);
+
+	ds_write(dest_file, trailer, sizeof(trailer));
 
 	rc = ds_close(dest_file);
 
+	xb_task_group_destroy(&comp_file->group);
+	destroy_jobs(comp_file->jobs, comp_file->comp_ctxt->njobs);
+
 	my_free(file);
 
 	return rc;
@@ -302,165 +315,64 @@ compress_deinit(ds_ctxt_t *ctxt)
 
 	xb_ad(ctxt->pipe_ctxt != NULL);
 
-	comp_ctxt = (ds_compress_ctxt_t *) ctxt->ptr;;
+	comp_ctxt = (ds_compress_ctxt_t *) ctxt->ptr;
 
-	destroy_worker_threads(comp_ctxt->threads, comp_ctxt->nthreads);
+	xb_executor_release(comp_ctxt->executor);
+	ds_buf_pool_destroy(comp_ctxt->buf_pool);
 
 	my_free(ctxt->root);
 	my_free(ctxt);
 }
 
-static inline
-int
-write_uint32_le(ds_file_t *file, ulong n)
-{
-	uchar tmp[4];
-
-	int4store(tmp, n);
-	return ds_write(file, tmp, sizeof(tmp));
-}
-
-static inline
-int
-write_uint64_le(ds_file_t *file, ulonglong n)
-{
-	uchar tmp[8];
-
-	int8store(tmp, n);
-	return ds_write(file, tmp, sizeof(tmp));
-}
-
 static
-comp_thread_ctxt_t *
-create_worker_threads(uint n)
+comp_job_t *
+create_jobs(uint n, ds_buf_pool_t *buf_pool)
 {
-	comp_thread_ctxt_t	*threads;
-	uint 			i;
-
-	threads = (comp_thread_ctxt_t *)
-		my_malloc(PSI_NOT_INSTRUMENTED,
-			  sizeof(comp_thread_ctxt_t) * n, MYF(MY_FAE));
-
-	for (i = 0; i < n; i++) {
-		comp_thread_ctxt_t *thd = threads + i;
-
-		thd->num = i + 1;
-		thd->started = FALSE;
-		thd->cancelled = FALSE;
-		thd->data_avail = FALSE;
-
-		thd->to = (char *) my_malloc(PSI_NOT_INSTRUMENTED,
-						   COMPRESS_CHUNK_SIZE +
-						   MY_QLZ_COMPRESS_OVERHEAD,
-						   MYF(MY_FAE));
-
-		/* Initialize the control mutex and condition var */
-		if (pthread_mutex_init(&thd->ctrl_mutex, NULL) ||
-		    pthread_cond_init(&thd->ctrl_cond, NULL)) {
-			goto err;
-		}
-
-		/* Initialize and data mutex and condition var */
-		if (pthread_mutex_init(&thd->data_mutex, NULL) ||
-		    pthread_cond_init(&thd->data_cond, NULL)) {
-			goto err;
-		}
+	comp_job_t	*jobs;
+	uint 		i;
 
-		pthread_mutex_lock(&thd->ctrl_mutex);
+	jobs = (comp_job_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					sizeof(comp_job_t) * n,
+					MYF(MY_FAE | MY_ZEROFILL));
 
-		if (pthread_create(&thd->id, NULL, compress_worker_thread_func,
-				   thd)) {
-			msg("compress: pthread_create() failed: "
-			    "errno = %d\n", errno);
-			goto err;
-		}
-	}
-
-	/* Wait for the threads to start */
 	for (i = 0; i < n; i++) {
-		comp_thread_ctxt_t *thd = threads + i;
-
-		while (thd->started == FALSE)
-			pthread_cond_wait(&thd->ctrl_cond, &thd->ctrl_mutex);
-		pthread_mutex_unlock(&thd->ctrl_mutex);
+		jobs[i].to_buf = ds_buf_get(buf_pool);
+		jobs[i].to = (char *) jobs[i].to_buf->data;
 	}
 
-	return threads;
-
-err:
-	return NULL;
+	return jobs;
 }
 
 static
 void
-destroy_worker_threads(comp_thread_ctxt_t *threads, uint n)
+destroy_jobs(comp_job_t *jobs, uint n)
 {
 	uint i;
 
 	for (i = 0; i < n; i++) {
-		comp_thread_ctxt_t *thd = threads + i;
-
-		pthread_mutex_lock(&thd->data_mutex);
-		threads[i].cancelled = TRUE;
-		pthread_cond_signal(&thd->data_cond);
-		pthread_mutex_unlock(&thd->data_mutex);
-
-		pthread_join(thd->id, NULL);
-
-		pthread_cond_destroy(&thd->data_cond);
-		pthread_mutex_destroy(&thd->data_mutex);
-		pthread_cond_destroy(&thd->ctrl_cond);
-		pthread_mutex_destroy(&thd->ctrl_mutex);
-
-		my_free(thd->to);
+		ds_buf_unref(jobs[i].to_buf);
 	}
 
-	my_free(threads);
+	my_free(jobs);
 }
 
 static
-void *
-compress_worker_thread_func(void *arg)
+void
+compress_job_func(void *arg)
 {
-	comp_thread_ctxt_t *thd = (comp_thread_ctxt_t *) arg;
-
-	pthread_mutex_lock(&thd->ctrl_mutex);
-
-	pthread_mutex_lock(&thd->data_mutex);
-
-	thd->started = TRUE;
-	pthread_cond_signal(&thd->ctrl_cond);
-
-	pthread_mutex_unlock(&thd->ctrl_mutex);
+	comp_job_t *job = (comp_job_t *) arg;
 
-	while (1) {
-		thd->data_avail = FALSE;
-		pthread_cond_signal(&thd->data_cond);
+	job->to_len = qlz_compress(job->from, job->to, job->from_len,
+				   &job->state);
 
-		while (!thd->data_avail && !thd->cancelled) {
-			pthread_cond_wait(&thd->data_cond, &thd->data_mutex);
-		}
-
-		if (thd->cancelled)
-			break;
-
-		thd->to_len = qlz_compress(thd->from, thd->to, thd->from_len,
-					   &thd->state);
-
-		/* qpress uses 0x00010000 as the initial value, but its own
-		Adler-32 implementation treats the value differently:
-		  1. higher order bits are the sum of all bytes in the sequence
-		  2. lower order bits are the sum of resulting values at every
-		     step.
-		So it's the other way around as compared to zlib's adler32().
-		That's why  0x00000001 is being passed here to be compatible
-		with qpress implementation. */
+	/* qpress uses 0x00010000 as the initial value, but its own
+	Adler-32 implementation treats the value differently:
+	  1. higher order bits are the sum of all bytes in the sequence
+	  2. lower order bits are the sum of resulting values at every
+	     step.
+	So it's the other way around as compared to zlib's adler32().
+	That's why  0x00000001 is being passed here to be compatible
+	with qpress implementation. */
 
-		thd->adler = adler32(0x00000001, (uchar *) thd->to,
-				     thd->to_len);
-	}
-
-	pthread_mutex_unlock(&thd->data_mutex);
-
-	return NULL;
+	job->adler = adler32(0x00000001, (uchar *) job->to, job->to_len);
 }
@@ -0,0 +1,551 @@
+/******************************************************
+Copyright (c) 2018 Percona LLC and/or its affiliates.
+
+Decompressing datasink implementation for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Decodes the single-file qpress archives written by the compress datasink.
+Blocks are decompressed in parallel by the shared executor. If the
+destination datasink supports positional writes, every block is also written
+by the task that decompressed it, otherwise blocks are written in the
+archive order. */
+
+#include <mysql_version.h>
+#include <my_base.h>
+#include <quicklz.h>
+#include <zlib.h>
+#include "common.h"
+#include "datasink.h"
+#include "executor.h"
+#include "ds_decompress.h"
+
+/* "qpress10" + 8-byte chunk size */
+#define DECOMPRESS_ARCHIVE_HEADER_SIZE 16
+/* 'F' + 4-byte name length, followed by the name and '\0' */
+#define DECOMPRESS_FILE_HEADER_SIZE 5
+/* "NEWBNEWB" + 8-byte offset + 4-byte adler32 checksum */
+#define DECOMPRESS_BLOCK_HEADER_SIZE 20
+/* "ENDSENDS" + 8-byte recovery information */
+#define DECOMPRESS_TRAILER_SIZE 16
+
+typedef enum {
+	DECOMPRESS_PARSE_OK,
+	DECOMPRESS_PARSE_INCOMPLETE,
+	DECOMPRESS_PARSE_ERROR
+} decomp_parse_result_t;
+
+typedef enum {
+	DECOMPRESS_STATE_HEADER,
+	DECOMPRESS_STATE_BLOCKS,
+	DECOMPRESS_STATE_END
+} decomp_state_t;
+
+typedef struct {
+	const char		*from;
+	size_t			from_len;
+	char			*to;
+	size_t			to_len;
+	size_t			to_size;
+	my_off_t		offset;		/* offset in the decompressed
+						file */
+	ulong			adler;
+	ds_file_t		*dest_file;	/* set for positional writes */
+	my_bool			failed;
+	my_bool			write_failed;
+	qlz_state_decompress	state;
+} decomp_job_t;
+
+typedef struct {
+	xb_executor_t		*executor;
+	uint			njobs;
+} ds_decompress_ctxt_t;
+
+typedef struct {
+	ds_file_t		*dest_file;
+	ds_decompress_ctxt_t	*decomp_ctxt;
+	my_bool			positional;
+	decomp_state_t		state;
+	my_off_t		offset;		/* decompressed bytes */
+	ulonglong		in_offset;	/* parsed bytes */
+	char			*buf;		/* incomplete element */
+	size_t			buf_len;
+	size_t			buf_size;
+	decomp_job_t		*jobs;
+	xb_task_group_t		group;
+} ds_decompress_file_t;
+
+/* Decompression options */
+uint		ds_decompress_threads = 1;
+
+static ds_ctxt_t *decompress_init(const char *root);
+static ds_file_t *decompress_open(ds_ctxt_t *ctxt, const char *path,
+				  MY_STAT *mystat);
+static int decompress_write(ds_file_t *file, const void *buf, size_t len);
+static int decompress_close(ds_file_t *file);
+static void decompress_deinit(ds_ctxt_t *ctxt);
+
+datasink_t datasink_decompress = {
+	&decompress_init,
+	&decompress_open,
+	&decompress_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	&decompress_close,
+	&decompress_deinit
+};
+
+static void decompress_job_func(void *arg);
+
+static
+ds_ctxt_t *
+decompress_init(const char *root)
+{
+	ds_ctxt_t		*ctxt;
+	ds_decompress_ctxt_t	*decomp_ctxt;
+	xb_executor_t		*executor;
+
+	/* Decompression jobs are run by the shared executor */
+	executor = xb_executor_acquire(ds_decompress_threads);
+	if (executor == NULL) {
+		msg("decompress: failed to create worker threads.\n");
+		return NULL;
+	}
+
+	ctxt = (ds_ctxt_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+				       sizeof(ds_ctxt_t) +
+				       sizeof(ds_decompress_ctxt_t),
+				       MYF(MY_FAE));
+
+	decomp_ctxt = (ds_decompress_ctxt_t *) (ctxt + 1);
+	decomp_ctxt->executor = executor;
+	decomp_ctxt->njobs = ds_decompress_threads;
+
+	ctxt->ptr = decomp_ctxt;
+	ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+
+	return ctxt;
+}
+
+static
+ds_file_t *
+decompress_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
+{
+	ds_decompress_ctxt_t	*decomp_ctxt;
+	ds_decompress_file_t	*decomp_file;
+	ds_ctxt_t		*dest_ctxt;
+	ds_file_t		*dest_file;
+	ds_file_t		*file;
+	char			new_name[FN_REFLEN];
+	size_t			path_len;
+
+	xb_ad(ctxt->pipe_ctxt != NULL);
+	dest_ctxt = ctxt->pipe_ctxt;
+
+	decomp_ctxt = (ds_decompress_ctxt_t *) ctxt->ptr;
+
+	/* Remove the .qp extension from the filename */
+	path_len = strlen(path);
+	if (path_len > 3 && path_len < sizeof(new_name) &&
+	    !strcmp(path + path_len - 3, ".qp")) {
+		memcpy(new_name, path, path_len - 3);
+		new_name[path_len - 3] = 0;
+		path = new_name;
+	}
+
+	dest_file = ds_open(dest_ctxt, path, mystat);
+	if (dest_file == NULL) {
+		msg("decompress: ds_open(\"%s\") failed.\n", path);
+		return NULL;
+	}
+
+	file = (ds_file_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+				       sizeof(ds_file_t) +
+				       sizeof(ds_decompress_file_t),
+				       MYF(MY_FAE | MY_ZEROFILL));
+	decomp_file = (ds_decompress_file_t *) (file + 1);
+	decomp_file->dest_file = dest_file;
+	decomp_file->decomp_ctxt = decomp_ctxt;
+	decomp_file->positional = ds_can_pwrite(dest_file);
+	decomp_file->state = DECOMPRESS_STATE_HEADER;
+	decomp_file->jobs = (decomp_job_t *)
+		my_malloc(PSI_NOT_INSTRUMENTED,
+			  sizeof(decomp_job_t) * decomp_ctxt->njobs,
+			  MYF(MY_FAE | MY_ZEROFILL));
+	xb_task_group_init(&decomp_file->group);
+
+	file->ptr = decomp_file;
+	file->path = dest_file->path;
+
+	return file;
+}
+
+/************************************************************************
+Parse the next element of the archive: the archive and file headers, a
+compressed block or the trailer. Blocks are described in 'job'.
+@return DECOMPRESS_PARSE_OK with the element length in 'needed',
+DECOMPRESS_PARSE_INCOMPLETE with the number of bytes required to make
+progress in 'needed', or DECOMPRESS_PARSE_ERROR. */
+static
+decomp_parse_result_t
+decompress_parse(ds_decompress_file_t *decomp_file, const char *ptr,
+		 size_t len, size_t *needed, decomp_job_t *job)
+{
+	size_t	name_len;
+	size_t	hdr_len;
+
+	switch (decomp_file->state) {
+	case DECOMPRESS_STATE_HEADER:
+		*needed = DECOMPRESS_ARCHIVE_HEADER_SIZE +
+			DECOMPRESS_FILE_HEADER_SIZE;
+		if (len < *needed) {
+			return(DECOMPRESS_PARSE_INCOMPLETE);
+		}
+		if (memcmp(ptr, "qpress10", 8)) {
+			msg("decompress: wrong archive magic in '%s'.\n",
+			    decomp_file->dest_file->path);
+			return(DECOMPRESS_PARSE_ERROR);
+		}
+		if (ptr[DECOMPRESS_ARCHIVE_HEADER_SIZE] != 'F') {
+			msg("decompress: '%s' is not a single file "
+			    "archive.\n", decomp_file->dest_file->path);
+			return(DECOMPRESS_PARSE_ERROR);
+		}
+		name_len = uint4korr(ptr + DECOMPRESS_ARCHIVE_HEADER_SIZE + 1);
+		if (name_len >= FN_REFLEN) {
+			msg("decompress: invalid file name length in "
+			    "'%s'.\n", decomp_file->dest_file->path);
+			return(DECOMPRESS_PARSE_ERROR);
+		}
+		/* The name is followed by '\0' */
+		*needed += name_len + 1;
+		if (len < *needed) {
+			return(DECOMPRESS_PARSE_INCOMPLETE);
+		}
+		decomp_file->state = DECOMPRESS_STATE_BLOCKS;
+		return(DECOMPRESS_PARSE_OK);
+
+	case DECOMPRESS_STATE_BLOCKS:
+		*needed = 8;
+		if (len < *needed) {
+			return(DECOMPRESS_PARSE_INCOMPLETE);
+		}
+		if (!memcmp(ptr, "ENDSENDS", 8)) {
+			*needed = DECOMPRESS_TRAILER_SIZE;
+			if (len < *needed) {
+				return(DECOMPRESS_PARSE_INCOMPLETE);
+			}
+			decomp_file->state = DECOMPRESS_STATE_END;
+			return(DECOMPRESS_PARSE_OK);
+		}
+		if (memcmp(ptr, "NEWBNEWB", 8)) {
+			msg("decompress: wrong block magic at offset 0x%llx "
+			    "in '%s'.\n", decomp_file->in_offset,
+			    decomp_file->dest_file->path);
+			return(DECOMPRESS_PARSE_ERROR);
+		}
+
+		/* The first byte of the QuickLZ header tells its length,
+		which is then needed to get the compressed length */
+		*needed = DECOMPRESS_BLOCK_HEADER_SIZE + 1;
+		if (len < *needed) {
+			return(DECOMPRESS_PARSE_INCOMPLETE);
+		}
+		hdr_len = qlz_size_header(ptr + DECOMPRESS_BLOCK_HEADER_SIZE);
+		*needed = DECOMPRESS_BLOCK_HEADER_SIZE + hdr_len;
+		if (len < *needed) {
+			return(DECOMPRESS_PARSE_INCOMPLETE);
+		}
+
+		job->from = ptr + DECOMPRESS_BLOCK_HEADER_SIZE;
+		job->from_len = qlz_size_compressed(job->from);
+		job->to_len = qlz_size_decompressed(job->from);
+		if (job->from_len <= hdr_len || job->to_len == 0 ||
+		    job->to_len > INT_MAX) {
+			msg("decompress: invalid block header at offset 0x%llx "
+			    "in '%s'.\n", decomp_file->in_offset,
+			    decomp_file->dest_file->path);
+			return(DECOMPRESS_PARSE_ERROR);
+		}
+
+		*needed = DECOMPRESS_BLOCK_HEADER_SIZE + job->from_len;
+		if (len < *needed) {
+			return(DECOMPRESS_PARSE_INCOMPLETE);
+		}
+
+		job->adler = uint4korr(ptr + 16);
+		job->offset = decomp_file->offset;
+		job->dest_file = decomp_file->positional ?
+			decomp_file->dest_file : NULL;
+		if (job->to_size < job->to_len) {
+			job->to = (char *) my_realloc(PSI_NOT_INSTRUMENTED,
+						      job->to, job->to_len,
+						      MYF(MY_FAE |
+							  MY_ALLOW_ZERO_PTR));
+			job->to_size = job->to_len;
+		}
+
+		decomp_file->offset += job->to_len;
+		return(DECOMPRESS_PARSE_OK);
+
+	case DECOMPRESS_STATE_END:
+		msg("decompress: unexpected data after the end of '%s'.\n",
+		    decomp_file->dest_file->path);
+		return(DECOMPRESS_PARSE_ERROR);
+	}
+
+	return(DECOMPRESS_PARSE_ERROR);
+}
+
+/************************************************************************
+Wait for the submitted blocks and write them unless the tasks have already
+done it.
+@return 0 on success, 1 on error. */
+static
+int
+decompress_reap(ds_decompress_file_t *decomp_file, uint njobs)
+{
+	decomp_job_t	*job;
+	uint		i;
+	int		rc = 0;
+
+	xb_task_group_wait(decomp_file->decomp_ctxt->executor,
+			   &decomp_file->group);
+
+	/* Write decompressed data in the original order */
+	for (i = 0; i < njobs && rc == 0; i++) {
+		job = decomp_file->jobs + i;
+
+		if (job->failed) {
+			msg("decompress: failed to decompress the block at "
+			    "offset 0x%llx in '%s'.\n",
+			    (ulonglong) job->offset,
+			    decomp_file->dest_file->path);
+			rc = 1;
+		} else if (job->write_failed ||
+			   (!decomp_file->positional &&
+			    ds_write(decomp_file->dest_file, job->to,
+				     job->to_len))) {
+			msg("decompress: write to destination failed.\n");
+			rc = 1;
+		}
+	}
+
+	return rc;
+}
+
+static
+int
+decompress_write(ds_file_t *file, const void *buf, size_t len)
+{
+	ds_decompress_file_t	*decomp_file;
+	ds_decompress_ctxt_t	*decomp_ctxt;
+	decomp_job_t		*job;
+	decomp_parse_result_t	parse_result = DECOMPRESS_PARSE_OK;
+	const char		*ptr;
+	size_t			needed;
+	size_t			n;
+	uint			njobs = 0;
+
+	decomp_file = (ds_decompress_file_t *) file->ptr;
+	decomp_ctxt = decomp_file->decomp_ctxt;
+
+	ptr = (const char *) buf;
+
+	/* Complete the element left incomplete by the previous write. Only
+	the bytes that are needed are copied, the rest is parsed in place. */
+	while (decomp_file->buf_len > 0) {
+		my_bool	is_block;
+
+		job = decomp_file->jobs;
+
+		is_block = decomp_file->state == DECOMPRESS_STATE_BLOCKS;
+
+		parse_result = decompress_parse(decomp_file, decomp_file->buf,
+						decomp_file->buf_len,
+						&needed, job);
+		if (parse_result == DECOMPRESS_PARSE_ERROR) {
+			return 1;
+		}
+
+		if (parse_result == DECOMPRESS_PARSE_OK) {
+			xb_ad(needed == decomp_file->buf_len);
+			decomp_file->in_offset += needed;
+			decomp_file->buf_len = 0;
+			/* The block still refers to the buffer, which is not
+			modified until the block is reaped below */
+			if (is_block &&
+			    decomp_file->state == DECOMPRESS_STATE_BLOCKS) {
+				xb_executor_submit(decomp_ctxt->executor,
+						   &decomp_file->group,
+						   decompress_job_func, job);
+				njobs++;
+			}
+			break;
+		}
+
+		if (len == 0) {
+			return 0;
+		}
+
+		n = MY_MIN(needed - decomp_file->buf_len, len);
+		if (decomp_file->buf_size < decomp_file->buf_len + n) {
+			decomp_file->buf_size = decomp_file->buf_len + n;
+			decomp_file->buf = (char *) my_realloc(
+				PSI_NOT_INSTRUMENTED, decomp_file->buf,
+				decomp_file->buf_size,
+				MYF(MY_FAE | MY_ALLOW_ZERO_PTR));
+		}
+		memcpy(decomp_file->buf + decomp_file->buf_len, ptr, n);
+		decomp_file->buf_len += n;
+		ptr += n;
+		len -= n;
+	}
+
+	while (1) {
+
+		/* Send a batch of blocks to the executor */
+		while (len > 0 && njobs < decomp_ctxt->njobs) {
+			my_bool	is_block;
+
+			job = decomp_file->jobs + njobs;
+
+			is_block = decomp_file->state ==
+				DECOMPRESS_STATE_BLOCKS;
+
+			parse_result = decompress_parse(decomp_file, ptr, len,
+							&needed, job);
+			if (parse_result != DECOMPRESS_PARSE_OK) {
+				break;
+			}
+
+			if (is_block &&
+			    decomp_file->state == DECOMPRESS_STATE_BLOCKS) {
+				xb_executor_submit(decomp_ctxt->executor,
+						   &decomp_file->group,
+						   decompress_job_func, job);
+				njobs++;
+			}
+
+			decomp_file->in_offset += needed;
+			ptr += needed;
+			len -= needed;
+		}
+
+		if (decompress_reap(decomp_file, njobs)) {
+			return 1;
+		}
+		njobs = 0;
+
+		if (parse_result == DECOMPRESS_PARSE_ERROR) {
+			return 1;
+		}
+
+		if (len == 0 || parse_result == DECOMPRESS_PARSE_INCOMPLETE) {
+			break;
+		}
+	}
+
+	/* Keep the incomplete element until the next write */
+	if (len > 0) {
+		if (decomp_file->buf_size < len) {
+			decomp_file->buf_size = len;
+			decomp_file->buf = (char *) my_realloc(
+				PSI_NOT_INSTRUMENTED, decomp_file->buf,
+				decomp_file->buf_size,
+				MYF(MY_FAE | MY_ALLOW_ZERO_PTR));
+		}
+		memcpy(decomp_file->buf, ptr, len);
+		decomp_file->buf_len = len;
+	}
+
+	return 0;
+}
+
+static
+int
+decompress_close(ds_file_t *file)
+{
+	ds_decompress_file_t	*decomp_file;
+	uint			i;
+	int			rc = 0;
+
+	decomp_file = (ds_decompress_file_t *) file->ptr;
+
+	if (decomp_file->state != DECOMPRESS_STATE_END ||
+	    decomp_file->buf_len > 0) {
+		msg("decompress: incomplete compressed file '%s'.\n",
+		    decomp_file->dest_file->path);
+		rc = 1;
+	}
+
+	if (ds_close(decomp_file->dest_file)) {
+		rc = 1;
+	}
+
+	for (i = 0; i < decomp_file->decomp_ctxt->njobs; i++) {
+		my_free(decomp_file->jobs[i].to);
+	}
+	my_free(decomp_file->jobs);
+	my_free(decomp_file->buf);
+
+	xb_task_group_destroy(&decomp_file->group);
+
+	my_free(file);
+
+	return rc;
+}
+
+static
+void
+decompress_deinit(ds_ctxt_t *ctxt)
+{
+	ds_decompress_ctxt_t	*decomp_ctxt;
+
+	xb_ad(ctxt->pipe_ctxt != NULL);
+
+	decomp_ctxt = (ds_decompress_ctxt_t *) ctxt->ptr;
+
+	xb_executor_release(decomp_ctxt->executor);
+
+	my_free(ctxt->root);
+	my_free(ctxt);
+}
+
+static
+void
+decompress_job_func(void *arg)
+{
+	decomp_job_t *job = (decomp_job_t *) arg;
+
+	job->failed = FALSE;
+	job->write_failed = FALSE;
+
+	/* See compress_job_func() for the initial value */
+	if (adler32(0x00000001, (const uchar *) job->from, job->from_len) !=
+	    job->adler ||
+	    qlz_decompress(job->from, job->to, &job->state) != job->to_len) {
+		job->failed = TRUE;
+		return;
+	}
+
+	if (job->dest_file != NULL &&
+	    ds_pwrite(job->dest_file, job->to, job->to_len, job->offset)) {
+		job->write_failed = TRUE;
+	}
+}
@@ -22,20 +22,12 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <my_base.h>
 #include "common.h"
 #include "datasink.h"
+#include "executor.h"
 #include "xbcrypt.h"
 #include "xbcrypt_common.h"
 #include "crc_glue.h"
 
 typedef struct {
-	pthread_t		id;
-	uint			num;
-	pthread_mutex_t 	ctrl_mutex;
-	pthread_cond_t		ctrl_cond;
-	pthread_mutex_t		data_mutex;
-	pthread_cond_t  	data_cond;
-	my_bool			started;
-	my_bool			data_avail;
-	my_bool			cancelled;
 	my_bool			failed;
 	const uchar 		*from;
 	size_t			from_len;
@@ -48,11 +40,11 @@ typedef struct {
 	my_bool			hash_appended;
 	gcry_cipher_hd_t	cipher_handle;
 	xb_rcrypt_result_t	parse_result;
-} crypt_thread_ctxt_t;
+} crypt_job_t;
 
 typedef struct {
-	crypt_thread_ctxt_t	*threads;
-	uint			nthreads;
+	xb_executor_t		*executor;
+	uint			njobs;
 	int			encrypt_algo;
 	size_t			chunk_size;
 } ds_decrypt_ctxt_t;
@@ -64,6 +56,8 @@ typedef struct {
 	uchar			*buf;
 	size_t			buf_len;
 	size_t			buf_size;
+	crypt_job_t		*jobs;
+	xb_task_group_t		group;
 } ds_decrypt_file_t;
 
 uint		ds_decrypt_encrypt_threads = 1;
@@ -80,13 +74,17 @@ datasink_t datasink_decrypt = {
 	&decrypt_init,
 	&decrypt_open,
 	&decrypt_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
 	&decrypt_close,
 	&decrypt_deinit
 };
 
-static crypt_thread_ctxt_t *create_worker_threads(uint n);
-static void destroy_worker_threads(crypt_thread_ctxt_t *threads, uint n);
-static void *decrypt_worker_thread_func(void *arg);
+static crypt_job_t *create_jobs(uint n);
+static void destroy_jobs(crypt_job_t *jobs, uint n);
+static void decrypt_job_func(void *arg);
 
 static
 ds_ctxt_t *
@@ -94,15 +92,15 @@ decrypt_init(const char *root)
 {
 	ds_ctxt_t		*ctxt;
 	ds_decrypt_ctxt_t	*decrypt_ctxt;
-	crypt_thread_ctxt_t	*threads;
+	xb_executor_t		*executor;
 
 	if (xb_crypt_init(NULL)) {
 		return NULL;
 	}
 
-	/* Create and initialize the worker threads */
-	threads = create_worker_threads(ds_decrypt_encrypt_threads);
-	if (threads == NULL) {
+	/* Decryption jobs are run by the shared executor */
+	executor = xb_executor_acquire(ds_decrypt_encrypt_threads);
+	if (executor == NULL) {
 		msg("decrypt: failed to create worker threads.\n");
 		return NULL;
 	}
@@ -113,8 +111,8 @@ decrypt_init(const char *root)
 				       MYF(MY_FAE));
 
 	decrypt_ctxt = (ds_decrypt_ctxt_t *) (ctxt + 1);
-	decrypt_ctxt->threads = threads;
-	decrypt_ctxt->nthreads = ds_decrypt_encrypt_threads;
+	decrypt_ctxt->executor = executor;
+	decrypt_ctxt->njobs = ds_decrypt_encrypt_threads;
 
 	ctxt->ptr = decrypt_ctxt;
 	ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
@@ -176,6 +174,12 @@ decrypt_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 	crypt_file->buf = NULL;
 	crypt_file->buf_size = 0;
 	crypt_file->buf_len = 0;
+	crypt_file->jobs = create_jobs(crypt_ctxt->njobs);
+	if (crypt_file->jobs == NULL) {
+		msg("decrypt: failed to initialize ciphers.\n");
+		goto err;
+	}
+	xb_task_group_init(&crypt_file->group);
 
 	file->ptr = crypt_file;
 	file->path = crypt_file->dest_file->path;
@@ -198,7 +202,7 @@ err:
 
 static
 xb_rcrypt_result_t
-parse_xbcrypt_chunk(crypt_thread_ctxt_t *thd, const uchar *buf, size_t len,
+parse_xbcrypt_chunk(crypt_job_t *thd, const uchar *buf, size_t len,
 		    size_t *bytes_processed)
 {
 	const uchar *ptr;
@@ -341,9 +345,9 @@ decrypt_write(ds_file_t *file, const void *buf, size_t len)
 {
 	ds_decrypt_file_t	*crypt_file;
 	ds_decrypt_ctxt_t	*crypt_ctxt;
-	crypt_thread_ctxt_t	*threads;
-	crypt_thread_ctxt_t	*thd;
-	uint			nthreads;
+	crypt_job_t		*jobs;
+	crypt_job_t		*job;
+	uint			njobs;
 	uint			i;
 	size_t			bytes_processed;
 	xb_rcrypt_result_t	parse_result = XB_CRYPT_READ_CHUNK;
@@ -352,15 +356,13 @@ decrypt_write(ds_file_t *file, const void *buf, size_t len)
 	crypt_file = (ds_decrypt_file_t *) file->ptr;
 	crypt_ctxt = crypt_file->crypt_ctxt;
 
-	threads = crypt_ctxt->threads;
-	nthreads = crypt_ctxt->nthreads;
+	jobs = crypt_file->jobs;
 
 	if (crypt_file->buf_len > 0) {
 		const size_t remainder = crypt_file->buf_len;
 		size_t new_data_size = 0;
-		thd = threads;
+		job = jobs;
 
-		pthread_mutex_lock(&thd->ctrl_mutex);
 		do {
 			if (parse_result == XB_CRYPT_READ_INCOMPLETE
 			    || crypt_file->buf_size == remainder) {
@@ -379,12 +381,11 @@ decrypt_write(ds_file_t *file, const void *buf, size_t len)
 			       new_data_size);
 
 			parse_result = parse_xbcrypt_chunk(
-				thd, crypt_file->buf,
+				job, crypt_file->buf,
 				remainder + new_data_size,
 				&bytes_processed);
 
 			if (parse_result == XB_CRYPT_READ_ERROR) {
-				pthread_mutex_unlock(&thd->ctrl_mutex);
 				return 1;
 			}
 
@@ -396,20 +397,16 @@ decrypt_write(ds_file_t *file, const void *buf, size_t len)
 		invocations, closing a file will report an error if there is
 		still some buffered data left unprocessed. */
 		if (parse_result == XB_CRYPT_READ_INCOMPLETE) {
-			pthread_mutex_unlock(&thd->ctrl_mutex);
 			return 0;
 		}
 
 		if (parse_result != XB_CRYPT_READ_CHUNK) {
 			msg("decrypt: failed to decrypt.\n");
-			pthread_mutex_unlock(&thd->ctrl_mutex);
 			return 1;
 		}
 
-		pthread_mutex_lock(&thd->data_mutex);
-		thd->data_avail = TRUE;
-		pthread_cond_signal(&thd->data_cond);
-		pthread_mutex_unlock(&thd->data_mutex);
+		xb_executor_submit(crypt_ctxt->executor, &crypt_file->group,
+				   decrypt_job_func, job);
 
 		xb_ad(bytes_processed > remainder);
 		len -= bytes_processed - remainder;
@@ -417,29 +414,22 @@ decrypt_write(ds_file_t *file, const void *buf, size_t len)
 
 		/* reap */
 
-		pthread_mutex_lock(&thd->data_mutex);
-		while (thd->data_avail == TRUE) {
-			pthread_cond_wait(&thd->data_cond,
-					  &thd->data_mutex);
-		}
+		xb_task_group_wait(crypt_ctxt->executor, &crypt_file->group);
 
-		if (thd->failed) {
+		if (job->failed) {
 			msg("decrypt: failed to decrypt chunk.\n");
 			err = TRUE;
 		}
 
-		xb_a(thd->to_len > 0);
+		xb_a(job->to_len > 0);
 
 		if (!err &&
-		    ds_write(crypt_file->dest_file, thd->to, thd->to_len)) {
+		    ds_write(crypt_file->dest_file, job->to, job->to_len)) {
 			msg("decrypt: write to destination failed.\n");
 			err = TRUE;
 		}
 
-		crypt_file->bytes_processed += thd->from_len;
-
-		pthread_mutex_unlock(&thd->data_mutex);
-		pthread_mutex_unlock(&thd->ctrl_mutex);
+		crypt_file->bytes_processed += job->from_len;
 
 		crypt_file->buf_len = 0;
 
@@ -449,71 +439,52 @@ decrypt_write(ds_file_t *file, const void *buf, size_t len)
 	}
 
 	while (parse_result == XB_CRYPT_READ_CHUNK && len > 0) {
-		uint max_thread;
-
-		for (i = 0; i < nthreads; i++) {
-			thd = threads + i;
 
-			pthread_mutex_lock(&thd->ctrl_mutex);
+		for (njobs = 0; njobs < crypt_ctxt->njobs; njobs++) {
+			job = jobs + njobs;
 
 			parse_result = parse_xbcrypt_chunk(
-				thd, buf, len, &bytes_processed);
+				job, buf, len, &bytes_processed);
 
 			if (parse_result == XB_CRYPT_READ_ERROR) {
-				pthread_mutex_unlock(&thd->ctrl_mutex);
 				err = TRUE;
 				break;
 			}
 
-			thd->parse_result = parse_result;
+			job->parse_result = parse_result;
 
 			if (parse_result != XB_CRYPT_READ_CHUNK) {
-				pthread_mutex_unlock(&thd->ctrl_mutex);
 				break;
 			}
 
-			pthread_mutex_lock(&thd->data_mutex);
-			thd->data_avail = TRUE;
-			pthread_cond_signal(&thd->data_cond);
-			pthread_mutex_unlock(&thd->data_mutex);
+			xb_executor_submit(crypt_ctxt->executor,
+					   &crypt_file->group,
+					   decrypt_job_func, job);
 
 			len -= bytes_processed;
 			buf += bytes_processed;
 		}
 
-		max_thread = (i < nthreads) ? i :  nthreads - 1;
-
-		/* Reap and write decrypted data */
-		for (i = 0; i <= max_thread; i++) {
-			thd = threads + i;
+		xb_task_group_wait(crypt_ctxt->executor, &crypt_file->group);
 
-			if (thd->parse_result != XB_CRYPT_READ_CHUNK) {
-				break;
-			}
-
-			pthread_mutex_lock(&thd->data_mutex);
-			while (thd->data_avail == TRUE) {
-				pthread_cond_wait(&thd->data_cond,
-						  &thd->data_mutex);
-			}
+		/* Write decrypted data in the original order */
+		for (i = 0; i < njobs; i++) {
+			job = jobs + i;
 
-			if (thd->failed) {
+			if (job->failed) {
 				msg("decrypt: failed to decrypt chunk.\n");
 				err = TRUE;
 			}
 
-			xb_a(thd->to_len > 0);
+			xb_a(job->to_len > 0);
 
-			if (!err && ds_write(crypt_file->dest_file, thd->to,
-				     thd->to_len)) {
+			if (!err && ds_write(crypt_file->dest_file, job->to,
+				     job->to_len)) {
 				msg("decrypt: write to destination failed.\n");
 				err = TRUE;
 			}
 
-			crypt_file->bytes_processed += thd->from_len;
-
-			pthread_mutex_unlock(&thd->data_mutex);
-			pthread_mutex_unlock(&thd->ctrl_mutex);
+			crypt_file->bytes_processed += job->from_len;
 		}
 
 		if (err) {
@@ -560,6 +531,9 @@ decrypt_close(ds_file_t *file)
 		rc = 1;
 	}
 
+	xb_task_group_destroy(&crypt_file->group);
+	destroy_jobs(crypt_file->jobs, crypt_file->crypt_ctxt->njobs);
+
 	my_free(crypt_file->buf);
 	my_free(file);
 
@@ -576,136 +550,60 @@ decrypt_deinit(ds_ctxt_t *ctxt)
 
 	crypt_ctxt = (ds_decrypt_ctxt_t *) ctxt->ptr;
 
-	destroy_worker_threads(crypt_ctxt->threads, crypt_ctxt->nthreads);
+	xb_executor_release(crypt_ctxt->executor);
 
 	my_free(ctxt->root);
 	my_free(ctxt);
 }
 
 static
-crypt_thread_ctxt_t *
-create_worker_threads(uint n)
+crypt_job_t *
+create_jobs(uint n)
 {
-	crypt_thread_ctxt_t	*threads;
-	uint 			i;
+	crypt_job_t	*jobs;
+	uint 		i;
 
-	threads = (crypt_thread_ctxt_t *)
-		my_malloc(PSI_NOT_INSTRUMENTED,
-			  sizeof(crypt_thread_ctxt_t) * n,
-			  MYF(MY_FAE | MY_ZEROFILL));
+	jobs = (crypt_job_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					 sizeof(crypt_job_t) * n,
+					 MYF(MY_FAE | MY_ZEROFILL));
 
 	for (i = 0; i < n; i++) {
-		crypt_thread_ctxt_t *thd = threads + i;
-
-		thd->num = i + 1;
-
-		/* Initialize the control mutex and condition var */
-		if (pthread_mutex_init(&thd->ctrl_mutex, NULL) ||
-		    pthread_cond_init(&thd->ctrl_cond, NULL)) {
-			goto err;
-		}
-
-		/* Initialize and data mutex and condition var */
-		if (pthread_mutex_init(&thd->data_mutex, NULL) ||
-		    pthread_cond_init(&thd->data_cond, NULL)) {
-			goto err;
-		}
-
-		if (xb_crypt_cipher_open(&thd->cipher_handle)) {
-			goto err;
-		}
-
-		pthread_mutex_lock(&thd->ctrl_mutex);
-
-		if (pthread_create(&thd->id, NULL, decrypt_worker_thread_func,
-				   thd)) {
-			msg("decrypt: pthread_create() failed: "
-			    "errno = %d\n", errno);
-			goto err;
+		if (xb_crypt_cipher_open(&jobs[i].cipher_handle)) {
+			destroy_jobs(jobs, i);
+			return NULL;
 		}
 	}
 
-	/* Wait for the threads to start */
-	for (i = 0; i < n; i++) {
-		crypt_thread_ctxt_t *thd = threads + i;
-
-		while (thd->started == FALSE)
-			pthread_cond_wait(&thd->ctrl_cond, &thd->ctrl_mutex);
-		pthread_mutex_unlock(&thd->ctrl_mutex);
-	}
-
-	return threads;
-
-err:
-	return NULL;
+	return jobs;
 }
 
 static
 void
-destroy_worker_threads(crypt_thread_ctxt_t *threads, uint n)
+destroy_jobs(crypt_job_t *jobs, uint n)
 {
 	uint i;
 
 	for (i = 0; i < n; i++) {
-		crypt_thread_ctxt_t *thd = threads + i;
-
-		pthread_mutex_lock(&thd->data_mutex);
-		threads[i].cancelled = TRUE;
-		pthread_cond_signal(&thd->data_cond);
-		pthread_mutex_unlock(&thd->data_mutex);
+		crypt_job_t *job = jobs + i;
 
-		pthread_join(thd->id, NULL);
+		xb_crypt_cipher_close(job->cipher_handle);
 
-		pthread_cond_destroy(&thd->data_cond);
-		pthread_mutex_destroy(&thd->data_mutex);
-		pthread_cond_destroy(&thd->ctrl_cond);
-		pthread_mutex_destroy(&thd->ctrl_mutex);
-
-		xb_crypt_cipher_close(thd->cipher_handle);
-
-		my_free(thd->to);
+		my_free(job->to);
 	}
 
-	my_free(threads);
+	my_free(jobs);
 }
 
 static
-void *
-decrypt_worker_thread_func(void *arg)
+void
+decrypt_job_func(void *arg)
 {
-	crypt_thread_ctxt_t *thd = (crypt_thread_ctxt_t *) arg;
-
-	pthread_mutex_lock(&thd->ctrl_mutex);
-
-	pthread_mutex_lock(&thd->data_mutex);
-
-	thd->started = TRUE;
-	pthread_cond_signal(&thd->ctrl_cond);
-
-	pthread_mutex_unlock(&thd->ctrl_mutex);
-
-	while (1) {
-		thd->data_avail = FALSE;
-		pthread_cond_signal(&thd->data_cond);
-
-		while (!thd->data_avail && !thd->cancelled) {
-			pthread_cond_wait(&thd->data_cond, &thd->data_mutex);
-		}
-
-		if (thd->cancelled)
-			break;
-
-		if (xb_crypt_decrypt(thd->cipher_handle, thd->from,
-				     thd->from_len, thd->to, &thd->to_len,
-				     thd->iv, thd->iv_len,
-				     thd->hash_appended)) {
-			thd->failed = TRUE;
-			continue;
-		}
+	crypt_job_t *job = (crypt_job_t *) arg;
 
+	if (xb_crypt_decrypt(job->cipher_handle, job->from,
+			     job->from_len, job->to, &job->to_len,
+			     job->iv, job->iv_len,
+			     job->hash_appended)) {
+		job->failed = TRUE;
 	}
-
-	pthread_mutex_unlock(&thd->data_mutex);
-
-	return NULL;
 }
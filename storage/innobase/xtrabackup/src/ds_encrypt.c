@@ -22,32 +22,27 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <my_base.h>
 #include "common.h"
 #include "datasink.h"
+#include "executor.h"
 #include "xbcrypt_common.h"
 #include "xbcrypt.h"
 
 #define XB_CRYPT_CHUNK_SIZE ((size_t) (ds_encrypt_encrypt_chunk_size))
 
 typedef struct {
-	pthread_t		id;
-	uint			num;
-	pthread_mutex_t 	ctrl_mutex;
-	pthread_cond_t		ctrl_cond;
-	pthread_mutex_t		data_mutex;
-	pthread_cond_t  	data_cond;
-	my_bool			started;
-	my_bool			data_avail;
-	my_bool			cancelled;
 	const uchar 		*from;
 	size_t			from_len;
+	ds_buf_t		*to_buf;
 	uchar			*to;
 	uchar			*iv;
 	size_t			to_len;
 	gcry_cipher_hd_t	cipher_handle;
-} crypt_thread_ctxt_t;
+} crypt_job_t;
 
 typedef struct {
-	crypt_thread_ctxt_t	*threads;
-	uint			nthreads;
+	xb_executor_t		*executor;
+	uint			njobs;
+	ds_buf_pool_t		*buf_pool;	/* output buffers, recycled
+						between files */
 } ds_encrypt_ctxt_t;
 
 typedef struct {
@@ -55,6 +50,8 @@ typedef struct {
 	ds_encrypt_ctxt_t	*crypt_ctxt;
 	size_t			bytes_processed;
 	ds_file_t		*dest_file;
+	crypt_job_t		*jobs;
+	xb_task_group_t		group;
 } ds_encrypt_file_t;
 
 /* Encryption options */
@@ -73,13 +70,17 @@ datasink_t datasink_encrypt = {
 	&encrypt_init,
 	&encrypt_open,
 	&encrypt_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
 	&encrypt_close,
 	&encrypt_deinit
 };
 
-static crypt_thread_ctxt_t *create_worker_threads(uint n);
-static void destroy_worker_threads(crypt_thread_ctxt_t *threads, uint n);
-static void *encrypt_worker_thread_func(void *arg);
+static crypt_job_t *create_jobs(uint n, ds_buf_pool_t *buf_pool);
+static void destroy_jobs(crypt_job_t *jobs, uint n);
+static void encrypt_job_func(void *arg);
 
 static uint encrypt_iv_len = 0;
 
@@ -106,15 +107,15 @@ encrypt_init(const char *root)
 {
 	ds_ctxt_t		*ctxt;
 	ds_encrypt_ctxt_t	*encrypt_ctxt;
-	crypt_thread_ctxt_t	*threads;
+	xb_executor_t		*executor;
 
 	if (xb_crypt_init(&encrypt_iv_len)) {
 		return NULL;
 	}
 
-	/* Create and initialize the worker threads */
-	threads = create_worker_threads(ds_encrypt_encrypt_threads);
-	if (threads == NULL) {
+	/* Encryption jobs are run by the shared executor */
+	executor = xb_executor_acquire(ds_encrypt_encrypt_threads);
+	if (executor == NULL) {
 		msg("encrypt: failed to create worker threads.\n");
 		return NULL;
 	}
@@ -125,8 +126,11 @@ encrypt_init(const char *root)
 				       MYF(MY_FAE));
 
 	encrypt_ctxt = (ds_encrypt_ctxt_t *) (ctxt + 1);
-	encrypt_ctxt->threads = threads;
-	encrypt_ctxt->nthreads = ds_encrypt_encrypt_threads;
+	encrypt_ctxt->executor = executor;
+	encrypt_ctxt->njobs = ds_encrypt_encrypt_threads;
+	encrypt_ctxt->buf_pool = ds_buf_pool_create(XB_CRYPT_CHUNK_SIZE +
+						    XB_CRYPT_HASH_LEN,
+						    sizeof(double));
 
 	ctxt->ptr = encrypt_ctxt;
 	ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
@@ -184,11 +188,19 @@ encrypt_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 	}
 
 	crypt_file->crypt_ctxt = crypt_ctxt;
+	crypt_file->jobs = create_jobs(crypt_ctxt->njobs, crypt_ctxt->buf_pool);
+	if (crypt_file->jobs == NULL) {
+		msg("encrypt: failed to initialize ciphers.\n");
+		goto err;
+	}
+	xb_task_group_init(&crypt_file->group);
+
 	crypt_file->xbcrypt_file = xb_crypt_write_open(crypt_file,
 					   my_xb_crypt_write_callback);
 
 	if (crypt_file->xbcrypt_file == NULL) {
 		msg("encrypt: xb_crypt_write_open() failed.\n");
+		xb_task_group_destroy(&crypt_file->group);
 		goto err;
 	}
 
@@ -199,6 +211,9 @@ encrypt_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 	return file;
 
 err:
+	if (crypt_file->jobs) {
+		destroy_jobs(crypt_file->jobs, crypt_ctxt->njobs);
+	}
 	if (crypt_file->dest_file) {
 		ds_close(crypt_file->dest_file);
 	}
@@ -212,77 +227,60 @@ encrypt_write(ds_file_t *file, const void *buf, size_t len)
 {
 	ds_encrypt_file_t	*crypt_file;
 	ds_encrypt_ctxt_t	*crypt_ctxt;
-	crypt_thread_ctxt_t	*threads;
-	crypt_thread_ctxt_t	*thd;
-	uint			nthreads;
+	crypt_job_t		*jobs;
+	crypt_job_t		*job;
+	uint			njobs;
 	uint			i;
 	const uchar		*ptr;
 
 	crypt_file = (ds_encrypt_file_t *) file->ptr;
 	crypt_ctxt = crypt_file->crypt_ctxt;
 
-	threads = crypt_ctxt->threads;
-	nthreads = crypt_ctxt->nthreads;
+	jobs = crypt_file->jobs;
 
 	ptr = (const uchar *) buf;
 	while (len > 0) {
-		uint max_thread;
 
-		/* Send data to worker threads for encryption */
-		for (i = 0; i < nthreads; i++) {
+		/* Send data to the executor for encryption */
+		for (njobs = 0; njobs < crypt_ctxt->njobs && len > 0; njobs++) {
 			size_t chunk_len;
 
-			thd = threads + i;
-
-			pthread_mutex_lock(&thd->ctrl_mutex);
+			job = jobs + njobs;
 
 			chunk_len = (len > XB_CRYPT_CHUNK_SIZE) ?
 				XB_CRYPT_CHUNK_SIZE : len;
-			thd->from = ptr;
-			thd->from_len = chunk_len;
+			job->from = ptr;
+			job->from_len = chunk_len;
 
-			pthread_mutex_lock(&thd->data_mutex);
-			thd->data_avail = TRUE;
-			pthread_cond_signal(&thd->data_cond);
-			pthread_mutex_unlock(&thd->data_mutex);
+			xb_executor_submit(crypt_ctxt->executor,
+					   &crypt_file->group,
+					   encrypt_job_func, job);
 
 			len -= chunk_len;
-			if (len == 0) {
-				break;
-			}
 			ptr += chunk_len;
 		}
 
-		max_thread = (i < nthreads) ? i :  nthreads - 1;
+		xb_task_group_wait(crypt_ctxt->executor, &crypt_file->group);
 
-		/* Reap and stream the encrypted data */
-		for (i = 0; i <= max_thread; i++) {
-			thd = threads + i;
+		/* Stream the encrypted data in the original order */
+		for (i = 0; i < njobs; i++) {
+			job = jobs + i;
 
-			pthread_mutex_lock(&thd->data_mutex);
-			while (thd->data_avail == TRUE) {
-				pthread_cond_wait(&thd->data_cond,
-						  &thd->data_mutex);
-			}
-
-			xb_a(thd->to_len > 0);
+			xb_a(job->to_len > 0);
 
 			if (xb_crypt_write_chunk(crypt_file->xbcrypt_file,
-						 thd->to,
-						 thd->from_len +
+						 job->to,
+						 job->from_len +
 							XB_CRYPT_HASH_LEN,
-						 thd->to_len,
-						 thd->iv,
+						 job->to_len,
+						 job->iv,
 						 encrypt_iv_len)) {
 				msg("encrypt: write to the destination file "
 				    "failed.\n");
 				return 1;
 			}
 
-			crypt_file->bytes_processed += thd->from_len;
-
-			pthread_mutex_unlock(&thd->data_mutex);
-			pthread_mutex_unlock(&thd->ctrl_mutex);
+			crypt_file->bytes_processed += job->from_len;
 		}
 	}
 
@@ -306,6 +304,9 @@ encrypt_close(ds_file_t *file)
 		rc = 1;
 	}
 
+	xb_task_group_destroy(&crypt_file->group);
+	destroy_jobs(crypt_file->jobs, crypt_file->crypt_ctxt->njobs);
+
 	my_free(file);
 
 	return rc;
@@ -321,146 +322,73 @@ encrypt_deinit(ds_ctxt_t *ctxt)
 
 	crypt_ctxt = (ds_encrypt_ctxt_t *) ctxt->ptr;
 
-	destroy_worker_threads(crypt_ctxt->threads, crypt_ctxt->nthreads);
+	xb_executor_release(crypt_ctxt->executor);
+	ds_buf_pool_destroy(crypt_ctxt->buf_pool);
 
 	my_free(ctxt->root);
 	my_free(ctxt);
 }
 
 static
-crypt_thread_ctxt_t *
-create_worker_threads(uint n)
+crypt_job_t *
+create_jobs(uint n, ds_buf_pool_t *buf_pool)
 {
-	crypt_thread_ctxt_t	*threads;
-	uint 			i;
+	crypt_job_t	*jobs;
+	uint 		i;
 
-	threads = (crypt_thread_ctxt_t *)
-		my_malloc(PSI_NOT_INSTRUMENTED,
-			  sizeof(crypt_thread_ctxt_t) * n, MYF(MY_FAE));
+	jobs = (crypt_job_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					 sizeof(crypt_job_t) * n,
+					 MYF(MY_FAE | MY_ZEROFILL));
 
 	for (i = 0; i < n; i++) {
-		crypt_thread_ctxt_t *thd = threads + i;
-
-		thd->num = i + 1;
-		thd->started = FALSE;
-		thd->cancelled = FALSE;
-		thd->data_avail = FALSE;
+		crypt_job_t *job = jobs + i;
 
-		thd->to = (uchar *) my_malloc(PSI_NOT_INSTRUMENTED,
-					      XB_CRYPT_CHUNK_SIZE +
-					      XB_CRYPT_HASH_LEN, MYF(MY_FAE));
+		job->to_buf = ds_buf_get(buf_pool);
+		job->to = job->to_buf->data;
 
-		thd->iv = (uchar *) my_malloc(PSI_NOT_INSTRUMENTED,
+		job->iv = (uchar *) my_malloc(PSI_NOT_INSTRUMENTED,
 					      encrypt_iv_len, MYF(MY_FAE));
 
-		/* Initialize the control mutex and condition var */
-		if (pthread_mutex_init(&thd->ctrl_mutex, NULL) ||
-		    pthread_cond_init(&thd->ctrl_cond, NULL)) {
-			goto err;
-		}
-
-		/* Initialize and data mutex and condition var */
-		if (pthread_mutex_init(&thd->data_mutex, NULL) ||
-		    pthread_cond_init(&thd->data_cond, NULL)) {
-			goto err;
-		}
-
-		if (xb_crypt_cipher_open(&thd->cipher_handle)) {
-			goto err;
-		}
-
-		pthread_mutex_lock(&thd->ctrl_mutex);
-
-		if (pthread_create(&thd->id, NULL, encrypt_worker_thread_func,
-				   thd)) {
-			msg("encrypt: pthread_create() failed: "
-			    "errno = %d\n", errno);
-			goto err;
+		if (xb_crypt_cipher_open(&job->cipher_handle)) {
+			ds_buf_unref(job->to_buf);
+			my_free(job->iv);
+			destroy_jobs(jobs, i);
+			return NULL;
 		}
 	}
 
-	/* Wait for the threads to start */
-	for (i = 0; i < n; i++) {
-		crypt_thread_ctxt_t *thd = threads + i;
-
-		while (thd->started == FALSE)
-			pthread_cond_wait(&thd->ctrl_cond, &thd->ctrl_mutex);
-		pthread_mutex_unlock(&thd->ctrl_mutex);
-	}
-
-	return threads;
-
-err:
-	return NULL;
+	return jobs;
 }
 
 static
 void
-destroy_worker_threads(crypt_thread_ctxt_t *threads, uint n)
+destroy_jobs(crypt_job_t *jobs, uint n)
 {
 	uint i;
 
 	for (i = 0; i < n; i++) {
-		crypt_thread_ctxt_t *thd = threads + i;
-
-		pthread_mutex_lock(&thd->data_mutex);
-		threads[i].cancelled = TRUE;
-		pthread_cond_signal(&thd->data_cond);
-		pthread_mutex_unlock(&thd->data_mutex);
+		crypt_job_t *job = jobs + i;
 
-		pthread_join(thd->id, NULL);
+		xb_crypt_cipher_close(job->cipher_handle);
 
-		pthread_cond_destroy(&thd->data_cond);
-		pthread_mutex_destroy(&thd->data_mutex);
-		pthread_cond_destroy(&thd->ctrl_cond);
-		pthread_mutex_destroy(&thd->ctrl_mutex);
-
-		xb_crypt_cipher_close(thd->cipher_handle);
-
-		my_free(thd->to);
-		my_free(thd->iv);
+		ds_buf_unref(job->to_buf);
+		my_free(job->iv);
 	}
 
-	my_free(threads);
+	my_free(jobs);
 }
 
 static
-void *
-encrypt_worker_thread_func(void *arg)
+void
+encrypt_job_func(void *arg)
 {
-	crypt_thread_ctxt_t *thd = (crypt_thread_ctxt_t *) arg;
-
-	pthread_mutex_lock(&thd->ctrl_mutex);
-
-	pthread_mutex_lock(&thd->data_mutex);
+	crypt_job_t *job = (crypt_job_t *) arg;
 
-	thd->started = TRUE;
-	pthread_cond_signal(&thd->ctrl_cond);
+	job->to_len = job->from_len;
 
-	pthread_mutex_unlock(&thd->ctrl_mutex);
-
-	while (1) {
-		thd->data_avail = FALSE;
-		pthread_cond_signal(&thd->data_cond);
-
-		while (!thd->data_avail && !thd->cancelled) {
-			pthread_cond_wait(&thd->data_cond, &thd->data_mutex);
-		}
-
-		if (thd->cancelled)
-			break;
-
-		thd->to_len = thd->from_len;
-
-		if (xb_crypt_encrypt(thd->cipher_handle, thd->from,
-				     thd->from_len, thd->to, &thd->to_len,
-				     thd->iv)) {
-			thd->to_len = 0;
-			continue;
-		}
+	if (xb_crypt_encrypt(job->cipher_handle, job->from,
+			     job->from_len, job->to, &job->to_len,
+			     job->iv)) {
+		job->to_len = 0;
 	}
-
-	pthread_mutex_unlock(&thd->data_mutex);
-
-	return NULL;
 }
@@ -24,15 +24,95 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <my_thread_local.h>
 #include "common.h"
 #include "datasink.h"
+#include "xtrabackup_config.h"
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_FICLONE
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+/* Start the writeback of written data right away, and wait for it once this
+many bytes have been written after it, so that the amount of dirty page cache
+per file stays bounded */
+#define DS_LOCAL_SYNC_LAG		(64 * 1024 * 1024)
+
+/* Maximum number of queued writes per write-behind thread. Beyond it the
+writing thread writes the buffer itself. */
+#define DS_LOCAL_QUEUE_PER_THREAD	4
+
+/* Alignment of the buffers, offsets and lengths written with O_DIRECT. It is
+a multiple of the logical block size of all common devices. */
+#define DS_LOCAL_DIRECT_ALIGN		4096
+
+typedef struct ds_local_write_struct ds_local_write_t;
 
 typedef struct {
-	File fd;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;		/* a write was queued */
+	pthread_cond_t		done_cond;	/* a queued write completed */
+	ds_local_write_t	*head;		/* queued writes */
+	ds_local_write_t	*tail;
+	uint			n_queued;
+	uint			n_threads;	/* write-behind threads */
+	pthread_t		*threads;
+	my_bool			shutdown;
+} ds_local_ctxt_t;
+
+typedef struct {
+	File			fd;
+	File			direct_fd;	/* the same file opened with
+						O_DIRECT, or -1 */
+	my_bool			direct_failed;	/* the device rejected a
+						write to direct_fd */
+	ds_local_ctxt_t		*local_ctxt;
+	my_off_t		offset;		/* end of the sequential
+						writes */
+	my_off_t		prealloc;	/* preallocated size, or 0 */
+	my_off_t		synced;		/* writeback waited for up to
+						this offset */
+	uint			n_pending;	/* queued writes, protected by
+						the context mutex */
+	my_bool			failed;		/* a queued write failed */
 } ds_local_file_t;
 
+struct ds_local_write_struct {
+	ds_file_t		*file;
+	ds_buf_t		*buf;
+	size_t			len;
+	my_off_t		offset;
+	ds_local_write_t	*next;
+};
+
+/* Drop written data from the page cache. Disabled when the files are read
+back right away, e.g. when a streamed backup is prepared after extraction. */
+my_bool	ds_local_drop_cache = TRUE;
+
+/* Preallocate files to the size passed to ds_open(). Only set when the files
+are as large as their sources. */
+my_bool	ds_local_preallocate = FALSE;
+
+/* Number of threads that write the buffers passed with ds_write_buf() behind
+the writing thread. 0 writes them in the calling thread. */
+uint	ds_local_write_threads = 0;
+
+/* Write the aligned parts of the files with O_DIRECT, so that they do not
+go through the page cache */
+my_bool	ds_local_direct_io = FALSE;
+
 static ds_ctxt_t *local_init(const char *root);
 static ds_file_t *local_open(ds_ctxt_t *ctxt, const char *path,
 			     MY_STAT *mystat);
 static int local_write(ds_file_t *file, const void *buf, size_t len);
+static int local_writev(ds_file_t *file, const struct iovec *iov,
+			uint iovcnt);
+static int local_write_buf(ds_file_t *file, ds_buf_t *buf, size_t len);
+static int local_pwrite(ds_file_t *file, const void *buf, size_t len,
+			my_off_t offset);
+static int local_copy_fd(ds_file_t *file, File src, my_off_t len,
+			 my_bool clone);
 static int local_close(ds_file_t *file);
 static void local_deinit(ds_ctxt_t *ctxt);
 
@@ -40,6 +120,10 @@ datasink_t datasink_local = {
 	&local_init,
 	&local_open,
 	&local_write,
+	&local_writev,
+	&local_write_buf,
+	&local_pwrite,
+	&local_copy_fd,
 	&local_close,
 	&local_deinit
 };
@@ -48,7 +132,8 @@ static
 ds_ctxt_t *
 local_init(const char *root)
 {
-	ds_ctxt_t *ctxt;
+	ds_ctxt_t	*ctxt;
+	ds_local_ctxt_t	*local_ctxt;
 
 	if (my_mkdir(root, 0777, MYF(0)) < 0
 	    && my_errno() != EEXIST && my_errno() != EISDIR)
@@ -60,17 +145,24 @@ local_init(const char *root)
 		return NULL;
 	}
 
-	ctxt = my_malloc(PSI_NOT_INSTRUMENTED, sizeof(ds_ctxt_t), MYF(MY_FAE));
+	ctxt = my_malloc(PSI_NOT_INSTRUMENTED,
+			 sizeof(ds_ctxt_t) + sizeof(ds_local_ctxt_t),
+			 MYF(MY_FAE | MY_ZEROFILL));
+	local_ctxt = (ds_local_ctxt_t *) (ctxt + 1);
+
+	pthread_mutex_init(&local_ctxt->mutex, NULL);
+	pthread_cond_init(&local_ctxt->cond, NULL);
+	pthread_cond_init(&local_ctxt->done_cond, NULL);
 
 	ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+	ctxt->ptr = local_ctxt;
 
 	return ctxt;
 }
 
 static
 ds_file_t *
-local_open(ds_ctxt_t *ctxt, const char *path,
-	   MY_STAT *mystat __attribute__((unused)))
+local_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 {
 	char 		fullpath[FN_REFLEN];
 	char		dirpath[FN_REFLEN];
@@ -104,10 +196,31 @@ local_open(ds_ctxt_t *ctxt, const char *path,
 				       sizeof(ds_file_t) +
 				       sizeof(ds_local_file_t) +
 				       path_len,
-				       MYF(MY_FAE));
+				       MYF(MY_FAE | MY_ZEROFILL));
 	local_file = (ds_local_file_t *) (file + 1);
 
 	local_file->fd = fd;
+	local_file->direct_fd = -1;
+	local_file->local_ctxt = (ds_local_ctxt_t *) ctxt->ptr;
+
+	/* Aligned writes go to a second descriptor opened with O_DIRECT, the
+	rest is written to the first one. Not all file systems support
+	O_DIRECT, e.g. tmpfs, then everything is written to the first one. */
+#ifdef O_DIRECT
+	if (ds_local_direct_io) {
+		local_file->direct_fd = open(fullpath,
+					     O_WRONLY | O_BINARY | O_DIRECT);
+	}
+#endif
+
+	/* Allocate the file in one piece instead of growing it with every
+	write. It is truncated to the written size on close. */
+#ifdef __linux__
+	if (ds_local_preallocate && mystat != NULL && mystat->st_size > 0
+	    && fallocate(fd, 0, 0, mystat->st_size) == 0) {
+		local_file->prealloc = mystat->st_size;
+	}
+#endif
 
 	file->path = (char *) local_file + sizeof(ds_local_file_t);
 	memcpy(file->path, fullpath, path_len);
@@ -117,37 +230,513 @@ local_open(ds_ctxt_t *ctxt, const char *path,
 	return file;
 }
 
+/************************************************************************
+Start the writeback of a written range. Wait for the writeback of the data
+written DS_LOCAL_SYNC_LAG bytes before it and drop that data from the page
+cache if requested. Safe to call from several threads for the same file. */
+static
+void
+local_written(ds_local_file_t *local_file, my_off_t offset, size_t len)
+{
+	File		fd = local_file->fd;
+#ifdef __linux__
+	my_off_t	synced = local_file->synced;
+	my_off_t	end = offset + len;
+
+	sync_file_range(fd, offset, len, SYNC_FILE_RANGE_WRITE);
+
+	if (end > synced + DS_LOCAL_SYNC_LAG
+	    && __sync_bool_compare_and_swap(&local_file->synced, synced,
+					    end - DS_LOCAL_SYNC_LAG)) {
+		sync_file_range(fd, synced, end - DS_LOCAL_SYNC_LAG - synced,
+				SYNC_FILE_RANGE_WAIT_BEFORE
+				| SYNC_FILE_RANGE_WRITE
+				| SYNC_FILE_RANGE_WAIT_AFTER);
+		if (ds_local_drop_cache) {
+			posix_fadvise(fd, synced,
+				      end - DS_LOCAL_SYNC_LAG - synced,
+				      POSIX_FADV_DONTNEED);
+		}
+	}
+#else
+	if (ds_local_drop_cache) {
+		posix_fadvise(fd, offset, len, POSIX_FADV_DONTNEED);
+	}
+#endif
+}
+
+/************************************************************************
+Write a buffer at the given offset. Aligned buffers go to the O_DIRECT
+descriptor, if any. The kernel writes back and drops the cached pages of the
+range of a direct write before it, so the cached unaligned writes and the
+direct ones stay coherent.
+@return 0 on success, 1 on error. */
+static
+int
+local_write_at(ds_file_t *file, const void *buf, size_t len,
+	       my_off_t offset, myf flags)
+{
+	ds_local_file_t	*local_file = (ds_local_file_t *) file->ptr;
+	char		errbuf[MYSYS_STRERROR_SIZE];
+
+	if (local_file->direct_fd >= 0 && !local_file->direct_failed
+	    && ((my_off_t) (size_t) buf | offset | len)
+	       % DS_LOCAL_DIRECT_ALIGN == 0) {
+
+		if (!my_pwrite(local_file->direct_fd, (const uchar *) buf,
+			       len, offset, MYF(MY_NABP))) {
+			local_written(local_file, offset, len);
+			return 0;
+		}
+
+		if (my_errno() != EINVAL) {
+			if (flags & MY_WME) {
+				my_error(EE_WRITE, MYF(ME_BELL), file->path,
+					 my_errno(),
+					 my_strerror(errbuf, sizeof(errbuf),
+						     my_errno()));
+			}
+			return 1;
+		}
+
+		/* The device does not accept this alignment. Write the
+		rest of the file through the page cache. */
+		if (__sync_bool_compare_and_swap(&local_file->direct_failed,
+						 FALSE, TRUE)) {
+			msg("local: O_DIRECT write to %s failed, writing the "
+			    "file through the page cache.\n", file->path);
+		}
+	}
+
+	if (my_pwrite(local_file->fd, (const uchar *) buf, len, offset,
+		      MYF(MY_NABP) | flags)) {
+		return 1;
+	}
+
+	local_written(local_file, offset, len);
+
+	return 0;
+}
+
 static
 int
 local_write(ds_file_t *file, const void *buf, size_t len)
 {
-	File fd = ((ds_local_file_t *) file->ptr)->fd;
+	ds_local_file_t	*local_file = (ds_local_file_t *) file->ptr;
+	my_off_t	offset = local_file->offset;
+
+	/* Writes are positional, as queued writes do not move the file
+	position */
+	local_file->offset += len;
+
+	return local_write_at(file, buf, len, offset, MYF(MY_WME));
+}
+
+static
+int
+local_writev(ds_file_t *file, const struct iovec *iov, uint iovcnt)
+{
+	ds_local_file_t	*local_file = (ds_local_file_t *) file->ptr;
+	File		fd = local_file->fd;
+	my_off_t	offset = local_file->offset;
+	size_t		len = 0;
+	uint		i;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	if (lseek(fd, offset, SEEK_SET) != (off_t) offset
+	    || xb_writev_full(fd, iov, iovcnt)) {
+		return 1;
+	}
+
+	local_file->offset += len;
+
+	local_written(local_file, offset, len);
+
+	return 0;
+}
+
+/************************************************************************
+Write-behind thread. Writes the queued buffers until the context is
+destroyed. */
+static
+void *
+local_writer_thread_func(void *arg)
+{
+	ds_local_ctxt_t		*local_ctxt = (ds_local_ctxt_t *) arg;
+	ds_local_write_t	*w;
+	ds_local_file_t		*local_file;
+	int			rc;
+
+	pthread_mutex_lock(&local_ctxt->mutex);
+
+	for (;;) {
+		while (local_ctxt->head == NULL && !local_ctxt->shutdown) {
+			pthread_cond_wait(&local_ctxt->cond,
+					  &local_ctxt->mutex);
+		}
+
+		w = local_ctxt->head;
+		if (w == NULL) {
+			break;
+		}
+
+		local_ctxt->head = w->next;
+		if (local_ctxt->head == NULL) {
+			local_ctxt->tail = NULL;
+		}
+		local_ctxt->n_queued--;
+
+		pthread_mutex_unlock(&local_ctxt->mutex);
+
+		local_file = (ds_local_file_t *) w->file->ptr;
+
+		rc = local_write_at(w->file, w->buf->data, w->len,
+				    w->offset, MYF(0));
+		if (rc) {
+			msg("local: failed to write %lu bytes at offset %llu "
+			    "to %s: errno = %d\n", (ulong) w->len,
+			    (ulonglong) w->offset, w->file->path, errno);
+		}
+
+		ds_buf_unref(w->buf);
+
+		pthread_mutex_lock(&local_ctxt->mutex);
+
+		if (rc) {
+			local_file->failed = TRUE;
+		}
+		local_file->n_pending--;
+		pthread_cond_broadcast(&local_ctxt->done_cond);
+
+		my_free(w);
+	}
+
+	pthread_mutex_unlock(&local_ctxt->mutex);
+
+	return NULL;
+}
+
+/************************************************************************
+Start the write-behind threads on the first queued write. Must be called
+with the context mutex held.
+@return number of running threads. */
+static
+uint
+local_start_writers(ds_local_ctxt_t *local_ctxt)
+{
+	uint	n = ds_local_write_threads;
+
+	if (local_ctxt->threads != NULL || n == 0) {
+		return local_ctxt->n_threads;
+	}
+
+	local_ctxt->threads = (pthread_t *)
+		my_malloc(PSI_NOT_INSTRUMENTED, sizeof(pthread_t) * n,
+			  MYF(MY_FAE));
+
+	while (local_ctxt->n_threads < n) {
+		if (pthread_create(&local_ctxt->threads[local_ctxt->n_threads],
+				   NULL, local_writer_thread_func,
+				   local_ctxt)) {
+			msg("local: pthread_create() failed: errno = %d\n",
+			    errno);
+			break;
+		}
+		local_ctxt->n_threads++;
+	}
+
+	return local_ctxt->n_threads;
+}
+
+/************************************************************************
+Queue a pooled buffer to be written behind the calling thread, which can go
+on reading the next one. The buffer is written in the calling thread when
+the queue is full. */
+static
+int
+local_write_buf(ds_file_t *file, ds_buf_t *buf, size_t len)
+{
+	ds_local_file_t		*local_file = (ds_local_file_t *) file->ptr;
+	ds_local_ctxt_t		*local_ctxt = local_file->local_ctxt;
+	my_off_t		offset = local_file->offset;
+	ds_local_write_t	*w;
+	uint			n_threads;
+	int			rc;
+
+	local_file->offset += len;
+
+	pthread_mutex_lock(&local_ctxt->mutex);
+
+	if (local_file->failed) {
+		pthread_mutex_unlock(&local_ctxt->mutex);
+		ds_buf_unref(buf);
+		return 1;
+	}
+
+	n_threads = local_start_writers(local_ctxt);
+
+	if (local_ctxt->n_queued >= n_threads * DS_LOCAL_QUEUE_PER_THREAD) {
+		pthread_mutex_unlock(&local_ctxt->mutex);
+
+		rc = local_write_at(file, buf->data, len, offset,
+				    MYF(MY_WME));
+		ds_buf_unref(buf);
+
+		return rc;
+	}
+
+	w = (ds_local_write_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					   sizeof(ds_local_write_t),
+					   MYF(MY_FAE));
+	w->file = file;
+	w->buf = buf;
+	w->len = len;
+	w->offset = offset;
+	w->next = NULL;
+
+	if (local_ctxt->tail != NULL) {
+		local_ctxt->tail->next = w;
+	} else {
+		local_ctxt->head = w;
+	}
+	local_ctxt->tail = w;
+	local_ctxt->n_queued++;
+	local_file->n_pending++;
+
+	pthread_cond_signal(&local_ctxt->cond);
+	pthread_mutex_unlock(&local_ctxt->mutex);
+
+	return 0;
+}
+
+static
+int
+local_pwrite(ds_file_t *file, const void *buf, size_t len, my_off_t offset)
+{
+	ds_local_file_t	*local_file = (ds_local_file_t *) file->ptr;
+
+	/* Several threads may be writing the rest of the file, so it is not
+	truncated to the sequential write offset on close */
+	local_file->prealloc = 0;
+
+	return local_write_at(file, buf, len, offset, MYF(MY_WME));
+}
+
+#ifdef __linux__
+/************************************************************************
+Check if an in-kernel copy failed because the file systems or the kernel do
+not support it, rather than because of an I/O error. */
+static
+my_bool
+local_copy_unsupported(int err)
+{
+	return(err == ENOSYS || err == EXDEV || err == EINVAL
+	       || err == EOPNOTSUPP || err == ENOTSUP);
+}
+
+/************************************************************************
+Undo a partial in-kernel copy, so that the file can be written from the
+start with local_write().
+@return -1 on success, 1 on error. */
+static
+int
+local_copy_reset(ds_file_t *file, File fd)
+{
+	char errbuf[MYSYS_STRERROR_SIZE];
 
-	if (!my_write(fd, buf, len, MYF(MY_WME | MY_NABP))) {
+	if (ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET) != 0) {
+		my_error(EE_WRITE, MYF(ME_BELL), file->path, errno,
+			 my_strerror(errbuf, sizeof(errbuf), errno));
+		return 1;
+	}
+
+	return -1;
+}
+#endif
+
+/************************************************************************
+Copy the first 'len' bytes of 'src' to a newly created local file. The data
+is shared with a reflink when 'src' has exactly 'len' bytes and both files are
+on the same reflink-capable file system (XFS, Btrfs). Otherwise the kernel
+copies it with copy_file_range() or sendfile(), which still avoids the copy
+to and from a user space buffer.
+
+With 'clone' only a reflink of the whole file is tried, and the file is
+truncated first, so that it can be cloned again when the caller finds a
+corrupted page in the clone.
+@return 0 on success, 1 on error, -1 if neither is supported. */
+static
+int
+local_copy_fd(ds_file_t *file, File src, my_off_t len, my_bool clone)
+{
+#ifdef __linux__
+	ds_local_file_t	*local_file = (ds_local_file_t *) file->ptr;
+	File		fd = local_file->fd;
+	my_off_t	copied;
+	ssize_t		n = 0;
+	char		errbuf[MYSYS_STRERROR_SIZE];
+
+	/* The copies set the file size themselves */
+	if (local_file->prealloc > 0 || clone) {
+		if (ftruncate(fd, 0)) {
+			goto error;
+		}
+		local_file->prealloc = 0;
+	}
+
+#ifdef HAVE_FICLONE
+	{
+		MY_STAT	stat;
+
+		if ((clone
+		     || (my_fstat(src, &stat, MYF(0)) == 0
+			 && (my_off_t) stat.st_size == len))
+		    && ioctl(fd, FICLONE, src) == 0) {
+			return 0;
+		}
+	}
+#endif
+
+	if (clone) {
+		return -1;
+	}
+
+#ifdef HAVE_COPY_FILE_RANGE
+	{
+		loff_t	in_offset = 0;
+		loff_t	out_offset = 0;
+
+		for (copied = 0; copied < len; copied += n) {
+			n = copy_file_range(src, &in_offset, fd, &out_offset,
+					    len - copied, 0);
+			if (n <= 0) {
+				break;
+			}
+		}
+
+		if (copied == len) {
+			goto done;
+		}
+
+		if (n < 0 && !local_copy_unsupported(errno)) {
+			goto error;
+		}
+
+		/* The source is shorter than expected */
+		if (n == 0) {
+			return local_copy_reset(file, fd);
+		}
+
+		/* copy_file_range() does not move the file position, so
+		sendfile() below overwrites any partial copy */
+	}
+#endif
+
+	{
+		off_t	in_offset = 0;
+
+		for (copied = 0; copied < len; copied += n) {
+			n = sendfile(fd, src, &in_offset, len - copied);
+			if (n <= 0) {
+				break;
+			}
+		}
+
+		if (copied == len) {
+			goto done;
+		}
+
+		if (n < 0 && !local_copy_unsupported(errno)) {
+			goto error;
+		}
+
+		return local_copy_reset(file, fd);
+	}
+
+done:
+	if (ds_local_drop_cache) {
 		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
-		return 0;
 	}
 
+	return 0;
+
+error:
+	my_error(EE_WRITE, MYF(ME_BELL), file->path, errno,
+		 my_strerror(errbuf, sizeof(errbuf), errno));
+
 	return 1;
+#else
+	return -1;
+#endif
 }
 
 static
 int
 local_close(ds_file_t *file)
 {
-	File fd = ((ds_local_file_t *) file->ptr)->fd;
+	ds_local_file_t	*local_file = (ds_local_file_t *) file->ptr;
+	ds_local_ctxt_t	*local_ctxt = local_file->local_ctxt;
+	File		fd = local_file->fd;
+	File		direct_fd = local_file->direct_fd;
+	my_bool		failed;
+	char		errbuf[MYSYS_STRERROR_SIZE];
+
+	/* Wait for the queued writes */
+	pthread_mutex_lock(&local_ctxt->mutex);
+	while (local_file->n_pending > 0) {
+		pthread_cond_wait(&local_ctxt->done_cond, &local_ctxt->mutex);
+	}
+	failed = local_file->failed;
+	pthread_mutex_unlock(&local_ctxt->mutex);
+
+	/* Release the preallocated space that has not been written */
+	if (local_file->prealloc > local_file->offset
+	    && ftruncate(fd, local_file->offset)) {
+		my_error(EE_WRITE, MYF(ME_BELL), file->path, errno,
+			 my_strerror(errbuf, sizeof(errbuf), errno));
+		failed = TRUE;
+	}
 
 	my_free(file);
 
-	my_sync(fd, MYF(MY_WME));
+	if (direct_fd >= 0) {
+		close(direct_fd);
+	}
+
+	/* The writeback of the file has been started as it was written, so
+	this mostly waits for its tail. A failed writeback fails the close of
+	this file, which a single syncfs() in local_deinit() could not do. */
+	if (my_sync(fd, MYF(MY_WME))) {
+		failed = TRUE;
+	}
 
-	return my_close(fd, MYF(MY_WME));
+	return my_close(fd, MYF(MY_WME)) || failed;
 }
 
 static
 void
 local_deinit(ds_ctxt_t *ctxt)
 {
+	ds_local_ctxt_t	*local_ctxt = (ds_local_ctxt_t *) ctxt->ptr;
+	uint		i;
+
+	pthread_mutex_lock(&local_ctxt->mutex);
+	local_ctxt->shutdown = TRUE;
+	pthread_cond_broadcast(&local_ctxt->cond);
+	pthread_mutex_unlock(&local_ctxt->mutex);
+
+	for (i = 0; i < local_ctxt->n_threads; i++) {
+		pthread_join(local_ctxt->threads[i], NULL);
+	}
+	my_free(local_ctxt->threads);
+
+	pthread_cond_destroy(&local_ctxt->done_cond);
+	pthread_cond_destroy(&local_ctxt->cond);
+	pthread_mutex_destroy(&local_ctxt->mutex);
+
 	my_free(ctxt->root);
 	my_free(ctxt);
 }
@@ -25,4 +25,17 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 extern datasink_t datasink_local;
 
+/* Drop written data from the page cache */
+extern my_bool ds_local_drop_cache;
+
+/* Preallocate files to the size passed to ds_open() */
+extern my_bool ds_local_preallocate;
+
+/* Number of write-behind threads per local datasink, 0 to write in the
+calling thread */
+extern uint ds_local_write_threads;
+
+/* Write aligned buffers with O_DIRECT */
+extern my_bool ds_local_direct_io;
+
 #endif
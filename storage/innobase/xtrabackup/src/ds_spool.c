@@ -0,0 +1,567 @@
+/******************************************************
+Copyright (c) 2018 Percona LLC and/or its affiliates.
+
+Spooling datasink for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+/* Let several threads write files to a datasink that can only take one file
+at a time, like the 'tar' archive. The destination is owned by one thread at
+a time. A file opened while the destination is free is streamed to it
+directly. Files opened while it is busy are spooled to memory and then to a
+temporary file, and piped to the destination after they are closed, by the
+thread that owns the destination at that time.
+
+All spooled files share a budget of ds_spool_max_size bytes and
+DS_SPOOL_MAX_FILES files. Once it is used up, the copy threads wait for the
+destination instead of spooling.
+
+A file streamed directly keeps the destination until it is closed, as a 'tar'
+entry cannot be interleaved with others. While a large file is streamed, the
+other threads can only spool up to the budget and then wait, so the copy is
+as parallel as the spool budget allows. */
+
+#include <my_base.h>
+#include <my_thread_local.h>
+#include "common.h"
+#include "datasink.h"
+#include "ds_spool.h"
+#include "ds_tmpfile.h"
+
+/* Number of bytes of a spooled file kept in memory before the rest goes to
+a temporary file. The buffer grows up to this size with the file, and is
+also used to pipe the temporary file. */
+#define DS_SPOOL_MEM_SIZE	(1024 * 1024)
+
+/* Maximum number of files spooled or waiting for the destination at a time */
+#define DS_SPOOL_MAX_FILES	256
+
+typedef struct ds_spool_file_struct ds_spool_file_t;
+
+typedef struct {
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;		/* the destination was
+						released */
+	my_bool			busy;		/* the destination is owned */
+	pthread_t		owner;		/* the owning thread */
+	ds_spool_file_t		*head;		/* closed spooled files */
+	ds_spool_file_t		*tail;
+	ulonglong		spooled_bytes;	/* bytes held by the spooled
+						files */
+	ulong			spooled_files;	/* files being spooled or
+						waiting for the destination */
+	ulong			total_files;	/* files spooled so far */
+	ulonglong		peak_bytes;	/* maximum of spooled_bytes */
+} ds_spool_ctxt_t;
+
+struct ds_spool_file_struct {
+	ds_ctxt_t		*ctxt;
+	ds_file_t		*dest_file;	/* set when the file is written
+						to the destination directly */
+	char			*path;
+	MY_STAT			mystat;
+	my_bool			spooled;	/* counted in the spool
+						budget */
+	my_bool			failed;		/* the file could not be
+						written to the destination,
+						which has been released */
+	uchar			*mem;		/* the first spooled bytes */
+	size_t			mem_len;
+	size_t			mem_size;
+	File			fd;		/* temporary file with the rest
+						of the spooled bytes, or -1 */
+	my_off_t		file_len;
+	ds_spool_file_t		*next;
+};
+
+ulonglong ds_spool_max_size = 1024 * 1024 * 1024ULL;
+
+static ds_ctxt_t *spool_init(const char *root);
+static ds_file_t *spool_open(ds_ctxt_t *ctxt, const char *path,
+			     MY_STAT *mystat);
+static int spool_write(ds_file_t *file, const void *buf, size_t len);
+static int spool_close(ds_file_t *file);
+static void spool_deinit(ds_ctxt_t *ctxt);
+
+datasink_t datasink_spool = {
+	&spool_init,
+	&spool_open,
+	&spool_write,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	&spool_close,
+	&spool_deinit
+};
+
+static
+ds_ctxt_t *
+spool_init(const char *root)
+{
+	ds_ctxt_t	*ctxt;
+	ds_spool_ctxt_t	*spool_ctxt;
+
+	ctxt = my_malloc(PSI_NOT_INSTRUMENTED,
+			 sizeof(ds_ctxt_t) + sizeof(ds_spool_ctxt_t),
+			 MYF(MY_FAE | MY_ZEROFILL));
+	spool_ctxt = (ds_spool_ctxt_t *) (ctxt + 1);
+
+	pthread_mutex_init(&spool_ctxt->mutex, NULL);
+	pthread_cond_init(&spool_ctxt->cond, NULL);
+
+	ctxt->ptr = spool_ctxt;
+	ctxt->root = my_strdup(PSI_NOT_INSTRUMENTED, root, MYF(MY_FAE));
+
+	return ctxt;
+}
+
+/************************************************************************
+Take the ownership of the destination, waiting for the current owner to
+release it. */
+static
+void
+spool_acquire(ds_spool_ctxt_t *spool_ctxt)
+{
+	pthread_mutex_lock(&spool_ctxt->mutex);
+
+	while (spool_ctxt->busy) {
+		pthread_cond_wait(&spool_ctxt->cond, &spool_ctxt->mutex);
+	}
+
+	spool_ctxt->busy = TRUE;
+	spool_ctxt->owner = pthread_self();
+
+	pthread_mutex_unlock(&spool_ctxt->mutex);
+}
+
+/************************************************************************
+Check if the destination is owned by the calling thread. The caller must hold
+spool_ctxt->mutex. */
+static
+my_bool
+spool_owned(ds_spool_ctxt_t *spool_ctxt)
+{
+	return(spool_ctxt->busy
+	       && pthread_equal(spool_ctxt->owner, pthread_self()));
+}
+
+/************************************************************************
+Return the bytes of a spooled file to the spool budget. */
+static
+void
+spool_unaccount(ds_spool_file_t *spool_file)
+{
+	ds_spool_ctxt_t	*spool_ctxt;
+
+	if (!spool_file->spooled) {
+		return;
+	}
+
+	spool_ctxt = (ds_spool_ctxt_t *) spool_file->ctxt->ptr;
+
+	pthread_mutex_lock(&spool_ctxt->mutex);
+	spool_ctxt->spooled_bytes -= spool_file->mem_len + spool_file->file_len;
+	spool_ctxt->spooled_files--;
+	pthread_mutex_unlock(&spool_ctxt->mutex);
+
+	spool_file->spooled = FALSE;
+}
+
+/************************************************************************
+Free a spooled file. */
+static
+void
+spool_free(ds_spool_file_t *spool_file)
+{
+	spool_unaccount(spool_file);
+
+	if (spool_file->fd >= 0) {
+		my_close(spool_file->fd, MYF(MY_WME));
+	}
+	my_free(spool_file->mem);
+	my_free((ds_file_t *) spool_file - 1);
+}
+
+/************************************************************************
+Open the file in the destination and pipe the spooled bytes to it. The
+calling thread must own the destination.
+@return 0 on success, 1 on error. */
+static
+int
+spool_pipe(ds_spool_file_t *spool_file, MY_STAT *mystat)
+{
+	ds_ctxt_t	*pipe_ctxt = spool_file->ctxt->pipe_ctxt;
+	ds_file_t	*dest_file;
+	size_t		bytes;
+
+	dest_file = ds_open(pipe_ctxt, spool_file->path, mystat);
+	if (dest_file == NULL) {
+		msg("spool: cannot open the destination for '%s'.\n",
+		    spool_file->path);
+		return 1;
+	}
+	spool_file->dest_file = dest_file;
+
+	if (spool_file->mem_len > 0
+	    && ds_write(dest_file, spool_file->mem, spool_file->mem_len)) {
+		return 1;
+	}
+
+	if (spool_file->fd < 0) {
+		return 0;
+	}
+
+	/* The memory buffer is full, reuse it to read the temporary file */
+	xb_ad(spool_file->mem_size == DS_SPOOL_MEM_SIZE);
+	posix_fadvise(spool_file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (my_seek(spool_file->fd, 0, SEEK_SET, MYF(0)) == MY_FILEPOS_ERROR) {
+		msg("spool: my_seek() failed for '%s', errno = %d.\n",
+		    spool_file->path, my_errno());
+		return 1;
+	}
+
+	while ((bytes = my_read(spool_file->fd, spool_file->mem,
+				DS_SPOOL_MEM_SIZE, MYF(MY_WME))) > 0) {
+		if (bytes == (size_t) -1
+		    || ds_write(dest_file, spool_file->mem, bytes)) {
+			return 1;
+		}
+	}
+
+	my_close(spool_file->fd, MYF(MY_WME));
+	spool_file->fd = -1;
+
+	return 0;
+}
+
+/************************************************************************
+Pipe a closed spooled file to the destination and free it.
+@return 0 on success, 1 on error. */
+static
+int
+spool_emit(ds_spool_file_t *spool_file)
+{
+	MY_STAT	mystat = spool_file->mystat;
+	int	rc;
+
+	/* The spool has the final size */
+	mystat.st_size = spool_file->mem_len + spool_file->file_len;
+
+	rc = spool_pipe(spool_file, &mystat);
+
+	if (spool_file->dest_file != NULL && ds_close(spool_file->dest_file)) {
+		rc = 1;
+	}
+	if (rc) {
+		msg("spool: cannot stream '%s'.\n", spool_file->path);
+	}
+
+	spool_free(spool_file);
+
+	return rc;
+}
+
+/************************************************************************
+Pipe the files closed while the calling thread owned the destination, then
+release the destination.
+@return 0 on success, 1 on error. */
+static
+int
+spool_release(ds_spool_ctxt_t *spool_ctxt)
+{
+	ds_spool_file_t	*spool_file;
+	int		rc = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&spool_ctxt->mutex);
+
+		spool_file = spool_ctxt->head;
+		if (spool_file == NULL) {
+			spool_ctxt->busy = FALSE;
+			pthread_cond_broadcast(&spool_ctxt->cond);
+			pthread_mutex_unlock(&spool_ctxt->mutex);
+			break;
+		}
+
+		spool_ctxt->head = spool_file->next;
+		if (spool_ctxt->head == NULL) {
+			spool_ctxt->tail = NULL;
+		}
+
+		pthread_mutex_unlock(&spool_ctxt->mutex);
+
+		rc |= spool_emit(spool_file);
+	}
+
+	return rc;
+}
+
+static
+ds_file_t *
+spool_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
+{
+	ds_spool_ctxt_t	*spool_ctxt = (ds_spool_ctxt_t *) ctxt->ptr;
+	ds_spool_file_t	*spool_file;
+	ds_file_t	*file;
+	size_t		path_len;
+	my_bool		direct;
+
+	xb_ad(ctxt->pipe_ctxt != NULL);
+
+	path_len = strlen(path) + 1; /* terminating '\0' */
+
+	file = (ds_file_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+				       sizeof(ds_file_t) +
+				       sizeof(ds_spool_file_t) + path_len,
+				       MYF(MY_FAE | MY_ZEROFILL));
+	spool_file = (ds_spool_file_t *) (file + 1);
+
+	spool_file->ctxt = ctxt;
+	spool_file->path = (char *) (spool_file + 1);
+	memcpy(spool_file->path, path, path_len);
+	memcpy(&spool_file->mystat, mystat, sizeof(MY_STAT));
+	spool_file->fd = -1;
+
+	file->ptr = spool_file;
+	file->path = spool_file->path;
+
+	/* Stream the file directly if the destination is free. Otherwise
+	spool it, unless the spool is full and the destination is owned by
+	another thread, which releases it eventually. */
+	pthread_mutex_lock(&spool_ctxt->mutex);
+	if (spool_ctxt->busy && !spool_owned(spool_ctxt)
+	    && (spool_ctxt->spooled_files >= DS_SPOOL_MAX_FILES
+		|| spool_ctxt->spooled_bytes >= ds_spool_max_size)) {
+		while (spool_ctxt->busy) {
+			pthread_cond_wait(&spool_ctxt->cond,
+					  &spool_ctxt->mutex);
+		}
+	}
+	direct = !spool_ctxt->busy;
+	if (direct) {
+		spool_ctxt->busy = TRUE;
+		spool_ctxt->owner = pthread_self();
+	} else {
+		spool_ctxt->spooled_files++;
+		spool_ctxt->total_files++;
+		spool_file->spooled = TRUE;
+	}
+	pthread_mutex_unlock(&spool_ctxt->mutex);
+
+	if (direct) {
+		spool_file->dest_file = ds_open(ctxt->pipe_ctxt, path, mystat);
+		if (spool_file->dest_file == NULL) {
+			spool_release(spool_ctxt);
+			my_free(file);
+			return NULL;
+		}
+	}
+
+	return file;
+}
+
+/************************************************************************
+Stop spooling a file when the spool budget is used up. Wait for the
+destination, pipe the spooled bytes to it and write the rest directly. On
+error the file is given up and the destination is released for the other
+threads.
+@return 0 on success, 1 on error. */
+static
+int
+spool_flush(ds_spool_file_t *spool_file)
+{
+	ds_spool_ctxt_t	*spool_ctxt;
+	int		rc;
+
+	spool_ctxt = (ds_spool_ctxt_t *) spool_file->ctxt->ptr;
+
+	spool_acquire(spool_ctxt);
+
+	/* The size is not known yet, as for the files that are streamed
+	directly */
+	rc = spool_pipe(spool_file, &spool_file->mystat);
+
+	spool_unaccount(spool_file);
+
+	if (spool_file->fd >= 0) {
+		my_close(spool_file->fd, MYF(MY_WME));
+		spool_file->fd = -1;
+	}
+	my_free(spool_file->mem);
+	spool_file->mem = NULL;
+	spool_file->mem_len = 0;
+	spool_file->mem_size = 0;
+	spool_file->file_len = 0;
+
+	if (rc) {
+		if (spool_file->dest_file != NULL) {
+			ds_close(spool_file->dest_file);
+			spool_file->dest_file = NULL;
+		}
+		spool_file->failed = TRUE;
+		spool_release(spool_ctxt);
+	}
+
+	return rc;
+}
+
+static
+int
+spool_write(ds_file_t *file, const void *buf, size_t len)
+{
+	ds_spool_file_t	*spool_file = (ds_spool_file_t *) file->ptr;
+	ds_spool_ctxt_t	*spool_ctxt;
+	size_t		n;
+	size_t		mem_size;
+	char		tmp_path[FN_REFLEN];
+
+	if (spool_file->failed) {
+		return 1;
+	}
+
+	if (spool_file->dest_file != NULL) {
+		return ds_write(spool_file->dest_file, buf, len);
+	}
+
+	spool_ctxt = (ds_spool_ctxt_t *) spool_file->ctxt->ptr;
+
+	/* Wait for the destination once the spool budget is used up, unless
+	it is owned by this thread for another file, which would never be
+	released while waiting for it */
+	pthread_mutex_lock(&spool_ctxt->mutex);
+	if (spool_ctxt->spooled_bytes + len > ds_spool_max_size
+	    && !spool_owned(spool_ctxt)) {
+		pthread_mutex_unlock(&spool_ctxt->mutex);
+		if (spool_flush(spool_file)) {
+			return 1;
+		}
+		return ds_write(spool_file->dest_file, buf, len);
+	}
+	spool_ctxt->spooled_bytes += len;
+	spool_ctxt->peak_bytes = MY_MAX(spool_ctxt->peak_bytes,
+					spool_ctxt->spooled_bytes);
+	pthread_mutex_unlock(&spool_ctxt->mutex);
+
+	/* Grow the memory buffer with the file */
+	if (spool_file->mem_len + len > spool_file->mem_size
+	    && spool_file->mem_size < DS_SPOOL_MEM_SIZE) {
+		mem_size = MY_MAX(spool_file->mem_len + len,
+				  2 * spool_file->mem_size);
+		mem_size = MY_MIN(mem_size, DS_SPOOL_MEM_SIZE);
+		spool_file->mem = (uchar *) my_realloc(PSI_NOT_INSTRUMENTED,
+					spool_file->mem, mem_size,
+					MYF(MY_FAE | MY_ALLOW_ZERO_PTR));
+		spool_file->mem_size = mem_size;
+	}
+
+	n = MY_MIN(len, spool_file->mem_size - spool_file->mem_len);
+	memcpy(spool_file->mem + spool_file->mem_len, buf, n);
+	spool_file->mem_len += n;
+
+	if (n == len) {
+		return 0;
+	}
+
+	if (spool_file->fd < 0) {
+		/* The file is removed on close */
+		spool_file->fd = create_temp_file(tmp_path,
+				my_tmpdir(&mysql_tmpdir_list), "xbspool",
+				O_CREAT | O_EXCL | O_RDWR, MYF(MY_WME));
+		if (spool_file->fd < 0) {
+			return 1;
+		}
+		unlink(tmp_path);
+	}
+
+	if (my_write(spool_file->fd, (const uchar *) buf + n, len - n,
+		     MYF(MY_WME | MY_NABP))) {
+		return 1;
+	}
+	spool_file->file_len += len - n;
+
+	return 0;
+}
+
+static
+int
+spool_close(ds_file_t *file)
+{
+	ds_spool_file_t	*spool_file = (ds_spool_file_t *) file->ptr;
+	ds_spool_ctxt_t	*spool_ctxt;
+	int		rc;
+
+	spool_ctxt = (ds_spool_ctxt_t *) spool_file->ctxt->ptr;
+
+	if (spool_file->failed) {
+		msg("spool: cannot stream '%s'.\n", spool_file->path);
+		spool_free(spool_file);
+
+		return 1;
+	}
+
+	if (spool_file->dest_file != NULL) {
+		rc = ds_close(spool_file->dest_file);
+		spool_free(spool_file);
+
+		return spool_release(spool_ctxt) || rc;
+	}
+
+	/* Pipe the file now if the destination is free, otherwise its owner
+	does it on release */
+	pthread_mutex_lock(&spool_ctxt->mutex);
+	xb_ad(!spool_owned(spool_ctxt));
+	if (spool_ctxt->busy) {
+		spool_file->next = NULL;
+		if (spool_ctxt->tail != NULL) {
+			spool_ctxt->tail->next = spool_file;
+		} else {
+			spool_ctxt->head = spool_file;
+		}
+		spool_ctxt->tail = spool_file;
+		pthread_mutex_unlock(&spool_ctxt->mutex);
+
+		return 0;
+	}
+	spool_ctxt->busy = TRUE;
+	spool_ctxt->owner = pthread_self();
+	pthread_mutex_unlock(&spool_ctxt->mutex);
+
+	rc = spool_emit(spool_file);
+
+	return spool_release(spool_ctxt) || rc;
+}
+
+static
+void
+spool_deinit(ds_ctxt_t *ctxt)
+{
+	ds_spool_ctxt_t	*spool_ctxt = (ds_spool_ctxt_t *) ctxt->ptr;
+
+	/* All files have been closed and piped by now */
+	xb_a(!spool_ctxt->busy);
+	xb_a(spool_ctxt->head == NULL);
+	xb_a(spool_ctxt->spooled_files == 0);
+
+	msg_ts("Spooled %lu files while streaming, at most %llu bytes at a "
+	       "time.\n", spool_ctxt->total_files, spool_ctxt->peak_bytes);
+
+	pthread_cond_destroy(&spool_ctxt->cond);
+	pthread_mutex_destroy(&spool_ctxt->mutex);
+
+	my_free(ctxt->root);
+	my_free(ctxt);
+}
@@ -31,6 +31,8 @@ static ds_ctxt_t *stdout_init(const char *root);
 static ds_file_t *stdout_open(ds_ctxt_t *ctxt, const char *path,
 			     MY_STAT *mystat);
 static int stdout_write(ds_file_t *file, const void *buf, size_t len);
+static int stdout_writev(ds_file_t *file, const struct iovec *iov,
+			 uint iovcnt);
 static int stdout_close(ds_file_t *file);
 static void stdout_deinit(ds_ctxt_t *ctxt);
 
@@ -38,6 +40,10 @@ datasink_t datasink_stdout = {
 	&stdout_init,
 	&stdout_open,
 	&stdout_write,
+	&stdout_writev,
+	NULL,
+	NULL,
+	NULL,
 	&stdout_close,
 	&stdout_deinit
 };
@@ -104,6 +110,20 @@ stdout_write(ds_file_t *file, const void *buf, size_t len)
 	return 1;
 }
 
+static
+int
+stdout_writev(ds_file_t *file, const struct iovec *iov, uint iovcnt)
+{
+	File fd = ((ds_stdout_file_t *) file->ptr)->fd;
+
+	if (!xb_writev_full(fd, iov, iovcnt)) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		return 0;
+	}
+
+	return 1;
+}
+
 static
 int
 stdout_close(ds_file_t *file)
@@ -44,6 +44,8 @@ static ds_ctxt_t *tmpfile_init(const char *root);
 static ds_file_t *tmpfile_open(ds_ctxt_t *ctxt, const char *path,
 			       MY_STAT *mystat);
 static int tmpfile_write(ds_file_t *file, const void *buf, size_t len);
+static int tmpfile_writev(ds_file_t *file, const struct iovec *iov,
+			  uint iovcnt);
 static int tmpfile_close(ds_file_t *file);
 static void tmpfile_deinit(ds_ctxt_t *ctxt);
 
@@ -51,6 +53,10 @@ datasink_t datasink_tmpfile = {
 	&tmpfile_init,
 	&tmpfile_open,
 	&tmpfile_write,
+	&tmpfile_writev,
+	NULL,
+	NULL,
+	NULL,
 	&tmpfile_close,
 	&tmpfile_deinit
 };
@@ -160,6 +166,19 @@ tmpfile_write(ds_file_t *file, const void *buf, size_t len)
 	return 1;
 }
 
+static int
+tmpfile_writev(ds_file_t *file, const struct iovec *iov, uint iovcnt)
+{
+	File fd = ((ds_tmp_file_t *) file->ptr)->fd;
+
+	if (!xb_writev_full(fd, iov, iovcnt)) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		return 0;
+	}
+
+	return 1;
+}
+
 static int
 tmpfile_close(ds_file_t *file)
 {
@@ -23,18 +23,39 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include "common.h"
 #include "datasink.h"
 #include "xbstream.h"
+#include "ds_xbstream.h"
+#include "ds_stdout.h"
 
+/* One independent xbstream output. Chunks of a file are always written to
+the same shard, so each shard is a valid stream that can be extracted on its
+own. */
 typedef struct {
 	xb_wstream_t	*xbstream;
-	ds_file_t	*dest_file;
-	pthread_mutex_t	mutex;
+	ds_file_t	*dest_file;	/* output opened in the destination
+					datasink, unsharded mode only */
+	File		fd;		/* shard output, sharded mode only */
+	char		*path;		/* shard output path */
+} ds_stream_shard_t;
+
+typedef struct {
+	ds_stream_shard_t	*shards;
+	uint			n_shards;
+	uint			next_shard;
+	pthread_mutex_t		mutex;
 } ds_stream_ctxt_t;
 
 typedef struct {
 	xb_wstream_file_t	*xbstream_file;
-	ds_stream_ctxt_t	*stream_ctxt;
+	ds_stream_shard_t	*shard;
 } ds_stream_file_t;
 
+/* Stream format version */
+uint	ds_xbstream_version = XB_STREAM_VERSION_DEFAULT;
+/* Number of xbstream outputs */
+uint	ds_xbstream_shards = 1;
+/* Shard N is written to "<ds_xbstream_shard_path>.N" */
+char	*ds_xbstream_shard_path = NULL;
+
 /***********************************************************************
 General streaming interface */
 
@@ -42,6 +63,8 @@ static ds_ctxt_t *xbstream_init(const char *root);
 static ds_file_t *xbstream_open(ds_ctxt_t *ctxt, const char *path,
 			      MY_STAT *mystat);
 static int xbstream_write(ds_file_t *file, const void *buf, size_t len);
+static int xbstream_writev(ds_file_t *file, const struct iovec *iov,
+			   uint iovcnt);
 static int xbstream_close(ds_file_t *file);
 static void xbstream_deinit(ds_ctxt_t *ctxt);
 
@@ -49,6 +72,10 @@ datasink_t datasink_xbstream = {
 	&xbstream_init,
 	&xbstream_open,
 	&xbstream_write,
+	&xbstream_writev,
+	NULL,
+	NULL,
+	NULL,
 	&xbstream_close,
 	&xbstream_deinit
 };
@@ -56,28 +83,75 @@ datasink_t datasink_xbstream = {
 static
 ssize_t
 my_xbstream_write_callback(xb_wstream_file_t *f __attribute__((unused)),
-		       void *userdata, const void *buf, size_t len)
+		       void *userdata, const struct iovec *iov, uint iovcnt)
 {
-	ds_stream_ctxt_t	*stream_ctxt;
+	ds_stream_shard_t	*shard;
+	size_t			len = 0;
+	uint			i;
+
+	shard = (ds_stream_shard_t *) userdata;
 
-	stream_ctxt = (ds_stream_ctxt_t *) userdata;
+	xb_ad(shard != NULL);
 
-	xb_ad(stream_ctxt != NULL);
-	xb_ad(stream_ctxt->dest_file != NULL);
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
 
-	if (!ds_write(stream_ctxt->dest_file, buf, len)) {
+	/* Called with the shard's stream mutex held */
+	if (shard->dest_file != NULL) {
+		if (!ds_writev(shard->dest_file, iov, iovcnt)) {
+			return len;
+		}
+	} else if (!xb_writev_full(shard->fd, iov, iovcnt)) {
 		return len;
 	}
 	return -1;
 }
 
+/* The stream index is only useful in regular files */
+static
+my_bool
+xbstream_is_seekable(File fd)
+{
+	MY_STAT	mystat;
+
+	return !my_fstat(fd, &mystat, MYF(0)) && MY_S_ISREG(mystat.st_mode);
+}
+
+static
+void
+xbstream_free_shards(ds_stream_ctxt_t *stream_ctxt)
+{
+	uint	i;
+
+	for (i = 0; i < stream_ctxt->n_shards; i++) {
+		ds_stream_shard_t	*shard = stream_ctxt->shards + i;
+
+		if (shard->xbstream != NULL &&
+		    xb_stream_write_done(shard->xbstream)) {
+			msg("xb_stream_done() failed.\n");
+		}
+		if (shard->dest_file != NULL) {
+			ds_close(shard->dest_file);
+		}
+		if (shard->fd >= 0) {
+			my_close(shard->fd, MYF(MY_WME));
+		}
+		my_free(shard->path);
+	}
+
+	my_free(stream_ctxt->shards);
+}
+
 static
 ds_ctxt_t *
 xbstream_init(const char *root __attribute__((unused)))
 {
 	ds_ctxt_t		*ctxt;
 	ds_stream_ctxt_t	*stream_ctxt;
-	xb_wstream_t *xbstream;
+	uint			i;
+
+	xb_a(ds_xbstream_shards > 0);
 
 	ctxt = my_malloc(PSI_NOT_INSTRUMENTED,
 			 sizeof(ds_ctxt_t) + sizeof(ds_stream_ctxt_t),
@@ -86,22 +160,65 @@ xbstream_init(const char *root __attribute__((unused)))
 
 	if (pthread_mutex_init(&stream_ctxt->mutex, NULL)) {
 		msg("xbstream_init: pthread_mutex_init() failed.\n");
-		goto err;
+		my_free(ctxt);
+		return NULL;
 	}
 
-	xbstream = xb_stream_write_new();
-	if (xbstream == NULL) {
-		msg("xb_stream_write_new() failed.\n");
-		goto err;
+	stream_ctxt->n_shards = ds_xbstream_shards;
+	stream_ctxt->next_shard = 0;
+	stream_ctxt->shards = (ds_stream_shard_t *)
+		my_malloc(PSI_NOT_INSTRUMENTED,
+			  sizeof(ds_stream_shard_t) * stream_ctxt->n_shards,
+			  MYF(MY_FAE | MY_ZEROFILL));
+
+	for (i = 0; i < stream_ctxt->n_shards; i++) {
+		ds_stream_shard_t	*shard = stream_ctxt->shards + i;
+
+		shard->fd = -1;
+
+		shard->xbstream = xb_stream_write_new(ds_xbstream_version);
+		if (shard->xbstream == NULL) {
+			msg("xb_stream_write_new() failed.\n");
+			goto err;
+		}
+
+		if (stream_ctxt->n_shards == 1) {
+			/* The output is opened in the destination datasink on
+			the first xbstream_open() */
+			continue;
+		}
+
+		/* Shard outputs may be FIFOs created in advance, so do not
+		insist on creating them. Opening a FIFO blocks until it has a
+		reader. */
+		shard->path = (char *) my_malloc(PSI_NOT_INSTRUMENTED,
+						 strlen(ds_xbstream_shard_path)
+						 + 12, MYF(MY_FAE));
+		sprintf(shard->path, "%s.%u", ds_xbstream_shard_path, i);
+
+		shard->fd = my_open(shard->path,
+				    O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+				    MYF(MY_WME));
+		if (shard->fd < 0) {
+			msg("xbstream_init: failed to open stream shard "
+			    "'%s'.\n", shard->path);
+			goto err;
+		}
+
+		if (xbstream_is_seekable(shard->fd)) {
+			xb_stream_write_set_index(shard->xbstream,
+						  my_xbstream_write_callback,
+						  shard);
+		}
 	}
-	stream_ctxt->xbstream = xbstream;
-	stream_ctxt->dest_file = NULL;
 
 	ctxt->ptr = stream_ctxt;
 
 	return ctxt;
 
 err:
+	xbstream_free_shards(stream_ctxt);
+	pthread_mutex_destroy(&stream_ctxt->mutex);
 	my_free(ctxt);
 	return NULL;
 }
@@ -113,8 +230,8 @@ xbstream_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 	ds_file_t		*file;
 	ds_stream_file_t	*stream_file;
 	ds_stream_ctxt_t	*stream_ctxt;
+	ds_stream_shard_t	*shard;
 	ds_ctxt_t		*dest_ctxt;
-	xb_wstream_t		*xbstream;
 	xb_wstream_file_t	*xbstream_file;
 
 
@@ -123,12 +240,22 @@ xbstream_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 
 	stream_ctxt = (ds_stream_ctxt_t *) ctxt->ptr;
 
+	/* Files are spread over the shards in a round-robin fashion */
 	pthread_mutex_lock(&stream_ctxt->mutex);
-	if (stream_ctxt->dest_file == NULL) {
-		stream_ctxt->dest_file = ds_open(dest_ctxt, path, mystat);
-		if (stream_ctxt->dest_file == NULL) {
+	shard = stream_ctxt->shards +
+		stream_ctxt->next_shard++ % stream_ctxt->n_shards;
+	if (stream_ctxt->n_shards == 1 && shard->dest_file == NULL) {
+		shard->dest_file = ds_open(dest_ctxt, path, mystat);
+		if (shard->dest_file == NULL) {
+			pthread_mutex_unlock(&stream_ctxt->mutex);
 			return NULL;
 		}
+		if (dest_ctxt->datasink == &datasink_stdout &&
+		    xbstream_is_seekable(fileno(stdout))) {
+			xb_stream_write_set_index(shard->xbstream,
+						  my_xbstream_write_callback,
+						  shard);
+		}
 	}
 	pthread_mutex_unlock(&stream_ctxt->mutex);
 
@@ -138,10 +265,8 @@ xbstream_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 				       MYF(MY_FAE));
 	stream_file = (ds_stream_file_t *) (file + 1);
 
-	xbstream = stream_ctxt->xbstream;
-
-	xbstream_file = xb_stream_write_open(xbstream, path, mystat,
-		                             stream_ctxt,
+	xbstream_file = xb_stream_write_open(shard->xbstream, path, mystat,
+		                             shard,
 					     my_xbstream_write_callback);
 
 	if (xbstream_file == NULL) {
@@ -150,17 +275,14 @@ xbstream_open(ds_ctxt_t *ctxt, const char *path, MY_STAT *mystat)
 	}
 
 	stream_file->xbstream_file = xbstream_file;
-	stream_file->stream_ctxt = stream_ctxt;
+	stream_file->shard = shard;
 	file->ptr = stream_file;
-	file->path = stream_ctxt->dest_file->path;
+	file->path = shard->dest_file != NULL ? shard->dest_file->path
+					      : shard->path;
 
 	return file;
 
 err:
-	if (stream_ctxt->dest_file) {
-		ds_close(stream_ctxt->dest_file);
-		stream_ctxt->dest_file = NULL;
-	}
 	my_free(file);
 
 	return NULL;
@@ -186,6 +308,25 @@ xbstream_write(ds_file_t *file, const void *buf, size_t len)
 	return 0;
 }
 
+static
+int
+xbstream_writev(ds_file_t *file, const struct iovec *iov, uint iovcnt)
+{
+	ds_stream_file_t	*stream_file;
+	xb_wstream_file_t	*xbstream_file;
+
+	stream_file = (ds_stream_file_t *) file->ptr;
+
+	xbstream_file = stream_file->xbstream_file;
+
+	if (xb_stream_write_datav(xbstream_file, iov, iovcnt)) {
+		msg("xb_stream_write_datav() failed.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
 static
 int
 xbstream_close(ds_file_t *file)
@@ -210,14 +351,7 @@ xbstream_deinit(ds_ctxt_t *ctxt)
 
 	stream_ctxt = (ds_stream_ctxt_t *) ctxt->ptr;
 
-	if (xb_stream_write_done(stream_ctxt->xbstream)) {
-		msg("xb_stream_done() failed.\n");
-	}
-
-	if (stream_ctxt->dest_file) {
-		ds_close(stream_ctxt->dest_file);
-		stream_ctxt->dest_file = NULL;
-	}
+	xbstream_free_shards(stream_ctxt);
 
 	pthread_mutex_destroy(&stream_ctxt->mutex);
 
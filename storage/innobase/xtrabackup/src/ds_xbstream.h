@@ -25,4 +25,9 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 extern datasink_t datasink_xbstream;
 
+/* Streaming options */
+extern uint	ds_xbstream_version;
+extern uint	ds_xbstream_shards;
+extern char	*ds_xbstream_shard_path;
+
 #endif
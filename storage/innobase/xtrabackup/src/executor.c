@@ -0,0 +1,519 @@
+/******************************************************
+Copyright (c) 2018 Percona LLC and/or its affiliates.
+
+Shared task executor for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_base.h>
+#include "common.h"
+#include "executor.h"
+
+/* Initial number of slots in a worker deque, must be a power of 2 */
+#define XB_DEQUE_INITIAL_SIZE		64
+
+/* Number of queued tasks per worker thread above which submitters execute
+tasks themselves */
+#define XB_EXECUTOR_BACKLOG_PER_THREAD	8
+
+typedef struct {
+	xb_task_func_t	func;
+	void		*arg;
+	xb_task_group_t	*group;
+} xb_task_t;
+
+typedef struct {
+	pthread_mutex_t	mutex;
+	xb_task_t	*tasks;
+	size_t		size;
+	size_t		top;		/* tasks are stolen from here */
+	size_t		bottom;		/* the owner pushes and pops here */
+} xb_task_deque_t;
+
+typedef struct {
+	pthread_t	id;
+	uint		num;
+	xb_executor_t	*executor;
+	xb_task_deque_t	deque;
+} xb_worker_t;
+
+struct xb_executor_struct {
+	xb_worker_t	*workers;
+	uint		nworkers;
+	uint		refcount;
+	uint		next_worker;	/* round-robin for outside submitters */
+	long		queued;
+	long		max_queued;
+	uint		sleeping;
+	my_bool		cancelled;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+};
+
+uint xb_executor_threads = 0;
+
+static xb_executor_t	*global_executor = NULL;
+static pthread_mutex_t	global_executor_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Maps worker threads to their xb_worker_t, NULL for other threads */
+static pthread_key_t	worker_key;
+static pthread_once_t	worker_key_once = PTHREAD_ONCE_INIT;
+
+static void *executor_worker_thread_func(void *arg);
+
+static
+void
+create_worker_key(void)
+{
+	pthread_key_create(&worker_key, NULL);
+}
+
+static
+void
+deque_init(xb_task_deque_t *deque)
+{
+	pthread_mutex_init(&deque->mutex, NULL);
+	deque->size = XB_DEQUE_INITIAL_SIZE;
+	deque->tasks = (xb_task_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					       sizeof(xb_task_t) * deque->size,
+					       MYF(MY_FAE));
+	deque->top = deque->bottom = 0;
+}
+
+static
+void
+deque_destroy(xb_task_deque_t *deque)
+{
+	xb_ad(deque->top == deque->bottom);
+
+	pthread_mutex_destroy(&deque->mutex);
+	my_free(deque->tasks);
+}
+
+static
+void
+deque_push_bottom(xb_task_deque_t *deque, const xb_task_t *task)
+{
+	pthread_mutex_lock(&deque->mutex);
+
+	if (deque->bottom - deque->top == deque->size) {
+		/* Full, double the ring keeping the order of tasks */
+		size_t		new_size = deque->size * 2;
+		xb_task_t	*tasks;
+		size_t		i;
+
+		tasks = (xb_task_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+						sizeof(xb_task_t) * new_size,
+						MYF(MY_FAE));
+		for (i = deque->top; i != deque->bottom; i++) {
+			tasks[i & (new_size - 1)] =
+				deque->tasks[i & (deque->size - 1)];
+		}
+		my_free(deque->tasks);
+		deque->tasks = tasks;
+		deque->size = new_size;
+	}
+
+	deque->tasks[deque->bottom & (deque->size - 1)] = *task;
+	deque->bottom++;
+
+	pthread_mutex_unlock(&deque->mutex);
+}
+
+static
+my_bool
+deque_pop_bottom(xb_task_deque_t *deque, xb_task_t *task)
+{
+	my_bool	found = FALSE;
+
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->bottom != deque->top) {
+		deque->bottom--;
+		*task = deque->tasks[deque->bottom & (deque->size - 1)];
+		found = TRUE;
+	}
+	pthread_mutex_unlock(&deque->mutex);
+
+	return found;
+}
+
+static
+my_bool
+deque_steal_top(xb_task_deque_t *deque, xb_task_t *task)
+{
+	my_bool	found = FALSE;
+
+	pthread_mutex_lock(&deque->mutex);
+	if (deque->bottom != deque->top) {
+		*task = deque->tasks[deque->top & (deque->size - 1)];
+		deque->top++;
+		found = TRUE;
+	}
+	pthread_mutex_unlock(&deque->mutex);
+
+	return found;
+}
+
+/************************************************************************
+Take a task for execution: the calling worker's own deque is tried first,
+then the other deques are scanned starting from the next worker.
+@return TRUE if a task was found. */
+static
+my_bool
+executor_get_task(xb_executor_t *executor, xb_worker_t *self, xb_task_t *task)
+{
+	uint	start;
+	uint	i;
+
+	if (self != NULL) {
+		if (deque_pop_bottom(&self->deque, task)) {
+			goto found;
+		}
+		start = self->num + 1;
+	} else {
+		start = executor->next_worker;
+	}
+
+	for (i = 0; i < executor->nworkers; i++) {
+		xb_worker_t *victim =
+			executor->workers + (start + i) % executor->nworkers;
+
+		if (victim != self && deque_steal_top(&victim->deque, task)) {
+			goto found;
+		}
+	}
+
+	return FALSE;
+
+found:
+	pthread_mutex_lock(&executor->mutex);
+	executor->queued--;
+	pthread_mutex_unlock(&executor->mutex);
+
+	return TRUE;
+}
+
+static
+void
+task_group_complete(xb_task_group_t *group)
+{
+	pthread_mutex_lock(&group->mutex);
+	xb_a(group->pending > 0);
+	if (--group->pending == 0) {
+		pthread_cond_broadcast(&group->cond);
+	}
+	pthread_mutex_unlock(&group->mutex);
+}
+
+static
+void
+executor_run_task(const xb_task_t *task)
+{
+	task->func(task->arg);
+
+	if (task->group != NULL) {
+		task_group_complete(task->group);
+	}
+}
+
+static
+xb_executor_t *
+executor_create(uint n)
+{
+	xb_executor_t	*executor;
+	uint		i;
+
+	pthread_once(&worker_key_once, create_worker_key);
+
+	executor = (xb_executor_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					       sizeof(xb_executor_t),
+					       MYF(MY_FAE | MY_ZEROFILL));
+	executor->workers = (xb_worker_t *)
+		my_malloc(PSI_NOT_INSTRUMENTED, sizeof(xb_worker_t) * n,
+			  MYF(MY_FAE | MY_ZEROFILL));
+	executor->max_queued = (long) n * XB_EXECUTOR_BACKLOG_PER_THREAD;
+
+	pthread_mutex_init(&executor->mutex, NULL);
+	pthread_cond_init(&executor->cond, NULL);
+
+	for (i = 0; i < n; i++) {
+		xb_worker_t *worker = executor->workers + i;
+
+		worker->num = i;
+		worker->executor = executor;
+		deque_init(&worker->deque);
+	}
+
+	for (i = 0; i < n; i++) {
+		xb_worker_t *worker = executor->workers + i;
+
+		if (pthread_create(&worker->id, NULL,
+				   executor_worker_thread_func, worker)) {
+			msg("executor: pthread_create() failed: "
+			    "errno = %d\n", errno);
+			goto err;
+		}
+		executor->nworkers++;
+	}
+
+	return executor;
+
+err:
+	pthread_mutex_lock(&executor->mutex);
+	executor->cancelled = TRUE;
+	pthread_cond_broadcast(&executor->cond);
+	pthread_mutex_unlock(&executor->mutex);
+
+	for (i = 0; i < executor->nworkers; i++) {
+		pthread_join(executor->workers[i].id, NULL);
+	}
+	for (i = 0; i < n; i++) {
+		deque_destroy(&executor->workers[i].deque);
+	}
+
+	pthread_cond_destroy(&executor->cond);
+	pthread_mutex_destroy(&executor->mutex);
+	my_free(executor->workers);
+	my_free(executor);
+
+	return NULL;
+}
+
+static
+void
+executor_destroy(xb_executor_t *executor)
+{
+	uint	i;
+
+	pthread_mutex_lock(&executor->mutex);
+	executor->cancelled = TRUE;
+	pthread_cond_broadcast(&executor->cond);
+	pthread_mutex_unlock(&executor->mutex);
+
+	for (i = 0; i < executor->nworkers; i++) {
+		pthread_join(executor->workers[i].id, NULL);
+		deque_destroy(&executor->workers[i].deque);
+	}
+
+	pthread_cond_destroy(&executor->cond);
+	pthread_mutex_destroy(&executor->mutex);
+	my_free(executor->workers);
+	my_free(executor);
+}
+
+/************************************************************************
+Get a reference to the shared executor, creating it on first use with
+xb_executor_threads workers, or 'hint' workers if xb_executor_threads is 0.
+@return executor handle or NULL on error. */
+xb_executor_t *
+xb_executor_acquire(uint hint)
+{
+	xb_executor_t	*executor;
+
+	pthread_mutex_lock(&global_executor_mutex);
+
+	if (global_executor == NULL) {
+		uint n = xb_executor_threads ? xb_executor_threads : hint;
+
+		global_executor = executor_create(n > 0 ? n : 1);
+	}
+
+	executor = global_executor;
+	if (executor != NULL) {
+		executor->refcount++;
+	}
+
+	pthread_mutex_unlock(&global_executor_mutex);
+
+	return executor;
+}
+
+/************************************************************************
+Release a reference obtained with xb_executor_acquire(). The worker threads
+are stopped when the last reference is released. */
+void
+xb_executor_release(xb_executor_t *executor)
+{
+	pthread_mutex_lock(&global_executor_mutex);
+
+	xb_a(executor == global_executor);
+	xb_a(executor->refcount > 0);
+
+	if (--executor->refcount == 0) {
+		executor_destroy(executor);
+		global_executor = NULL;
+	}
+
+	pthread_mutex_unlock(&global_executor_mutex);
+}
+
+/************************************************************************
+@return number of worker threads in the executor. */
+uint
+xb_executor_get_n_threads(const xb_executor_t *executor)
+{
+	return executor->nworkers;
+}
+
+/************************************************************************
+Submit a task for execution. When the number of queued tasks exceeds the
+executor's backlog limit, the task is executed by the calling thread
+instead, which throttles producers that outrun the workers. */
+void
+xb_executor_submit(xb_executor_t *executor, xb_task_group_t *group,
+		   xb_task_func_t func, void *arg)
+{
+	xb_worker_t	*self;
+	xb_task_t	task;
+	my_bool		backlogged;
+
+	pthread_mutex_lock(&executor->mutex);
+	backlogged = executor->queued >= executor->max_queued;
+	pthread_mutex_unlock(&executor->mutex);
+
+	if (backlogged) {
+		func(arg);
+		return;
+	}
+
+	task.func = func;
+	task.arg = arg;
+	task.group = group;
+
+	if (group != NULL) {
+		pthread_mutex_lock(&group->mutex);
+		group->pending++;
+		pthread_mutex_unlock(&group->mutex);
+	}
+
+	self = (xb_worker_t *) pthread_getspecific(worker_key);
+	if (self != NULL && self->executor == executor) {
+		deque_push_bottom(&self->deque, &task);
+	} else {
+		uint	num;
+
+		pthread_mutex_lock(&executor->mutex);
+		num = executor->next_worker++ % executor->nworkers;
+		pthread_mutex_unlock(&executor->mutex);
+
+		deque_push_bottom(&executor->workers[num].deque, &task);
+	}
+
+	pthread_mutex_lock(&executor->mutex);
+	executor->queued++;
+	if (executor->sleeping > 0) {
+		pthread_cond_signal(&executor->cond);
+	}
+	pthread_mutex_unlock(&executor->mutex);
+}
+
+/************************************************************************
+Initialize a task group. */
+void
+xb_task_group_init(xb_task_group_t *group)
+{
+	pthread_mutex_init(&group->mutex, NULL);
+	pthread_cond_init(&group->cond, NULL);
+	group->pending = 0;
+}
+
+/************************************************************************
+Wait until all tasks of the group have completed. The calling thread
+executes queued tasks while waiting, so waiting from a worker thread never
+deadlocks the pool. */
+void
+xb_task_group_wait(xb_executor_t *executor, xb_task_group_t *group)
+{
+	xb_worker_t	*self;
+	xb_task_t	task;
+
+	self = (xb_worker_t *) pthread_getspecific(worker_key);
+	if (self != NULL && self->executor != executor) {
+		self = NULL;
+	}
+
+	while (1) {
+		pthread_mutex_lock(&group->mutex);
+		if (group->pending == 0) {
+			pthread_mutex_unlock(&group->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&group->mutex);
+
+		if (executor_get_task(executor, self, &task)) {
+			executor_run_task(&task);
+			continue;
+		}
+
+		/* Nothing left to help with, the remaining tasks of the group
+		are being executed by other threads. */
+		pthread_mutex_lock(&group->mutex);
+		while (group->pending > 0) {
+			pthread_cond_wait(&group->cond, &group->mutex);
+		}
+		pthread_mutex_unlock(&group->mutex);
+	}
+}
+
+/************************************************************************
+Destroy a task group. */
+void
+xb_task_group_destroy(xb_task_group_t *group)
+{
+	xb_ad(group->pending == 0);
+
+	pthread_cond_destroy(&group->cond);
+	pthread_mutex_destroy(&group->mutex);
+}
+
+static
+void *
+executor_worker_thread_func(void *arg)
+{
+	xb_worker_t	*self = (xb_worker_t *) arg;
+	xb_executor_t	*executor = self->executor;
+	xb_task_t	task;
+
+	pthread_setspecific(worker_key, self);
+
+	/* Tasks may use mysys, e.g. the data copying tasks */
+	my_thread_init();
+
+	while (1) {
+		if (executor_get_task(executor, self, &task)) {
+			executor_run_task(&task);
+			continue;
+		}
+
+		pthread_mutex_lock(&executor->mutex);
+		while (executor->queued <= 0 && !executor->cancelled) {
+			executor->sleeping++;
+			pthread_cond_wait(&executor->cond, &executor->mutex);
+			executor->sleeping--;
+		}
+		if (executor->queued <= 0 && executor->cancelled) {
+			pthread_mutex_unlock(&executor->mutex);
+			break;
+		}
+		pthread_mutex_unlock(&executor->mutex);
+	}
+
+	my_thread_end();
+
+	pthread_setspecific(worker_key, NULL);
+
+	return NULL;
+}
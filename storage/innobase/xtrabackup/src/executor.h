@@ -0,0 +1,92 @@
+/******************************************************
+Copyright (c) 2018 Percona LLC and/or its affiliates.
+
+Shared task executor for XtraBackup.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XB_EXECUTOR_H
+#define XB_EXECUTOR_H
+
+#include <my_global.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A process-wide pool of worker threads shared by all datasinks. Every
+worker owns a deque of tasks: tasks submitted by a worker are pushed to and
+popped from the bottom of its own deque, idle workers steal from the top of
+the other deques. Tasks submitted by threads outside of the pool are
+distributed over the worker deques in a round-robin fashion. */
+
+typedef struct xb_executor_struct xb_executor_t;
+
+typedef void (*xb_task_func_t)(void *arg);
+
+/* Tracks completion of a batch of tasks submitted together. */
+typedef struct {
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+	uint		pending;
+} xb_task_group_t;
+
+/* Number of worker threads in the shared executor. 0 means that the pool is
+sized by the first datasink that acquires it. */
+extern uint xb_executor_threads;
+
+/************************************************************************
+Get a reference to the shared executor, creating it on first use with
+xb_executor_threads workers, or 'hint' workers if xb_executor_threads is 0.
+@return executor handle or NULL on error. */
+xb_executor_t *xb_executor_acquire(uint hint);
+
+/************************************************************************
+Release a reference obtained with xb_executor_acquire(). The worker threads
+are stopped when the last reference is released. */
+void xb_executor_release(xb_executor_t *executor);
+
+/************************************************************************
+@return number of worker threads in the executor. */
+uint xb_executor_get_n_threads(const xb_executor_t *executor);
+
+/************************************************************************
+Submit a task for execution. When the number of queued tasks exceeds the
+executor's backlog limit, the task is executed by the calling thread
+instead, which throttles producers that outrun the workers. */
+void xb_executor_submit(xb_executor_t *executor, xb_task_group_t *group,
+			xb_task_func_t func, void *arg);
+
+/************************************************************************
+Initialize a task group. */
+void xb_task_group_init(xb_task_group_t *group);
+
+/************************************************************************
+Wait until all tasks of the group have completed. The calling thread
+executes queued tasks while waiting, so waiting from a worker thread never
+deadlocks the pool. */
+void xb_task_group_wait(xb_executor_t *executor, xb_task_group_t *group);
+
+/************************************************************************
+Destroy a task group. */
+void xb_task_group_destroy(xb_task_group_t *group);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* XB_EXECUTOR_H */
@@ -38,6 +38,19 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 /* Size of read buffer in pages (640 pages = 10M for 16K sized pages) */
 #define XB_FIL_CUR_PAGES 640
 
+/* Read buffers are recycled between cursors rather than allocated for every
+file. A buffer can outlive its cursor while a datasink still holds it. */
+static ds_buf_pool_t	*read_buf_pool = NULL;
+static pthread_once_t	read_buf_pool_once = PTHREAD_ONCE_INIT;
+
+static
+void
+read_buf_pool_create(void)
+{
+	read_buf_pool = ds_buf_pool_create(opt_read_buffer_size,
+					   UNIV_PAGE_SIZE);
+}
+
 /***********************************************************************
 Extracts the relative path ("database/table.ibd") of a tablespace from a
 specified possibly absolute path.
@@ -143,7 +156,7 @@ xb_fil_cur_open(
 
 	/* Initialize these first so xb_fil_cur_close() handles them correctly
 	in case of error */
-	cursor->orig_buf = NULL;
+	cursor->read_buf = NULL;
 	cursor->node = NULL;
 
 	cursor->space_id = node->space->id;
@@ -210,7 +223,8 @@ xb_fil_cur_open(
 		return(XB_FIL_CUR_ERROR);
 	}
 
-	if (srv_unix_file_flush_method == SRV_UNIX_O_DIRECT
+	if (opt_direct_io
+	    || srv_unix_file_flush_method == SRV_UNIX_O_DIRECT
 	    || srv_unix_file_flush_method == SRV_UNIX_O_DIRECT_NO_FSYNC) {
 
 		os_file_set_nocache(cursor->file.m_file, node->name, "OPEN");
@@ -242,10 +256,9 @@ xb_fil_cur_open(
 	ut_a(opt_read_buffer_size >= UNIV_PAGE_SIZE);
 	/* Allocate read buffer */
 	cursor->buf_size = opt_read_buffer_size;
-	cursor->orig_buf = static_cast<byte *>
-		(ut_malloc_nokey(cursor->buf_size + UNIV_PAGE_SIZE));
-	cursor->buf = static_cast<byte *>
-		(ut_align(cursor->orig_buf, UNIV_PAGE_SIZE));
+	pthread_once(&read_buf_pool_once, read_buf_pool_create);
+	cursor->read_buf = ds_buf_get(read_buf_pool);
+	cursor->buf = static_cast<byte *>(cursor->read_buf->data);
 
 	cursor->buf_read = 0;
 	cursor->buf_npages = 0;
@@ -273,6 +286,73 @@ xb_fil_cur_open(
 	return(XB_FIL_CUR_SUCCESS);
 }
 
+/************************************************************************
+Checks a page read from the source file or from a copy of it, decrypting and
+decompressing it into the cursor scratch pages if needed.
+
+@return true if the page is corrupted */
+static
+bool
+xb_fil_cur_page_is_corrupted(
+/*=========================*/
+	xb_fil_cur_t*		cursor,		/*!< in/out: source file
+						cursor */
+	byte*			page,		/*!< in/out: page */
+	const IORequest&	read_request,	/*!< in: request with the
+						encryption key */
+	const page_size_t&	page_size)	/*!< in: page size */
+{
+	if (Encryption::is_encrypted_page(page)) {
+		Encryption	encryption(read_request.encryption_algorithm());
+
+		memcpy(cursor->decrypt, page, cursor->page_size);
+		if (encryption.decrypt(read_request, cursor->decrypt,
+				       cursor->page_size, cursor->scratch,
+				       cursor->page_size) != DB_SUCCESS) {
+			return(true);
+		}
+
+		if (Compression::is_compressed_page(cursor->decrypt)
+		    && os_file_decompress_page(false, cursor->decrypt,
+					       cursor->scratch,
+					       cursor->page_size)
+		    != DB_SUCCESS) {
+			return(true);
+		}
+
+		return(buf_page_is_corrupted(TRUE, cursor->decrypt,
+					     page_size, false));
+	}
+
+	if (Compression::is_compressed_page(page)
+	    && os_file_decompress_page(false, page, cursor->scratch,
+				       cursor->page_size) != DB_SUCCESS) {
+		return(true);
+	}
+
+	return(buf_page_is_corrupted(TRUE, page, page_size, false));
+}
+
+/************************************************************************
+@return whether a page of the source file is in the doublewrite buffer, whose
+pages are not verified */
+static
+bool
+xb_fil_cur_is_doublewrite_page(
+/*===========================*/
+	const xb_fil_cur_t*	cursor,	/*!< in: source file cursor */
+	ulint			page_no)/*!< in: page number */
+{
+	if (cursor->is_system &&
+	    page_no >= FSP_EXTENT_SIZE &&
+	    page_no < FSP_EXTENT_SIZE * 3) {
+		xb_a(cursor->page_size == UNIV_PAGE_SIZE);
+		return(true);
+	}
+
+	return(false);
+}
+
 /************************************************************************
 Reads and verifies the next block of pages from the source
 file. Positions the cursor after the last read non-corrupted page.
@@ -311,6 +391,14 @@ xb_fil_cur_read(
 		return(XB_FIL_CUR_EOF);
 	}
 
+	/* The datasinks may still hold the previous block of pages, e.g. in a
+	write-behind queue. Read into another buffer then. */
+	if (cursor->read_buf->ref_count > 1) {
+		ds_buf_unref(cursor->read_buf);
+		cursor->read_buf = ds_buf_get(read_buf_pool);
+		cursor->buf = static_cast<byte *>(cursor->read_buf->data);
+	}
+
 	if (to_read > (ib_uint64_t) cursor->buf_size) {
 		to_read = (ib_uint64_t) cursor->buf_size;
 	}
@@ -377,56 +465,13 @@ read_retry:
 	for (page = cursor->buf, i = 0; i < npages;
 	     page += cursor->page_size, i++) {
 
-		if (Encryption::is_encrypted_page(page)) {
-			dberr_t		ret;
-			Encryption	encryption(
-				read_request.encryption_algorithm());
-
-			memcpy(cursor->decrypt, page, cursor->page_size);
-			ret = encryption.decrypt(read_request, cursor->decrypt,
-						 cursor->page_size,
-						 cursor->scratch,
-						 cursor->page_size);
-			if (ret != DB_SUCCESS) {
-				goto corruption;
-			}
-
-			if (Compression::is_compressed_page(cursor->decrypt)) {
-				if (os_file_decompress_page(false,
-				    cursor->decrypt, cursor->scratch,
-				    cursor->page_size) != DB_SUCCESS) {
-					goto corruption;
-				}
-			}
-
-			if (buf_page_is_corrupted(TRUE, cursor->decrypt,
-						  page_size, false)) {
-				goto corruption;
-			}
-
-		}
-
-		if (Compression::is_compressed_page(page)) {
-
-			if (os_file_decompress_page(false, page,
-			    cursor->scratch, cursor->page_size) != DB_SUCCESS) {
-				goto corruption;
-			}
-
-		}
-
-		if (!Encryption::is_encrypted_page(page) &&
-		    buf_page_is_corrupted(TRUE, page, page_size, false)) {
-
-corruption:
+		if (xb_fil_cur_page_is_corrupted(cursor, page, read_request,
+						 page_size)) {
 
 			ulint page_no = cursor->buf_page_no + i;
 
-			if (cursor->is_system &&
-			    page_no >= FSP_EXTENT_SIZE &&
-			    page_no < FSP_EXTENT_SIZE * 3) {
+			if (xb_fil_cur_is_doublewrite_page(cursor, page_no)) {
 				/* skip doublewrite buffer pages */
-				xb_a(cursor->page_size == UNIV_PAGE_SIZE);
 				msg("[%02u] xtrabackup: "
 				    "Page %lu is a doublewrite buffer page, "
 				    "skipping.\n", cursor->thread_n, page_no);
@@ -457,7 +502,97 @@ corruption:
 
 	cursor->read_filter->update(&cursor->read_filter_ctxt, n_read, cursor);
 
-	posix_fadvise(cursor->file.m_file, offset, to_read, POSIX_FADV_DONTNEED);
+	/* Direct reads do not populate the page cache */
+	if (!opt_direct_io) {
+		posix_fadvise(cursor->file.m_file, offset, to_read,
+			      POSIX_FADV_DONTNEED);
+	}
+
+	return(ret);
+}
+
+/************************************************************************
+Reads all pages of a copy of the source file, e.g. a reflink clone, and
+verifies them the same way as xb_fil_cur_read() verifies the source pages.
+Must be called before the cursor has read any pages.
+
+@return true if all pages of the copy are valid, false if a page is corrupted
+or the copy cannot be read */
+bool
+xb_fil_cur_verify_copy(
+/*===================*/
+	xb_fil_cur_t*	cursor,	/*!< in/out: source file cursor */
+	const char*	path)	/*!< in: path of the copy */
+{
+	File		fd;
+	MY_STAT		statinfo;
+	my_off_t	size;
+	bool		ret = true;
+	page_size_t	page_size(cursor->zip_size != 0 ?
+				  cursor->zip_size : cursor->page_size,
+				  cursor->page_size,
+				  cursor->zip_size != 0);
+	IORequest	read_request(IORequest::READ);
+
+	read_request.encryption_algorithm(Encryption::AES);
+	read_request.encryption_key(cursor->encryption_key,
+				    cursor->encryption_klen,
+				    cursor->encryption_iv);
+
+	fd = my_open(path, O_RDONLY | O_BINARY, MYF(MY_WME));
+	if (fd < 0) {
+		return(false);
+	}
+
+	if (my_fstat(fd, &statinfo, MYF(MY_WME))) {
+		my_close(fd, MYF(MY_WME));
+		return(false);
+	}
+
+	size = statinfo.st_size & ~((my_off_t) cursor->page_size - 1);
+
+	for (my_off_t offset = 0; offset < size && ret; ) {
+		size_t	to_read = (size_t) ut_min((my_off_t) cursor->buf_size,
+						  size - offset);
+
+		xtrabackup_io_throttling();
+
+		if (my_pread(fd, cursor->buf, to_read, offset,
+			     MYF(MY_WME | MY_NABP))) {
+			ret = false;
+			break;
+		}
+
+		for (ulint i = 0; i < to_read >> cursor->page_size_shift;
+		     i++) {
+			ulint	page_no = (ulint) (offset
+						   >> cursor->page_size_shift)
+				+ i;
+
+			if (xb_fil_cur_page_is_corrupted(
+				    cursor,
+				    cursor->buf + (i << cursor->page_size_shift),
+				    read_request, page_size)
+			    && !xb_fil_cur_is_doublewrite_page(cursor,
+							       page_no)) {
+				msg("[%02u] xtrabackup: page %lu of %s is "
+				    "corrupted.\n", cursor->thread_n,
+				    page_no, path);
+				ret = false;
+				break;
+			}
+		}
+
+		/* Direct reads do not populate the page cache */
+		if (!opt_direct_io) {
+			posix_fadvise(fd, offset, to_read,
+				      POSIX_FADV_DONTNEED);
+		}
+
+		offset += to_read;
+	}
+
+	my_close(fd, MYF(MY_WME));
 
 	return(ret);
 }
@@ -478,11 +613,25 @@ xb_fil_cur_close(
 	if (cursor->decrypt != NULL) {
 		ut_free(cursor->decrypt);
 	}
-	if (cursor->orig_buf != NULL) {
-		ut_free(cursor->orig_buf);
+	if (cursor->read_buf != NULL) {
+		ds_buf_unref(cursor->read_buf);
+		cursor->read_buf = NULL;
 	}
 	if (cursor->node != NULL) {
 		xb_fil_node_close_file(cursor->node);
 		cursor->file = XB_FILE_UNDEFINED;
 	}
 }
+
+/************************************************************************
+Free the read buffers cached for reuse by source file cursors. Must be
+called when no cursors are open. */
+void
+xb_fil_cur_free_buffers(void)
+/*=========================*/
+{
+	if (read_buf_pool != NULL) {
+		ds_buf_pool_destroy(read_buf_pool);
+		read_buf_pool = NULL;
+	}
+}
@@ -27,6 +27,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #include <my_dir.h>
 #include "read_filt.h"
+#include "ds_buf.h"
 
 struct xb_fil_cur_t {
 	pfs_os_file_t	file;		/*!< source file handle */
@@ -47,8 +48,9 @@ struct xb_fil_cur_t {
 	xb_read_filt_t*	read_filter;	/*!< read filter */
 	xb_read_filt_ctxt_t	read_filter_ctxt;
 					/*!< read filter context */
-	byte*		orig_buf;	/*!< read buffer */
-	byte*		buf;		/*!< aligned pointer for orig_buf */
+	ds_buf_t*	read_buf;	/*!< pooled read buffer */
+	byte*		buf;		/*!< aligned pointer to read_buf
+					data */
 	byte*		scratch;	/*!< page to use for temporary
 					decompress */
 	byte*		decrypt;	/*!< page to use for temporary
@@ -105,6 +107,19 @@ xb_fil_cur_read(
 /*============*/
 	xb_fil_cur_t*	cursor);	/*!< in/out: source file cursor */
 
+/************************************************************************
+Reads all pages of a copy of the source file, e.g. a reflink clone, and
+verifies them the same way as xb_fil_cur_read() verifies the source pages.
+Must be called before the cursor has read any pages.
+
+@return true if all pages of the copy are valid, false if a page is corrupted
+or the copy cannot be read */
+bool
+xb_fil_cur_verify_copy(
+/*===================*/
+	xb_fil_cur_t*	cursor,	/*!< in/out: source file cursor */
+	const char*	path);	/*!< in: path of the copy */
+
 /************************************************************************
 Close the source file cursor opened with xb_fil_cur_open() and its
 associated read filter. */
@@ -113,6 +128,13 @@ xb_fil_cur_close(
 /*=============*/
 	xb_fil_cur_t *cursor);	/*!< in/out: source file cursor */
 
+/************************************************************************
+Free the read buffers cached for reuse by source file cursors. Must be
+called when no cursors are open. */
+void
+xb_fil_cur_free_buffers(void);
+/*==========================*/
+
 /***********************************************************************
 Extracts the relative path ("database/table.ibd") of a tablespace from a
 specified possibly absolute path.
@@ -832,9 +832,8 @@ algorithm and key used when the backup was taken MUST be provided via the\n\
 specified options. --decrypt and --decompress may be used together at the same\n\
 time to completely normalize a previously compressed and encrypted backup. The\n\
 --parallel option will allow multiple files to be decrypted and/or decompressed\n\
-simultaneously. In order to decompress, the qpress utility MUST be installed\n\
-and accessable within the path. This process will remove the original\n\
-compressed/encrypted files and leave the results in the same location.\n\
+simultaneously. This process will remove the original compressed/encrypted\n\
+files and leave the results in the same location.\n\
 \n\
 On success the exit code innobackupex is 0. A non-zero exit code \n\
 indicates an error.\n");
@@ -212,7 +212,10 @@ wf_wt_process(xb_write_filt_ctxt_t *ctxt, ds_file_t *dstfile)
 {
 	xb_fil_cur_t			*cursor = ctxt->cursor;
 
-	if (ds_write(dstfile, cursor->buf, cursor->buf_read)) {
+	/* Hand the read buffer over to the datasink chain, which may keep
+	it instead of copying the pages */
+	if (ds_write_buf(dstfile, ds_buf_ref(cursor->read_buf),
+			 cursor->buf_read)) {
 		return(FALSE);
 	}
 
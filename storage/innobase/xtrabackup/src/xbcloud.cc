@@ -27,21 +27,32 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <ev.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <gcrypt.h>
 #include <assert.h>
 #include <my_sys.h>
 #include <my_dir.h>
 #include <my_getopt.h>
+#include <pthread.h>
 #include <algorithm>
+#include <deque>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 #include <jsmn.h>
 #include "xbstream.h"
 
 using std::min;
 using std::max;
 using std::map;
+using std::pair;
+using std::set;
 using std::string;
+using std::deque;
+using std::vector;
 
 #define XBCLOUD_VERSION "1.0"
 
@@ -50,6 +61,12 @@ using std::string;
 
 #define SWIFT_CHUNK_SIZE 11 * 1024 * 1024
 
+#define SWIFT_SEGMENT_SIZE 32 * 1024 * 1024
+
+/* Objects are downloaded in ranges of at most this size, which must fit
+into the SWIFT_CHUNK_SIZE connection buffer */
+#define SWIFT_RANGE_SIZE (8 * 1024 * 1024)
+
 #if ((LIBCURL_VERSION_MAJOR >= 7) && (LIBCURL_VERSION_MINOR >= 16))
 #define OLD_CURL_MULTI 0
 #else
@@ -65,6 +82,8 @@ typedef struct global_io_info_struct global_io_info;
 typedef struct slo_chunk_struct slo_chunk;
 typedef struct container_list_struct container_list;
 typedef struct object_info_struct object_info;
+typedef struct download_part_struct download_part;
+typedef struct storage_backend_struct storage_backend;
 
 struct swift_auth_info_struct {
 	char url[SWIFT_MAX_URL_SIZE];
@@ -82,9 +101,17 @@ struct global_io_info_struct {
 	connection_info **connections;
 	long chunk_no;
 	connection_info *current_connection;
-	const char *url;
+	char *carry;		/* start of a chunk read into a segment
+				of another file */
+	size_t carry_len;
+	size_t carry_size;
+	bool download;
+	container_list *list;	/* objects to download */
+	download_part *parts;	/* byte ranges of the objects */
+	size_t n_parts;
+	size_t next_part;	/* next range to request */
+	size_t next_emit;	/* next range to write to the output */
 	const char *container;
-	const char *token;
 	const char *backup_name;
 };
 
@@ -114,13 +141,19 @@ struct connection_info_struct {
 	char hash[33];
 	size_t chunk_no;
 	bool magic_verified;
+	bool name_parsed;
 	size_t chunk_path_len;
 	xb_chunk_type_t chunk_type;
 	size_t payload_size;
+	size_t chunk_start;	/* offset of the chunk being read */
 	size_t chunk_size;
+	size_t segment_size;	/* size of the uploaded segment */
 	int retry_count;
 	bool upload_started;
 	ulong global_idx;
+	size_t part_no;		/* range being downloaded */
+	bool part_busy;
+	bool part_done;
 };
 
 struct slo_chunk_struct {
@@ -136,6 +169,31 @@ struct object_info_struct {
 	size_t bytes;
 };
 
+struct download_part_struct {
+	size_t object_idx;
+	size_t offset;
+	size_t length;
+};
+
+/* Object store backend. Put and get requests are started on a connection and
+complete in the event loop with conn_upload_done() and conn_download_done(),
+so all backends share the parallel upload and download pipelines. */
+struct storage_backend_struct {
+	/* authenticate */
+	bool (*init)();
+	bool (*create_container)(const char *container);
+	/* list objects with names starting with prefix, sorted by name */
+	container_list *(*list)(const char *container, const char *prefix);
+	bool (*delete_object)(const char *container, const char *name);
+	/* set up and tear down the event loop of the transfers */
+	void (*loop_init)(global_io_info *global);
+	void (*loop_end)(global_io_info *global);
+	/* upload the segment of a connection */
+	void (*put_start)(connection_info *conn);
+	/* download the range conn->part_no */
+	void (*get_start)(connection_info *conn);
+};
+
 struct container_list_struct {
 	size_t content_length;
 	size_t content_bufsize;
@@ -146,9 +204,9 @@ struct container_list_struct {
 	bool final;
 };
 
-enum {SWIFT, S3};
+enum {SWIFT, S3, LOCAL};
 const char *storage_names[] =
-{ "SWIFT", "S3", NullS};
+{ "SWIFT", "S3", "LOCAL", NullS};
 
 static my_bool opt_verbose = 0;
 static ulong opt_storage = SWIFT;
@@ -170,7 +228,13 @@ static const char *opt_swift_auth_version = NULL;
 static const char *opt_name = NULL;
 static const char *opt_cacert = NULL;
 static ulong opt_parallel = 1;
+static ulonglong opt_segment_size = SWIFT_SEGMENT_SIZE;
 static my_bool opt_insecure = 0;
+static my_bool opt_resume = 0;
+static const char *opt_upload_journal = NULL;
+static const char *opt_local_dir = NULL;
+static ulong opt_local_latency = 0;
+static ulonglong opt_local_bandwidth = 0;
 static enum {MODE_GET, MODE_PUT, MODE_DELETE} opt_mode;
 
 static char **file_list = NULL;
@@ -197,8 +261,14 @@ enum {
 	OPT_SWIFT_STORAGE_URL,
 	OPT_SWIFT_AUTH_VERSION,
 	OPT_PARALLEL,
+	OPT_SEGMENT_SIZE,
 	OPT_CACERT,
 	OPT_INSECURE,
+	OPT_RESUME,
+	OPT_UPLOAD_JOURNAL,
+	OPT_LOCAL_DIR,
+	OPT_LOCAL_LATENCY,
+	OPT_LOCAL_BANDWIDTH,
 	OPT_VERBOSE
 };
 
@@ -208,7 +278,7 @@ static struct my_option my_long_options[] =
 	{"help", '?', "Display this help and exit.",
 	 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0},
 
-	{"storage", OPT_STORAGE, "Specify storage type S3/SWIFT.",
+	{"storage", OPT_STORAGE, "Specify storage type S3/SWIFT/LOCAL.",
 	 &opt_storage, &opt_storage, &storage_typelib,
 	 GET_ENUM, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
 
@@ -300,10 +370,16 @@ static struct my_option my_long_options[] =
 	 0, 0, 0, 0, 0, 0},
 
 	{"parallel", OPT_PARALLEL,
-	 "Number of parallel chunk uploads.",
+	 "Number of parallel chunk uploads and downloads.",
 	 &opt_parallel, &opt_parallel, 0, GET_ULONG, REQUIRED_ARG,
 	 1, 0, 0, 0, 0, 0},
 
+	{"segment-size", OPT_SEGMENT_SIZE,
+	 "Consecutive chunks of the same file are uploaded as a single object "
+	 "until it reaches this size. 0 uploads every chunk separately.",
+	 &opt_segment_size, &opt_segment_size, 0, GET_ULL, REQUIRED_ARG,
+	 SWIFT_SEGMENT_SIZE, 0, 4096ULL * 1024 * 1024, 0, 0, 0},
+
 	{"cacert", OPT_CACERT,
 	 "CA certificate file.",
 	 &opt_cacert, &opt_cacert, 0, GET_STR_ALLOC, REQUIRED_ARG,
@@ -314,6 +390,36 @@ static struct my_option my_long_options[] =
 	 &opt_insecure, &opt_insecure, 0, GET_BOOL, NO_ARG,
 	 0, 0, 0, 0, 0, 0},
 
+	{"resume", OPT_RESUME,
+	 "Used with put. Continue an interrupted upload of the same stream: "
+	 "the segments that are already stored with the same size and MD5 "
+	 "are not uploaded again.",
+	 &opt_resume, &opt_resume, 0, GET_BOOL, NO_ARG,
+	 0, 0, 0, 0, 0, 0},
+
+	{"upload-journal", OPT_UPLOAD_JOURNAL,
+	 "Used with put. Append the name, size and MD5 of every uploaded "
+	 "segment to this file, and skip the segments it lists with --resume.",
+	 &opt_upload_journal, &opt_upload_journal, 0, GET_STR_ALLOC,
+	 REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+	{"local-dir", OPT_LOCAL_DIR,
+	 "Directory to store backups into with --storage=local.",
+	 &opt_local_dir, &opt_local_dir, 0, GET_STR_ALLOC, REQUIRED_ARG,
+	 0, 0, 0, 0, 0, 0},
+
+	{"local-latency", OPT_LOCAL_LATENCY,
+	 "Time in milliseconds every request takes with --storage=local, "
+	 "in addition to the transfer time.",
+	 &opt_local_latency, &opt_local_latency, 0, GET_ULONG, REQUIRED_ARG,
+	 0, 0, 0, 0, 0, 0},
+
+	{"local-bandwidth", OPT_LOCAL_BANDWIDTH,
+	 "Transfer rate in bytes per second of every request with "
+	 "--storage=local. 0 means unlimited.",
+	 &opt_local_bandwidth, &opt_local_bandwidth, 0, GET_ULL, REQUIRED_ARG,
+	 0, 0, 0, 0, 0, 0},
+
 	{"verbose", OPT_VERBOSE,
 	 "Turn ON cURL tracing.",
 	 &opt_verbose, &opt_verbose, 0, GET_BOOL, NO_ARG,
@@ -339,6 +445,17 @@ static const char * const masked_args[] = {
 
 static map<string, ulonglong> file_chunk_count;
 
+/* Size and MD5 of the stored segments, by object name */
+static map<string, pair<size_t, string> > stored_objects;
+
+static FILE *upload_journal = NULL;
+/* objects of the backup uploaded or found already stored by this run */
+static set<string> produced_objects;
+
+static const storage_backend *backend;
+
+static swift_auth_info swift_info;
+
 static
 void
 print_version()
@@ -474,8 +591,14 @@ int parse_args(int argc, char **argv)
 			fprintf(stderr, "Swift auth URL is not specified\n");
 			exit(EXIT_FAILURE);
 		}
+	} else if (opt_storage == LOCAL) {
+		if (opt_local_dir == NULL) {
+			fprintf(stderr, "Local directory is not specified\n");
+			exit(EXIT_FAILURE);
+		}
 	} else {
-		fprintf(stderr, "Swift is only supported storage API\n");
+		fprintf(stderr, "Swift and local are the only supported "
+			"storage APIs\n");
 	}
 
 	if (argc > 0) {
@@ -770,7 +893,8 @@ swift_delete_object(swift_auth_info *info, const char *url)
 		}
 		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
 		if (http_code != 200 && /* OK */
-		    http_code != 204    /* no content */) {
+		    http_code != 204 && /* no content */
+		    http_code != 404    /* already deleted */) {
 			fprintf(stderr, "error: request failed "
 				"with response code: %ld\n", http_code);
 			goto cleanup;
@@ -797,39 +921,48 @@ static void conn_buffer_updated(connection_info *conn);
 static connection_info *conn_new(global_io_info *global, ulong global_idx);
 static void conn_cleanup(connection_info *conn);
 static void conn_upload_retry(connection_info *conn);
+static void conn_segment_upload(connection_info *conn);
+static void conn_journal_write(connection_info *conn);
+static void conn_upload_done(connection_info *conn, bool ok);
+static void conn_download_done(connection_info *conn, bool ok);
 
 /* Check for completed transfers, and remove their easy handles */
 static void check_multi_info(global_io_info *g)
 {
-	char *eff_url;
 	CURLMsg *msg;
 	int msgs_left;
 	connection_info *conn;
 	CURL *easy;
+	CURLcode result;
+	long http_code;
 
 	while ((msg = curl_multi_info_read(g->multi, &msgs_left))) {
 		if (msg->msg == CURLMSG_DONE) {
 			easy = msg->easy_handle;
+			result = msg->data.result;
+			http_code = 0;
 			curl_easy_getinfo(easy, CURLINFO_PRIVATE, &conn);
-			curl_easy_getinfo(easy, CURLINFO_EFFECTIVE_URL,
-					  &eff_url);
+			curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE,
+					  &http_code);
 			curl_multi_remove_handle(g->multi, easy);
 			curl_easy_cleanup(easy);
 			conn->easy = NULL;
-			if (conn->chunk_acked) {
-				conn->chunk_uploaded = true;
-				fprintf(stderr, "%s is done\n", conn->hash);
-			} else {
-				fprintf(stderr, "error: chunk %zu '%s' %s "
-					"is not uploaded, but socket closed "
-					"(%zu bytes of %zu left to upload)\n",
-					conn->chunk_no,
-					conn->name,
-					conn->hash,
-					conn->chunk_size - conn->upload_size,
-					conn->chunk_size);
-				conn_upload_retry(conn);
+			if (conn->slist != NULL) {
+				curl_slist_free_all(conn->slist);
+				conn->slist = NULL;
 			}
+			if (!g->download) {
+				conn_upload_done(conn, conn->chunk_acked);
+				continue;
+			}
+			if (result == CURLE_OK &&
+			    (http_code < 200 || http_code >= 300)) {
+				snprintf(conn->error, sizeof(conn->error),
+					 "response code: %ld", http_code);
+			}
+			conn_download_done(conn, result == CURLE_OK &&
+					   http_code >= 200 &&
+					   http_code < 300);
 		}
 	}
 }
@@ -985,7 +1118,7 @@ static connection_info *get_current_connection(global_io_info *global)
 	connection_info *conn = global->current_connection;
 	ulong i;
 
-	if (conn && conn->filled_size < conn->chunk_size)
+	if (conn && !conn->upload_started)
 		return conn;
 
 	for (i = 0; i < opt_parallel; i++) {
@@ -993,6 +1126,18 @@ static connection_info *get_current_connection(global_io_info *global)
 		if (conn->chunk_uploaded || conn->filled_size == 0) {
 			global->current_connection = conn;
 			conn_upload_init(conn);
+			if (global->carry_len > 0) {
+				/* the chunk read last starts this segment */
+				memcpy(conn->buffer, global->carry,
+				       global->carry_len);
+				conn->filled_size = global->carry_len;
+				global->carry_len = 0;
+				conn_buffer_updated(conn);
+				if (conn->upload_started) {
+					/* it was a complete EOF chunk */
+					continue;
+				}
+			}
 			return conn;
 		}
 	}
@@ -1006,13 +1151,14 @@ static void input_cb(EV_P_ struct ev_io *w, int revents)
 	global_io_info *io_global = (global_io_info *)(w->data);
 	connection_info *conn = get_current_connection(io_global);
 
-	if (conn == NULL)
+	if (conn == NULL || io_global->eof)
 		return;
 
-	if (conn->filled_size < conn->chunk_size) {
+	if (conn->filled_size < conn->chunk_start + conn->chunk_size) {
 		if (revents & EV_READ) {
 			ssize_t nbytes = read(io_global->input_fd,
 					      conn->buffer + conn->filled_size,
+					      conn->chunk_start +
 					      conn->chunk_size -
 					      conn->filled_size);
 			if (nbytes > 0) {
@@ -1031,11 +1177,16 @@ static void input_cb(EV_P_ struct ev_io *w, int revents)
 			} else {
 				io_global->eof = 1;
 				ev_io_stop(io_global->loop, w);
+				/* upload the last segment */
+				if (conn->chunk_start > 0 &&
+				    conn->filled_size == conn->chunk_start) {
+					conn_segment_upload(conn);
+				}
 			}
 		}
 	}
 
-	assert(conn->filled_size <= conn->chunk_size);
+	assert(conn->filled_size <= conn->chunk_start + conn->chunk_size);
 }
 
 static int swift_upload_read_cb(char *ptr, size_t size, size_t nmemb,
@@ -1046,13 +1197,13 @@ static int swift_upload_read_cb(char *ptr, size_t size, size_t nmemb,
 	connection_info *conn = (connection_info*)(data);
 
 	if (conn->filled_size == conn->upload_size &&
-	    conn->upload_size < conn->chunk_size && !conn->global->eof) {
+	    conn->upload_size < conn->segment_size && !conn->global->eof) {
 		ssize_t nbytes;
 		assert(conn->global->current_connection == conn);
 		do {
 			nbytes = read(conn->global->input_fd,
 				      conn->buffer + conn->filled_size,
-				      conn->chunk_size - conn->filled_size);
+				      conn->segment_size - conn->filled_size);
 		} while (nbytes == -1 && errno == EAGAIN);
 		if (nbytes > 0) {
 			conn->filled_size += nbytes;
@@ -1067,7 +1218,7 @@ static int swift_upload_read_cb(char *ptr, size_t size, size_t nmemb,
 	memcpy(ptr, conn->buffer + conn->upload_size, realsize);
 	conn->upload_size += realsize;
 
-	assert(conn->filled_size <= conn->chunk_size);
+	assert(conn->filled_size <= conn->segment_size);
 	assert(conn->upload_size <= conn->filled_size);
 
 	return realsize;
@@ -1092,17 +1243,27 @@ size_t upload_header_read_cb(char *ptr, size_t size, size_t nmemb,
 	return nmemb * size;
 }
 
-static int conn_upload_init(connection_info *conn)
+/*********************************************************************//**
+Prepare to parse the next chunk of the segment. */
+static void conn_chunk_init(connection_info *conn)
 {
-	conn->filled_size = 0;
-	conn->upload_size = 0;
-	conn->chunk_uploaded = false;
-	conn->chunk_acked = false;
 	conn->chunk_size = CHUNK_HEADER_CONSTANT_LEN;
 	conn->magic_verified = false;
+	conn->name_parsed = false;
 	conn->chunk_path_len = 0;
 	conn->chunk_type = XB_CHUNK_TYPE_UNKNOWN;
 	conn->payload_size = 0;
+}
+
+static int conn_upload_init(connection_info *conn)
+{
+	conn->filled_size = 0;
+	conn->upload_size = 0;
+	conn->chunk_uploaded = false;
+	conn->chunk_acked = false;
+	conn->chunk_start = 0;
+	conn->segment_size = 0;
+	conn_chunk_init(conn);
 	conn->upload_started = false;
 	conn->retry_count = 0;
 	if (conn->name != NULL) {
@@ -1121,42 +1282,70 @@ static int conn_upload_init(connection_info *conn)
 	return 0;
 }
 
+/*********************************************************************//**
+Format the name of the segment object of the connection. */
+static void conn_object_name(connection_info *conn, char *buf, size_t size)
+{
+	snprintf(buf, size, "%s/%s.%020zu", conn->global->backup_name,
+		 conn->name, conn->chunk_no);
+}
+
+/*********************************************************************//**
+Record an uploaded or skipped segment in the upload journal. The journal starts with a
+"segment-size N" line, as the segments of a resumed upload only match the
+stored ones when the stream is split the same way. */
+static void conn_journal_write(connection_info *conn)
+{
+	char object_name[SWIFT_MAX_URL_SIZE];
+
+	if (upload_journal == NULL) {
+		return;
+	}
+
+	conn_object_name(conn, object_name, sizeof(object_name));
+
+	if (fprintf(upload_journal, "%s %zu %s\n", conn->hash,
+		    conn->segment_size, object_name) < 0 ||
+	    fflush(upload_journal) != 0) {
+		fprintf(stderr, "error: failed to write the upload journal "
+			"%s\n", opt_upload_journal);
+		exit(EXIT_FAILURE);
+	}
+}
+
 static void conn_upload_prepare(connection_info *conn)
 {
 	gcry_md_hd_t md5;
 
 	gcry_md_open(&md5, GCRY_MD_MD5, 0);
-	gcry_md_write(md5, conn->buffer, conn->chunk_size);
+	gcry_md_write(md5, conn->buffer, conn->segment_size);
 	hex_md5(gcry_md_read(md5, GCRY_MD_MD5), conn->hash);
 	gcry_md_close(md5);
 }
 
-static int conn_upload_start(connection_info *conn)
+static void swift_put_start(connection_info *conn)
 {
 	char token_header[SWIFT_MAX_HDR_SIZE];
 	char object_url[SWIFT_MAX_URL_SIZE];
+	char object_name[SWIFT_MAX_URL_SIZE];
 	char content_len[200], etag[200];
 	global_io_info *global;
 	CURLMcode rc;
 
 	global = conn->global;
 
-	fprintf(stderr, "uploading chunk %s/%s/%s.%020zu "
-			"(md5: %s, size: %zu)\n",
-			global->container, global->backup_name, conn->name,
-			conn->chunk_no, conn->hash, conn->chunk_size);
+	conn_object_name(conn, object_name, sizeof(object_name));
 
-	snprintf(object_url, array_elements(object_url), "%s/%s/%s/%s.%020zu",
-		 global->url, global->container, global->backup_name,
-		 conn->name, conn->chunk_no);
+	snprintf(object_url, array_elements(object_url), "%s/%s/%s",
+		 swift_info.url, global->container, object_name);
 
 	snprintf(content_len, sizeof(content_len), "Content-Length: %lu",
-		(ulong)(conn->chunk_size));
+		(ulong)(conn->segment_size));
 
 	snprintf(etag, sizeof(etag), "ETag: %s", conn->hash);
 
 	snprintf(token_header, array_elements(token_header),
-		 "X-Auth-Token: %s", global->token);
+		 "X-Auth-Token: %s", swift_info.token);
 
 	conn->slist = curl_slist_append(conn->slist, token_header);
 	conn->slist = curl_slist_append(conn->slist,
@@ -1170,7 +1359,7 @@ static int conn_upload_start(connection_info *conn)
 	conn->easy = curl_easy_init();
 	if (!conn->easy) {
 		fprintf(stderr, "error: curl_easy_init() failed\n");
-		return 1;
+		exit(EXIT_FAILURE);
 	}
 	curl_easy_setopt(conn->easy, CURLOPT_URL, object_url);
 	curl_easy_setopt(conn->easy, CURLOPT_READFUNCTION,
@@ -1188,7 +1377,7 @@ static int conn_upload_start(connection_info *conn)
 				     upload_header_read_cb);
 	curl_easy_setopt(conn->easy, CURLOPT_HEADERDATA, conn);
 	curl_easy_setopt(conn->easy, CURLOPT_INFILESIZE,
-				     (long) conn->chunk_size);
+				     (long) conn->segment_size);
 	if (opt_cacert != NULL)
 		curl_easy_setopt(conn->easy, CURLOPT_CAINFO, opt_cacert);
 	if (opt_insecure)
@@ -1203,10 +1392,41 @@ static int conn_upload_start(connection_info *conn)
 					   &global->still_running);
 	} while(rc == CURLM_CALL_MULTI_PERFORM);
 #endif
+}
+
+static void conn_upload_start(connection_info *conn)
+{
+	global_io_info *global = conn->global;
+
+	fprintf(stderr, "uploading chunk %s/%s/%s.%020zu "
+			"(md5: %s, size: %zu)\n",
+			global->container, global->backup_name, conn->name,
+			conn->chunk_no, conn->hash, conn->segment_size);
 
 	conn->upload_started = true;
 
-	return 0;
+	backend->put_start(conn);
+}
+
+/*********************************************************************//**
+Handle a finished segment upload, retry it on failure. */
+static void conn_upload_done(connection_info *conn, bool ok)
+{
+	if (ok) {
+		conn->chunk_uploaded = true;
+		fprintf(stderr, "%s is done\n", conn->hash);
+		conn_journal_write(conn);
+	} else {
+		fprintf(stderr, "error: chunk %zu '%s' %s "
+			"is not uploaded, but socket closed "
+			"(%zu bytes of %zu left to upload)\n",
+			conn->chunk_no,
+			conn->name,
+			conn->hash,
+			conn->segment_size - conn->upload_size,
+			conn->segment_size);
+		conn_upload_retry(conn);
+	}
 }
 
 static void conn_cleanup(connection_info *conn)
@@ -1228,14 +1448,6 @@ static void conn_cleanup(connection_info *conn)
 
 static void conn_upload_retry(connection_info *conn)
 {
-	/* already closed by cURL */
-	conn->easy = NULL;
-
-	if (conn->slist != NULL) {
-		curl_slist_free_all(conn->slist);
-		conn->slist = NULL;
-	}
-
 	if (conn->retry_count++ > 3) {
 		fprintf(stderr, "error: retry count limit reached\n");
 		exit(EXIT_FAILURE);
@@ -1279,29 +1491,94 @@ error:
 	return NULL;
 }
 
+/*********************************************************************//**
+Copy the name of the chunk being parsed into the connection. */
+static
+void
+conn_set_name(connection_info *conn, const char *chunk)
+{
+	if (conn->name == NULL) {
+		conn->name = (char*)(malloc(conn->chunk_path_len + 1));
+	} else if (conn->name_len < conn->chunk_path_len + 1) {
+		conn->name = (char*)(realloc(conn->name,
+					conn->chunk_path_len + 1));
+	}
+	conn->name_len = conn->chunk_path_len + 1;
+
+	memcpy(conn->name, chunk + CHUNK_HEADER_CONSTANT_LEN,
+		conn->chunk_path_len);
+	conn->name[conn->chunk_path_len] = 0;
+}
+
+/*********************************************************************//**
+Start uploading the complete chunks of the connection as a segment. */
+static
+void
+conn_segment_upload(connection_info *conn)
+{
+	char object_name[SWIFT_MAX_URL_SIZE];
+	map<string, pair<size_t, string> >::const_iterator stored;
+
+	conn->segment_size = conn->chunk_start;
+	conn->chunk_no = file_chunk_count[conn->name]++;
+	conn_upload_prepare(conn);
+
+	conn_object_name(conn, object_name, sizeof(object_name));
+	produced_objects.insert(object_name);
+
+	if (opt_resume) {
+		stored = stored_objects.find(object_name);
+		if (stored != stored_objects.end() &&
+		    stored->second.first == conn->segment_size &&
+		    stored->second.second == conn->hash) {
+			fprintf(stderr, "skipping chunk %s/%s "
+				"(md5: %s, size: %zu), already uploaded\n",
+				conn->global->container, object_name,
+				conn->hash, conn->segment_size);
+			conn->upload_started = true;
+			conn->upload_size = conn->filled_size;
+			conn->chunk_acked = true;
+			conn->chunk_uploaded = true;
+			/* It may only be known from the container list, and
+			must be found in the journal if this upload is
+			interrupted as well */
+			conn_journal_write(conn);
+			return;
+		}
+	}
+
+	conn_upload_start(conn);
+}
+
 /*********************************************************************//**
 Handle input buffer updates. Parse chunk header and set appropriate
-buffer size. */
+buffer size. Consecutive chunks of the same file are read into the same
+buffer and uploaded as one segment once it grows to opt_segment_size. */
 static
 void
 conn_buffer_updated(connection_info *conn)
 {
+	global_io_info *global = conn->global;
+	char *chunk = conn->buffer + conn->chunk_start;
+	size_t filled = conn->filled_size - conn->chunk_start;
 	bool ready_for_upload = false;
+	bool name_parsed = false;
 
 	/* chunk header */
 	if (!conn->magic_verified &&
-	    conn->filled_size >= CHUNK_HEADER_CONSTANT_LEN) {
-		if (strncmp(XB_STREAM_CHUNK_MAGIC, conn->buffer,
-			sizeof(XB_STREAM_CHUNK_MAGIC) - 1) != 0) {
+	    filled >= CHUNK_HEADER_CONSTANT_LEN) {
+		if (strncmp(XB_STREAM_CHUNK_MAGIC, chunk,
+			sizeof(XB_STREAM_CHUNK_MAGIC) - 1) != 0 &&
+		    strncmp(XB_STREAM_CHUNK_MAGIC_V2, chunk,
+			sizeof(XB_STREAM_CHUNK_MAGIC_V2) - 1) != 0) {
 
 			fprintf(stderr, "Error: magic expected\n");
 			exit(EXIT_FAILURE);
 		}
 		conn->magic_verified = true;
-		conn->chunk_path_len = uint4korr(conn->buffer
-						 + PATH_LENGTH_OFFSET);
+		conn->chunk_path_len = uint4korr(chunk + PATH_LENGTH_OFFSET);
 		conn->chunk_type = (xb_chunk_type_t)
-					(conn->buffer[CHUNK_TYPE_OFFSET]);
+					(chunk[CHUNK_TYPE_OFFSET]);
 		conn->chunk_size = CHUNK_HEADER_CONSTANT_LEN +
 					conn->chunk_path_len;
 		if (conn->chunk_type != XB_CHUNK_TYPE_EOF) {
@@ -1309,68 +1586,90 @@ conn_buffer_updated(connection_info *conn)
 		}
 	}
 
+	/* the index chunk and its trailer end a version 2 stream written
+	to a file. The offsets in it do not match the stored objects, so
+	the rest of the input is not stored. */
+	if (conn->magic_verified &&
+	    conn->chunk_type == XB_CHUNK_TYPE_INDEX) {
+		conn->filled_size = conn->chunk_start;
+		global->eof = 1;
+		ev_io_stop(global->loop, &global->input_event);
+		if (conn->chunk_start > 0 && !conn->upload_started) {
+			conn_segment_upload(conn);
+		}
+		return;
+	}
+
 	/* ordinary chunk */
 	if (conn->magic_verified &&
-	    conn->payload_size == 0 &&
+	    !conn->name_parsed &&
 	    conn->chunk_type != XB_CHUNK_TYPE_EOF &&
-	    conn->filled_size >= CHUNK_HEADER_CONSTANT_LEN
+	    filled >= CHUNK_HEADER_CONSTANT_LEN
 					+ conn->chunk_path_len + 16) {
 
-		conn->payload_size = uint8korr(conn->buffer +
-					CHUNK_HEADER_CONSTANT_LEN + 
+		conn->payload_size = uint8korr(chunk +
+					CHUNK_HEADER_CONSTANT_LEN +
 					conn->chunk_path_len);
 
 		conn->chunk_size = conn->payload_size + 4 + 16 +
 					conn->chunk_path_len +
 					CHUNK_HEADER_CONSTANT_LEN;
-
-		if (conn->name == NULL) {
-			conn->name = (char*)(malloc(conn->chunk_path_len + 1));
-		} else if (conn->name_len < conn->chunk_path_len + 1) {
-			conn->name = (char*)(realloc(conn->name,
-						conn->chunk_path_len + 1));
-		}
-		conn->name_len = conn->chunk_path_len + 1;
-
-		memcpy(conn->name, conn->buffer + CHUNK_HEADER_CONSTANT_LEN,
-			conn->chunk_path_len);
-		conn->name[conn->chunk_path_len] = 0;
-
-		if (conn->buffer_size < conn->chunk_size) {
-			conn->buffer =
-			      (char *)(realloc(conn->buffer, conn->chunk_size));
-			conn->buffer_size = conn->chunk_size;
-		}
+		name_parsed = true;
 	}
 
 	/* EOF chunk has no payload */
 	if (conn->magic_verified &&
+	    !conn->name_parsed &&
 	    conn->chunk_type == XB_CHUNK_TYPE_EOF &&
-	    conn->filled_size >= CHUNK_HEADER_CONSTANT_LEN
+	    filled >= CHUNK_HEADER_CONSTANT_LEN
 					+ conn->chunk_path_len) {
+		name_parsed = true;
+	}
+
+	if (name_parsed) {
+		conn->name_parsed = true;
+
+		if (conn->chunk_start == 0) {
+			conn_set_name(conn, chunk);
+		} else if (strlen(conn->name) != conn->chunk_path_len ||
+			   memcmp(conn->name, chunk + CHUNK_HEADER_CONSTANT_LEN,
+				  conn->chunk_path_len) != 0) {
+			/* the chunk belongs to another file, it starts the
+			next segment */
+			if (global->carry_size < filled) {
+				global->carry = (char *)(realloc(global->carry,
+								 filled));
+				global->carry_size = filled;
+			}
+			memcpy(global->carry, chunk, filled);
+			global->carry_len = filled;
+			conn->filled_size = conn->chunk_start;
 
-		if (conn->name == NULL) {
-			conn->name = (char*)(malloc(conn->chunk_path_len + 1));
-		} else if (conn->name_len < conn->chunk_path_len + 1) {
-			conn->name = (char*)(realloc(conn->name,
-						conn->chunk_path_len + 1));
+			conn_segment_upload(conn);
+			return;
 		}
-		conn->name_len = conn->chunk_path_len + 1;
 
-		memcpy(conn->name, conn->buffer + CHUNK_HEADER_CONSTANT_LEN,
-			conn->chunk_path_len);
-		conn->name[conn->chunk_path_len] = 0;
+		if (conn->buffer_size < conn->chunk_start + conn->chunk_size) {
+			conn->buffer_size = conn->chunk_start +
+						conn->chunk_size;
+			conn->buffer = (char *)(realloc(conn->buffer,
+							conn->buffer_size));
+		}
 	}
 
-	if (conn->filled_size > 0 && conn->filled_size == conn->chunk_size) {
-		ready_for_upload = true;
+	if (filled > 0 && filled == conn->chunk_size) {
+		conn->chunk_start += conn->chunk_size;
+		if (conn->chunk_type == XB_CHUNK_TYPE_EOF ||
+		    conn->chunk_start >= opt_segment_size) {
+			ready_for_upload = true;
+		} else {
+			conn_chunk_init(conn);
+		}
 	}
 
-	/* start upload once recieved the size of the chunk */
+	/* start upload once the segment is complete */
 	if (!conn->upload_started && ready_for_upload) {
-		conn->chunk_no = file_chunk_count[conn->name]++;
-		conn_upload_prepare(conn);
-		conn_upload_start(conn);
+		conn_segment_upload(conn);
 	}
 }
 
@@ -1397,59 +1696,223 @@ static int multi_timer_cb(CURLM *multi, long timeout_ms, global_io_info *global)
 	return 0;
 }
 
+/*********************************************************************//**
+Set up the cURL multi interface for the transfers. */
 static
-int swift_upload_parts(swift_auth_info *auth, const char *container,
-		       const char *name)
+void
+swift_loop_init(global_io_info *global)
 {
-	global_io_info io_global;
-	ulong i;
 #if (OLD_CURL_MULTI)
 	long timeout;
 #endif
 	CURLMcode rc;
+
+	global->multi = curl_multi_init();
+	ev_timer_init(&global->timer_event, timer_cb, 0., 0.);
+	global->timer_event.data = global;
+
+	/* setup the generic multi interface options we want */
+	curl_multi_setopt(global->multi, CURLMOPT_SOCKETFUNCTION, sock_cb);
+	curl_multi_setopt(global->multi, CURLMOPT_SOCKETDATA, global);
+#if !(OLD_CURL_MULTI)
+	curl_multi_setopt(global->multi, CURLMOPT_TIMERFUNCTION, multi_timer_cb);
+	curl_multi_setopt(global->multi, CURLMOPT_TIMERDATA, global);
+	do {
+		rc = curl_multi_socket_action(global->multi,
+					      CURL_SOCKET_TIMEOUT, 0,
+					      &global->still_running);
+	} while (rc == CURLM_CALL_MULTI_PERFORM);
+#else
+	curl_multi_timeout(global->multi, &timeout);
+	if (timeout >= 0) {
+		multi_timer_cb(global->multi, timeout, global);
+	}
+	do {
+		rc = curl_multi_socket_all(global->multi, &global->still_running);
+	} while(rc == CURLM_CALL_MULTI_PERFORM);
+#endif
+}
+
+static
+void
+swift_loop_end(global_io_info *global)
+{
+	check_multi_info(global);
+	curl_multi_cleanup(global->multi);
+}
+
+static bool chunk_belongs_to(const char *chunk_name, const char *backup_name);
+static void container_list_free(container_list *list);
+
+/*********************************************************************//**
+Read the segments already stored for the backup from the upload journal
+and the container list. The journal is needed as the container list may
+not show the most recent uploads yet.
+@return	true on success */
+static
+bool
+load_stored_objects(const char *container, const char *name)
+{
+	container_list *list;
+	char line[SWIFT_MAX_URL_SIZE + 100];
+	FILE *journal;
+
+	if (opt_upload_journal != NULL &&
+	    (journal = fopen(opt_upload_journal, "r")) != NULL) {
+		while (fgets(line, sizeof(line), journal) != NULL) {
+			char hash[33];
+			size_t size;
+			int name_offset = 0;
+			size_t len = strlen(line);
+
+			if (len > 0 && line[len - 1] == '\n') {
+				line[len - 1] = 0;
+			}
+			if (strncmp(line, "segment-size ", 13) == 0) {
+				if (strtoull(line + 13, NULL, 10) !=
+				    opt_segment_size) {
+					fprintf(stderr, "error: the upload "
+						"journal %s was written with "
+						"--%s, cannot resume with "
+						"--segment-size=%llu\n",
+						opt_upload_journal, line,
+						opt_segment_size);
+					fclose(journal);
+					return(false);
+				}
+				continue;
+			}
+			if (sscanf(line, "%32s %zu %n", hash, &size,
+				   &name_offset) != 2 || name_offset == 0) {
+				fprintf(stderr, "error: malformed line in the "
+					"upload journal %s: %s\n",
+					opt_upload_journal, line);
+				fclose(journal);
+				return(false);
+			}
+			if (chunk_belongs_to(line + name_offset, name)) {
+				stored_objects[line + name_offset] =
+					pair<size_t, string>(size, hash);
+			}
+		}
+		fclose(journal);
+	}
+
+	if ((list = backend->list(container, name)) == NULL) {
+		return(false);
+	}
+
+	for (size_t i = 0; i < list->idx; i++) {
+		const object_info *object = &list->objects[i];
+
+		if (chunk_belongs_to(object->name, name)) {
+			stored_objects[object->name] =
+				pair<size_t, string>(object->bytes,
+						     object->hash);
+		}
+	}
+
+	container_list_free(list);
+
+	fprintf(stderr, "found %zu uploaded chunks of backup '%s'\n",
+		stored_objects.size(), name);
+
+	return(true);
+}
+
+/*********************************************************************//**
+Delete the objects of the backup which the resumed upload did not produce.
+The resumed stream may be split into segments differently, e.g. with
+--parallel, and the objects left over from the interrupted upload would
+then be downloaded as a part of the backup.
+@return	true on success */
+static
+bool
+delete_stale_objects(const char *container, const char *name)
+{
+	container_list *list;
+	set<string> stale;
+
+	if ((list = backend->list(container, name)) == NULL) {
+		return(false);
+	}
+
+	for (size_t i = 0; i < list->idx; i++) {
+		stale.insert(list->objects[i].name);
+	}
+
+	container_list_free(list);
+
+	/* The listing may not show the most recent uploads yet */
+	for (map<string, pair<size_t, string> >::const_iterator it =
+		     stored_objects.begin(); it != stored_objects.end(); ++it) {
+		stale.insert(it->first);
+	}
+
+	for (set<string>::const_iterator it = stale.begin();
+	     it != stale.end(); ++it) {
+		if (!chunk_belongs_to(it->c_str(), name) ||
+		    produced_objects.count(*it)) {
+			continue;
+		}
+		fprintf(stderr, "delete %s, not a part of the resumed "
+			"upload\n", it->c_str());
+		if (!backend->delete_object(container, it->c_str())) {
+			fprintf(stderr, "error: failed to delete chunk %s\n",
+				it->c_str());
+			return(false);
+		}
+	}
+
+	return(true);
+}
+
+static
+int upload_parts(const char *container, const char *name)
+{
+	global_io_info io_global;
+	ulong i;
 	int n_dirty_buffers;
 
 	memset(&io_global, 0, sizeof(io_global));
 
+	if (opt_resume && !load_stored_objects(container, name)) {
+		fprintf(stderr, "error: failed to list the uploaded chunks\n");
+		return(EXIT_FAILURE);
+	}
+
+	if (opt_upload_journal != NULL &&
+	    (upload_journal = fopen(opt_upload_journal,
+				    opt_resume ? "a" : "w")) == NULL) {
+		fprintf(stderr, "error: failed to open the upload journal "
+			"%s\n", opt_upload_journal);
+		return(EXIT_FAILURE);
+	}
+
+	if (upload_journal != NULL && ftell(upload_journal) == 0 &&
+	    (fprintf(upload_journal, "segment-size %llu\n",
+		     opt_segment_size) < 0 ||
+	     fflush(upload_journal) != 0)) {
+		fprintf(stderr, "error: failed to write the upload journal "
+			"%s\n", opt_upload_journal);
+		return(EXIT_FAILURE);
+	}
+
 	io_global.loop = ev_default_loop(0);
 	init_input(&io_global);
-	io_global.multi = curl_multi_init();
-	ev_timer_init(&io_global.timer_event, timer_cb, 0., 0.);
-	io_global.timer_event.data = &io_global;
 	io_global.connections = (connection_info **)
 		(calloc(opt_parallel, sizeof(connection_info)));
-	io_global.url = auth->url;
 	io_global.container = container;
 	io_global.backup_name = name;
-	io_global.token = auth->token;
 	for (i = 0; i < opt_parallel; i++) {
 		io_global.connections[i] = conn_new(&io_global, i);
 	}
 
-	/* setup the generic multi interface options we want */
-	curl_multi_setopt(io_global.multi, CURLMOPT_SOCKETFUNCTION, sock_cb);
-	curl_multi_setopt(io_global.multi, CURLMOPT_SOCKETDATA, &io_global);
-#if !(OLD_CURL_MULTI)
-	curl_multi_setopt(io_global.multi, CURLMOPT_TIMERFUNCTION, multi_timer_cb);
-	curl_multi_setopt(io_global.multi, CURLMOPT_TIMERDATA, &io_global);
-	do {
-		rc = curl_multi_socket_action(io_global.multi,
-					      CURL_SOCKET_TIMEOUT, 0,
-					      &io_global.still_running);
-	} while (rc == CURLM_CALL_MULTI_PERFORM);
-#else
-	curl_multi_timeout(io_global.multi, &timeout);
-	if (timeout >= 0) {
-		multi_timer_cb(io_global.multi, timeout, &io_global);
-	}
-	do {
-		rc = curl_multi_socket_all(io_global.multi, &io_global.still_running);
-	} while(rc == CURLM_CALL_MULTI_PERFORM);
-#endif
+	backend->loop_init(&io_global);
 
 	ev_loop(io_global.loop, 0);
-	check_multi_info(&io_global);
-	curl_multi_cleanup(io_global.multi);
+
+	backend->loop_end(&io_global);
 
 	n_dirty_buffers = 0;
 	for (i = 0; i < opt_parallel; i++) {
@@ -1470,10 +1933,27 @@ int swift_upload_parts(swift_auth_info *auth, const char *container,
 	}
 	free(io_global.connections);
 
+	if (io_global.carry_len > 0) {
+		fprintf(stderr, "error: upload failed: %lu bytes of the last "
+			"chunk are not uploaded\n",
+			(ulong)(io_global.carry_len));
+		++n_dirty_buffers;
+	}
+	free(io_global.carry);
+
+	if (upload_journal != NULL) {
+		fclose(upload_journal);
+		upload_journal = NULL;
+	}
+
 	if (n_dirty_buffers > 0) {
 		return(EXIT_FAILURE);
 	}
 
+	if (opt_resume && !delete_stale_objects(container, name)) {
+		return(EXIT_FAILURE);
+	}
+
 	return 0;
 }
 
@@ -1932,60 +2412,282 @@ chunk_in_list(const char *chunk_name, char **list, int list_size)
 	return(false);
 }
 
+/*********************************************************************//**
+Write the range received by cURL into the connection buffer. */
 static
-int swift_download(swift_auth_info *auth, const char *container,
-		   const char *name)
+size_t
+swift_download_write_cb(char *ptr, size_t size, size_t nmemb, void *data)
 {
-	container_list *list;
-	char *buf = NULL;
-	size_t buf_size = 0;
-	size_t result_len = 0;
-
-	if ((list = swift_list(auth, container, name)) == NULL) {
-		return(CURLE_FAILED_INIT);
-	}
-
-	for (size_t i = 0; i < list->idx; i++) {
-		const char *chunk_name = list->objects[i].name;
-
-		if (chunk_belongs_to(chunk_name, name)
-		    && chunk_in_list(chunk_name, file_list, file_list_size)) {
-			char url[SWIFT_MAX_URL_SIZE];
-
-			snprintf(url, sizeof(url), "%s/%s/%s",
-				 auth->url, container, chunk_name);
-
-			if ((buf = swift_fetch_into_buffer(
-					auth, url, &buf, &buf_size, &result_len,
-					NULL, NULL)) == NULL) {
-				fprintf(stderr, "error: failed to download "
-						"chunk %s\n", chunk_name);
-				container_list_free(list);
-				return(CURLE_FAILED_INIT);
-			}
+	connection_info *conn = (connection_info *)(data);
+	size_t realsize = size * nmemb;
 
-			fwrite(buf, 1, result_len, stdout);
-		}
+	if (conn->filled_size + realsize > conn->buffer_size) {
+		/* more than requested, fail the transfer */
+		return 0;
 	}
 
-	free(buf);
+	memcpy(conn->buffer + conn->filled_size, ptr, realsize);
+	conn->filled_size += realsize;
 
-	container_list_free(list);
-
-	return(CURLE_OK);
+	return realsize;
 }
 
-
 /*********************************************************************//**
-Delete backup with given name from given container.
-@return	true if backup deleted successfully */
+Start downloading the range conn->part_no from Swift. */
 static
-bool swift_delete(swift_auth_info *auth, const char *container,
-		  const char *name)
+void
+swift_get_start(connection_info *conn)
 {
-	container_list *list;
+	char token_header[SWIFT_MAX_HDR_SIZE];
+	char object_url[SWIFT_MAX_URL_SIZE];
+	char range[100];
+	global_io_info *global = conn->global;
+	download_part *part = &global->parts[conn->part_no];
+	CURLMcode rc;
+
+	snprintf(object_url, array_elements(object_url), "%s/%s/%s",
+		 swift_info.url, global->container,
+		 global->list->objects[part->object_idx].name);
+
+	snprintf(range, sizeof(range), "%zu-%zu", part->offset,
+		 part->offset + part->length - 1);
+
+	snprintf(token_header, array_elements(token_header),
+		 "X-Auth-Token: %s", swift_info.token);
+
+	conn->slist = curl_slist_append(conn->slist, token_header);
+	conn->slist = curl_slist_append(conn->slist,
+					"Connection: keep-alive");
+
+	conn->easy = curl_easy_init();
+	if (!conn->easy) {
+		fprintf(stderr, "error: curl_easy_init() failed\n");
+		exit(EXIT_FAILURE);
+	}
+	curl_easy_setopt(conn->easy, CURLOPT_URL, object_url);
+	curl_easy_setopt(conn->easy, CURLOPT_RANGE, range);
+	curl_easy_setopt(conn->easy, CURLOPT_WRITEFUNCTION,
+				     swift_download_write_cb);
+	curl_easy_setopt(conn->easy, CURLOPT_WRITEDATA, conn);
+	curl_easy_setopt(conn->easy, CURLOPT_VERBOSE, opt_verbose);
+	curl_easy_setopt(conn->easy, CURLOPT_ERRORBUFFER, conn->error);
+	curl_easy_setopt(conn->easy, CURLOPT_PRIVATE, conn);
+	curl_easy_setopt(conn->easy, CURLOPT_NOPROGRESS, 1L);
+	curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_TIME, 5L);
+	curl_easy_setopt(conn->easy, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+	curl_easy_setopt(conn->easy, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(conn->easy, CURLOPT_HTTPHEADER, conn->slist);
+	if (opt_cacert != NULL)
+		curl_easy_setopt(conn->easy, CURLOPT_CAINFO, opt_cacert);
+	if (opt_insecure)
+		curl_easy_setopt(conn->easy, CURLOPT_SSL_VERIFYPEER, FALSE);
+
+	rc = curl_multi_add_handle(global->multi, conn->easy);
+	mcode_or_die("swift_get_start: curl_multi_add_handle", rc);
+
+#if (OLD_CURL_MULTI)
+	do {
+		rc = curl_multi_socket_all(global->multi,
+					   &global->still_running);
+	} while(rc == CURLM_CALL_MULTI_PERFORM);
+#endif
+}
+
+/*********************************************************************//**
+Start downloading the range conn->part_no. */
+static
+void
+conn_download_start(connection_info *conn)
+{
+	conn->filled_size = 0;
+	conn->error[0] = 0;
+
+	backend->get_start(conn);
+}
 
-	if ((list = swift_list(auth, container, name)) == NULL) {
+/*********************************************************************//**
+Request the next ranges on the idle connections. A connection stays busy
+until its range is written out, so at most opt_parallel ranges are kept in
+memory. */
+static
+void
+download_schedule(global_io_info *global)
+{
+	for (ulong i = 0; i < opt_parallel; i++) {
+		connection_info *conn = global->connections[i];
+
+		if (conn->part_busy || global->next_part >= global->n_parts) {
+			continue;
+		}
+
+		conn->part_no = global->next_part++;
+		conn->part_busy = true;
+		conn->part_done = false;
+		conn->retry_count = 0;
+		conn_download_start(conn);
+	}
+}
+
+/*********************************************************************//**
+Write the downloaded ranges to the output in the stream order. */
+static
+void
+download_emit(global_io_info *global)
+{
+	bool found = true;
+
+	while (found) {
+		found = false;
+		for (ulong i = 0; i < opt_parallel; i++) {
+			connection_info *conn = global->connections[i];
+
+			if (!conn->part_busy || !conn->part_done ||
+			    conn->part_no != global->next_emit) {
+				continue;
+			}
+
+			if (fwrite(conn->buffer, 1, conn->filled_size, stdout)
+			    != conn->filled_size) {
+				fprintf(stderr, "error: failed to write "
+					"to the output\n");
+				exit(EXIT_FAILURE);
+			}
+
+			conn->part_busy = false;
+			++global->next_emit;
+			found = true;
+		}
+	}
+}
+
+/*********************************************************************//**
+Handle a finished range transfer, retry it on failure. */
+static
+void
+conn_download_done(connection_info *conn, bool ok)
+{
+	global_io_info *global = conn->global;
+	download_part *part = &global->parts[conn->part_no];
+	const char *name = global->list->objects[part->object_idx].name;
+
+	if (!ok || conn->filled_size != part->length) {
+		fprintf(stderr, "error: failed to download bytes %zu-%zu of "
+			"chunk %s (%s)\n",
+			part->offset, part->offset + part->length - 1, name,
+			conn->error[0] != 0 ? conn->error : "short read");
+		if (conn->retry_count++ > 3) {
+			fprintf(stderr, "error: retry count limit reached\n");
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stderr, "warning: retrying to download chunk %s\n",
+			name);
+		conn_download_start(conn);
+		return;
+	}
+
+	conn->part_done = true;
+
+	download_emit(global);
+	download_schedule(global);
+}
+
+static
+int download_parts(const char *container, const char *name)
+{
+	global_io_info io_global;
+	container_list *list;
+	size_t n_parts = 0;
+	ulong i;
+	int result = CURLE_OK;
+
+	if ((list = backend->list(container, name)) == NULL) {
+		return(CURLE_FAILED_INIT);
+	}
+
+	memset(&io_global, 0, sizeof(io_global));
+
+	/* split the objects of the backup into ranges */
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t j = 0; j < list->idx; j++) {
+			const object_info *object = &list->objects[j];
+
+			if (!chunk_belongs_to(object->name, name)
+			    || !chunk_in_list(object->name, file_list,
+					      file_list_size)) {
+				continue;
+			}
+
+			for (size_t offset = 0; offset < object->bytes;
+			     offset += SWIFT_RANGE_SIZE) {
+				if (pass == 1) {
+					download_part *part =
+						&io_global.parts[n_parts];
+					part->object_idx = j;
+					part->offset = offset;
+					part->length = min(object->bytes
+							   - offset,
+							   (size_t)
+							   SWIFT_RANGE_SIZE);
+				}
+				++n_parts;
+			}
+		}
+		if (pass == 0) {
+			io_global.parts = (download_part *)
+				(calloc(n_parts + 1, sizeof(download_part)));
+			io_global.n_parts = n_parts;
+			n_parts = 0;
+		}
+	}
+
+	io_global.download = true;
+	io_global.list = list;
+	io_global.loop = ev_default_loop(0);
+	io_global.connections = (connection_info **)
+		(calloc(opt_parallel, sizeof(connection_info)));
+	io_global.container = container;
+	io_global.backup_name = name;
+	for (i = 0; i < opt_parallel; i++) {
+		io_global.connections[i] = conn_new(&io_global, i);
+	}
+
+	backend->loop_init(&io_global);
+
+	download_schedule(&io_global);
+
+	ev_loop(io_global.loop, 0);
+
+	backend->loop_end(&io_global);
+
+	if (io_global.next_emit != io_global.n_parts) {
+		fprintf(stderr, "error: download failed: %zu of %zu ranges "
+			"are not downloaded\n",
+			io_global.n_parts - io_global.next_emit,
+			io_global.n_parts);
+		result = CURLE_FAILED_INIT;
+	}
+
+	for (i = 0; i < opt_parallel; i++) {
+		conn_cleanup(io_global.connections[i]);
+	}
+	free(io_global.connections);
+	free(io_global.parts);
+
+	container_list_free(list);
+
+	return(result);
+}
+
+
+/*********************************************************************//**
+Delete backup with given name from given container.
+@return	true if backup deleted successfully */
+static
+bool backup_delete(const char *container, const char *name)
+{
+	container_list *list;
+
+	if ((list = backend->list(container, name)) == NULL) {
 		return(false);
 	}
 
@@ -1993,13 +2695,8 @@ bool swift_delete(swift_auth_info *auth, const char *container,
 		const char *chunk_name = list->objects[i].name;
 
 		if (chunk_belongs_to(chunk_name, name)) {
-			char url[SWIFT_MAX_URL_SIZE];
-
-			snprintf(url, sizeof(url), "%s/%s/%s",
-				 auth->url, container, chunk_name);
-
 			fprintf(stderr, "delete %s\n", chunk_name);
-			if (!swift_delete_object(auth, url)) {
+			if (!backend->delete_object(container, chunk_name)) {
 				fprintf(stderr, "error: failed to delete "
 						"chunk %s\n", chunk_name);
 				container_list_free(list);
@@ -2017,12 +2714,11 @@ bool swift_delete(swift_auth_info *auth, const char *container,
 Check if backup with given name exists.
 @return	true if backup exists */
 static
-bool swift_backup_exists(swift_auth_info *auth, const char *container,
-			 const char *backup_name)
+bool backup_exists(const char *container, const char *backup_name)
 {
 	container_list *list;
 
-	if ((list = swift_list(auth, container, backup_name)) == NULL) {
+	if ((list = backend->list(container, backup_name)) == NULL) {
 		fprintf(stderr, "error: unable to list container %s\n",
 			container);
 		exit(EXIT_FAILURE);
@@ -2611,36 +3307,24 @@ cleanup:
 	return(auth_res);
 }
 
-int main(int argc, char **argv)
+/*********************************************************************//**
+Authenticate to Swift and set the object store URL.
+@return	true on success */
+static
+bool
+swift_init()
 {
-	swift_auth_info info;
 	char auth_url[SWIFT_MAX_URL_SIZE];
 
-	MY_INIT(argv[0]);
-
-        /* handle_options in parse_args is destructive so
-         * we make a copy of our argument pointers so we can
-         * mask the sensitive values afterwards */
-        char **mask_argv = (char **)malloc(sizeof(char *) * (argc - 1));
-        memcpy(mask_argv, argv + 1, sizeof(char *) * (argc - 1));
-
-	if (parse_args(argc, argv)) {
-		return(EXIT_FAILURE);
-	}
-
-        mask_args(argc, mask_argv);  /* mask args on cmdline */
-
-	curl_global_init(CURL_GLOBAL_ALL);
-
 	if (opt_swift_auth_version == NULL || *opt_swift_auth_version == '1') {
 		/* TempAuth */
 		snprintf(auth_url, SWIFT_MAX_URL_SIZE, "%sauth/v%s/",
 			 opt_swift_auth_url, opt_swift_auth_version ?
 			 			opt_swift_auth_version : "1.0");
 
-		if (!swift_temp_auth(auth_url, &info)) {
+		if (!swift_temp_auth(auth_url, &swift_info)) {
 			fprintf(stderr, "error: failed to authenticate\n");
-			return(EXIT_FAILURE);
+			return(false);
 		}
 
 	} else if (*opt_swift_auth_version == '2') {
@@ -2648,9 +3332,9 @@ int main(int argc, char **argv)
 		snprintf(auth_url, SWIFT_MAX_URL_SIZE, "%sv%s/tokens",
 			 opt_swift_auth_url, opt_swift_auth_version);
 
-		if (!swift_keystone_auth_v2(auth_url, &info)) {
+		if (!swift_keystone_auth_v2(auth_url, &swift_info)) {
 			fprintf(stderr, "error: failed to authenticate\n");
-			return(EXIT_FAILURE);
+			return(false);
 		}
 
 	} else if (*opt_swift_auth_version == '3') {
@@ -2658,53 +3342,556 @@ int main(int argc, char **argv)
 		snprintf(auth_url, SWIFT_MAX_URL_SIZE, "%sv%s/auth/tokens",
 			 opt_swift_auth_url, opt_swift_auth_version);
 
-		if (!swift_keystone_auth_v3(auth_url, &info)) {
+		if (!swift_keystone_auth_v3(auth_url, &swift_info)) {
 			fprintf(stderr, "error: failed to authenticate\n");
-			exit(EXIT_FAILURE);
+			return(false);
 		}
 
 	}
 
 	if (opt_swift_storage_url != NULL) {
-		snprintf(info.url, sizeof(info.url), "%s",
+		snprintf(swift_info.url, sizeof(swift_info.url), "%s",
 			 opt_swift_storage_url);
 	}
 
-	fprintf(stderr, "Object store URL: %s\n", info.url);
+	fprintf(stderr, "Object store URL: %s\n", swift_info.url);
+
+	return(true);
+}
+
+static
+bool
+swift_backend_create_container(const char *container)
+{
+	return(swift_create_container(&swift_info, container) == 0);
+}
+
+static
+container_list *
+swift_backend_list(const char *container, const char *prefix)
+{
+	return(swift_list(&swift_info, container, prefix));
+}
+
+static
+bool
+swift_backend_delete_object(const char *container, const char *name)
+{
+	char url[SWIFT_MAX_URL_SIZE];
+
+	snprintf(url, sizeof(url), "%s/%s/%s", swift_info.url, container,
+		 name);
+
+	return(swift_delete_object(&swift_info, url));
+}
+
+static const storage_backend swift_backend = {
+	swift_init,
+	swift_backend_create_container,
+	swift_backend_list,
+	swift_backend_delete_object,
+	swift_loop_init,
+	swift_loop_end,
+	swift_put_start,
+	swift_get_start
+};
+
+/*****************************************************************************/
+
+/* The local backend stores the objects as files under the directory given as
+the container. Every request takes --local-latency plus the transfer time at
+--local-bandwidth, so that the parallel pipelines and the segment size can be
+benchmarked without an object store. The requests are served by one worker
+thread per connection, which does the file I/O and waits for the simulated
+delay, and are completed in the event loop through an ev_async watcher. */
+
+/* Suffix of the object files being written */
+#define LOCAL_TMP_SUFFIX ".xbcloud-tmp"
+
+static
+bool
+local_init()
+{
+	fprintf(stderr, "Object store directory: %s\n", opt_local_dir);
+
+	return(true);
+}
+
+/*********************************************************************//**
+Create the directories of all components of path followed by '/'.
+@return	true on success */
+static
+bool
+local_make_dirs(const string &path)
+{
+	for (size_t pos = path.find('/', 1); pos != string::npos;
+	     pos = path.find('/', pos + 1)) {
+		string dir = path.substr(0, pos);
+
+		if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+			fprintf(stderr, "error: cannot create directory "
+				"%s: %s\n", dir.c_str(), strerror(errno));
+			return(false);
+		}
+	}
+
+	return(true);
+}
+
+static
+bool
+local_create_container(const char *container)
+{
+	return(local_make_dirs(string(container) + "/"));
+}
+
+/*********************************************************************//**
+Compute the MD5 of a file. */
+static
+bool
+local_file_md5(const char *path, char *hash)
+{
+	char buf[64 * 1024];
+	gcry_md_hd_t md5;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return(false);
+	}
+
+	gcry_md_open(&md5, GCRY_MD_MD5, 0);
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		gcry_md_write(md5, buf, n);
+	}
+	hex_md5(gcry_md_read(md5, GCRY_MD_MD5), hash);
+	gcry_md_close(md5);
+	close(fd);
+
+	return(n == 0);
+}
+
+/*********************************************************************//**
+Add the object files in the directory container/dir to the list.
+@return	true on success */
+static
+bool
+local_list_dir(container_list *list, const char *container, const string &dir)
+{
+	string path = string(container) + "/" + dir;
+	struct dirent *entry;
+	DIR *d;
+	bool ret = true;
+
+	if ((d = opendir(path.c_str())) == NULL) {
+		return(errno == ENOENT);
+	}
+
+	while (ret && (entry = readdir(d)) != NULL) {
+		string name = dir + "/" + entry->d_name;
+		string file_path = string(container) + "/" + name;
+		char hash[33] = "";
+		struct stat st;
+
+		if (strcmp(entry->d_name, ".") == 0 ||
+		    strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+
+		if (stat(file_path.c_str(), &st) != 0) {
+			ret = false;
+		} else if (S_ISDIR(st.st_mode)) {
+			ret = local_list_dir(list, container, name);
+		} else if (name.size() < SWIFT_MAX_URL_SIZE &&
+			   (name.size() < sizeof(LOCAL_TMP_SUFFIX) ||
+			    name.compare(name.size() + 1
+					 - sizeof(LOCAL_TMP_SUFFIX),
+					 string::npos, LOCAL_TMP_SUFFIX)
+			    != 0)) {
+			/* the hash is only needed to resume uploads */
+			if (opt_resume &&
+			    !local_file_md5(file_path.c_str(), hash)) {
+				ret = false;
+			}
+			container_list_add_object(list, name.c_str(), hash,
+						  st.st_size);
+		}
+	}
+
+	closedir(d);
+
+	if (!ret) {
+		fprintf(stderr, "error: cannot list %s: %s\n", path.c_str(),
+			strerror(errno));
+	}
+
+	return(ret);
+}
+
+static
+int
+local_object_cmp(const void *a, const void *b)
+{
+	return(strcmp(((const object_info *) a)->name,
+		      ((const object_info *) b)->name));
+}
+
+static
+container_list *
+local_list(const char *container, const char *prefix)
+{
+	container_list *list = container_list_new();
+
+	if (!local_list_dir(list, container, prefix)) {
+		container_list_free(list);
+		return(NULL);
+	}
+
+	qsort(list->objects, list->idx, sizeof(object_info),
+	      local_object_cmp);
+	list->final = true;
+
+	return(list);
+}
+
+static
+bool
+local_delete_object(const char *container, const char *name)
+{
+	string path = string(container) + "/" + name;
+	size_t pos;
+
+	if (unlink(path.c_str()) != 0) {
+		if (errno == ENOENT) {
+			/* already deleted */
+			return(true);
+		}
+		fprintf(stderr, "error: cannot delete %s: %s\n", path.c_str(),
+			strerror(errno));
+		return(false);
+	}
+
+	/* remove the directories left empty */
+	while ((pos = path.rfind('/')) != string::npos &&
+	       pos > strlen(container)) {
+		path.resize(pos);
+		if (rmdir(path.c_str()) != 0) {
+			break;
+		}
+	}
+
+	return(true);
+}
+
+/* Requests of the local backend, protected by local_mutex */
+static pthread_mutex_t local_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t local_cond = PTHREAD_COND_INITIALIZER;
+static deque<connection_info *> local_requests;	/* started */
+static deque<connection_info *> local_done;	/* served */
+static bool local_shutdown = false;
+static vector<pthread_t> local_threads;
+static struct ev_async local_async;
+
+/*********************************************************************//**
+Write the segment of a connection to its object file.
+@return	size of the request */
+static
+size_t
+local_put(connection_info *conn)
+{
+	char object_name[SWIFT_MAX_URL_SIZE];
+	size_t written = 0;
+	ssize_t n = 0;
+	int fd;
+
+	conn_object_name(conn, object_name, sizeof(object_name));
+
+	string path = string(conn->global->container) + "/" + object_name;
+	string tmp_path = path + LOCAL_TMP_SUFFIX;
+
+	conn->chunk_acked = false;
+
+	if (local_make_dirs(path) &&
+	    (fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+		       0666)) >= 0) {
+		while (written < conn->segment_size &&
+		       (n = write(fd, conn->buffer + written,
+				  conn->segment_size - written)) > 0) {
+			written += n;
+		}
+		if (close(fd) == 0 && written == conn->segment_size &&
+		    rename(tmp_path.c_str(), path.c_str()) == 0) {
+			conn->upload_size = conn->segment_size;
+			conn->chunk_acked = true;
+		}
+	}
+
+	if (!conn->chunk_acked) {
+		fprintf(stderr, "error: cannot write %s: %s\n", path.c_str(),
+			strerror(errno));
+	}
+
+	return(conn->segment_size);
+}
+
+/*********************************************************************//**
+Read the range conn->part_no of an object file into the connection buffer.
+@return	size of the request */
+static
+size_t
+local_get(connection_info *conn)
+{
+	global_io_info *global = conn->global;
+	download_part *part = &global->parts[conn->part_no];
+	string path = string(global->container) + "/" +
+		global->list->objects[part->object_idx].name;
+	ssize_t n = 0;
+	int fd;
+
+	conn->chunk_acked = false;
+
+	if ((fd = open(path.c_str(), O_RDONLY)) >= 0) {
+		while (conn->filled_size < part->length &&
+		       (n = pread(fd, conn->buffer + conn->filled_size,
+				  part->length - conn->filled_size,
+				  part->offset + conn->filled_size)) > 0) {
+			conn->filled_size += n;
+		}
+		conn->chunk_acked = (n >= 0);
+		close(fd);
+	}
+
+	if (!conn->chunk_acked) {
+		snprintf(conn->error, sizeof(conn->error), "%s",
+			 strerror(errno));
+	}
+
+	return(part->length);
+}
+
+/*********************************************************************//**
+Worker thread of the local backend. Serve the started requests and hand
+them back to the event loop after the simulated delay. */
+static
+void *
+local_worker_thread(void *arg)
+{
+	global_io_info *global = (global_io_info *)(arg);
+	connection_info *conn;
+	double delay;
+	size_t size;
+
+	pthread_mutex_lock(&local_mutex);
+
+	for (;;) {
+		while (local_requests.empty() && !local_shutdown) {
+			pthread_cond_wait(&local_cond, &local_mutex);
+		}
+		if (local_requests.empty()) {
+			break;
+		}
+		conn = local_requests.front();
+		local_requests.pop_front();
+
+		pthread_mutex_unlock(&local_mutex);
+
+		size = global->download ? local_get(conn) : local_put(conn);
+
+		delay = opt_local_latency / 1000.0;
+		if (opt_local_bandwidth > 0) {
+			delay += (double) size / opt_local_bandwidth;
+		}
+		if (delay > 0) {
+			my_sleep((ulong)(delay * 1000000));
+		}
+
+		pthread_mutex_lock(&local_mutex);
+
+		local_done.push_back(conn);
+		ev_async_send(global->loop, &local_async);
+	}
+
+	pthread_mutex_unlock(&local_mutex);
+
+	return(NULL);
+}
+
+/* Called by libev when worker threads have served requests */
+static void local_async_cb(EV_P_ struct ev_async *w, int revents)
+{
+	connection_info *conn;
+
+	for (;;) {
+		pthread_mutex_lock(&local_mutex);
+		if (local_done.empty()) {
+			pthread_mutex_unlock(&local_mutex);
+			break;
+		}
+		conn = local_done.front();
+		local_done.pop_front();
+		pthread_mutex_unlock(&local_mutex);
+
+		/* the request no longer keeps the loop running */
+		ev_unref(EV_A);
+
+		/* chunk_acked tells if the request succeeded */
+		if (conn->global->download) {
+			conn_download_done(conn, conn->chunk_acked);
+		} else {
+			conn_upload_done(conn, conn->chunk_acked);
+		}
+	}
+}
+
+/*********************************************************************//**
+Start the worker threads, one per connection. */
+static
+void
+local_loop_init(global_io_info *global)
+{
+	pthread_t thread;
+
+	ev_async_init(&local_async, local_async_cb);
+	ev_async_start(global->loop, &local_async);
+	/* only the requests being served keep the loop running */
+	ev_unref(global->loop);
+
+	local_shutdown = false;
+	for (ulong i = 0; i < opt_parallel; i++) {
+		if (pthread_create(&thread, NULL, local_worker_thread,
+				   global) != 0) {
+			fprintf(stderr, "error: cannot create a thread: %s\n",
+				strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		local_threads.push_back(thread);
+	}
+}
+
+/*********************************************************************//**
+Stop the worker threads once the event loop is done. */
+static
+void
+local_loop_end(global_io_info *global)
+{
+	pthread_mutex_lock(&local_mutex);
+	local_shutdown = true;
+	pthread_cond_broadcast(&local_cond);
+	pthread_mutex_unlock(&local_mutex);
+
+	for (size_t i = 0; i < local_threads.size(); i++) {
+		pthread_join(local_threads[i], NULL);
+	}
+	local_threads.clear();
+	local_done.clear();
+
+	ev_ref(global->loop);
+	ev_async_stop(global->loop, &local_async);
+}
+
+/*********************************************************************//**
+Queue a request of a connection for the worker threads. */
+static
+void
+local_request_start(connection_info *conn)
+{
+	/* keep the loop running until the request is served */
+	ev_ref(conn->global->loop);
+
+	pthread_mutex_lock(&local_mutex);
+	local_requests.push_back(conn);
+	pthread_cond_signal(&local_cond);
+	pthread_mutex_unlock(&local_mutex);
+}
+
+static
+void
+local_put_start(connection_info *conn)
+{
+	local_request_start(conn);
+}
+
+static
+void
+local_get_start(connection_info *conn)
+{
+	local_request_start(conn);
+}
+
+static const storage_backend local_backend = {
+	local_init,
+	local_create_container,
+	local_list,
+	local_delete_object,
+	local_loop_init,
+	local_loop_end,
+	local_put_start,
+	local_get_start
+};
+
+int main(int argc, char **argv)
+{
+	const char *container;
+
+	MY_INIT(argv[0]);
+
+        /* handle_options in parse_args is destructive so
+         * we make a copy of our argument pointers so we can
+         * mask the sensitive values afterwards */
+        char **mask_argv = (char **)malloc(sizeof(char *) * (argc - 1));
+        memcpy(mask_argv, argv + 1, sizeof(char *) * (argc - 1));
+
+	if (parse_args(argc, argv)) {
+		return(EXIT_FAILURE);
+	}
+
+        mask_args(argc, mask_argv);  /* mask args on cmdline */
+
+	curl_global_init(CURL_GLOBAL_ALL);
+
+	if (opt_storage == LOCAL) {
+		backend = &local_backend;
+		container = opt_local_dir;
+	} else {
+		backend = &swift_backend;
+		container = opt_swift_container;
+	}
+
+	if (!backend->init()) {
+		return(EXIT_FAILURE);
+	}
 
 	if (opt_mode == MODE_PUT) {
 
-		if (swift_create_container(&info, opt_swift_container) != 0) {
+		if (!backend->create_container(container)) {
 			fprintf(stderr, "error: failed to create "
 				"container %s\n",
-				opt_swift_container);
+				container);
 			return(EXIT_FAILURE);
 		}
 
-		if (swift_backup_exists(&info, opt_swift_container, opt_name)) {
+		if (!opt_resume && backup_exists(container, opt_name)) {
 			fprintf(stderr, "error: backup named '%s' "
 				"already exists!\n",
 				opt_name);
 			return(EXIT_FAILURE);
 		}
 
-		if (swift_upload_parts(&info, opt_swift_container,
-					opt_name) != 0) {
+		if (upload_parts(container, opt_name) != 0) {
 			fprintf(stderr, "error: upload failed\n");
 			return(EXIT_FAILURE);
 		}
 
 	} else if (opt_mode == MODE_GET) {
 
-		if (swift_download(&info, opt_swift_container, opt_name)
-				   != CURLE_OK) {
+		if (download_parts(container, opt_name) != CURLE_OK) {
 			fprintf(stderr, "error: download failed\n");
 			return(EXIT_FAILURE);
 		}
 
 	} else if (opt_mode == MODE_DELETE) {
 
-		if (!swift_delete(&info, opt_swift_container, opt_name)) {
+		if (!backup_delete(container, opt_name)) {
 			fprintf(stderr, "error: delete failed\n");
 			return(EXIT_FAILURE);
 		}
@@ -21,25 +21,25 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 #include <mysql_version.h>
 #include <my_base.h>
 #include <my_getopt.h>
-#include <hash.h>
-#include <pthread.h>
 #include "common.h"
 #include "xbstream.h"
+#include "xbstream_extract.h"
 #include "xbcrypt_common.h"
 #include "datasink.h"
 #include "ds_decrypt.h"
+#include "ds_decompress.h"
+#include "executor.h"
 #include "crc_glue.h"
 #include <gcrypt.h>
 
 #define XBSTREAM_VERSION "1.0"
 #define XBSTREAM_BUFFER_SIZE (10 * 1024 * 1024UL)
 
-#define START_FILE_HASH_SIZE 16
-
 typedef enum {
 	RUN_MODE_NONE,
 	RUN_MODE_CREATE,
-	RUN_MODE_EXTRACT
+	RUN_MODE_EXTRACT,
+	RUN_MODE_LIST
 } run_mode_t;
 
 const char *xbstream_encrypt_algo_names[] =
@@ -56,6 +56,7 @@ datasink_t datasink_compress;
 datasink_t datasink_tmpfile;
 datasink_t datasink_encrypt;
 datasink_t datasink_buffer;
+datasink_t datasink_spool;
 
 static run_mode_t	opt_mode;
 static char *		opt_directory = NULL;
@@ -65,9 +66,17 @@ static ulong 		opt_encrypt_algo;
 static char 		*opt_encrypt_key_file = NULL;
 static void 		*opt_encrypt_key = NULL;
 static int		opt_encrypt_threads = 1;
+static my_bool		opt_decompress = FALSE;
+static uint		opt_decompress_threads = 1;
+static uint		opt_stream_version = XB_STREAM_VERSION_DEFAULT;
+static char		*opt_member = NULL;
 
 enum {
-	OPT_ENCRYPT_THREADS = 256
+	OPT_ENCRYPT_THREADS = 256,
+	OPT_STREAM_VERSION,
+	OPT_MEMBER,
+	OPT_DECOMPRESS,
+	OPT_DECOMPRESS_THREADS
 };
 
 static struct my_option my_long_options[] =
@@ -76,15 +85,32 @@ static struct my_option my_long_options[] =
 	 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0},
 	{"create", 'c', "Stream the specified files to the standard output.",
 	 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0},
-	{"extract", 'x', "Extract to disk files from the stream on the "
-	 "standard input.",
+	{"extract", 'x', "Extract to disk files from the streams specified on "
+	 "the command line, or from the stream on the standard input if none "
+	 "are specified. Multiple streams are extracted in parallel.",
+	 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0},
+	{"list", 't', "List files in the stream specified on the command line "
+	 "or on the standard input. Uses the stream index when the stream is "
+	 "in a regular file that has one.",
 	 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0},
+	{"member", OPT_MEMBER, "Extract only the file with the specified path "
+	 "in the stream. Only the chunks of that file are read when the stream "
+	 "is in a regular file with an index.",
+	 &opt_member, &opt_member, 0,
+	 GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+	{"stream-version", OPT_STREAM_VERSION, "Version of the stream format "
+	 "to create. Version 2 uses CRC-32C checksums and ends with an index of "
+	 "the stream when written to a regular file. Version 1 streams can be "
+	 "read by older xbstream binaries. The default value is 1.",
+	 &opt_stream_version, &opt_stream_version, 0, GET_UINT, REQUIRED_ARG,
+	 XB_STREAM_VERSION_DEFAULT, 1, 2, 0, 0, 0},
 	{"directory", 'C', "Change the current directory to the specified one "
 	 "before streaming or extracting.", &opt_directory, &opt_directory, 0,
 	 GET_STR_ALLOC, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
 	{"verbose", 'v', "Print verbose output.", &opt_verbose, &opt_verbose,
 	 0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
-	{"parallel", 'p', "Number of worker threads for reading / writing.",
+	{"parallel", 'p', "Number of worker threads for writing "
+	 "extracted files.",
 	 &opt_parallel, &opt_parallel, 0, GET_INT, REQUIRED_ARG,
 	 1, 1, INT_MAX, 0, 0, 0},
 	{"decrypt", 'd', "Decrypt files ending with .xbcrypt.",
@@ -101,29 +127,23 @@ static struct my_option my_long_options[] =
 	 "The default value is 1.",
 	 &opt_encrypt_threads, &opt_encrypt_threads,
 	 0, GET_INT, REQUIRED_ARG, 1, 1, INT_MAX, 0, 0, 0},
+	{"decompress", OPT_DECOMPRESS, "Decompress files ending with .qp "
+	 "while extracting them.",
+	 &opt_decompress, &opt_decompress, 0, GET_BOOL, NO_ARG,
+	 0, 0, 0, 0, 0, 0},
+	{"decompress-threads", OPT_DECOMPRESS_THREADS,
+	 "Number of blocks of a file decompressed in parallel. "
+	 "The default value is 1.",
+	 &opt_decompress_threads, &opt_decompress_threads,
+	 0, GET_UINT, REQUIRED_ARG, 1, 1, UINT_MAX, 0, 0, 0},
 
 	{0, 0, 0, 0, 0, 0, GET_NO_ARG, NO_ARG, 0, 0, 0, 0, 0, 0}
 };
 
-typedef struct {
-	HASH			*filehash;
-	xb_rstream_t		*stream;
-	ds_ctxt_t		*ds_ctxt;
-	ds_ctxt_t		*ds_decrypt_ctxt;
-	pthread_mutex_t		*mutex;
-} extract_ctxt_t;
-
-typedef struct {
-	char 		*path;
-	uint		pathlen;
-	my_off_t	offset;
-	ds_file_t	*file;
-	pthread_mutex_t	mutex;
-} file_entry_t;
-
 static int get_options(int *argc, char ***argv);
 static int mode_create(int argc, char **argv);
 static int mode_extract(int n_threads, int argc, char **argv);
+static int mode_list(int argc, char **argv);
 static my_bool get_one_option(int optid, const struct my_option *opt,
 			      char *argument);
 
@@ -141,7 +161,8 @@ main(int argc, char **argv)
 	crc_init();
 
 	if (opt_mode == RUN_MODE_NONE) {
-		msg("%s: either -c or -x must be specified.\n", my_progname);
+		msg("%s: one of -c, -x or -t must be specified.\n",
+		    my_progname);
 		goto err;
 	}
 
@@ -155,6 +176,8 @@ main(int argc, char **argv)
 	} else if (opt_mode == RUN_MODE_EXTRACT &&
 		   mode_extract(opt_parallel, argc, argv)) {
 		goto err;
+	} else if (opt_mode == RUN_MODE_LIST && mode_list(argc, argv)) {
+		goto err;
 	}
 
 	my_cleanup_options(my_long_options);
@@ -207,8 +230,14 @@ usage(void)
 	puts("Usage: ");
 	printf("  %s -c [OPTIONS...] FILES...	# stream specified files to "
 	       "standard output.\n", my_progname);
-	printf("  %s -x [OPTIONS...]		# extract files from the stream"
-	       "on the standard input.\n", my_progname);
+	printf("  %s -x [OPTIONS...] [STREAMS...]	# extract files from the "
+	       "specified streams\n"
+	       "					# or the standard input.\n",
+	       my_progname);
+	printf("  %s -t [OPTIONS...] [STREAM]	# list files in the specified "
+	       "stream\n"
+	       "					# or the standard input.\n",
+	       my_progname);
 
 	puts("\nOptions:");
 	my_print_help(my_long_options);
@@ -219,7 +248,8 @@ int
 set_run_mode(run_mode_t mode)
 {
 	if (opt_mode != RUN_MODE_NONE) {
-		msg("%s: can't set specify both -c and -x.\n", my_progname);
+		msg("%s: only one of -c, -x and -t can be specified.\n",
+		    my_progname);
 		return 1;
 	}
 
@@ -244,6 +274,11 @@ get_one_option(int optid, const struct my_option *opt __attribute__((unused)),
 			return TRUE;
 		}
 		break;
+	case 't':
+		if (set_run_mode(RUN_MODE_LIST)) {
+			return TRUE;
+		}
+		break;
 	case '?':
 		usage();
 		exit(0);
@@ -302,12 +337,18 @@ mode_create(int argc, char **argv)
 		return 1;
 	}
 
-	stream = xb_stream_write_new();
+	stream = xb_stream_write_new(opt_stream_version);
 	if (stream == NULL) {
 		msg("%s: xb_stream_write_new() failed.\n", my_progname);
 		return 1;
 	}
 
+	/* The index can only be used in a regular file */
+	if (my_fstat(fileno(stdout), &mystat, MYF(0)) == 0 &&
+	    MY_S_ISREG(mystat.st_mode)) {
+		xb_stream_write_set_index(stream, NULL, NULL);
+	}
+
 	for (i = 0; i < argc; i++) {
 		char			*filepath = argv[i];
 		File			src_file;
@@ -343,7 +384,9 @@ mode_create(int argc, char **argv)
 		}
 	}
 
-	xb_stream_write_done(stream);
+	if (xb_stream_write_done(stream)) {
+		return 1;
+	}
 
 	return 0;
 err:
@@ -352,286 +395,210 @@ err:
 	return 1;
 }
 
-/************************************************************************
-Check if string ends with given suffix.
-@return true if string ends with given suffix. */
 static
-my_bool
-ends_with(const char *str, const char *suffix)
+int
+mode_extract(int n_threads, int argc, char **argv)
 {
-	size_t suffix_len = strlen(suffix);
-	size_t str_len = strlen(str);
-	return(str_len >= suffix_len
-	       && strcmp(str + str_len - suffix_len, suffix) == 0);
-}
+	ds_ctxt_t		*ds_ctxt = NULL;
+	ds_ctxt_t		*ds_decrypt_ctxt = NULL;
+	ds_ctxt_t		*ds_decompress_ctxt = NULL;
+	ds_ctxt_t		*ds_decrypt_decompress_ctxt = NULL;
+	xb_extract_options_t	options;
+	xb_rstream_t		**streams;
+	File			*fds;
+	int			n_inputs;
+	int			i;
+	int			ret = 0;
 
-static
-file_entry_t *
-file_entry_new(extract_ctxt_t *ctxt, const char *path, uint pathlen)
-{
-	file_entry_t	*entry;
-	ds_file_t	*file;
-
-	entry = (file_entry_t *) my_malloc(PSI_NOT_INSTRUMENTED,
-					   sizeof(file_entry_t),
-					   MYF(MY_WME | MY_ZEROFILL));
-	if (entry == NULL) {
-		return NULL;
-	}
+	/* Read the standard input if no streams are specified */
+	n_inputs = argc > 0 ? argc : 1;
 
-	entry->path = my_strndup(PSI_NOT_INSTRUMENTED,
-				 path, pathlen, MYF(MY_WME));
-	if (entry->path == NULL) {
-		goto err;
-	}
-	entry->pathlen = pathlen;
+	streams = (xb_rstream_t **) my_malloc(PSI_NOT_INSTRUMENTED,
+					      sizeof(xb_rstream_t *) *
+					      n_inputs,
+					      MYF(MY_FAE | MY_ZEROFILL));
+	fds = (File *) my_malloc(PSI_NOT_INSTRUMENTED,
+				 sizeof(File) * n_inputs, MYF(MY_FAE));
 
-	if (ctxt->ds_decrypt_ctxt && ends_with(path, ".xbcrypt")) {
-		file = ds_open(ctxt->ds_decrypt_ctxt, path, NULL);
-	} else {
-		file = ds_open(ctxt->ds_ctxt, path, NULL);
-	}
-	if (file == NULL) {
-		msg("%s: failed to create file.\n", my_progname);
-		goto err;
+	for (i = 0; i < n_inputs; i++) {
+		fds[i] = -1;
 	}
 
-	if (opt_verbose) {
-		msg("%s\n", entry->path);
+	/* Open all inputs before starting the threads. Sharded streams are
+	opened in the same order by xtrabackup, so this does not block forever
+	on named pipes. */
+	for (i = 0; i < n_inputs; i++) {
+		if (argc == 0) {
+			streams[i] = xb_stream_read_new();
+		} else {
+			fds[i] = my_open(argv[i], O_RDONLY | O_BINARY,
+					 MYF(MY_WME));
+			if (fds[i] < 0) {
+				msg("%s: failed to open %s.\n", my_progname,
+				    argv[i]);
+				ret = 1;
+				goto exit;
+			}
+			streams[i] = xb_stream_read_new_fd(fds[i]);
+		}
+		if (streams[i] == NULL) {
+			msg("%s: xb_stream_read_new() failed.\n", my_progname);
+			ret = 1;
+			goto exit;
+		}
 	}
 
-	entry->file = file;
-
-	pthread_mutex_init(&entry->mutex, NULL);
-
-	return entry;
-
-err:
-	if (entry->path != NULL) {
-		my_free(entry->path);
+	/* If --directory is specified, it is already set as CWD by now. */
+	ds_ctxt = ds_create(".", DS_TYPE_LOCAL);
+	if (ds_ctxt == NULL) {
+		ret = 1;
+		goto exit;
 	}
-	my_free(entry);
-
-	return NULL;
-}
-
-static
-uchar *
-get_file_entry_key(file_entry_t *entry, size_t *length,
-		   my_bool not_used __attribute__((unused)))
-{
-	*length = entry->pathlen;
-	return (uchar *) entry->path;
-}
-
-static
-void
-file_entry_free(file_entry_t *entry)
-{
-	pthread_mutex_destroy(&entry->mutex);
-	ds_close(entry->file);
-	my_free(entry->path);
-	my_free(entry);
-}
-
-static
-void *
-extract_worker_thread_func(void *arg)
-{
-	xb_rstream_chunk_t	chunk;
-	file_entry_t		*entry;
-	xb_rstream_result_t	res;
-
-	extract_ctxt_t *ctxt = (extract_ctxt_t *) arg;
-
-	my_thread_init();
 
-	memset(&chunk, 0, sizeof(chunk));
-
-	while (1) {
-
-		pthread_mutex_lock(ctxt->mutex);
-		res = xb_stream_read_chunk(ctxt->stream, &chunk);
+	/* Decryption and decompression share the worker pool */
+	if (xb_executor_threads == 0) {
+		xb_executor_threads = MY_MAX((uint) opt_encrypt_threads,
+					     opt_decompress_threads);
+	}
 
-		if (res != XB_STREAM_READ_CHUNK) {
-			pthread_mutex_unlock(ctxt->mutex);
-			break;
+	if (opt_decompress) {
+		ds_decompress_threads = opt_decompress_threads;
+		ds_decompress_ctxt = ds_create(".", DS_TYPE_DECOMPRESS);
+		if (ds_decompress_ctxt == NULL) {
+			ret = 1;
+			goto exit;
 		}
+		ds_set_pipe(ds_decompress_ctxt, ds_ctxt);
+	}
 
-		/* If unknown type and ignorable flag is set, skip this chunk */
-		if (chunk.type == XB_CHUNK_TYPE_UNKNOWN && \
-		    !(chunk.flags & XB_STREAM_FLAG_IGNORABLE)) {
-			pthread_mutex_unlock(ctxt->mutex);
-			continue;
+	if (opt_encrypt_algo) {
+		ds_encrypt_algo = opt_encrypt_algo;
+		ds_encrypt_key = opt_encrypt_key;
+		ds_encrypt_key_file = opt_encrypt_key_file;
+		ds_decrypt_encrypt_threads = opt_encrypt_threads;
+		ds_decrypt_ctxt = ds_create(".", DS_TYPE_DECRYPT);
+		if (ds_decrypt_ctxt == NULL) {
+			ret = 1;
+			goto exit;
 		}
+		ds_set_pipe(ds_decrypt_ctxt, ds_ctxt);
 
-		/* See if we already have this file open */
-		entry = (file_entry_t *) my_hash_search(ctxt->filehash,
-							(uchar *) chunk.path,
-							chunk.pathlen);
-
-		if (entry == NULL) {
-			entry = file_entry_new(ctxt,
-					       chunk.path,
-					       chunk.pathlen);
-			if (entry == NULL) {
-				res = XB_STREAM_READ_ERROR;
-				pthread_mutex_unlock(ctxt->mutex);
-				break;
-			}
-			if (my_hash_insert(ctxt->filehash, (uchar *) entry)) {
-				msg("%s: my_hash_insert() failed.\n",
-				    my_progname);
-				pthread_mutex_unlock(ctxt->mutex);
-				break;
+		/* Compressed files are encrypted after compression */
+		if (ds_decompress_ctxt != NULL) {
+			ds_decrypt_decompress_ctxt = ds_create(".",
+							DS_TYPE_DECRYPT);
+			if (ds_decrypt_decompress_ctxt == NULL) {
+				ret = 1;
+				goto exit;
 			}
+			ds_set_pipe(ds_decrypt_decompress_ctxt,
+				    ds_decompress_ctxt);
 		}
+	}
 
-		pthread_mutex_lock(&entry->mutex);
-
-		pthread_mutex_unlock(ctxt->mutex);
-
-		res = xb_stream_validate_checksum(&chunk);
+	memset(&options, 0, sizeof(options));
+	options.ds_ctxt = ds_ctxt;
+	options.ds_decrypt_ctxt = ds_decrypt_ctxt;
+	options.ds_decompress_ctxt = ds_decompress_ctxt;
+	options.ds_decrypt_decompress_ctxt = ds_decrypt_decompress_ctxt;
+	options.member = opt_member;
+	options.verbose = opt_verbose;
 
-		if (res != XB_STREAM_READ_CHUNK) {
-			pthread_mutex_unlock(&entry->mutex);
-			break;
-		}
-
-		if (chunk.type == XB_CHUNK_TYPE_EOF) {
-			pthread_mutex_lock(ctxt->mutex);
-			pthread_mutex_unlock(&entry->mutex);
-			my_hash_delete(ctxt->filehash, (uchar *) entry);
-			pthread_mutex_unlock(ctxt->mutex);
+	ret = xb_stream_extract(&options, streams, n_inputs, n_threads);
 
-			continue;
-		}
+exit:
+	if (ds_decrypt_decompress_ctxt != NULL) {
+		ds_destroy(ds_decrypt_decompress_ctxt);
+	}
+	if (ds_decompress_ctxt != NULL) {
+		ds_destroy(ds_decompress_ctxt);
+	}
+	if (ds_ctxt != NULL) {
+		ds_destroy(ds_ctxt);
+	}
+ 	if (ds_decrypt_ctxt) {
+ 		ds_destroy(ds_decrypt_ctxt);
+ 	}
 
-		if (entry->offset != chunk.offset) {
-			msg("%s: out-of-order chunk: real offset = 0x%llx, "
-			    "expected offset = 0x%llx\n", my_progname,
-			    chunk.offset, entry->offset);
-			pthread_mutex_unlock(&entry->mutex);
-			res = XB_STREAM_READ_ERROR;
-			break;
+	for (i = 0; i < n_inputs; i++) {
+		if (streams[i] != NULL) {
+			xb_stream_read_done(streams[i]);
 		}
-
-		if (ds_write(entry->file, chunk.data, chunk.length)) {
-			msg("%s: my_write() failed.\n", my_progname);
-			pthread_mutex_unlock(&entry->mutex);
-			res = XB_STREAM_READ_ERROR;
-			break;
+		if (fds[i] >= 0) {
+			my_close(fds[i], MYF(MY_WME));
 		}
-
-		entry->offset += chunk.length;
-
-		pthread_mutex_unlock(&entry->mutex);
 	}
+	my_free(streams);
+	my_free(fds);
 
-	if (chunk.data)
-		my_free(chunk.data);
-
-	my_thread_end();
-
-	return (void *)(res);
+	return ret;
 }
 
-
+/************************************************************************
+Print the paths of the files in the stream. The index is used when the
+stream has one, otherwise the whole stream is read.
+@return 0 on success, 1 on error. */
 static
 int
-mode_extract(int n_threads, int argc __attribute__((unused)),
-	     char **argv __attribute__((unused)))
+mode_list(int argc, char **argv)
 {
-	xb_rstream_t		*stream = NULL;
-	HASH			filehash;
-	ds_ctxt_t		*ds_ctxt = NULL;
-	ds_ctxt_t		*ds_decrypt_ctxt = NULL;
-	extract_ctxt_t		ctxt;
-	int			i;
-	pthread_t		*tids = NULL;
-	void			**retvals = NULL;
-	pthread_mutex_t		mutex;
+	xb_rstream_t		*stream;
+	xb_stream_index_t	*index;
+	xb_rstream_chunk_t	chunk;
+	xb_rstream_result_t	res;
+	File			fd = -1;
+	ulong			i;
 	int			ret = 0;
 
-	if (my_hash_init(&filehash, &my_charset_bin, START_FILE_HASH_SIZE,
-			  0, 0, (my_hash_get_key) get_file_entry_key,
-			  (my_hash_free_key) file_entry_free, MYF(0),
-			  PSI_NOT_INSTRUMENTED)) {
-		msg("%s: failed to initialize file hash.\n", my_progname);
+	if (argc > 1) {
+		msg("%s: only one stream can be listed.\n", my_progname);
 		return 1;
 	}
 
-	if (pthread_mutex_init(&mutex, NULL)) {
-		msg("%s: failed to initialize mutex.\n", my_progname);
-		my_hash_free(&filehash);
-		return 1;
+	if (argc == 1) {
+		fd = my_open(argv[0], O_RDONLY | O_BINARY, MYF(MY_WME));
+		if (fd < 0) {
+			msg("%s: failed to open %s.\n", my_progname, argv[0]);
+			return 1;
+		}
+		stream = xb_stream_read_new_fd(fd);
+	} else {
+		stream = xb_stream_read_new();
 	}
 
-	/* If --directory is specified, it is already set as CWD by now. */
-	ds_ctxt = ds_create(".", DS_TYPE_LOCAL);
-	if (ds_ctxt == NULL) {
-		ret = 1;
+	/* Every file has exactly one EOF chunk */
+	index = xb_stream_read_index(stream);
+	if (index != NULL) {
+		for (i = 0; i < index->n_entries; i++) {
+			if (index->entries[i].type == XB_CHUNK_TYPE_EOF) {
+				printf("%.*s\n", (int) index->entries[i].pathlen,
+				       index->entries[i].path);
+			}
+		}
+		xb_stream_index_free(index);
 		goto exit;
 	}
 
-	if (opt_encrypt_algo) {
-		ds_encrypt_algo = opt_encrypt_algo;
-		ds_encrypt_key = opt_encrypt_key;
-		ds_encrypt_key_file = opt_encrypt_key_file;
-		ds_decrypt_encrypt_threads = opt_encrypt_threads;
-		ds_decrypt_ctxt = ds_create(".", DS_TYPE_DECRYPT);
-		if (ds_decrypt_ctxt == NULL) {
-			ret = 1;
-			goto exit;
+	memset(&chunk, 0, sizeof(chunk));
+
+	while ((res = xb_stream_read_chunk(stream, &chunk)) ==
+	       XB_STREAM_READ_CHUNK) {
+		if (chunk.type == XB_CHUNK_TYPE_EOF) {
+			printf("%s\n", chunk.path);
 		}
-		ds_set_pipe(ds_decrypt_ctxt, ds_ctxt);
 	}
 
-	stream = xb_stream_read_new();
-	if (stream == NULL) {
-		msg("%s: xb_stream_read_new() failed.\n", my_progname);
-		pthread_mutex_destroy(&mutex);
+	if (res == XB_STREAM_READ_ERROR) {
 		ret = 1;
-		goto exit;
 	}
 
-	ctxt.stream = stream;
-	ctxt.filehash = &filehash;
-	ctxt.ds_ctxt = ds_ctxt;
-	ctxt.ds_decrypt_ctxt = ds_decrypt_ctxt;
-	ctxt.mutex = &mutex;
-
-	tids = malloc(sizeof(pthread_t) * n_threads);
-	retvals = malloc(sizeof(void*) * n_threads);
-
-	for (i = 0; i < n_threads; i++)
-		pthread_create(tids + i, NULL, extract_worker_thread_func,
-			       &ctxt);
-
-	for (i = 0; i < n_threads; i++)
-		pthread_join(tids[i], retvals + i);
-
-	for (i = 0; i < n_threads; i++) {
-		if ((ulong)retvals[i] == XB_STREAM_READ_ERROR) {
-			ret = 1;
-			goto exit;
-		}
-	}
+	my_free(chunk.data);
 
 exit:
-	pthread_mutex_destroy(&mutex);
-
-	free(tids);
-	free(retvals);
-
-	my_hash_free(&filehash);
-	if (ds_ctxt != NULL) {
-		ds_destroy(ds_ctxt);
-	}
- 	if (ds_decrypt_ctxt) {
- 		ds_destroy(ds_decrypt_ctxt);
- 	}
 	xb_stream_read_done(stream);
+	if (fd >= 0) {
+		my_close(fd, MYF(MY_WME));
+	}
 
 	return ret;
 }
@@ -23,10 +23,32 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 
 #include <my_base.h>
 #include <my_dir.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* Magic value in a chunk header */
 #define XB_STREAM_CHUNK_MAGIC "XBSTCK01"
 
+/* Magic value in a version 2 chunk header. Version 2 chunks have the same
+layout as version 1 ones, but payloads are checksummed with CRC-32C, and the
+stream may end with an index chunk. */
+#define XB_STREAM_CHUNK_MAGIC_V2 "XBSTCK02"
+
+/* Stream format version written by default. Version 2 is opt-in, as older
+binaries cannot read it. */
+#define XB_STREAM_VERSION_DEFAULT 1
+
+/* The payload of the index chunk is a sequence of records, one per chunk:
+chunk type (1 byte), path length (4 bytes), path, offset of the chunk from the
+beginning of the stream (8 bytes), followed by a trailer, which is also the
+end of the stream: offset of the index chunk (8 bytes), length of the index
+chunk (8 bytes), XB_STREAM_INDEX_MAGIC. */
+#define XB_STREAM_INDEX_MAGIC "XBSTIDX2"
+#define XB_STREAM_INDEX_TRAILER_LEN (8 + 8 + sizeof(XB_STREAM_INDEX_MAGIC) - 1)
+
 /* Chunk flags */
 /* Chunk can be ignored if unknown version/format */
 #define XB_STREAM_FLAG_IGNORABLE 0x01
@@ -50,11 +72,22 @@ typedef enum {
 /************************************************************************
 Write interface. */
 
+/* Called with the chunk header and payload buffers of each chunk, which are
+to be written in order as a single unit. Returns -1 on error. */
 typedef ssize_t xb_stream_write_callback(xb_wstream_file_t *file,
 					 void *userdata,
-					 const void *buf, size_t len);
+					 const struct iovec *iov,
+					 uint iovcnt);
 
-xb_wstream_t *xb_stream_write_new(void);
+xb_wstream_t *xb_stream_write_new(uint version);
+
+/* Write an index of all chunks at the end of the stream when it is done.
+Only done for version 2 streams; should only be requested when the output is
+seekable, as that is the only case when the index can be used. 'onwrite' and
+'userdata' are used to write the index chunk. */
+void xb_stream_write_set_index(xb_wstream_t *stream,
+			       xb_stream_write_callback *onwrite,
+			       void *userdata);
 
 xb_wstream_file_t *xb_stream_write_open(xb_wstream_t *stream, const char *path,
 					MY_STAT *mystat, void *userdata,
@@ -62,6 +95,9 @@ xb_wstream_file_t *xb_stream_write_open(xb_wstream_t *stream, const char *path,
 
 int xb_stream_write_data(xb_wstream_file_t *file, const void *buf, size_t len);
 
+int xb_stream_write_datav(xb_wstream_file_t *file, const struct iovec *iov,
+			  uint iovcnt);
+
 int xb_stream_write_close(xb_wstream_file_t *file);
 
 int xb_stream_write_done(xb_wstream_t *stream);
@@ -78,12 +114,14 @@ typedef enum {
 typedef enum {
 	XB_CHUNK_TYPE_UNKNOWN = '\0',
 	XB_CHUNK_TYPE_PAYLOAD = 'P',
-	XB_CHUNK_TYPE_EOF = 'E'
+	XB_CHUNK_TYPE_EOF = 'E',
+	XB_CHUNK_TYPE_INDEX = 'I'
 } xb_chunk_type_t;
 
 typedef struct xb_rstream_struct xb_rstream_t;
 
 typedef struct {
+	uint		version;
 	uchar           flags;
 	xb_chunk_type_t type;
 	uint		pathlen;
@@ -98,11 +136,45 @@ typedef struct {
 
 xb_rstream_t *xb_stream_read_new(void);
 
+/* Read the stream from an already open file. The file is not closed by
+xb_stream_read_done(). */
+xb_rstream_t *xb_stream_read_new_fd(File fd);
+
 xb_rstream_result_t xb_stream_read_chunk(xb_rstream_t *stream,
 					 xb_rstream_chunk_t *chunk);
 
 int xb_stream_read_done(xb_rstream_t *stream);
 
+typedef struct {
+	xb_chunk_type_t	type;
+	const char	*path;		/* not '\0'-terminated */
+	uint		pathlen;
+	my_off_t	offset;		/* chunk offset in the stream */
+} xb_stream_index_entry_t;
+
+typedef struct {
+	xb_stream_index_entry_t	*entries;
+	ulong			n_entries;
+	xb_rstream_chunk_t	chunk;	/* holds the index chunk payload */
+} xb_stream_index_t;
+
+/* Read the index of a stream in a regular file. On success the stream is
+positioned at the beginning of the stream, and xb_stream_read_chunk_at() can
+be used to read chunks by their index entries.
+@return index or NULL if the stream has no index or cannot be seeked. */
+xb_stream_index_t *xb_stream_read_index(xb_rstream_t *stream);
+
+void xb_stream_index_free(xb_stream_index_t *index);
+
+/* Read the chunk at the specified offset from the beginning of the stream */
+xb_rstream_result_t xb_stream_read_chunk_at(xb_rstream_t *stream,
+					    my_off_t offset,
+					    xb_rstream_chunk_t *chunk);
+
 int xb_stream_validate_checksum(xb_rstream_chunk_t *chunk);
 
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
 #endif
@@ -0,0 +1,738 @@
+/******************************************************
+Copyright (c) 2011-2018 Percona LLC and/or its affiliates.
+
+Parallel extraction of xbstream streams.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#include <my_base.h>
+#include <hash.h>
+#include <pthread.h>
+#include "common.h"
+#include "xbstream.h"
+#include "xbstream_extract.h"
+
+#define START_FILE_HASH_SIZE 16
+
+
+typedef struct {
+	char 		*path;
+	uint		pathlen;
+	my_off_t	read_offset;	/* next expected chunk offset, used by
+					the reader only */
+	my_off_t	offset;		/* write position of files that are
+					written in the stream order */
+	my_bool		positional;	/* chunks are written with
+					ds_pwrite() */
+	uint		pending;	/* chunks queued, but not written yet */
+	ds_file_t	*file;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	cond;
+} file_entry_t;
+
+/* A chunk buffer. Buffers are reused, so chunk data is only reallocated when
+a larger chunk is read. */
+typedef struct {
+	xb_rstream_chunk_t	chunk;
+	file_entry_t		*entry;
+} extract_slot_t;
+
+/* Bounded queue of chunks between the reader threads and the workers. Chunks
+are taken by the workers in the order they were read. */
+typedef struct {
+	extract_slot_t		*slots;
+	uint			n_slots;
+	extract_slot_t		**free_slots;	/* stack of unused slots */
+	uint			n_free;
+	extract_slot_t		**queue;	/* ring of read chunks */
+	uint			head;
+	uint			n_queued;
+	uint			n_readers;	/* readers still running */
+	my_bool			error;
+	pthread_mutex_t		mutex;
+	pthread_cond_t		slot_free;
+	pthread_cond_t		slot_queued;
+} extract_queue_t;
+
+typedef struct {
+	const xb_extract_options_t	*options;
+	HASH				filehash;
+	pthread_mutex_t			mutex;	/* protects filehash */
+	my_bool				member_found;
+	extract_queue_t			queue;
+} extract_ctxt_t;
+
+/* A reader thread. A file is never split between streams, so each stream is
+read by its own thread. */
+typedef struct {
+	extract_ctxt_t		*ctxt;
+	xb_rstream_t		*stream;
+} extract_thread_arg_t;
+
+/************************************************************************
+Check if string ends with given suffix.
+@return true if string ends with given suffix. */
+static
+my_bool
+ends_with(const char *str, const char *suffix)
+{
+	size_t suffix_len = strlen(suffix);
+	size_t str_len = strlen(str);
+	return(str_len >= suffix_len
+	       && strcmp(str + str_len - suffix_len, suffix) == 0);
+}
+
+static
+file_entry_t *
+file_entry_new(extract_ctxt_t *ctxt, const char *path, uint pathlen)
+{
+	const xb_extract_options_t	*options = ctxt->options;
+	file_entry_t			*entry;
+	ds_file_t			*file;
+
+	entry = (file_entry_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+					   sizeof(file_entry_t),
+					   MYF(MY_WME | MY_ZEROFILL));
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	entry->path = my_strndup(PSI_NOT_INSTRUMENTED,
+				 path, pathlen, MYF(MY_WME));
+	if (entry->path == NULL) {
+		goto err;
+	}
+	entry->pathlen = pathlen;
+
+	if (options->ds_decrypt_decompress_ctxt &&
+	    ends_with(entry->path, ".qp.xbcrypt")) {
+		file = ds_open(options->ds_decrypt_decompress_ctxt,
+			       entry->path, NULL);
+	} else if (options->ds_decrypt_ctxt &&
+		   ends_with(entry->path, ".xbcrypt")) {
+		file = ds_open(options->ds_decrypt_ctxt, entry->path, NULL);
+	} else if (options->ds_decompress_ctxt &&
+		   ends_with(entry->path, ".qp")) {
+		file = ds_open(options->ds_decompress_ctxt, entry->path, NULL);
+	} else if (options->plain_only &&
+		   (ends_with(entry->path, ".qp") ||
+		    ends_with(entry->path, ".xbcrypt"))) {
+		msg("%s: %s is compressed or encrypted, use --decompress and "
+		    "--decrypt to extract it.\n", my_progname, entry->path);
+		goto err;
+	} else {
+		file = ds_open(options->ds_ctxt, entry->path, NULL);
+	}
+	if (file == NULL) {
+		msg("%s: failed to create file.\n", my_progname);
+		goto err;
+	}
+
+	if (options->verbose) {
+		msg("%s\n", entry->path);
+	}
+
+	entry->file = file;
+	entry->positional = ds_can_pwrite(file);
+
+	pthread_mutex_init(&entry->mutex, NULL);
+	pthread_cond_init(&entry->cond, NULL);
+
+	return entry;
+
+err:
+	if (entry->path != NULL) {
+		my_free(entry->path);
+	}
+	my_free(entry);
+
+	return NULL;
+}
+
+static
+uchar *
+get_file_entry_key(file_entry_t *entry, size_t *length,
+		   my_bool not_used __attribute__((unused)))
+{
+	*length = entry->pathlen;
+	return (uchar *) entry->path;
+}
+
+static
+void
+file_entry_free(file_entry_t *entry)
+{
+	pthread_mutex_destroy(&entry->mutex);
+	pthread_cond_destroy(&entry->cond);
+	ds_close(entry->file);
+	my_free(entry->path);
+	my_free(entry);
+}
+
+static
+void
+extract_queue_init(extract_queue_t *queue, uint n_slots, uint n_readers)
+{
+	uint	i;
+
+	queue->slots = (extract_slot_t *)
+		my_malloc(PSI_NOT_INSTRUMENTED,
+			  sizeof(extract_slot_t) * n_slots,
+			  MYF(MY_FAE | MY_ZEROFILL));
+	queue->free_slots = (extract_slot_t **)
+		my_malloc(PSI_NOT_INSTRUMENTED,
+			  sizeof(extract_slot_t *) * n_slots, MYF(MY_FAE));
+	queue->queue = (extract_slot_t **)
+		my_malloc(PSI_NOT_INSTRUMENTED,
+			  sizeof(extract_slot_t *) * n_slots, MYF(MY_FAE));
+
+	for (i = 0; i < n_slots; i++) {
+		queue->free_slots[i] = queue->slots + i;
+	}
+
+	queue->n_slots = n_slots;
+	queue->n_free = n_slots;
+	queue->head = 0;
+	queue->n_queued = 0;
+	queue->n_readers = n_readers;
+	queue->error = FALSE;
+
+	pthread_mutex_init(&queue->mutex, NULL);
+	pthread_cond_init(&queue->slot_free, NULL);
+	pthread_cond_init(&queue->slot_queued, NULL);
+}
+
+static
+void
+extract_queue_destroy(extract_queue_t *queue)
+{
+	uint	i;
+
+	for (i = 0; i < queue->n_slots; i++) {
+		my_free(queue->slots[i].chunk.data);
+	}
+
+	my_free(queue->slots);
+	my_free(queue->free_slots);
+	my_free(queue->queue);
+
+	pthread_mutex_destroy(&queue->mutex);
+	pthread_cond_destroy(&queue->slot_free);
+	pthread_cond_destroy(&queue->slot_queued);
+}
+
+/* Get an unused slot for reading a chunk.
+@return slot or NULL if extraction has failed. */
+static
+extract_slot_t *
+extract_queue_get_free(extract_queue_t *queue)
+{
+	extract_slot_t	*slot = NULL;
+
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->n_free == 0 && !queue->error) {
+		pthread_cond_wait(&queue->slot_free, &queue->mutex);
+	}
+	if (!queue->error) {
+		slot = queue->free_slots[--queue->n_free];
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return slot;
+}
+
+static
+void
+extract_queue_put_free(extract_queue_t *queue, extract_slot_t *slot)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->free_slots[queue->n_free++] = slot;
+	pthread_cond_signal(&queue->slot_free);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static
+void
+extract_queue_put(extract_queue_t *queue, extract_slot_t *slot)
+{
+	pthread_mutex_lock(&queue->mutex);
+	xb_a(queue->n_queued < queue->n_slots);
+	queue->queue[(queue->head + queue->n_queued++) % queue->n_slots] =
+		slot;
+	pthread_cond_signal(&queue->slot_queued);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/* Get the next read chunk.
+@return slot or NULL if all readers have finished and the queue is empty. */
+static
+extract_slot_t *
+extract_queue_get(extract_queue_t *queue)
+{
+	extract_slot_t	*slot = NULL;
+
+	pthread_mutex_lock(&queue->mutex);
+	while (queue->n_queued == 0 && queue->n_readers > 0) {
+		pthread_cond_wait(&queue->slot_queued, &queue->mutex);
+	}
+	if (queue->n_queued > 0) {
+		slot = queue->queue[queue->head];
+		queue->head = (queue->head + 1) % queue->n_slots;
+		queue->n_queued--;
+	}
+	pthread_mutex_unlock(&queue->mutex);
+
+	return slot;
+}
+
+static
+void
+extract_queue_reader_done(extract_queue_t *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->n_readers--;
+	pthread_cond_broadcast(&queue->slot_queued);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+/* Stop the readers. Chunks that are already queued are still passed to the
+workers to release the files, but not written. */
+static
+void
+extract_queue_set_error(extract_queue_t *queue)
+{
+	pthread_mutex_lock(&queue->mutex);
+	queue->error = TRUE;
+	pthread_cond_broadcast(&queue->slot_free);
+	pthread_mutex_unlock(&queue->mutex);
+}
+
+static
+my_bool
+extract_queue_failed(extract_queue_t *queue)
+{
+	my_bool	error;
+
+	pthread_mutex_lock(&queue->mutex);
+	error = queue->error;
+	pthread_mutex_unlock(&queue->mutex);
+
+	return error;
+}
+
+/************************************************************************
+Read chunks from one input and queue them for the workers. Only the chunk
+headers are looked at here, so that a single reader can keep many workers
+busy. */
+static
+void *
+extract_reader_thread_func(void *arg)
+{
+	extract_slot_t		*slot = NULL;
+	xb_rstream_chunk_t	*chunk;
+	file_entry_t		*entry;
+	xb_rstream_result_t	res;
+
+	extract_ctxt_t *ctxt = ((extract_thread_arg_t *) arg)->ctxt;
+	xb_rstream_t *stream = ((extract_thread_arg_t *) arg)->stream;
+	extract_queue_t *queue = &ctxt->queue;
+	const char *member = ctxt->options->member;
+
+	my_thread_init();
+
+	while (1) {
+
+		if (slot == NULL) {
+			slot = extract_queue_get_free(queue);
+			if (slot == NULL) {
+				/* Failed in another thread */
+				res = XB_STREAM_READ_EOF;
+				break;
+			}
+		}
+		chunk = &slot->chunk;
+
+		res = xb_stream_read_chunk(stream, chunk);
+
+		if (res != XB_STREAM_READ_CHUNK) {
+			break;
+		}
+
+		/* If unknown type and ignorable flag is set, skip this chunk */
+		if (chunk->type == XB_CHUNK_TYPE_UNKNOWN && \
+		    !(chunk->flags & XB_STREAM_FLAG_IGNORABLE)) {
+			continue;
+		}
+
+		/* The index is only used for random access */
+		if (chunk->type == XB_CHUNK_TYPE_INDEX ||
+		    (member != NULL && strcmp(chunk->path, member))) {
+			continue;
+		}
+
+		pthread_mutex_lock(&ctxt->mutex);
+
+		/* See if we already have this file open */
+		entry = (file_entry_t *) my_hash_search(&ctxt->filehash,
+							(uchar *) chunk->path,
+							chunk->pathlen);
+
+		if (entry == NULL) {
+			entry = file_entry_new(ctxt,
+					       chunk->path,
+					       chunk->pathlen);
+			if (entry == NULL) {
+				pthread_mutex_unlock(&ctxt->mutex);
+				res = XB_STREAM_READ_ERROR;
+				break;
+			}
+			if (my_hash_insert(&ctxt->filehash, (uchar *) entry)) {
+				msg("%s: my_hash_insert() failed.\n",
+				    my_progname);
+				pthread_mutex_unlock(&ctxt->mutex);
+				file_entry_free(entry);
+				res = XB_STREAM_READ_ERROR;
+				break;
+			}
+			ctxt->member_found = TRUE;
+		}
+
+		if (chunk->type == XB_CHUNK_TYPE_EOF) {
+			/* The entry is freed by the worker that gets the EOF
+			chunk, a file with the same path that follows in the
+			stream gets a new entry */
+			my_hash_delete(&ctxt->filehash, (uchar *) entry);
+		}
+
+		pthread_mutex_unlock(&ctxt->mutex);
+
+		if (chunk->type != XB_CHUNK_TYPE_EOF) {
+			if (entry->read_offset != chunk->offset) {
+				msg("%s: out-of-order chunk: real offset = "
+				    "0x%llx, expected offset = 0x%llx\n",
+				    my_progname, chunk->offset,
+				    entry->read_offset);
+				res = XB_STREAM_READ_ERROR;
+				break;
+			}
+			entry->read_offset += chunk->length;
+
+			pthread_mutex_lock(&entry->mutex);
+			entry->pending++;
+			pthread_mutex_unlock(&entry->mutex);
+		}
+
+		slot->entry = entry;
+		extract_queue_put(queue, slot);
+		slot = NULL;
+	}
+
+	if (slot != NULL) {
+		extract_queue_put_free(queue, slot);
+	}
+
+	if (res == XB_STREAM_READ_ERROR) {
+		extract_queue_set_error(queue);
+	}
+
+	extract_queue_reader_done(queue);
+
+	my_thread_end();
+
+	return (void *)(res);
+}
+
+/************************************************************************
+Write one queued chunk. Chunks of files that support positional writes are
+written independently of each other, other files (i.e. the ones that are
+decrypted) get their chunks in the stream order.
+@return 0 on success, 1 on error. */
+static
+int
+extract_write_chunk(extract_ctxt_t *ctxt, xb_rstream_chunk_t *chunk,
+		    file_entry_t *entry)
+{
+	my_bool	skip = extract_queue_failed(&ctxt->queue);
+	int	ret = 0;
+
+	if (chunk->type == XB_CHUNK_TYPE_EOF) {
+		/* Wait for the chunks of the file that are still being
+		written by other workers */
+		pthread_mutex_lock(&entry->mutex);
+		while (entry->pending > 0) {
+			pthread_cond_wait(&entry->cond, &entry->mutex);
+		}
+		pthread_mutex_unlock(&entry->mutex);
+
+		file_entry_free(entry);
+
+		return 0;
+	}
+
+	if (!skip &&
+	    xb_stream_validate_checksum(chunk) != XB_STREAM_READ_CHUNK) {
+		skip = TRUE;
+		ret = 1;
+	}
+
+	if (entry->positional) {
+		if (!skip && ds_pwrite(entry->file, chunk->data,
+				       chunk->length, chunk->offset)) {
+			msg("%s: my_pwrite() failed.\n", my_progname);
+			ret = 1;
+		}
+
+		pthread_mutex_lock(&entry->mutex);
+	} else {
+		pthread_mutex_lock(&entry->mutex);
+
+		/* Skipped chunks still have to take their turn, so that the
+		following chunks are not waiting forever */
+		while (entry->offset != chunk->offset) {
+			pthread_cond_wait(&entry->cond, &entry->mutex);
+		}
+
+		if (!skip && ds_write(entry->file, chunk->data,
+				      chunk->length)) {
+			msg("%s: my_write() failed.\n", my_progname);
+			ret = 1;
+		}
+
+		entry->offset += chunk->length;
+	}
+
+	entry->pending--;
+	pthread_cond_broadcast(&entry->cond);
+	pthread_mutex_unlock(&entry->mutex);
+
+	return ret;
+}
+
+static
+void *
+extract_worker_thread_func(void *arg)
+{
+	extract_ctxt_t		*ctxt = (extract_ctxt_t *) arg;
+	extract_slot_t		*slot;
+	xb_rstream_result_t	res = XB_STREAM_READ_EOF;
+
+	my_thread_init();
+
+	while ((slot = extract_queue_get(&ctxt->queue)) != NULL) {
+
+		if (extract_write_chunk(ctxt, &slot->chunk, slot->entry)) {
+			extract_queue_set_error(&ctxt->queue);
+			res = XB_STREAM_READ_ERROR;
+		}
+
+		extract_queue_put_free(&ctxt->queue, slot);
+	}
+
+	my_thread_end();
+
+	return (void *)(res);
+}
+
+
+/************************************************************************
+Extract the member file using the stream index, reading only the chunks of
+that file.
+@return 0 on success, 1 on error. */
+static
+int
+extract_member_indexed(extract_ctxt_t *ctxt, xb_rstream_t *stream,
+		       const xb_stream_index_t *index)
+{
+	const char		*member = ctxt->options->member;
+	xb_rstream_chunk_t	chunk;
+	file_entry_t		*entry = NULL;
+	size_t			member_len = strlen(member);
+	ulong			i;
+	int			ret = 0;
+
+	memset(&chunk, 0, sizeof(chunk));
+
+	for (i = 0; i < index->n_entries; i++) {
+		const xb_stream_index_entry_t *ientry = index->entries + i;
+
+		if (ientry->pathlen != member_len ||
+		    memcmp(ientry->path, member, member_len)) {
+			continue;
+		}
+
+		if (xb_stream_read_chunk_at(stream, ientry->offset, &chunk) !=
+		    XB_STREAM_READ_CHUNK ||
+		    chunk.type != ientry->type ||
+		    strcmp(chunk.path, member)) {
+			msg("%s: the stream index does not match the stream "
+			    "at offset 0x%llx.\n", my_progname,
+			    (ulonglong) ientry->offset);
+			ret = 1;
+			break;
+		}
+
+		if (entry == NULL) {
+			entry = file_entry_new(ctxt, chunk.path,
+					       chunk.pathlen);
+			if (entry == NULL) {
+				ret = 1;
+				break;
+			}
+			ctxt->member_found = TRUE;
+		}
+
+		if (chunk.type == XB_CHUNK_TYPE_EOF) {
+			break;
+		}
+
+		if (xb_stream_validate_checksum(&chunk) !=
+		    XB_STREAM_READ_CHUNK) {
+			ret = 1;
+			break;
+		}
+
+		if (entry->offset != chunk.offset) {
+			msg("%s: out-of-order chunk: real offset = 0x%llx, "
+			    "expected offset = 0x%llx\n", my_progname,
+			    chunk.offset, entry->offset);
+			ret = 1;
+			break;
+		}
+
+		if (ds_write(entry->file, chunk.data, chunk.length)) {
+			msg("%s: my_write() failed.\n", my_progname);
+			ret = 1;
+			break;
+		}
+
+		entry->offset += chunk.length;
+	}
+
+	if (entry != NULL) {
+		file_entry_free(entry);
+	}
+
+	my_free(chunk.data);
+
+	return ret;
+}
+
+/************************************************************************
+Extract the files from the streams.
+@return 0 on success, 1 on error. */
+int
+xb_stream_extract(const xb_extract_options_t *options, xb_rstream_t **streams,
+		  uint n_streams, uint n_threads)
+{
+	extract_ctxt_t		ctxt;
+	extract_thread_arg_t	*args = NULL;
+	pthread_t		*tids = NULL;
+	void			**retvals = NULL;
+	file_entry_t		*entry;
+	uint			i;
+	int			ret = 0;
+
+	ctxt.options = options;
+	ctxt.member_found = FALSE;
+
+	/* Entries are freed when the EOF chunk is written, so that is not done
+	by the hash */
+	if (my_hash_init(&ctxt.filehash, &my_charset_bin, START_FILE_HASH_SIZE,
+			  0, 0, (my_hash_get_key) get_file_entry_key,
+			  NULL, MYF(0),
+			  PSI_NOT_INSTRUMENTED)) {
+		msg("%s: failed to initialize file hash.\n", my_progname);
+		return 1;
+	}
+
+	if (pthread_mutex_init(&ctxt.mutex, NULL)) {
+		msg("%s: failed to initialize mutex.\n", my_progname);
+		my_hash_free(&ctxt.filehash);
+		return 1;
+	}
+
+	/* A single file in a stream with an index is extracted directly */
+	if (options->member != NULL && n_streams == 1) {
+		xb_stream_index_t	*index;
+
+		index = xb_stream_read_index(streams[0]);
+		if (index != NULL) {
+			ret = extract_member_indexed(&ctxt, streams[0], index);
+			xb_stream_index_free(index);
+			goto done;
+		}
+	}
+
+	/* Every worker can have one chunk in progress while the readers fill up
+	to two more chunks per stream */
+	extract_queue_init(&ctxt.queue, n_threads + 2 * n_streams, n_streams);
+
+	tids = malloc(sizeof(pthread_t) * (n_threads + n_streams));
+	retvals = malloc(sizeof(void*) * (n_threads + n_streams));
+	args = malloc(sizeof(extract_thread_arg_t) * n_streams);
+
+	for (i = 0; i < n_streams; i++) {
+		args[i].ctxt = &ctxt;
+		args[i].stream = streams[i];
+		pthread_create(tids + i, NULL, extract_reader_thread_func,
+			       args + i);
+	}
+
+	for (i = 0; i < n_threads; i++) {
+		pthread_create(tids + n_streams + i, NULL,
+			       extract_worker_thread_func, &ctxt);
+	}
+
+	for (i = 0; i < n_threads + n_streams; i++)
+		pthread_join(tids[i], retvals + i);
+
+	extract_queue_destroy(&ctxt.queue);
+
+	for (i = 0; i < n_threads + n_streams; i++) {
+		if ((ulong)retvals[i] == XB_STREAM_READ_ERROR) {
+			ret = 1;
+		}
+	}
+
+done:
+	if (ret == 0 && options->member != NULL && !ctxt.member_found) {
+		msg("%s: %s: not found in the stream.\n", my_progname,
+		    options->member);
+		ret = 1;
+	}
+
+	if (ret == 0 && options->complete && ctxt.filehash.records > 0) {
+		entry = (file_entry_t *) my_hash_element(&ctxt.filehash, 0);
+		msg("%s: unexpected end of stream, %s is incomplete.\n",
+		    my_progname, entry->path);
+		ret = 1;
+	}
+
+	/* Close the files that were not finished with an EOF chunk */
+	for (i = 0; i < ctxt.filehash.records; i++) {
+		file_entry_free((file_entry_t *) my_hash_element(&ctxt.filehash,
+								 i));
+	}
+	my_hash_free(&ctxt.filehash);
+
+	pthread_mutex_destroy(&ctxt.mutex);
+
+	free(tids);
+	free(retvals);
+	free(args);
+
+	return ret;
+}
@@ -0,0 +1,57 @@
+/******************************************************
+Copyright (c) 2011-2018 Percona LLC and/or its affiliates.
+
+Parallel extraction of xbstream streams.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+
+*******************************************************/
+
+#ifndef XBSTREAM_EXTRACT_H
+#define XBSTREAM_EXTRACT_H
+
+#include "datasink.h"
+#include "xbstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	ds_ctxt_t	*ds_ctxt;		/* destination of the files */
+	ds_ctxt_t	*ds_decrypt_ctxt;	/* .xbcrypt files, or NULL */
+	ds_ctxt_t	*ds_decompress_ctxt;	/* .qp files, or NULL */
+	ds_ctxt_t	*ds_decrypt_decompress_ctxt;
+						/* .qp.xbcrypt files, or NULL */
+	const char	*member;		/* the only file to extract, or
+						NULL */
+	my_bool		verbose;		/* print the extracted paths */
+	my_bool		plain_only;		/* fail on .qp and .xbcrypt files
+						that are not decoded */
+	my_bool		complete;		/* fail on files that are not
+						finished with an EOF chunk */
+} xb_extract_options_t;
+
+/* Extract the files from the streams. Each stream is read by its own thread,
+and the chunks are checksummed and written by n_threads workers, at their
+offsets where the datasink allows it.
+@return 0 on success, 1 on error. */
+int xb_stream_extract(const xb_extract_options_t *options,
+		      xb_rstream_t **streams, uint n_streams, uint n_threads);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
@@ -35,22 +35,30 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 struct xb_rstream_struct {
 	my_off_t	offset;
 	File 		fd;
+	my_off_t	base;	/* file offset of the stream start */
 };
 
 xb_rstream_t *
 xb_stream_read_new(void)
+{
+#ifdef __WIN__
+	setmode(fileno(stdin), _O_BINARY);
+#endif
+
+	return xb_stream_read_new_fd(fileno(stdin));
+}
+
+xb_rstream_t *
+xb_stream_read_new_fd(File fd)
 {
 	xb_rstream_t *stream;
 
 	stream = (xb_rstream_t *) my_malloc(PSI_NOT_INSTRUMENTED,
 					    sizeof(xb_rstream_t), MYF(MY_FAE));
 
-	stream->fd = fileno(stdin);
+	stream->fd = fd;
 	stream->offset = 0;
-
-#ifdef __WIN__
-	setmode(stream->fd, _O_BINARY);
-#endif
+	stream->base = 0;
 
 	return stream;
 }
@@ -62,6 +70,7 @@ validate_chunk_type(uchar code)
 	switch ((xb_chunk_type_t) code) {
 	case XB_CHUNK_TYPE_PAYLOAD:
 	case XB_CHUNK_TYPE_EOF:
+	case XB_CHUNK_TYPE_INDEX:
 		return (xb_chunk_type_t) code;
 	default:
 		return XB_CHUNK_TYPE_UNKNOWN;
@@ -73,7 +82,11 @@ xb_stream_validate_checksum(xb_rstream_chunk_t *chunk)
 {
 	ulong	checksum;
 
-	checksum = crc32_iso3309(0, chunk->data, chunk->length);
+	if (chunk->version == 1) {
+		checksum = crc32_iso3309(0, chunk->data, chunk->length);
+	} else {
+		checksum = crc32c(0, chunk->data, chunk->length);
+	}
 	if (checksum != chunk->checksum) {
 		msg("xb_stream_read_chunk(): invalid checksum at offset "
 		    "0x%llx: expected 0x%lx, read 0x%lx.\n",
@@ -119,7 +132,11 @@ xb_stream_read_chunk(xb_rstream_t *stream, xb_rstream_chunk_t *chunk)
 	ptr = tmpbuf;
 
 	/* Chunk magic value */
-	if (memcmp(tmpbuf, XB_STREAM_CHUNK_MAGIC, 8)) {
+	if (!memcmp(tmpbuf, XB_STREAM_CHUNK_MAGIC, 8)) {
+		chunk->version = 1;
+	} else if (!memcmp(tmpbuf, XB_STREAM_CHUNK_MAGIC_V2, 8)) {
+		chunk->version = 2;
+	} else {
 		msg("xb_stream_read_chunk(): wrong chunk magic at offset "
 		    "0x%llx.\n", (ulonglong) stream->offset);
 		goto err;
@@ -221,6 +238,128 @@ err:
 	return XB_STREAM_READ_ERROR;
 }
 
+xb_rstream_result_t
+xb_stream_read_chunk_at(xb_rstream_t *stream, my_off_t offset,
+			xb_rstream_chunk_t *chunk)
+{
+	if (my_seek(stream->fd, stream->base + offset, MY_SEEK_SET,
+		    MYF(MY_WME)) == MY_FILEPOS_ERROR) {
+		return XB_STREAM_READ_ERROR;
+	}
+	stream->offset = offset;
+
+	return xb_stream_read_chunk(stream, chunk);
+}
+
+xb_stream_index_t *
+xb_stream_read_index(xb_rstream_t *stream)
+{
+	MY_STAT			mystat;
+	uchar			trailer[XB_STREAM_INDEX_TRAILER_LEN];
+	my_off_t		index_offset;
+	my_off_t		index_len;
+	xb_stream_index_t	*index;
+	const uchar		*ptr;
+	const uchar		*end;
+	ulong			n;
+
+	if (my_fstat(stream->fd, &mystat, MYF(0)) ||
+	    !MY_S_ISREG(mystat.st_mode) ||
+	    (my_off_t) mystat.st_size < sizeof(trailer)) {
+		return NULL;
+	}
+
+	/* The stream occupies the file from its current position */
+	stream->base = my_tell(stream->fd, MYF(0));
+	if (stream->base == (my_off_t) -1 ||
+	    (my_off_t) mystat.st_size < stream->base + sizeof(trailer)) {
+		return NULL;
+	}
+
+	if (my_pread(stream->fd, trailer, sizeof(trailer),
+		     mystat.st_size - sizeof(trailer), MYF(MY_NABP)) ||
+	    memcmp(trailer + 16, XB_STREAM_INDEX_MAGIC,
+		   sizeof(XB_STREAM_INDEX_MAGIC) - 1)) {
+		return NULL;
+	}
+
+	index_offset = uint8korr(trailer);
+	index_len = uint8korr(trailer + 8);
+	if (index_len < sizeof(trailer) ||
+	    stream->base + index_offset + index_len !=
+	    (my_off_t) mystat.st_size) {
+		/* Not the index of this stream */
+		return NULL;
+	}
+
+	index = (xb_stream_index_t *) my_malloc(PSI_NOT_INSTRUMENTED,
+						sizeof(xb_stream_index_t),
+						MYF(MY_FAE | MY_ZEROFILL));
+
+	if (xb_stream_read_chunk_at(stream, index_offset, &index->chunk) !=
+	    XB_STREAM_READ_CHUNK ||
+	    index->chunk.type != XB_CHUNK_TYPE_INDEX ||
+	    index->chunk.length < sizeof(trailer) ||
+	    xb_stream_validate_checksum(&index->chunk) !=
+	    XB_STREAM_READ_CHUNK) {
+		msg("xb_stream_read_index(): corrupted stream index at "
+		    "offset 0x%llx.\n", (ulonglong) index_offset);
+		goto err;
+	}
+
+	/* Count and then parse the records */
+	end = (const uchar *) index->chunk.data + index->chunk.length -
+		sizeof(trailer);
+	for (n = 0, ptr = (const uchar *) index->chunk.data; ptr < end; n++) {
+		if (end - ptr < 1 + 4 + 8 ||
+		    (my_off_t) (end - ptr) < 1 + 4 + 8 + uint4korr(ptr + 1)) {
+			msg("xb_stream_read_index(): truncated index "
+			    "record.\n");
+			goto err;
+		}
+		ptr += 1 + 4 + uint4korr(ptr + 1) + 8;
+	}
+
+	index->n_entries = n;
+	index->entries = (xb_stream_index_entry_t *)
+		my_malloc(PSI_NOT_INSTRUMENTED,
+			  sizeof(xb_stream_index_entry_t) * (n + 1),
+			  MYF(MY_FAE));
+
+	for (n = 0, ptr = (const uchar *) index->chunk.data; ptr < end; n++) {
+		xb_stream_index_entry_t	*entry = index->entries + n;
+
+		entry->type = (xb_chunk_type_t) *ptr++;
+		entry->pathlen = uint4korr(ptr);
+		ptr += 4;
+		entry->path = (const char *) ptr;
+		ptr += entry->pathlen;
+		entry->offset = uint8korr(ptr);
+		ptr += 8;
+	}
+
+	if (my_seek(stream->fd, stream->base, MY_SEEK_SET,
+		    MYF(MY_WME)) == MY_FILEPOS_ERROR) {
+		goto err;
+	}
+	stream->offset = 0;
+
+	return index;
+
+err:
+	xb_stream_index_free(index);
+
+	return NULL;
+}
+
+void
+xb_stream_index_free(xb_stream_index_t *index)
+{
+	my_free(index->entries);
+	my_free(index->chunk.data);
+	my_free(index);
+}
+
 int
 xb_stream_read_done(xb_rstream_t *stream)
 {
@@ -28,15 +28,36 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
 /* Group writes smaller than this into a single chunk */
 #define XB_STREAM_MIN_CHUNK_SIZE (10 * 1024 * 1024)
 
+/* Same for version 2 streams. Larger chunks mean fewer headers and index
+records, and longer sequential writes when the chunks are extracted. */
+#define XB_STREAM_V2_MIN_CHUNK_SIZE (32 * 1024 * 1024)
+
+/* Initial size of the index buffer */
+#define XB_STREAM_INDEX_INIT_SIZE (64 * 1024)
+
+/* Chunk magic + flags + chunk type + path_len + len + offset + checksum */
+#define XB_STREAM_CHUNK_HEADER_LEN (sizeof(XB_STREAM_CHUNK_MAGIC) - 1 + 1 + 1 \
+				    + 4 + 8 + 8 + 4)
+
 struct xb_wstream_struct {
 	pthread_mutex_t	mutex;
+	uint		version;
+	const char	*magic;
+	size_t		chunk_size;
+	my_off_t	pos;		/* number of bytes written */
+	/* Index of the written chunks, NULL if not requested */
+	uchar		*index;
+	size_t		index_len;
+	size_t		index_size;
+	xb_stream_write_callback *index_write;
+	void		*index_userdata;
 };
 
 struct xb_wstream_file_struct {
 	xb_wstream_t	*stream;
 	char		*path;
 	ulong		path_len;
-	char		chunk[XB_STREAM_MIN_CHUNK_SIZE];
+	char		*chunk;
 	char		*chunk_ptr;
 	size_t		chunk_free;
 	my_off_t	offset;
@@ -46,30 +67,153 @@ struct xb_wstream_file_struct {
 
 static int xb_stream_flush(xb_wstream_file_t *file);
 static int xb_stream_write_chunk(xb_wstream_file_t *file,
-				 const void *buf, size_t len);
+				 const struct iovec *iov, uint iovcnt);
 static int xb_stream_write_eof(xb_wstream_file_t *file);
 
 static
 ssize_t
 xb_stream_default_write_callback(xb_wstream_file_t *file __attribute__((unused)),
 				 void *userdata __attribute__((unused)),
-				 const void *buf, size_t len)
+				 const struct iovec *iov, uint iovcnt)
 {
-	if (my_write(fileno(stdout), buf, len, MYF(MY_WME | MY_NABP)))
+	size_t	len = 0;
+	uint	i;
+
+	if (xb_writev_full(fileno(stdout), iov, iovcnt))
 		return -1;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
 	return len;
 }
 
 xb_wstream_t *
-xb_stream_write_new(void)
+xb_stream_write_new(uint version)
 {
 	xb_wstream_t	*stream;
 
+	xb_a(version == 1 || version == 2);
+
 	stream = (xb_wstream_t *) my_malloc(PSI_NOT_INSTRUMENTED,
-					    sizeof(xb_wstream_t), MYF(MY_FAE));
+					    sizeof(xb_wstream_t),
+					    MYF(MY_FAE | MY_ZEROFILL));
 	pthread_mutex_init(&stream->mutex, NULL);
+	stream->version = version;
+	stream->magic = version == 1 ? XB_STREAM_CHUNK_MAGIC
+				     : XB_STREAM_CHUNK_MAGIC_V2;
+	stream->chunk_size = version == 1 ? XB_STREAM_MIN_CHUNK_SIZE
+					  : XB_STREAM_V2_MIN_CHUNK_SIZE;
+
+	return stream;
+}
+
+void
+xb_stream_write_set_index(xb_wstream_t *stream,
+			  xb_stream_write_callback *onwrite,
+			  void *userdata)
+{
+	if (stream->version < 2 || stream->index != NULL) {
+		return;
+	}
+
+	stream->index_size = XB_STREAM_INDEX_INIT_SIZE;
+	stream->index = (uchar *) my_malloc(PSI_NOT_INSTRUMENTED,
+					    stream->index_size, MYF(MY_FAE));
+	stream->index_len = 0;
+	stream->index_write = onwrite ? onwrite
+				      : xb_stream_default_write_callback;
+	stream->index_userdata = userdata;
+}
+
+/* Append an index record for a chunk about to be written at stream->pos.
+Must be called with the stream mutex held. */
+static
+void
+xb_stream_index_add(xb_wstream_t *stream, xb_chunk_type_t type,
+		    const char *path, ulong path_len)
+{
+	uchar	*ptr;
+	size_t	len = 1 + 4 + path_len + 8;
+
+	if (stream->index == NULL) {
+		return;
+	}
+
+	if (stream->index_len + len > stream->index_size) {
+		while (stream->index_len + len > stream->index_size) {
+			stream->index_size *= 2;
+		}
+		stream->index = (uchar *) my_realloc(PSI_NOT_INSTRUMENTED,
+						     stream->index,
+						     stream->index_size,
+						     MYF(MY_FAE));
+	}
+
+	ptr = stream->index + stream->index_len;
+
+	*ptr++ = (uchar) type;
+	int4store(ptr, path_len);
+	ptr += 4;
+	memcpy(ptr, path, path_len);
+	ptr += path_len;
+	int8store(ptr, stream->pos);
 
-	return stream;;
+	stream->index_len += len;
+}
+
+/* Write the index chunk, which is the last chunk of the stream */
+static
+int
+xb_stream_write_index(xb_wstream_t *stream)
+{
+	uchar		header[XB_STREAM_CHUNK_HEADER_LEN];
+	uchar		trailer[XB_STREAM_INDEX_TRAILER_LEN];
+	uchar		*ptr;
+	struct iovec	vec[3];
+	size_t		len;
+	ulong		checksum;
+
+	len = stream->index_len + sizeof(trailer);
+
+	/* Offset and total length of the index chunk */
+	int8store(trailer, stream->pos);
+	int8store(trailer + 8, sizeof(header) + len);
+	memcpy(trailer + 16, XB_STREAM_INDEX_MAGIC,
+	       sizeof(XB_STREAM_INDEX_MAGIC) - 1);
+
+	checksum = crc32c(0, stream->index, stream->index_len);
+	checksum = crc32c(checksum, trailer, sizeof(trailer));
+
+	ptr = header;
+	memcpy(ptr, stream->magic, sizeof(XB_STREAM_CHUNK_MAGIC) - 1);
+	ptr += sizeof(XB_STREAM_CHUNK_MAGIC) - 1;
+	*ptr++ = XB_STREAM_FLAG_IGNORABLE;       /* Chunk flags */
+	*ptr++ = (uchar) XB_CHUNK_TYPE_INDEX;    /* Chunk type */
+	int4store(ptr, 0);                       /* Path length */
+	ptr += 4;
+	int8store(ptr, len);                     /* Payload length */
+	ptr += 8;
+	int8store(ptr, 0);                       /* Payload offset */
+	ptr += 8;
+	int4store(ptr, checksum);
+	ptr += 4;
+
+	xb_ad(ptr == header + sizeof(header));
+
+	vec[0].iov_base = header;
+	vec[0].iov_len = sizeof(header);
+	vec[1].iov_base = stream->index;
+	vec[1].iov_len = stream->index_len;
+	vec[2].iov_base = trailer;
+	vec[2].iov_len = sizeof(trailer);
+
+	if (stream->index_write(NULL, stream->index_userdata, vec, 3) == -1) {
+		return 1;
+	}
+
+	return 0;
 }
 
 xb_wstream_file_t *
@@ -98,8 +242,10 @@ xb_stream_write_open(xb_wstream_t *stream, const char *path,
 
 	file->stream = stream;
 	file->offset = 0;
+	file->chunk = (char *) my_malloc(PSI_NOT_INSTRUMENTED,
+					 stream->chunk_size, MYF(MY_FAE));
 	file->chunk_ptr = file->chunk;
-	file->chunk_free = XB_STREAM_MIN_CHUNK_SIZE;
+	file->chunk_free = stream->chunk_size;
 	if (onwrite) {
 #ifdef __WIN__
 		setmode(fileno(stdout), _O_BINARY);
@@ -117,9 +263,31 @@ xb_stream_write_open(xb_wstream_t *stream, const char *path,
 int
 xb_stream_write_data(xb_wstream_file_t *file, const void *buf, size_t len)
 {
+	struct iovec	iov;
+
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+
+	return xb_stream_write_datav(file, &iov, 1);
+}
+
+int
+xb_stream_write_datav(xb_wstream_file_t *file, const struct iovec *iov,
+		      uint iovcnt)
+{
+	size_t	len = 0;
+	uint	i;
+
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
 	if (len < file->chunk_free) {
-		memcpy(file->chunk_ptr, buf, len);
-		file->chunk_ptr += len;
+		for (i = 0; i < iovcnt; i++) {
+			memcpy(file->chunk_ptr, iov[i].iov_base,
+			       iov[i].iov_len);
+			file->chunk_ptr += iov[i].iov_len;
+		}
 		file->chunk_free -= len;
 
 		return 0;
@@ -128,55 +296,81 @@ xb_stream_write_data(xb_wstream_file_t *file, const void *buf, size_t len)
 	if (xb_stream_flush(file))
 		return 1;
 
-	return xb_stream_write_chunk(file, buf, len);
+	/* Leave room for the chunk header in the vector */
+	while (iovcnt > XB_IOV_MAX - 1) {
+		if (xb_stream_write_chunk(file, iov, XB_IOV_MAX - 1))
+			return 1;
+		iov += XB_IOV_MAX - 1;
+		iovcnt -= XB_IOV_MAX - 1;
+	}
+
+	return xb_stream_write_chunk(file, iov, iovcnt);
 }
 
 int
 xb_stream_write_close(xb_wstream_file_t *file)
 {
+	int	rc = 0;
+
 	if (xb_stream_flush(file) ||
 	    xb_stream_write_eof(file)) {
-		my_free(file);
-		return 1;
+		rc = 1;
 	}
 
+	my_free(file->chunk);
 	my_free(file);
 
-	return 0;
+	return rc;
 }
 
 int
 xb_stream_write_done(xb_wstream_t *stream)
 {
+	int	rc = 0;
+
+	/* Empty streams get no index */
+	if (stream->index != NULL && stream->pos > 0 &&
+	    xb_stream_write_index(stream)) {
+		msg("xb_stream_write_done(): failed to write the stream "
+		    "index.\n");
+		rc = 1;
+	}
+
 	pthread_mutex_destroy(&stream->mutex);
 
+	my_free(stream->index);
 	my_free(stream);
 
-	return 0;
+	return rc;
 }
 
 static
 int
 xb_stream_flush(xb_wstream_file_t *file)
 {
+	struct iovec	iov;
+
 	if (file->chunk_ptr == file->chunk) {
 		return 0;
 	}
 
-	if (xb_stream_write_chunk(file, file->chunk,
-				  file->chunk_ptr - file->chunk)) {
+	iov.iov_base = file->chunk;
+	iov.iov_len = file->chunk_ptr - file->chunk;
+
+	if (xb_stream_write_chunk(file, &iov, 1)) {
 		return 1;
 	}
 
 	file->chunk_ptr = file->chunk;
-	file->chunk_free = XB_STREAM_MIN_CHUNK_SIZE;
+	file->chunk_free = file->stream->chunk_size;
 
 	return 0;
 }
 
 static
 int
-xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf, size_t len)
+xb_stream_write_chunk(xb_wstream_file_t *file, const struct iovec *iov,
+		      uint iovcnt)
 {
 	/* Chunk magic + flags + chunk type + path_len + path + len + offset +
 	checksum */
@@ -185,12 +379,35 @@ xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf, size_t len)
 	uchar		*ptr;
 	xb_wstream_t	*stream = file->stream;
 	ulong		checksum;
+	struct iovec	vec[XB_IOV_MAX];
+	size_t		len = 0;
+	uint		i;
+
+	/* The header and the payload are passed to the callback as a single
+	vector */
+	xb_a(iovcnt < XB_IOV_MAX);
+
+	checksum = 0;
+	for (i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+		if (stream->version == 1) {
+			checksum = crc32_iso3309(checksum,
+						 (const uchar *)
+						 iov[i].iov_base,
+						 iov[i].iov_len);
+		} else {
+			checksum = crc32c(checksum,
+					  (const uchar *) iov[i].iov_base,
+					  iov[i].iov_len);
+		}
+		vec[i + 1] = iov[i];
+	}
 
 	/* Write xbstream header */
 	ptr = tmpbuf;
 
 	/* Chunk magic */
-	memcpy(ptr, XB_STREAM_CHUNK_MAGIC, sizeof(XB_STREAM_CHUNK_MAGIC) - 1);
+	memcpy(ptr, stream->magic, sizeof(XB_STREAM_CHUNK_MAGIC) - 1);
 	ptr += sizeof(XB_STREAM_CHUNK_MAGIC) - 1;
 
 	*ptr++ = 0;                              /* Chunk flags */
@@ -206,8 +423,6 @@ xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf, size_t len)
 	int8store(ptr, len);                     /* Payload length */
 	ptr += 8;
 
-	checksum = crc32_iso3309(0, buf, len);   /* checksum */
-
 	pthread_mutex_lock(&stream->mutex);
 
 	int8store(ptr, file->offset);            /* Payload offset */
@@ -218,14 +433,17 @@ xb_stream_write_chunk(xb_wstream_file_t *file, const void *buf, size_t len)
 
 	xb_ad(ptr <= tmpbuf + sizeof(tmpbuf));
 
-	if (file->write(file, file->userdata, tmpbuf, ptr-tmpbuf) == -1)
-		goto err;
+	vec[0].iov_base = tmpbuf;
+	vec[0].iov_len = ptr - tmpbuf;
 
+	xb_stream_index_add(stream, XB_CHUNK_TYPE_PAYLOAD, file->path,
+			    file->path_len);
 
-	if (file->write(file, file->userdata, buf, len) == -1) /* Payload */
+	if (file->write(file, file->userdata, vec, iovcnt + 1) == -1)
 		goto err;
 
 	file->offset+= len;
+	stream->pos += vec[0].iov_len + len;
 
 	pthread_mutex_unlock(&stream->mutex);
 
@@ -247,6 +465,7 @@ xb_stream_write_eof(xb_wstream_file_t *file)
 			       FN_REFLEN];
 	uchar		*ptr;
 	xb_wstream_t	*stream = file->stream;
+	struct iovec	vec;
 
 	pthread_mutex_lock(&stream->mutex);
 
@@ -254,7 +473,7 @@ xb_stream_write_eof(xb_wstream_file_t *file)
 	ptr = tmpbuf;
 
 	/* Chunk magic */
-	memcpy(ptr, XB_STREAM_CHUNK_MAGIC, sizeof(XB_STREAM_CHUNK_MAGIC) - 1);
+	memcpy(ptr, stream->magic, sizeof(XB_STREAM_CHUNK_MAGIC) - 1);
 	ptr += sizeof(XB_STREAM_CHUNK_MAGIC) - 1;
 
 	*ptr++ = 0;                              /* Chunk flags */
@@ -269,10 +488,17 @@ xb_stream_write_eof(xb_wstream_file_t *file)
 
 	xb_ad(ptr <= tmpbuf + sizeof(tmpbuf));
 
-	if (file->write(file, file->userdata, tmpbuf,
-			(ulonglong) (ptr - tmpbuf)) == -1)
+	vec.iov_base = tmpbuf;
+	vec.iov_len = ptr - tmpbuf;
+
+	xb_stream_index_add(stream, XB_CHUNK_TYPE_EOF, file->path,
+			    file->path_len);
+
+	if (file->write(file, file->userdata, &vec, 1) == -1)
 		goto err;
 
+	stream->pos += vec.iov_len;
+
 	pthread_mutex_unlock(&stream->mutex);
 
 	return 0;
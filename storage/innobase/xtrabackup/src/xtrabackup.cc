@@ -72,8 +72,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include <sql_locale.h>
 
 #include <list>
+#include <map>
 #include <sstream>
 #include <set>
+#include <vector>
 #include <mysql.h>
 
 #define G_PTR uchar*
@@ -87,7 +89,10 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "write_filt.h"
 #include "xtrabackup.h"
 #include "ds_buffer.h"
+#include "ds_local.h"
+#include "ds_spool.h"
 #include "ds_tmpfile.h"
+#include "ds_xbstream.h"
 #include "xbstream.h"
 #include "changed_page_bitmap.h"
 #include "read_filt.h"
@@ -99,6 +104,7 @@ Place, Suite 330, Boston, MA 02111-1307 USA
 #include "keyring_plugins.h"
 #include "xb0xb.h"
 #include "ds_encrypt.h"
+#include "executor.h"
 #include "xbcrypt_common.h"
 #include "crc_glue.h"
 #include "xtrabackup_config.h"
@@ -139,6 +145,7 @@ my_bool xtrabackup_export = FALSE;
 my_bool xtrabackup_apply_log_only = FALSE;
 
 longlong xtrabackup_use_memory = 100*1024*1024L;
+my_bool xtrabackup_spill_redo = FALSE;
 my_bool xtrabackup_create_ib_logfile = FALSE;
 
 long xtrabackup_throttle = 0; /* 0:unlimited */
@@ -205,11 +212,13 @@ int xtrabackup_parallel;
 char *xtrabackup_stream_str = NULL;
 xb_stream_fmt_t xtrabackup_stream_fmt = XB_STREAM_FMT_NONE;
 ibool xtrabackup_stream = FALSE;
+my_bool xtrabackup_extract_stream = FALSE;
 
 const char *xtrabackup_compress_alg = NULL;
 ibool xtrabackup_compress = FALSE;
 uint xtrabackup_compress_threads;
 ulonglong xtrabackup_compress_chunk_size = 0;
+uint xtrabackup_decompress_threads;
 
 const char *xtrabackup_encrypt_algo_names[] =
 { "NONE", "AES128", "AES192", "AES256", NullS};
@@ -327,6 +336,7 @@ ibool srv_rebuild_indexes = FALSE;
 static char *xtrabackup_debug_sync = NULL;
 
 my_bool xtrabackup_compact = FALSE;
+my_bool xtrabackup_reflink = FALSE;
 my_bool xtrabackup_rebuild_indexes = FALSE;
 
 my_bool xtrabackup_incremental_force_scan = FALSE;
@@ -397,6 +407,15 @@ static TYPELIB binlog_info_typelib = {array_elements(binlog_info_values)-1, "",
 				      binlog_info_values, NULL};
 ulong opt_binlog_info;
 
+static const char *stats_format_values[] = {"text", "json", NullS};
+static TYPELIB stats_format_typelib = {array_elements(stats_format_values)-1,
+				       "", stats_format_values, NULL};
+enum stats_format_t {
+	STATS_FORMAT_TEXT,
+	STATS_FORMAT_JSON
+};
+static ulong opt_stats_format = STATS_FORMAT_TEXT;
+
 char *opt_incremental_history_name = NULL;
 char *opt_incremental_history_uuid = NULL;
 
@@ -435,6 +454,7 @@ uint opt_lock_ddl_timeout = 0;
 const char *opt_history = NULL;
 my_bool opt_decrypt = FALSE;
 uint opt_read_buffer_size = 0;
+my_bool opt_direct_io = FALSE;
 
 const char *ssl_mode_names_lib[] =
   {"DISABLED", "PREFERRED", "REQUIRED", "VERIFY_CA", "VERIFY_IDENTITY",
@@ -544,14 +564,11 @@ datafiles_iter_free(datafiles_iter_t *it)
 	ut_free(it);
 }
 
-/* ======== Date copying thread context ======== */
+/* ======== Date copying task context ======== */
 
 typedef struct {
 	datafiles_iter_t 	*it;
 	uint			num;
-	uint			*count;
-	ib_mutex_t		*count_mutex;
-	os_thread_id_t		id;
 } data_thread_ctxt_t;
 
 /* ======== for option and variables ======== */
@@ -562,11 +579,13 @@ enum options_xtrabackup
                                      than OPT_MAX_CLIENT_OPTION */
   OPT_XTRA_BACKUP,
   OPT_XTRA_STATS,
+  OPT_XTRA_STATS_FORMAT,
   OPT_XTRA_PREPARE,
   OPT_XTRA_EXPORT,
   OPT_XTRA_APPLY_LOG_ONLY,
   OPT_XTRA_PRINT_PARAM,
   OPT_XTRA_USE_MEMORY,
+  OPT_XTRA_SPILL_REDO,
   OPT_XTRA_THROTTLE,
   OPT_XTRA_LOG_COPY_INTERVAL,
   OPT_XTRA_INCREMENTAL,
@@ -581,14 +600,21 @@ enum options_xtrabackup
   OPT_XTRA_CREATE_IB_LOGFILE,
   OPT_XTRA_PARALLEL,
   OPT_XTRA_STREAM,
+  OPT_XTRA_STREAM_SHARDS,
+  OPT_XTRA_STREAM_VERSION,
+  OPT_XTRA_STREAM_SHARD_PATH,
+  OPT_XTRA_EXTRACT_STREAM,
+  OPT_XTRA_STREAM_SPOOL_SIZE,
   OPT_XTRA_COMPRESS,
   OPT_XTRA_COMPRESS_THREADS,
   OPT_XTRA_COMPRESS_CHUNK_SIZE,
+  OPT_XTRA_DECOMPRESS_THREADS,
   OPT_XTRA_ENCRYPT,
   OPT_XTRA_ENCRYPT_KEY,
   OPT_XTRA_ENCRYPT_KEY_FILE,
   OPT_XTRA_ENCRYPT_THREADS,
   OPT_XTRA_ENCRYPT_CHUNK_SIZE,
+  OPT_XTRA_THREADS,
   OPT_XTRA_SERVER_ID,
   OPT_XTRA_ENCRYPT_FOR_SERVER_ID,
   OPT_LOG,
@@ -638,6 +664,7 @@ enum options_xtrabackup
   OPT_INNODB_THREAD_SLEEP_DELAY,
   OPT_XTRA_DEBUG_SYNC,
   OPT_XTRA_COMPACT,
+  OPT_XTRA_REFLINK,
   OPT_XTRA_REBUILD_INDEXES,
   OPT_XTRA_REBUILD_THREADS,
   OPT_INNODB_CHECKSUM_ALGORITHM,
@@ -697,6 +724,7 @@ enum options_xtrabackup
   OPT_XTRA_TABLES_COMPATIBILITY_CHECK,
   OPT_XTRA_CHECK_PRIVILEGES,
   OPT_XTRA_READ_BUFFER_SIZE,
+  OPT_XTRA_DIRECT_IO,
 };
 
 struct my_option xb_client_options[] =
@@ -712,6 +740,12 @@ struct my_option xb_client_options[] =
   {"stats", OPT_XTRA_STATS, "calc statistic of datadir (offline mysqld is recommended)",
    (G_PTR*) &xtrabackup_stats, (G_PTR*) &xtrabackup_stats,
    0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+  {"stats-format", OPT_XTRA_STATS_FORMAT, "Output format of --stats: "
+   "'text' (the default) or 'json'. The JSON output also includes the fill "
+   "factor and the leaf page fragmentation of every index and the page usage "
+   "of every tablespace.",
+   &opt_stats_format, &opt_stats_format, &stats_format_typelib, GET_ENUM,
+   REQUIRED_ARG, STATS_FORMAT_TEXT, 0, 0, 0, 0, 0},
   {"prepare", OPT_XTRA_PREPARE, "prepare a backup for starting mysql server on the backup.",
    (G_PTR*) &xtrabackup_prepare, (G_PTR*) &xtrabackup_prepare,
    0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
@@ -729,6 +763,13 @@ struct my_option xb_client_options[] =
    (G_PTR*) &xtrabackup_use_memory, (G_PTR*) &xtrabackup_use_memory,
    0, GET_LL, REQUIRED_ARG, 100*1024*1024L, 1024*1024L, LLONG_MAX, 0,
    1024*1024L, 0},
+  {"spill-redo", OPT_XTRA_SPILL_REDO, "Used with --prepare. When the log "
+   "records do not fit into --use-memory, write them to sorted runs in "
+   "temporary files in --tmpdir and apply them with a merge of the runs, "
+   "instead of applying the log in several batches. Every page is then read "
+   "and written once, and the log is scanned once.",
+   (G_PTR*) &xtrabackup_spill_redo, (G_PTR*) &xtrabackup_spill_redo, 0,
+   GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
   {"throttle", OPT_XTRA_THROTTLE, "limit count of IO operations (pairs of read&write) per second to IOS values (for '--backup')",
    (G_PTR*) &xtrabackup_throttle, (G_PTR*) &xtrabackup_throttle,
    0, GET_LONG, REQUIRED_ARG, 0, 0, LONG_MAX, 0, 1, 0},
@@ -786,6 +827,47 @@ struct my_option xb_client_options[] =
    (G_PTR*) &xtrabackup_stream_str, (G_PTR*) &xtrabackup_stream_str, 0, GET_STR,
    REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
 
+  {"stream-shards", OPT_XTRA_STREAM_SHARDS, "Split the 'xbstream' stream "
+   "into the specified number of independent streams written to the files "
+   "named by --stream-shard-path with the suffixes .0, .1, etc. instead of "
+   "the standard output. Every backup file is written to a single shard, so "
+   "each shard can be extracted separately. The default value is 1.",
+   (G_PTR*) &ds_xbstream_shards, (G_PTR*) &ds_xbstream_shards, 0, GET_UINT,
+   REQUIRED_ARG, 1, 1, 1024, 0, 0, 0},
+
+  {"stream-version", OPT_XTRA_STREAM_VERSION, "Version of the 'xbstream' "
+   "format to write. Version 2 uses CRC-32C checksums and ends with an index "
+   "of the stream when written to a regular file. Version 1 streams can be "
+   "read by older xbstream binaries. The default value is 1.",
+   (G_PTR*) &ds_xbstream_version, (G_PTR*) &ds_xbstream_version, 0, GET_UINT,
+   REQUIRED_ARG, XB_STREAM_VERSION_DEFAULT, 1, 2, 0, 0, 0},
+
+  {"stream-shard-path", OPT_XTRA_STREAM_SHARD_PATH, "Path prefix of the "
+   "stream shard outputs when --stream-shards is greater than 1. The "
+   "outputs may be named pipes created in advance.",
+   (G_PTR*) &ds_xbstream_shard_path, (G_PTR*) &ds_xbstream_shard_path, 0,
+   GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
+
+  {"extract-stream", OPT_XTRA_EXTRACT_STREAM, "Used with --prepare. Extract "
+   "a backup in the 'xbstream' format read from the standard input into the "
+   "empty --target-dir with --parallel threads like 'xbstream -x', and then "
+   "prepare it. The prepare starts after the whole stream has been "
+   "extracted. Compressed and encrypted files are decompressed and "
+   "decrypted while they are extracted when --decompress and --decrypt are "
+   "specified.",
+   (G_PTR*) &xtrabackup_extract_stream, (G_PTR*) &xtrabackup_extract_stream, 0,
+   GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
+  {"stream-spool-size", OPT_XTRA_STREAM_SPOOL_SIZE, "Maximum total number of "
+   "bytes spooled in memory and temporary files when streaming in the 'tar' "
+   "format with --parallel. Only one file at a time is written to the 'tar' "
+   "stream, the files copied by the other threads meanwhile are spooled and "
+   "streamed after they are copied. Once the spooled files reach this size, "
+   "the copy threads wait for the stream. A file written to the stream "
+   "directly holds it until the file is copied. The default value is 1G.",
+   (G_PTR*) &ds_spool_max_size, (G_PTR*) &ds_spool_max_size, 0, GET_ULL,
+   REQUIRED_ARG, 1024 * 1024 * 1024LL, 0, ULLONG_MAX, 0, 0, 0},
+
   {"compress", OPT_XTRA_COMPRESS, "Compress individual backup files using the "
    "specified compression algorithm. Currently the only supported algorithm "
    "is 'quicklz'. It is also the default algorithm, i.e. the one used when "
@@ -826,11 +908,31 @@ struct my_option xb_client_options[] =
    (G_PTR*) &xtrabackup_encrypt_chunk_size, (G_PTR*) &xtrabackup_encrypt_chunk_size,
    0, GET_ULL, REQUIRED_ARG, (1 << 16), 1024, ULLONG_MAX, 0, 0, 0},
 
+  {"threads", OPT_XTRA_THREADS,
+   "Number of threads in the worker pool shared by data copying, "
+   "compression, encryption, decryption and decompression. The default value "
+   "0 means the largest of the --compress-threads, --encrypt-threads and "
+   "--decompress-threads values that apply, plus --parallel for the data "
+   "copying tasks.",
+   (G_PTR*) &xb_executor_threads, (G_PTR*) &xb_executor_threads,
+   0, GET_UINT, REQUIRED_ARG, 0, 0, UINT_MAX, 0, 0, 0},
+
   {"compact", OPT_XTRA_COMPACT,
    "Create a compact backup by skipping secondary index pages.",
    (G_PTR*) &xtrabackup_compact, (G_PTR*) &xtrabackup_compact,
    0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
 
+  {"reflink", OPT_XTRA_REFLINK,
+   "Create a full local backup by cloning the InnoDB data files with "
+   "reflinks, when the data directory and --target-dir are on the same file "
+   "system that supports them, such as XFS or Btrfs. The clones share their "
+   "data blocks with the data files and are made without writing the pages. "
+   "The pages of each clone are read back and their checksums are verified, "
+   "a file is cloned again when a page is corrupted. Files that cannot be "
+   "cloned are copied as usual.",
+   (G_PTR*) &xtrabackup_reflink, (G_PTR*) &xtrabackup_reflink,
+   0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
   {"rebuild_indexes", OPT_XTRA_REBUILD_INDEXES,
    "Rebuild secondary indexes in InnoDB tables after applying the log. "
    "Only has effect with --prepare.",
@@ -983,6 +1085,13 @@ struct my_option xb_client_options[] =
    (uchar *) &opt_decompress,
    0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
 
+  {"decompress-threads", OPT_XTRA_DECOMPRESS_THREADS,
+   "Number of blocks of a file decompressed in parallel by --decompress. "
+   "The default value is 1.",
+   (G_PTR*) &xtrabackup_decompress_threads,
+   (G_PTR*) &xtrabackup_decompress_threads,
+   0, GET_UINT, REQUIRED_ARG, 1, 1, UINT_MAX, 0, 0, 0},
+
   {"user", 'u', "This option specifies the MySQL username used "
    "when connecting to the server, if that's not the current user. "
    "The option accepts a string argument. See mysql --help for details.",
@@ -1139,6 +1248,15 @@ struct my_option xb_client_options[] =
    0, GET_UINT, OPT_ARG, 10*1024*1024,
    UNIV_PAGE_SIZE_MAX, UINT_MAX, 0, UNIV_PAGE_SIZE_MAX, 0},
 
+  {"direct-io", OPT_XTRA_DIRECT_IO,
+   "Read the InnoDB data files and write the files of a local backup with "
+   "O_DIRECT, bypassing the OS page cache, so that the backup does not evict "
+   "the pages cached for the server nor fill the page cache of the backup "
+   "target. Writes that are not aligned to the I/O block size, such as the "
+   "end of a file, still go through the page cache.",
+   &opt_direct_io, &opt_direct_io,
+   0, GET_BOOL, NO_ARG, 0, 0, 0, 0, 0, 0},
+
 #include "sslopt-longopts.h"
 
 #if !defined(HAVE_YASSL)
@@ -1169,7 +1287,10 @@ struct my_option xb_server_options[] =
    (G_PTR*) &opt_mysql_tmpdir, 0, GET_STR, REQUIRED_ARG, 0, 0, 0, 0, 0, 0},
   {"parallel", OPT_XTRA_PARALLEL,
    "Number of threads to use for parallel datafiles transfer. "
-   "The default value is 1.",
+   "With --prepare, the number of threads parsing the log ahead of the "
+   "log scan and applying the log records to the datafiles. With --stats, "
+   "the number of threads scanning the tablespaces. The default "
+   "value is 1.",
    (G_PTR*) &xtrabackup_parallel, (G_PTR*) &xtrabackup_parallel, 0, GET_INT,
    REQUIRED_ARG, 1, 1, INT_MAX, 0, 0, 0},
 
@@ -2803,6 +2924,40 @@ xtrabackup_copy_datafile(fil_node_t* node, uint thread_n)
 		       node_path, dstfile->path);
 	}
 
+	/* Clone the whole file. The log copied since the backup start makes
+	the clone consistent on prepare, as it does for the copied pages. The
+	pages of the clone are read back and verified like the copied pages,
+	and the file is cloned again when a page is corrupted. */
+	if (xtrabackup_reflink && write_filter == &wf_write_through
+	    && read_filter == &rf_pass_through) {
+		int	clone_rc;
+		ulint	retry_count = 10;
+
+		while ((clone_rc = ds_copy_fd(dstfile, cursor.file.m_file,
+					      cursor.statinfo.st_size,
+					      TRUE)) == 0) {
+			if (xb_fil_cur_verify_copy(&cursor, dstfile->path)) {
+				msg_ts("[%02u] Cloned %s\n", thread_n,
+				       node_path);
+				goto done;
+			}
+			if (--retry_count == 0) {
+				msg("[%02u] xtrabackup: Error: failed to "
+				    "clone %s after 10 retries.\n",
+				    thread_n, node_path);
+				goto error;
+			}
+			msg("[%02u] xtrabackup: cannot verify the clone of "
+			    "%s, cloning it again...\n", thread_n, node_path);
+			os_thread_sleep(100000);
+		}
+		if (clone_rc > 0) {
+			goto error;
+		}
+		msg("[%02u] xtrabackup: cannot clone %s, copying it.\n",
+		    thread_n, node_path);
+	}
+
 	/* The main copy loop */
 	while ((res = xb_fil_cur_read(&cursor)) == XB_FIL_CUR_SUCCESS) {
 		if (!write_filter->process(&write_filt_ctxt, dstfile)) {
@@ -2819,6 +2974,7 @@ xtrabackup_copy_datafile(fil_node_t* node, uint thread_n)
 		goto error;
 	}
 
+done:
 	/* close */
 	msg_ts("[%02u]        ...done\n", thread_n);
 	xb_fil_cur_close(&cursor);
@@ -3321,23 +3477,17 @@ io_handler_thread(
 }
 
 /**************************************************************************
-Datafiles copying thread.*/
+Datafiles copying task, run on the shared executor. */
 static
-os_thread_ret_t
+void
 data_copy_thread_func(
 /*==================*/
-	void *arg) /* thread context */
+	void *arg) /* task context */
 {
 	data_thread_ctxt_t	*ctxt = (data_thread_ctxt_t *) arg;
 	uint			num = ctxt->num;
 	fil_node_t*		node;
 
-	/*
-	  Initialize mysys thread-specific memory so we can
-	  use mysys functions in this thread.
-	*/
-	my_thread_init();
-
 	debug_sync_point("data_copy_thread_func");
 
 	while ((node = datafiles_iter_next(ctxt->it)) != NULL) {
@@ -3349,14 +3499,6 @@ data_copy_thread_func(
 			exit(EXIT_FAILURE);
 		}
 	}
-
-	mutex_enter(ctxt->count_mutex);
-	(*ctxt->count)--;
-	mutex_exit(ctxt->count_mutex);
-
-	my_thread_end();
-	os_thread_exit();
-	OS_THREAD_DUMMY_RETURN;
 }
 
 /************************************************************************
@@ -3364,27 +3506,42 @@ Initialize the appropriate datasink(s). Both local backups and streaming in the
 'xbstream' format allow parallel writes so we can write directly.
 
 Otherwise (i.e. when streaming in the 'tar' format) we need 2 separate datasinks
-for the data stream (and don't allow parallel data copying) and for metainfo
-files (including xtrabackup_logfile). The second datasink writes to temporary
-files first, and then streams them in a serialized way when closed. */
+for the data stream and for metainfo files (including xtrabackup_logfile). The
+second datasink writes to temporary files first, and then streams them in a
+serialized way when closed. With parallel data copying, the data stream also
+spools the files copied while another one is being streamed. */
 static void
 xtrabackup_init_datasinks(void)
 {
-	if (xtrabackup_parallel > 1 && xtrabackup_stream &&
-	    xtrabackup_stream_fmt == XB_STREAM_FMT_TAR) {
-		msg("xtrabackup: warning: the --parallel option does not have "
-		    "any effect when streaming in the 'tar' format. "
-		    "You can use the 'xbstream' format instead.\n");
-		xtrabackup_parallel = 1;
+	/* Size the worker pool shared by the data copy tasks and the
+	compression and encryption datasinks */
+	if (xb_executor_threads == 0) {
+		if (xtrabackup_compress) {
+			xb_executor_threads = xtrabackup_compress_threads;
+		}
+		if (xtrabackup_encrypt) {
+			xb_executor_threads = MY_MAX(xb_executor_threads,
+						     xtrabackup_encrypt_threads);
+		}
+		if (xtrabackup_backup) {
+			xb_executor_threads += xtrabackup_parallel;
+		}
 	}
 
 	/* Start building out the pipelines from the terminus back */
 	if (xtrabackup_stream) {
-		/* All streaming goes to stdout */
+		/* All streaming goes to stdout, unless the 'xbstream' stream is
+		sharded, in which case the shards are written by
+		ds_xbstream itself */
 		ds_data = ds_meta = ds_redo = ds_create(xtrabackup_target_dir,
 						        DS_TYPE_STDOUT);
 	} else {
-		/* Local filesystem */
+		/* Local filesystem. The data files are written behind the copy
+		threads, and preallocated when they are copied as is. */
+		ds_local_write_threads = xtrabackup_parallel;
+		ds_local_direct_io = opt_direct_io;
+		ds_local_preallocate = !xtrabackup_compress
+			&& !xtrabackup_encrypt && !xtrabackup_incremental;
 		ds_data = ds_meta = ds_redo = ds_create(xtrabackup_target_dir,
 						        DS_TYPE_LOCAL);
 	}
@@ -3411,7 +3568,15 @@ xtrabackup_init_datasinks(void)
 
 		if (xtrabackup_stream_fmt != XB_STREAM_FMT_XBSTREAM) {
 
-			/* 'tar' does not allow parallel streams */
+			/* 'tar' does not allow parallel streams, so spool the
+			data files copied by the other threads */
+			if (xtrabackup_parallel > 1) {
+				ds_data = ds_create(xtrabackup_target_dir,
+						    DS_TYPE_SPOOL);
+				xtrabackup_add_datasink(ds_data);
+				ds_set_pipe(ds_data, ds);
+			}
+
 			ds_redo = ds_meta = ds_create(xtrabackup_target_dir,
 						      DS_TYPE_TMPFILE);
 			xtrabackup_add_datasink(ds_meta);
@@ -4550,8 +4715,8 @@ xtrabackup_backup_func(void)
 	MY_STAT			 stat_info;
 	lsn_t			 latest_cp;
 	uint			 i;
-	uint			 count;
-	ib_mutex_t		 count_mutex;
+	xb_executor_t		*executor;
+	xb_task_group_t		 group;
 	data_thread_ctxt_t 	*data_threads;
 
 	recv_is_making_a_backup = true;
@@ -4911,34 +5076,31 @@ reread_log_header:
 		exit(EXIT_FAILURE);
 	}
 
-	/* Create data copying threads */
+	/* Run the data copying tasks on the worker pool shared with the
+	compression and encryption datasinks */
+	executor = xb_executor_acquire(xtrabackup_parallel);
+	if (executor == NULL) {
+		msg("xtrabackup: Error: cannot start the data copying "
+		    "threads.\n");
+		exit(EXIT_FAILURE);
+	}
+
 	data_threads = (data_thread_ctxt_t *)
 		ut_malloc_nokey(sizeof(data_thread_ctxt_t) *
                                 xtrabackup_parallel);
-	count = xtrabackup_parallel;
-	mutex_create(LATCH_ID_XTRA_COUNT_MUTEX, &count_mutex);
+	xb_task_group_init(&group);
 
 	for (i = 0; i < (uint) xtrabackup_parallel; i++) {
 		data_threads[i].it = it;
 		data_threads[i].num = i+1;
-		data_threads[i].count = &count;
-		data_threads[i].count_mutex = &count_mutex;
-		os_thread_create(data_copy_thread_func, data_threads + i,
-				 &data_threads[i].id);
-	}
-
-	/* Wait for threads to exit */
-	while (1) {
-		os_thread_sleep(1000000);
-		mutex_enter(&count_mutex);
-		if (count == 0) {
-			mutex_exit(&count_mutex);
-			break;
-		}
-		mutex_exit(&count_mutex);
+		xb_executor_submit(executor, &group, data_copy_thread_func,
+				   data_threads + i);
 	}
 
-	mutex_free(&count_mutex);
+	xb_task_group_wait(executor, &group);
+	xb_task_group_destroy(&group);
+
+	xb_executor_release(executor);
 	ut_free(data_threads);
 	datafiles_iter_free(it);
 
@@ -5093,210 +5255,947 @@ skip_last_cp:
 }
 
 /* ================= stats ================= */
-static my_bool
-xtrabackup_stats_level(
-	dict_index_t*	index,
-	ulint		level)
+
+/* The real index statistics are gathered by reading the tablespaces
+sequentially in large blocks on --parallel threads instead of walking every
+level of every index through the buffer pool. A page is attributed to an index
+by the index id in its header. Pages which are free according to the extent
+descriptors are skipped, so the pages of freed segments are not counted. */
+
+/** Statistics of one level of an index */
+struct xb_stats_level_t {
+	ulonglong	n_pages;	/*!< number of pages */
+	ulonglong	n_recs;		/*!< number of records */
+	ulonglong	data_size;	/*!< bytes used by the records */
+};
+
+/** Real statistics of an index gathered by the scan */
+struct xb_stats_real_t {
+	std::vector<xb_stats_level_t>	levels;
+					/*!< statistics by level, 0 is leaf */
+	ulonglong	n_leaf_jumps;	/*!< leaf pages not followed by the
+					next page of the tablespace */
+	ulonglong	n_extern_fields;/*!< externally stored fields owned by
+					the leaf records */
+	ulonglong	extern_size;	/*!< bytes of externally stored
+					fields */
+	ulonglong	n_extern_pages;	/*!< BLOB pages of the tablespace
+					attributed to the index */
+
+	xb_stats_real_t()
+		: n_leaf_jumps(0), n_extern_fields(0), extern_size(0),
+		  n_extern_pages(0) {}
+};
+
+/** An index to gather statistics of */
+struct xb_stats_index_t {
+	std::string	table_name;
+	std::string	index_name;
+	dict_index_t*	index;
+	ulint		space_id;
+	ulint		root_page;
+	ulint		page_size;	/*!< physical page size */
+	ib_uint64_t	n_vals;		/*!< estimated number of different key
+					values */
+	ulint		n_leaf_pages;	/*!< estimated number of leaf pages */
+	ulint		index_size;	/*!< estimated number of pages */
+	xb_stats_real_t	real;
+};
+
+/** Page counts of a tablespace by the kind of the page */
+struct xb_stats_pages_t {
+	ulonglong	n_free;		/*!< free pages */
+	ulonglong	n_index;	/*!< pages of the scanned indexes */
+	ulonglong	n_blob;		/*!< BLOB pages */
+	ulonglong	n_other;	/*!< other used pages */
+	ulonglong	n_corrupt;	/*!< pages failing the checksum */
+};
+
+/** A datafile of a scanned tablespace */
+struct xb_stats_file_t {
+	std::string	name;
+	pfs_os_file_t	file;
+	ulint		first_page;	/*!< first page number in the file */
+	ulint		n_pages;	/*!< size of the file in pages */
+};
+
+/** A tablespace to scan */
+struct xb_stats_space_t {
+	ulint		id;
+	page_size_t	page_size;
+	std::vector<xb_stats_file_t>	files;
+	ulint		size;		/*!< size of all files in pages */
+	xb_stats_pages_t	pages;
+	byte		encryption_key[32];
+	ulint		encryption_klen;
+	byte		encryption_iv[32];
+
+	explicit xb_stats_space_t(const page_size_t& page_size_)
+		: page_size(0, 0, false)
+	{
+		page_size.copy_from(page_size_);
+	}
+};
+
+/** A range of pages of a tablespace described by a single extent descriptor
+page, which is the first page of the range */
+struct xb_stats_unit_t {
+	xb_stats_space_t*	space;
+	ulint			first_page;
+	ulint			n_pages;
+};
+
+/** Buffers of a statistics thread */
+struct xb_stats_thread_t {
+	uint		num;		/*!< thread number */
+	pthread_t	id;		/*!< thread ID */
+	byte*		buf_unaligned;
+	byte*		buf;		/*!< read buffer */
+	ulint		buf_size;	/*!< read buffer size */
+	byte*		frame_unaligned;
+	byte*		frame;		/*!< uncompressed frame of a compressed
+					page */
+	byte*		descr;		/*!< copy of the extent descriptor
+					page */
+	byte*		scratch;	/*!< page to decrypt and decompress
+					with */
+	mem_heap_t*	heap;		/*!< heap for record offsets */
+};
+
+static std::vector<xb_stats_index_t*>		stats_indexes;
+static std::map<index_id_t, xb_stats_index_t*>	stats_index_map;
+static std::map<ulint, xb_stats_space_t*>	stats_spaces;
+static std::vector<xb_stats_unit_t>		stats_units;
+static ulint					stats_next_unit;
+static pthread_mutex_t				stats_mutex;
+
+/************************************************************************
+Opens the datafiles of a tablespace to scan and splits it into units of work.
+Does nothing if the tablespace is already added. */
+static
+void
+xb_stats_add_space(
+/*===============*/
+	ulint	space_id)	/*!< in: tablespace id */
 {
-	ulint	space;
-	page_t*	page;
+	fil_space_t*		fil_space;
+	xb_stats_space_t*	space;
+	ulint			phys;
 
-	rec_t*	node_ptr;
+	if (stats_spaces.count(space_id)) {
+		return;
+	}
 
-	ulint	right_page_no;
+	fil_space = fil_space_get(space_id);
+	if (fil_space == NULL) {
+		msg("xtrabackup: Warning: tablespace %lu is not found, "
+		    "skipping.\n", space_id);
+		stats_spaces[space_id] = NULL;
+		return;
+	}
 
-	page_cur_t	cursor;
+	space = new xb_stats_space_t(page_size_t(fil_space->flags));
+	space->id = space_id;
+	space->size = 0;
+	memset(&space->pages, 0, sizeof(space->pages));
+	memcpy(space->encryption_key, fil_space->encryption_key,
+	       sizeof(space->encryption_key));
+	memcpy(space->encryption_iv, fil_space->encryption_iv,
+	       sizeof(space->encryption_iv));
+	space->encryption_klen = fil_space->encryption_klen;
 
-	mtr_t	mtr;
-	mem_heap_t*	heap	= mem_heap_create(256);
+	phys = space->page_size.physical();
 
-	ulint*	offsets = NULL;
+	for (fil_node_t* node = UT_LIST_GET_FIRST(fil_space->chain);
+	     node != NULL; node = UT_LIST_GET_NEXT(chain, node)) {
 
-	ulonglong n_pages, n_pages_extern;
-	ulonglong sum_data, sum_data_extern;
-	ulonglong n_recs;
-	buf_block_t*	block;
-	page_size_t	page_size(0, 0, false);
-	bool		found;
+		xb_stats_file_t	file;
+		os_offset_t	size;
+		bool		success;
 
-	n_pages = sum_data = n_recs = 0;
-	n_pages_extern = sum_data_extern = 0;
+		file.name = node->name;
+		file.file = os_file_create_simple_no_error_handling(
+			0, node->name, OS_FILE_OPEN, OS_FILE_READ_ONLY,
+			srv_read_only_mode, &success);
+		if (!success) {
+			/* The following call prints an error message */
+			os_file_get_last_error(TRUE);
 
+			msg("xtrabackup: error: cannot open %s\n", node->name);
+			exit(EXIT_FAILURE);
+		}
 
-	if (level == 0)
-		fprintf(stdout, "        leaf pages: ");
-	else
-		fprintf(stdout, "     level %lu pages: ", level);
+		size = os_file_get_size(file.file);
+		if (size == (os_offset_t) -1) {
+			msg("xtrabackup: error: cannot get size of %s\n",
+			    node->name);
+			exit(EXIT_FAILURE);
+		}
 
-	mtr_start(&mtr);
+		if (opt_direct_io) {
+			os_file_set_nocache(file.file.m_file, node->name,
+					    "OPEN");
+		}
+		posix_fadvise(file.file.m_file, 0, 0, POSIX_FADV_SEQUENTIAL);
 
-	mtr_x_lock(&(index->lock), &mtr);
-	block = btr_root_block_get(index, RW_X_LATCH, &mtr);
-	page = buf_block_get_frame(block);
+		file.first_page = space->size;
+		file.n_pages = (ulint) (size / phys);
+		space->size += file.n_pages;
+		space->files.push_back(file);
+	}
+
+	stats_spaces[space_id] = space;
+
+	/* An extent descriptor page describes the next physical page size
+	pages */
+	for (ulint page_no = 0; page_no < space->size; page_no += phys) {
+		xb_stats_unit_t	unit;
+
+		unit.space = space;
+		unit.first_page = page_no;
+		unit.n_pages = ut_min(phys, space->size - page_no);
+		stats_units.push_back(unit);
+	}
+}
 
-	space = page_get_space_id(page);
-	page_size.copy_from(fil_space_get_page_size(space, &found));
+/************************************************************************
+Reads consecutive pages of a tablespace, which may span several datafiles.
+
+@return number of pages read, less than requested at the end of the
+tablespace */
+static
+ulint
+xb_stats_read_pages(
+/*================*/
+	const xb_stats_space_t*	space,		/*!< in: tablespace */
+	ulint			page_no,	/*!< in: first page to read */
+	ulint			n_pages,	/*!< in: number of pages */
+	byte*			buf)		/*!< out: pages */
+{
+	IORequest	read_request(IORequest::READ
+				     | IORequest::NO_COMPRESSION);
+	ulint		phys = space->page_size.physical();
+	ulint		n_done = 0;
+
+	for (size_t i = 0; i < space->files.size() && n_done < n_pages; i++) {
+		const xb_stats_file_t&	file = space->files[i];
+		ulint			cur = page_no + n_done;
+		ulint			n;
+		ulint			n_read = 0;
+
+		if (cur >= file.first_page + file.n_pages) {
+			continue;
+		}
 
-	ut_a(found);
+		n = ut_min(n_pages - n_done,
+			   file.first_page + file.n_pages - cur);
 
-	while (level != btr_page_get_level(page, &mtr)) {
+		xtrabackup_io_throttling();
 
-		ut_a(space == block->page.id.space());
-		ut_a(space == page_get_space_id(page));
-		ut_a(!page_is_leaf(page));
+		os_file_read_no_error_handling(
+			read_request, file.file, buf + n_done * phys,
+			(os_offset_t) (cur - file.first_page) * phys,
+			n * phys, &n_read);
 
-		page_cur_set_before_first(block, &cursor);
-		page_cur_move_to_next(&cursor);
+		n_done += n_read / phys;
 
-		node_ptr = page_cur_get_rec(&cursor);
-		offsets = rec_get_offsets(node_ptr, index, offsets,
-					ULINT_UNDEFINED, &heap);
-		block = btr_node_ptr_get_child(node_ptr, index, offsets, &mtr);
-		page = buf_block_get_frame(block);
+		if (n_read < n * phys) {
+			break;
+		}
 	}
 
-loop:
-	mem_heap_empty(heap);
-	offsets = NULL;
-	mtr_x_lock(&(index->lock), &mtr);
+	return(n_done);
+}
+
+/************************************************************************
+Decrypts and decompresses a page in place and verifies its checksum.
+
+@return true if the page is valid */
+static
+bool
+xb_stats_prepare_page(
+/*==================*/
+	xb_stats_space_t*	space,		/*!< in: tablespace */
+	byte*			page,		/*!< in/out: page */
+	byte*			scratch)	/*!< in: scratch page */
+{
+	ulint	phys = space->page_size.physical();
 
-	right_page_no = btr_page_get_next(page, &mtr);
+	if (Encryption::is_encrypted_page(page)) {
+		IORequest	read_request(IORequest::READ);
 
+		read_request.encryption_algorithm(Encryption::AES);
+		read_request.encryption_key(space->encryption_key,
+					    space->encryption_klen,
+					    space->encryption_iv);
 
-	/*=================================*/
-	//fprintf(stdout, "%lu ", (ulint) buf_frame_get_page_no(page));
+		Encryption	encryption(read_request.encryption_algorithm());
 
-	n_pages++;
-	sum_data += page_get_data_size(page);
-	n_recs += page_get_n_recs(page);
+		if (encryption.decrypt(read_request, page, phys, scratch, phys)
+		    != DB_SUCCESS) {
+			return(false);
+		}
+	}
 
+	if (Compression::is_compressed_page(page)
+	    && os_file_decompress_page(false, page, scratch, phys)
+	    != DB_SUCCESS) {
+		return(false);
+	}
 
-	if (level == 0) {
-		page_cur_t	cur;
-		ulint	n_fields;
-		ulint	i;
-		mem_heap_t*	local_heap	= NULL;
-		ulint	offsets_[REC_OFFS_NORMAL_SIZE];
-		ulint*	local_offsets	= offsets_;
+	return(!buf_page_is_corrupted(false, page, space->page_size, false));
+}
+
+/************************************************************************
+@return true if the extent descriptor page marks a page as free */
+static
+bool
+xb_stats_page_is_free(
+/*==================*/
+	const byte*		descr_page,	/*!< in: extent descriptor
+						page */
+	const page_size_t&	page_size,	/*!< in: page size */
+	ulint			page_no)	/*!< in: page number */
+{
+	const xdes_t*	descr = descr_page + XDES_ARR_OFFSET
+		+ XDES_SIZE * xdes_calc_descriptor_index(page_size, page_no);
 
-		*offsets_ = (sizeof offsets_) / sizeof *offsets_;
+	switch (mach_read_from_4(descr + XDES_STATE)) {
+	case XDES_FREE_FRAG:
+	case XDES_FULL_FRAG:
+	case XDES_FSEG:
+		return(xdes_get_bit(descr, XDES_FREE_BIT,
+				    page_no % FSP_EXTENT_SIZE));
+	}
 
-		page_cur_set_before_first(block, &cur);
-		page_cur_move_to_next(&cur);
+	/* Free extents and extents beyond the free limit */
+	return(true);
+}
 
-		for (;;) {
-			if (page_cur_is_after_last(&cur)) {
-				break;
+/************************************************************************
+Counts the externally stored fields owned by the records of a clustered index
+leaf page. */
+static
+void
+xb_stats_scan_extern(
+/*=================*/
+	const xb_stats_index_t*	stats,		/*!< in: index */
+	const page_size_t&	page_size,	/*!< in: page size */
+	byte*			page,		/*!< in: leaf page */
+	xb_stats_thread_t*	thread,		/*!< in: thread buffers */
+	xb_stats_real_t*	real)		/*!< in/out: statistics */
+{
+	const page_t*	frame = page;
+	ulint*		offsets = NULL;
+
+	if (page_size.is_compressed()) {
+		page_zip_des_t	page_zip;
+
+		page_zip_des_init(&page_zip);
+		page_zip_set_size(&page_zip, page_size.physical());
+		page_zip.data = page;
+
+		if (!page_zip_decompress(&page_zip, thread->frame, TRUE)) {
+			return;
+		}
+		frame = thread->frame;
+	}
+
+	mem_heap_empty(thread->heap);
+
+	for (const rec_t* rec = page_rec_get_next_const(
+		     page_get_infimum_rec(frame));
+	     !page_rec_is_supremum(rec);
+	     rec = page_rec_get_next_const(rec)) {
+
+		offsets = rec_get_offsets(rec, stats->index, offsets,
+					  ULINT_UNDEFINED, &thread->heap);
+
+		if (!rec_offs_any_extern(offsets)) {
+			continue;
+		}
+
+		for (ulint i = 0; i < rec_offs_n_fields(offsets); i++) {
+			const byte*	ref;
+			ulint		len;
+
+			if (!rec_offs_nth_extern(offsets, i)) {
+				continue;
+			}
+
+			ref = rec_get_nth_field(rec, offsets, i, &len);
+			ut_a(len >= BTR_EXTERN_FIELD_REF_SIZE);
+			ref += len - BTR_EXTERN_FIELD_REF_SIZE;
+
+			/* Skip the fields not written yet and the fields
+			inherited from another version of the record */
+			if (!memcmp(ref, field_ref_zero,
+				    BTR_EXTERN_FIELD_REF_SIZE)
+			    || (mach_read_from_1(ref + BTR_EXTERN_LEN)
+				& BTR_EXTERN_OWNER_FLAG)) {
+				continue;
 			}
 
-			local_offsets = rec_get_offsets(cur.rec, index, local_offsets,
-						ULINT_UNDEFINED, &local_heap);
-			n_fields = rec_offs_n_fields(local_offsets);
+			real->n_extern_fields++;
+			real->extern_size += mach_read_from_4(
+				ref + BTR_EXTERN_LEN + 4);
+		}
+	}
+}
 
-			for (i = 0; i < n_fields; i++) {
-				if (rec_offs_nth_extern(local_offsets, i)) {
-					page_t*	local_page;
-					ulint	space_id;
-					ulint	page_no;
-					ulint	offset;
-					byte*	blob_header;
-					ulint	part_len;
-					mtr_t	local_mtr;
-					ulint	local_len;
-					byte*	data;
-					buf_block_t*	local_block;
+/************************************************************************
+Adds the statistics gathered by a unit of work to the total. */
+static
+void
+xb_stats_real_add(
+/*==============*/
+	xb_stats_real_t*	dst,	/*!< in/out: total */
+	const xb_stats_real_t&	src)	/*!< in: statistics to add */
+{
+	if (dst->levels.size() < src.levels.size()) {
+		dst->levels.resize(src.levels.size());
+	}
 
-					data = rec_get_nth_field(cur.rec, local_offsets, i, &local_len);
+	for (size_t i = 0; i < src.levels.size(); i++) {
+		dst->levels[i].n_pages += src.levels[i].n_pages;
+		dst->levels[i].n_recs += src.levels[i].n_recs;
+		dst->levels[i].data_size += src.levels[i].data_size;
+	}
 
-					ut_a(local_len >= BTR_EXTERN_FIELD_REF_SIZE);
-					local_len -= BTR_EXTERN_FIELD_REF_SIZE;
+	dst->n_leaf_jumps += src.n_leaf_jumps;
+	dst->n_extern_fields += src.n_extern_fields;
+	dst->extern_size += src.extern_size;
+}
 
-					space_id = mach_read_from_4(data + local_len + BTR_EXTERN_SPACE_ID);
-					page_no = mach_read_from_4(data + local_len + BTR_EXTERN_PAGE_NO);
-					offset = mach_read_from_4(data + local_len + BTR_EXTERN_OFFSET);
+/************************************************************************
+Scans the pages of a unit of work. */
+static
+void
+xb_stats_scan_unit(
+/*===============*/
+	const xb_stats_unit_t*	unit,	/*!< in: unit of work */
+	xb_stats_thread_t*	thread)	/*!< in: thread buffers */
+{
+	typedef std::map<xb_stats_index_t*, xb_stats_real_t> real_map_t;
+
+	xb_stats_space_t*	space = unit->space;
+	const page_size_t&	page_size = space->page_size;
+	ulint			phys = page_size.physical();
+	ulint			end = unit->first_page + unit->n_pages;
+	bool			descr_valid = false;
+	real_map_t		real;
+	xb_stats_pages_t	pages;
+
+	memset(&pages, 0, sizeof(pages));
+
+	for (ulint page_no = unit->first_page; page_no < end; ) {
+		ulint	n = ut_min(thread->buf_size / phys, end - page_no);
+		ulint	n_read;
+
+		n_read = xb_stats_read_pages(space, page_no, n, thread->buf);
+
+		for (ulint i = 0; i < n_read; i++) {
+			byte*	page = thread->buf + i * phys;
+			ulint	cur = page_no + i;
+			bool	valid = xb_stats_prepare_page(
+				space, page, thread->scratch);
+
+			if (cur == unit->first_page) {
+				descr_valid = valid;
+				if (valid) {
+					memcpy(thread->descr, page, phys);
+				} else {
+					msg("[%02u] xtrabackup: Warning: "
+					    "extent descriptor page %lu of "
+					    "tablespace %lu is corrupted, "
+					    "counting free pages as used.\n",
+					    thread->num, cur, space->id);
+				}
+			}
 
-					if (offset != FIL_PAGE_DATA)
-						msg("\nWarning: several record may share same external page.\n");
+			if (space->id == TRX_SYS_SPACE
+			    && cur >= FSP_EXTENT_SIZE
+			    && cur < FSP_EXTENT_SIZE * 3) {
+				/* doublewrite buffer pages hold copies of
+				the index pages */
+				pages.n_other++;
+				continue;
+			}
 
-					for (;;) {
-						mtr_start(&local_mtr);
+			if (!valid) {
+				pages.n_corrupt++;
+				continue;
+			}
 
-						local_block = btr_block_get(page_id_t(space_id, page_no), page_size, RW_S_LATCH, index, &local_mtr);
-						local_page = buf_block_get_frame(local_block);
-						blob_header = local_page + offset;
-#define BTR_BLOB_HDR_PART_LEN		0
-#define BTR_BLOB_HDR_NEXT_PAGE_NO	4
-						//part_len = btr_blob_get_part_len(blob_header);
-						part_len = mach_read_from_4(blob_header + BTR_BLOB_HDR_PART_LEN);
+			if (descr_valid
+			    && xb_stats_page_is_free(thread->descr, page_size,
+						     cur)) {
+				pages.n_free++;
+				continue;
+			}
 
-						//page_no = btr_blob_get_next_page_no(blob_header);
-						page_no = mach_read_from_4(blob_header + BTR_BLOB_HDR_NEXT_PAGE_NO);
+			switch (fil_page_get_type(page)) {
+			case FIL_PAGE_INDEX:
+			case FIL_PAGE_RTREE:
+				break;
+			case FIL_PAGE_TYPE_BLOB:
+			case FIL_PAGE_TYPE_ZBLOB:
+			case FIL_PAGE_TYPE_ZBLOB2:
+				pages.n_blob++;
+				continue;
+			default:
+				pages.n_other++;
+				continue;
+			}
 
-						offset = FIL_PAGE_DATA;
+			std::map<index_id_t, xb_stats_index_t*>::const_iterator
+				it = stats_index_map.find(
+					btr_page_get_index_id(page));
+			ulint	level = mach_read_from_2(
+				page + PAGE_HEADER + PAGE_LEVEL);
 
+			if (it == stats_index_map.end()
+			    || it->second->space_id != space->id) {
+				pages.n_other++;
+				continue;
+			}
 
+			if (level > BTR_MAX_NODE_LEVEL) {
+				pages.n_corrupt++;
+				continue;
+			}
 
+			pages.n_index++;
 
-						/*=================================*/
-						//fprintf(stdout, "[%lu] ", (ulint) buf_frame_get_page_no(page));
+			xb_stats_real_t&	r = real[it->second];
 
-						n_pages_extern++;
-						sum_data_extern += part_len;
+			if (r.levels.size() <= level) {
+				r.levels.resize(level + 1);
+			}
+			r.levels[level].n_pages++;
+			r.levels[level].n_recs += page_get_n_recs(page);
+			r.levels[level].data_size += page_get_data_size(page);
 
+			if (level == 0) {
+				ulint	next = mach_read_from_4(
+					page + FIL_PAGE_NEXT);
 
-						mtr_commit(&local_mtr);
+				if (next != FIL_NULL && next != cur + 1) {
+					r.n_leaf_jumps++;
+				}
 
-						if (page_no == FIL_NULL)
-							break;
-					}
+				if (dict_index_is_clust(it->second->index)) {
+					xb_stats_scan_extern(
+						it->second, page_size, page,
+						thread, &r);
 				}
 			}
+		}
 
-			page_cur_move_to_next(&cur);
+		if (n_read < n) {
+			break;
 		}
+
+		page_no += n;
 	}
 
+	pthread_mutex_lock(&stats_mutex);
 
+	for (real_map_t::const_iterator it = real.begin(); it != real.end();
+	     ++it) {
+		xb_stats_real_add(&it->first->real, it->second);
+	}
 
+	space->pages.n_free += pages.n_free;
+	space->pages.n_index += pages.n_index;
+	space->pages.n_blob += pages.n_blob;
+	space->pages.n_other += pages.n_other;
+	space->pages.n_corrupt += pages.n_corrupt;
 
-	mtr_commit(&mtr);
-	if (right_page_no != FIL_NULL) {
-		mtr_start(&mtr);
-		block = btr_block_get(page_id_t(space,
-						dict_index_get_page(index)),
-				      page_size,
-				      RW_X_LATCH, index, &mtr);
-		page = buf_block_get_frame(block);
-		goto loop;
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+/**************************************************************************
+Worker thread function for the statistics scan. */
+static
+void *
+xb_stats_thread_func(
+/*=================*/
+	void*	arg)	/* thread context */
+{
+	xb_stats_thread_t*	thread = (xb_stats_thread_t *) arg;
+	const xb_stats_unit_t*	unit;
+
+	my_thread_init();
+
+	thread->buf_size = opt_read_buffer_size;
+	thread->buf_unaligned = static_cast<byte *>
+		(ut_malloc_nokey(thread->buf_size + UNIV_PAGE_SIZE));
+	thread->buf = static_cast<byte *>
+		(ut_align(thread->buf_unaligned, UNIV_PAGE_SIZE));
+	thread->frame_unaligned = static_cast<byte *>
+		(ut_malloc_nokey(2 * UNIV_PAGE_SIZE));
+	thread->frame = static_cast<byte *>
+		(ut_align(thread->frame_unaligned, UNIV_PAGE_SIZE));
+	thread->descr = static_cast<byte *>(ut_malloc_nokey(UNIV_PAGE_SIZE));
+	thread->scratch = static_cast<byte *>
+		(ut_malloc_nokey(UNIV_PAGE_SIZE));
+	thread->heap = mem_heap_create(UNIV_PAGE_SIZE);
+
+	/* Loop until there are no more units of work */
+	for (;;) {
+		pthread_mutex_lock(&stats_mutex);
+
+		if (stats_next_unit == stats_units.size()) {
+
+			pthread_mutex_unlock(&stats_mutex);
+			break;
+		}
+
+		unit = &stats_units[stats_next_unit++];
+
+		pthread_mutex_unlock(&stats_mutex);
+
+		xb_stats_scan_unit(unit, thread);
 	}
-	mem_heap_free(heap);
 
-	if (level == 0)
-		fprintf(stdout, "recs=%llu, ", n_recs);
+	mem_heap_free(thread->heap);
+	ut_free(thread->scratch);
+	ut_free(thread->descr);
+	ut_free(thread->frame_unaligned);
+	ut_free(thread->buf_unaligned);
+
+	my_thread_end();
+
+	return(NULL);
+}
 
-	fprintf(stdout, "pages=%llu, data=%llu bytes, data/pages=%lld%%",
-		n_pages, sum_data,
-		((sum_data * 100) / page_size.physical()) / n_pages);
+/************************************************************************
+Scans the tablespaces of the collected indexes on --parallel threads and
+attributes the BLOB pages of every tablespace to its indexes in proportion to
+the size of their externally stored fields. */
+static
+void
+xb_stats_scan(void)
+/*===============*/
+{
+	xb_stats_thread_t*	threads;
+	uint			i;
 
+	msg("xtrabackup: Scanning %lu tablespaces with %d threads\n",
+	    (ulong) stats_spaces.size(), xtrabackup_parallel);
 
-	if (level == 0 && n_pages_extern) {
-		putc('\n', stdout);
-		/* also scan blob pages*/
-		fprintf(stdout, "    external pages: ");
+	pthread_mutex_init(&stats_mutex, NULL);
+	stats_next_unit = 0;
+
+	threads = (xb_stats_thread_t *)
+		ut_malloc_nokey(sizeof(*threads) * xtrabackup_parallel);
+
+	for (i = 0; i < (uint) xtrabackup_parallel; i++) {
 
-		fprintf(stdout, "pages=%llu, data=%llu bytes, data/pages=%lld%%",
-			n_pages_extern, sum_data_extern,
-			((sum_data_extern * 100) / page_size.physical())
-				/ n_pages_extern);
+		threads[i].num = i + 1;
+		if (pthread_create(&threads[i].id, NULL, xb_stats_thread_func,
+				   &threads[i])) {
+
+			msg("error: pthread_create() failed: errno = %d\n",
+			    errno);
+			ut_a(0);
+		}
+	}
+
+	/* Wait for worker threads to finish */
+	for (i = 0; i < (uint) xtrabackup_parallel; i++) {
+		pthread_join(threads[i].id, NULL);
+	}
+
+	ut_free(threads);
+	pthread_mutex_destroy(&stats_mutex);
+
+	std::map<ulint, ulonglong>	space_extern_size;
+
+	for (i = 0; i < stats_indexes.size(); i++) {
+		space_extern_size[stats_indexes[i]->space_id] +=
+			stats_indexes[i]->real.extern_size;
+	}
+
+	for (i = 0; i < stats_indexes.size(); i++) {
+		xb_stats_index_t*	stats = stats_indexes[i];
+		xb_stats_space_t*	space = stats_spaces[stats->space_id];
+		ulonglong		total = space_extern_size[
+			stats->space_id];
+
+		if (space != NULL && total > 0) {
+			stats->real.n_extern_pages = (ulonglong)
+				((double) space->pages.n_blob
+				 * stats->real.extern_size / total + 0.5);
+		}
+	}
+}
+
+/************************************************************************
+@return data size in percents of the size of the pages */
+static
+longlong
+xb_stats_fill_percent(
+/*==================*/
+	ulonglong	data_size,	/*!< in: data size */
+	ulonglong	n_pages,	/*!< in: number of pages */
+	ulint		page_size)	/*!< in: physical page size */
+{
+	if (n_pages == 0 || page_size == 0) {
+		return(0);
+	}
+
+	return(((data_size * 100) / page_size) / n_pages);
+}
+
+/************************************************************************
+@return data size as a fraction of the size of the pages */
+static
+double
+xb_stats_fill_factor(
+/*=================*/
+	ulonglong	data_size,	/*!< in: data size */
+	ulonglong	n_pages,	/*!< in: number of pages */
+	ulint		page_size)	/*!< in: physical page size */
+{
+	if (n_pages == 0 || page_size == 0) {
+		return(0);
+	}
+
+	return((double) data_size / ((double) n_pages * page_size));
+}
+
+/************************************************************************
+Prints the statistics in the traditional text format. */
+static
+void
+xb_stats_print_text(void)
+/*=====================*/
+{
+	fprintf(stdout, "\n\n<INDEX STATISTICS>\n");
+
+	for (size_t i = 0; i < stats_indexes.size(); i++) {
+		const xb_stats_index_t*	stats = stats_indexes[i];
+		const xb_stats_real_t&	real = stats->real;
+
+		fprintf(stdout,
+			"  table: %s, index: %s, space id: %lu, root page: %lu"
+			", zip size: %lu"
+			"\n  estimated statistics in dictionary:\n"
+			"    key vals: %lu, leaf pages: %lu, size pages: %lu\n"
+			"  real statistics:\n",
+			stats->table_name.c_str(), stats->index_name.c_str(),
+			(ulong) stats->space_id,
+			(ulong) stats->root_page,
+			(ulong) stats->page_size,
+			(ulong) stats->n_vals,
+			(ulong) stats->n_leaf_pages,
+			(ulong) stats->index_size);
+
+		for (size_t level = real.levels.size(); level-- > 0; ) {
+			const xb_stats_level_t&	l = real.levels[level];
+
+			if (level == 0) {
+				fprintf(stdout, "        leaf pages: "
+					"recs=%llu, ", l.n_recs);
+			} else {
+				fprintf(stdout, "     level %lu pages: ",
+					(ulong) level);
+			}
+
+			fprintf(stdout,
+				"pages=%llu, data=%llu bytes, "
+				"data/pages=%lld%%\n",
+				l.n_pages, l.data_size,
+				xb_stats_fill_percent(l.data_size, l.n_pages,
+						      stats->page_size));
+		}
+
+		if (real.n_extern_fields) {
+			fprintf(stdout, "    external pages: "
+				"pages=%llu, data=%llu bytes, "
+				"data/pages=%lld%%\n",
+				real.n_extern_pages, real.extern_size,
+				xb_stats_fill_percent(real.extern_size,
+						      real.n_extern_pages,
+						      stats->page_size));
+		}
+
+		putc('\n', stdout);
 	}
 
 	putc('\n', stdout);
+}
 
-	if (level > 0) {
-		xtrabackup_stats_level(index, level - 1);
+/************************************************************************
+Prints a JSON string literal. */
+static
+void
+xb_stats_print_json_string(
+/*=======================*/
+	const std::string&	str)	/*!< in: string */
+{
+	putc('"', stdout);
+
+	for (size_t i = 0; i < str.size(); i++) {
+		unsigned char	c = str[i];
+
+		if (c == '"' || c == '\\') {
+			fprintf(stdout, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(stdout, "\\u%04x", c);
+		} else {
+			putc(c, stdout);
+		}
 	}
 
-	return(TRUE);
+	putc('"', stdout);
+}
+
+/************************************************************************
+Prints the statistics in the JSON format. */
+static
+void
+xb_stats_print_json(void)
+/*=====================*/
+{
+	bool	first = true;
+
+	fprintf(stdout, "{\n  \"tablespaces\": [");
+
+	for (std::map<ulint, xb_stats_space_t*>::const_iterator it =
+		     stats_spaces.begin(); it != stats_spaces.end(); ++it) {
+
+		const xb_stats_space_t*	space = it->second;
+
+		if (space == NULL) {
+			continue;
+		}
+
+		fprintf(stdout, "%s\n    {\"space_id\": %lu, \"files\": [",
+			first ? "" : ",", (ulong) space->id);
+		first = false;
+
+		for (size_t i = 0; i < space->files.size(); i++) {
+			if (i) {
+				fputs(", ", stdout);
+			}
+			xb_stats_print_json_string(space->files[i].name);
+		}
+
+		fprintf(stdout,
+			"], \"page_size\": %lu, \"pages\": %lu, "
+			"\"free_pages\": %llu, \"index_pages\": %llu, "
+			"\"blob_pages\": %llu, \"other_pages\": %llu, "
+			"\"corrupt_pages\": %llu}",
+			(ulong) space->page_size.physical(),
+			(ulong) space->size,
+			space->pages.n_free, space->pages.n_index,
+			space->pages.n_blob, space->pages.n_other,
+			space->pages.n_corrupt);
+	}
+
+	fprintf(stdout, "\n  ],\n  \"indexes\": [");
+
+	for (size_t i = 0; i < stats_indexes.size(); i++) {
+		const xb_stats_index_t*	stats = stats_indexes[i];
+		const xb_stats_real_t&	real = stats->real;
+		ulonglong		n_pages = 0;
+		ulonglong		data_size = 0;
+		ulonglong		n_leaf_pages = 0;
+		ulonglong		n_recs = 0;
+
+		for (size_t level = 0; level < real.levels.size(); level++) {
+			n_pages += real.levels[level].n_pages;
+			data_size += real.levels[level].data_size;
+		}
+		if (!real.levels.empty()) {
+			n_leaf_pages = real.levels[0].n_pages;
+			n_recs = real.levels[0].n_recs;
+		}
+
+		fprintf(stdout, "%s\n    {\"table\": ", i ? "," : "");
+		xb_stats_print_json_string(stats->table_name);
+		fprintf(stdout, ", \"index\": ");
+		xb_stats_print_json_string(stats->index_name);
+		fprintf(stdout,
+			", \"space_id\": %lu, \"root_page\": %lu, "
+			"\"page_size\": %lu,\n"
+			"     \"estimated\": {\"key_vals\": %llu, "
+			"\"leaf_pages\": %lu, \"size_pages\": %lu},\n"
+			"     \"pages\": %llu, \"leaf_pages\": %llu, "
+			"\"records\": %llu, \"data\": %llu, "
+			"\"fill_factor\": %.4f, \"fragmentation\": %.4f,\n"
+			"     \"levels\": [",
+			(ulong) stats->space_id,
+			(ulong) stats->root_page,
+			(ulong) stats->page_size,
+			(ulonglong) stats->n_vals,
+			(ulong) stats->n_leaf_pages,
+			(ulong) stats->index_size,
+			n_pages, n_leaf_pages, n_recs, data_size,
+			xb_stats_fill_factor(data_size, n_pages,
+					     stats->page_size),
+			n_leaf_pages > 1
+			? (double) real.n_leaf_jumps / (n_leaf_pages - 1)
+			: 0.0);
+
+		for (size_t level = real.levels.size(); level-- > 0; ) {
+			const xb_stats_level_t&	l = real.levels[level];
+
+			fprintf(stdout,
+				"%s{\"level\": %lu, \"pages\": %llu, "
+				"\"records\": %llu, \"data\": %llu, "
+				"\"fill_factor\": %.4f}",
+				level + 1 < real.levels.size() ? ", " : "",
+				(ulong) level, l.n_pages, l.n_recs,
+				l.data_size,
+				xb_stats_fill_factor(l.data_size, l.n_pages,
+						     stats->page_size));
+		}
+
+		fprintf(stdout,
+			"],\n     \"extern\": {\"fields\": %llu, "
+			"\"data\": %llu, \"pages\": %llu}}",
+			real.n_extern_fields, real.extern_size,
+			real.n_extern_pages);
+	}
+
+	fprintf(stdout, "\n  ]\n}\n");
+}
+
+/************************************************************************
+Closes the scanned datafiles and frees the collected statistics. */
+static
+void
+xb_stats_free(void)
+/*===============*/
+{
+	for (std::map<ulint, xb_stats_space_t*>::iterator it =
+		     stats_spaces.begin(); it != stats_spaces.end(); ++it) {
+
+		xb_stats_space_t*	space = it->second;
+
+		if (space == NULL) {
+			continue;
+		}
+
+		for (size_t i = 0; i < space->files.size(); i++) {
+			os_file_close(space->files[i].file);
+		}
+
+		delete space;
+	}
+
+	for (size_t i = 0; i < stats_indexes.size(); i++) {
+		delete stats_indexes[i];
+	}
+
+	stats_spaces.clear();
+	stats_indexes.clear();
+	stats_index_map.clear();
+	stats_units.clear();
 }
 
 static void
@@ -5366,9 +6265,7 @@ xtrabackup_stats_func(int argc, char **argv)
 
 	xb_filters_init();
 
-	fprintf(stdout, "\n\n<INDEX STATISTICS>\n");
-
-	/* gather stats */
+	/* collect the indexes and their estimated statistics */
 
 	{
 	dict_table_t*	sys_tables;
@@ -5455,49 +6352,32 @@ loop:
 
 			index = UT_LIST_GET_FIRST(table->indexes);
 			while (index != NULL) {
-{
-	ib_uint64_t	n_vals;
-	bool		found;
-
-	if (index->n_user_defined_cols > 0) {
-		n_vals = index->stat_n_diff_key_vals[
-					index->n_user_defined_cols];
-	} else {
-		n_vals = index->stat_n_diff_key_vals[1];
-	}
-
-	fprintf(stdout,
-		"  table: %s, index: %s, space id: %lu, root page: %lu"
-		", zip size: %lu"
-		"\n  estimated statistics in dictionary:\n"
-		"    key vals: %lu, leaf pages: %lu, size pages: %lu\n"
-		"  real statistics:\n",
-		table->name.m_name, index->name(),
-		(ulong) index->space,
-		(ulong) index->page,
-		(ulong) fil_space_get_page_size(index->space, &found).physical(),
-		(ulong) n_vals,
-		(ulong) index->stat_n_leaf_pages,
-		(ulong) index->stat_index_size);
-
-	{
-		mtr_t	local_mtr;
-		page_t*	root;
-		ulint	page_level;
-
-		mtr_start(&local_mtr);
-
-		mtr_x_lock(&(index->lock), &local_mtr);
-		root = btr_root_get(index, &local_mtr);
-		page_level = btr_page_get_level(root, &local_mtr);
-
-		xtrabackup_stats_level(index, page_level);
+				xb_stats_index_t*	stats;
+				bool			found;
+
+				stats = new xb_stats_index_t();
+				stats->table_name = table->name.m_name;
+				stats->index_name = index->name();
+				stats->index = index;
+				stats->space_id = index->space;
+				stats->root_page = index->page;
+				stats->page_size = fil_space_get_page_size(
+					index->space, &found).physical();
+				if (index->n_user_defined_cols > 0) {
+					stats->n_vals =
+						index->stat_n_diff_key_vals[
+						index->n_user_defined_cols];
+				} else {
+					stats->n_vals =
+						index->stat_n_diff_key_vals[1];
+				}
+				stats->n_leaf_pages = index->stat_n_leaf_pages;
+				stats->index_size = index->stat_index_size;
 
-		mtr_commit(&local_mtr);
-	}
+				stats_indexes.push_back(stats);
+				stats_index_map[index->id] = stats;
+				xb_stats_add_space(index->space);
 
-	putc('\n', stdout);
-}
 				index = UT_LIST_GET_NEXT(indexes, index);
 			}
 		}
@@ -5512,10 +6392,18 @@ skip:
 	}
 
 end:
-	putc('\n', stdout);
+	xb_stats_scan();
+
+	if (opt_stats_format == STATS_FORMAT_JSON) {
+		xb_stats_print_json();
+	} else {
+		xb_stats_print_text();
+	}
 
 	fflush(stdout);
 
+	xb_stats_free();
+
 	xb_filters_free();
 
 	/* shutdown InnoDB */
@@ -7740,6 +8628,20 @@ skip_check:
 	srv_apply_log_only = (ibool) xtrabackup_apply_log_only;
 	srv_rebuild_indexes = (ibool) xtrabackup_rebuild_indexes;
 
+	/* The sorted pages are split between the threads applying the log */
+	recv_n_apply_threads = (ulint) xtrabackup_parallel;
+
+	recv_spill_log_recs = xtrabackup_spill_redo;
+
+	/* xtrabackup_logfile is the only file of the log group, scan it
+	through a memory mapping */
+	recv_map_log_file = true;
+
+	/* All tablespaces of the backup are loaded before the log is scanned,
+	do not store the log records of the other ones, e.g. the tables
+	excluded from a partial backup */
+	recv_skip_missing_spaces = true;
+
 	/* increase IO threads */
 	if(srv_n_file_io_threads < 10) {
 		srv_n_read_io_threads = 4;
@@ -8894,6 +9796,32 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (ds_xbstream_shards > 1 &&
+	    (!xtrabackup_stream ||
+	     xtrabackup_stream_fmt != XB_STREAM_FMT_XBSTREAM)) {
+		msg("xtrabackup: error: "
+		    "--stream-shards requires --stream=xbstream.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (ds_xbstream_shards > 1 && ds_xbstream_shard_path == NULL) {
+		msg("xtrabackup: error: "
+		    "--stream-shards requires --stream-shard-path.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (xtrabackup_extract_stream) {
+		if (!xtrabackup_prepare || xtrabackup_incremental_dir) {
+			msg("xtrabackup: error: "
+			    "--extract-stream can only be used with --prepare "
+			    "of a full backup.\n");
+			exit(EXIT_FAILURE);
+		}
+
+		/* --decrypt and --decompress are applied while extracting */
+		xtrabackup_decrypt_decompress = FALSE;
+	}
+
 	if (!xtrabackup_prepare &&
 	    (innobase_log_arch_dir || xtrabackup_archived_to_lsn)) {
 
@@ -8917,6 +9845,15 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
+	if (xtrabackup_reflink
+	    && (!xtrabackup_backup || xtrabackup_stream || xtrabackup_compress
+		|| xtrabackup_encrypt || xtrabackup_incremental)) {
+		msg("xtrabackup: error: --reflink can only be used with "
+		    "--backup of a full backup that is not streamed, "
+		    "compressed or encrypted.\n");
+		exit(EXIT_FAILURE);
+	}
+
 	/* cannot execute both for now */
 	{
 		int num = 0;
@@ -8960,6 +9897,9 @@ int main(int argc, char **argv)
 
 	/* --prepare */
 	if (xtrabackup_prepare) {
+		if (xtrabackup_extract_stream && !extract_stream()) {
+			exit(EXIT_FAILURE);
+		}
 		xtrabackup_prepare_func(server_argc, server_defaults);
 	}
 
@@ -8979,6 +9919,8 @@ int main(int argc, char **argv)
 
 	backup_cleanup();
 
+	xb_fil_cur_free_buffers();
+
 	if (innobackupex_mode) {
 		ibx_cleanup();
 	}
@@ -81,6 +81,7 @@ extern lsn_t		metadata_last_lsn;
 
 extern xb_stream_fmt_t	xtrabackup_stream_fmt;
 extern ibool		xtrabackup_stream;
+extern my_bool		xtrabackup_extract_stream;
 
 extern char		*xtrabackup_tables;
 extern char		*xtrabackup_tables_file;
@@ -117,6 +118,7 @@ extern my_bool		xb_close_files;
 extern const char	*xtrabackup_compress_alg;
 extern uint		xtrabackup_compress_threads;
 extern ulonglong	xtrabackup_compress_chunk_size;
+extern uint		xtrabackup_decompress_threads;
 extern ulong		xtrabackup_encrypt_algo;
 extern uint		xtrabackup_encrypt_threads;
 extern ulonglong	xtrabackup_encrypt_chunk_size;
@@ -178,6 +180,7 @@ extern const char	*opt_history;
 extern my_bool		opt_decrypt;
 
 extern uint		opt_read_buffer_size;
+extern my_bool		opt_direct_io;
 
 extern char		*opt_xtra_plugin_dir;
 extern char		*opt_transition_key;
@@ -4,8 +4,6 @@
 
 . inc/common.sh
 
-require_qpress
-
 start_server --innodb_file_per_table
 load_sakila
 
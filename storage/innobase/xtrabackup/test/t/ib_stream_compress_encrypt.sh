@@ -2,8 +2,6 @@
 # Test streaming + compression + encryption
 ############################################################################
 
-require_qpress
-
 encrypt_algo="AES256"
 encrypt_key="percona_xtrabackup_is_awesome___"
 stream_format=xbstream
@@ -0,0 +1,38 @@
+########################################################################
+# Test that files copied back by the kernel match the backup
+########################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+checksum_a=`checksum_table sakila payment`
+
+xtrabackup --backup --target-dir=$topdir/backup
+xtrabackup --prepare --target-dir=$topdir/backup
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/backup
+
+for file in ibdata1 sakila/payment.ibd sakila/payment.frm
+do
+	if ! cmp $topdir/backup/$file $mysql_datadir/$file
+	then
+		vlog "$file differs from the backup"
+		exit -1
+	fi
+done
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
@@ -0,0 +1,76 @@
+########################################################################
+# Test --direct-io backups, including files with a tail that is not
+# aligned for O_DIRECT
+########################################################################
+
+. inc/common.sh
+
+dd if=/dev/zero of=$topdir/direct_probe bs=4096 count=1 oflag=direct \
+   >/dev/null 2>&1 || skip_test "Requires O_DIRECT support in $topdir"
+rm -f $topdir/direct_probe
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+# Pages of 1KB are written in blocks whose length is not always a multiple
+# of 4KB, so the tail of the file is written through the page cache after
+# the aligned blocks were written directly
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+CREATE TABLE payment_zip LIKE payment;
+ALTER TABLE payment_zip ROW_FORMAT=COMPRESSED KEY_BLOCK_SIZE=1;
+INSERT INTO payment_zip SELECT * FROM payment;
+EOF
+
+i=0
+while [ $((`stat -c %s $mysql_datadir/sakila/payment_zip.ibd` % 4096)) -eq 0 ]
+do
+	i=$((i+1))
+	if [ $i -gt 100 ]; then
+		die "payment_zip.ibd stays aligned to 4KB"
+	fi
+	run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+INSERT INTO payment_zip SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment LIMIT 100;
+EOF
+done
+
+zip_size=`stat -c %s $mysql_datadir/sakila/payment_zip.ibd`
+vlog "payment_zip.ibd is $zip_size bytes"
+
+checksum_a=`checksum_table sakila payment`
+checksum_zip_a=`checksum_table sakila payment_zip`
+
+xtrabackup --backup --direct-io --parallel=4 --target-dir=$topdir/backup
+
+if grep -q "O_DIRECT write to .* failed" $OUTFILE ; then
+	die "Direct writes have been rejected"
+fi
+
+if [ `stat -c %s $topdir/backup/sakila/payment_zip.ibd` -ne $zip_size ]
+then
+	die "The size of payment_zip.ibd has changed in the backup"
+fi
+
+xtrabackup --prepare --target-dir=$topdir/backup
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/backup
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+checksum_zip_b=`checksum_table sakila payment_zip`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
+
+if [ "$checksum_zip_a" != "$checksum_zip_b" ]; then
+	vlog "Checksums do not match: $checksum_zip_a != $checksum_zip_b"
+	exit -1
+fi
@@ -0,0 +1,45 @@
+############################################################################
+# Test extracting and then preparing a streamed backup with --extract-stream
+############################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+checksum_a=`checksum_table sakila payment`
+
+xtrabackup --backup --stream=xbstream --compress --compress-threads=4 \
+	   --target-dir=$topdir/tmp > $topdir/stream.xbs
+
+# Compressed files cannot be prepared without --decompress
+run_cmd_expect_failure $XB_BIN $XB_ARGS --prepare --extract-stream \
+	--target-dir=$topdir/nodecompress < $topdir/stream.xbs
+
+# A truncated stream must be rejected
+head -c 1000000 $topdir/stream.xbs > $topdir/truncated.xbs
+run_cmd_expect_failure $XB_BIN $XB_ARGS --prepare --extract-stream \
+	--decompress --target-dir=$topdir/truncated < $topdir/truncated.xbs
+
+xtrabackup --prepare --extract-stream --parallel=4 --decompress \
+	   --decompress-threads=4 --target-dir=$topdir/backup < $topdir/stream.xbs
+
+if ls $topdir/backup/*.qp >/dev/null 2>&1 ; then
+	die "Compressed files have been extracted"
+fi
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/backup
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
@@ -2,8 +2,6 @@
 # Test basic local parallel backup with compression and encryption
 ############################################################################
 
-require_qpress
-
 encrypt_algo="AES256"
 encrypt_key="percona_xtrabackup_is_awesome___"
 
@@ -0,0 +1,67 @@
+########################################################################
+# Test applying the log with several threads on --prepare
+########################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+mkdir $topdir/backup
+
+xtrabackup --backup --target-dir=$topdir/backup \
+           --debug-sync="data_copy_thread_func" &
+
+job_pid=$!
+pid_file=$topdir/backup/xtrabackup_debug_sync
+
+# Wait for xtrabackup to suspend
+i=0
+while [ ! -r "$pid_file" ]
+do
+    sleep 1
+    i=$((i+1))
+    echo "Waited $i seconds for $pid_file to be created"
+done
+
+xb_pid=`cat $pid_file`
+
+# Modify many pages, so that there are log records to apply on prepare
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+UPDATE payment SET amount = amount + 1;
+CREATE TABLE payment_copy LIKE payment;
+INSERT INTO payment_copy SELECT * FROM payment;
+EOF
+
+checksum_a=`checksum_table sakila payment`
+checksum_copy_a=`checksum_table sakila payment_copy`
+
+# Resume xtrabackup
+vlog "Resuming xtrabackup"
+kill -SIGCONT $xb_pid
+
+run_cmd wait $job_pid
+
+xtrabackup --prepare --parallel=8 --target-dir=$topdir/backup
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/backup
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+checksum_copy_b=`checksum_table sakila payment_copy`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
+
+if [ "$checksum_copy_a" != "$checksum_copy_b" ]; then
+	vlog "Checksums do not match: $checksum_copy_a != $checksum_copy_b"
+	exit -1
+fi
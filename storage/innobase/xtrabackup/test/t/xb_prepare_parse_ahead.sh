@@ -0,0 +1,94 @@
+########################################################################
+# Test parsing the log ahead of the log scan in several rounds on --prepare
+########################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+CREATE TABLE payment_copy LIKE payment;
+INSERT INTO payment_copy SELECT * FROM payment;
+EOF
+
+mkdir $topdir/backup
+
+xtrabackup --backup --target-dir=$topdir/backup \
+           --debug-sync="data_copy_thread_func" &
+
+job_pid=$!
+pid_file=$topdir/backup/xtrabackup_debug_sync
+
+# Wait for xtrabackup to suspend
+i=0
+while [ ! -r "$pid_file" ]
+do
+    sleep 1
+    i=$((i+1))
+    echo "Waited $i seconds for $pid_file to be created"
+done
+
+xb_pid=`cat $pid_file`
+
+# Each round parses 16MB of log per thread, generate well over 32MB of log
+# records so that 2 threads need several rounds
+for i in 1 2 3 4 5 6
+do
+	run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+INSERT INTO payment_copy SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_copy;
+EOF
+done
+
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+UPDATE payment SET amount = amount + 1;
+UPDATE payment_copy SET amount = amount + 1;
+EOF
+
+checksum_a=`checksum_table sakila payment`
+checksum_copy_a=`checksum_table sakila payment_copy`
+
+# Resume xtrabackup
+vlog "Resuming xtrabackup"
+kill -SIGCONT $xb_pid
+
+run_cmd wait $job_pid
+
+logfile_size=`stat -c %s $topdir/backup/xtrabackup_logfile`
+vlog "xtrabackup_logfile is $logfile_size bytes"
+
+if [ $logfile_size -le $((64 * 1024 * 1024)) ]; then
+	die "xtrabackup_logfile is too small for several parse-ahead rounds"
+fi
+
+xtrabackup --prepare --parallel=2 --target-dir=$topdir/backup
+
+rounds=`grep "Parsed the log ahead of the log scan in" $OUTFILE | \
+	sed -e 's/.* in \([0-9]*\) rounds.*/\1/'`
+
+if [ -z "$rounds" ] || [ "$rounds" -lt 2 ]; then
+	die "The log was not parsed ahead in several rounds: '$rounds'"
+fi
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/backup
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+checksum_copy_b=`checksum_table sakila payment_copy`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
+
+if [ "$checksum_copy_a" != "$checksum_copy_b" ]; then
+	vlog "Checksums do not match: $checksum_copy_a != $checksum_copy_b"
+	exit -1
+fi
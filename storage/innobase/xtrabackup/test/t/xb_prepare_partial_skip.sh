@@ -0,0 +1,51 @@
+########################################################################
+# Test that prepare of a partial backup does not store the log records of
+# the tablespaces that are not in the backup
+########################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+mkdir $topdir/backup
+
+xtrabackup --backup --tables='^sakila[.]payment$' \
+           --target-dir=$topdir/backup \
+           --debug-sync="data_copy_thread_func" &
+
+job_pid=$!
+pid_file=$topdir/backup/xtrabackup_debug_sync
+
+# Wait for xtrabackup to suspend
+i=0
+while [ ! -r "$pid_file" ]
+do
+    sleep 1
+    i=$((i+1))
+    echo "Waited $i seconds for $pid_file to be created"
+done
+
+xb_pid=`cat $pid_file`
+
+# Modify a table in the backup and a table that is not
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+UPDATE payment SET amount = amount + 1;
+UPDATE rental SET return_date = NOW();
+EOF
+
+# Resume xtrabackup
+vlog "Resuming xtrabackup"
+kill -SIGCONT $xb_pid
+
+run_cmd wait $job_pid
+
+xtrabackup --prepare --target-dir=$topdir/backup
+
+if ! grep -q "Discarded .* log records of tablespaces that are not in the backup" $OUTFILE
+then
+	vlog "Log records of sakila.rental were not discarded"
+	exit -1
+fi
@@ -0,0 +1,93 @@
+########################################################################
+# Test spilling log records to temporary files on --prepare
+########################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+# The log records of a tablespace deleted during the backup are spilled with
+# the others, and must be discarded on the merge
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+CREATE TABLE payment_dropped LIKE payment;
+INSERT INTO payment_dropped SELECT * FROM payment;
+EOF
+
+mkdir $topdir/backup
+
+xtrabackup --backup --target-dir=$topdir/backup \
+           --debug-sync="data_copy_thread_func" &
+
+job_pid=$!
+pid_file=$topdir/backup/xtrabackup_debug_sync
+
+# Wait for xtrabackup to suspend
+i=0
+while [ ! -r "$pid_file" ]
+do
+    sleep 1
+    i=$((i+1))
+    echo "Waited $i seconds for $pid_file to be created"
+done
+
+xb_pid=`cat $pid_file`
+
+# Generate more log records than fit into --use-memory
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+INSERT INTO payment_dropped SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_dropped;
+UPDATE payment_dropped SET amount = amount + 1;
+DROP TABLE payment_dropped;
+UPDATE payment SET amount = amount + 1;
+CREATE TABLE payment_copy LIKE payment;
+INSERT INTO payment_copy SELECT * FROM payment;
+INSERT INTO payment_copy SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_copy;
+UPDATE payment_copy SET amount = amount + 1;
+EOF
+
+checksum_a=`checksum_table sakila payment`
+checksum_copy_a=`checksum_table sakila payment_copy`
+
+# Resume xtrabackup
+vlog "Resuming xtrabackup"
+kill -SIGCONT $xb_pid
+
+run_cmd wait $job_pid
+
+xtrabackup --prepare --spill-redo --use-memory=5M \
+           --target-dir=$topdir/backup
+
+if ! grep -q "Merging .* runs of spilled log records" $OUTFILE
+then
+	vlog "Log records were not spilled"
+	exit -1
+fi
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/backup
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+checksum_copy_b=`checksum_table sakila payment_copy`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
+
+if [ "$checksum_copy_a" != "$checksum_copy_b" ]; then
+	vlog "Checksums do not match: $checksum_copy_a != $checksum_copy_b"
+	exit -1
+fi
+
+if [ -f $mysql_datadir/sakila/payment_dropped.ibd ]; then
+	vlog "Dropped tablespace is restored"
+	exit -1
+fi
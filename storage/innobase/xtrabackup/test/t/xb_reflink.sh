@@ -0,0 +1,80 @@
+########################################################################
+# Test --reflink backups
+########################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+which filefrag >/dev/null 2>&1 || skip_test "Requires filefrag"
+
+mkdir $topdir/backup
+
+# Files that cannot be cloned are copied, but only clones are tested here
+cp --reflink=always $mysql_datadir/sakila/film.ibd $topdir/backup/probe \
+	>/dev/null 2>&1 || \
+	skip_test "Requires reflink support between the datadir and $topdir"
+rm -f $topdir/backup/probe
+
+xtrabackup --backup --reflink --target-dir=$topdir/backup \
+           --debug-sync="data_copy_thread_func" &
+
+job_pid=$!
+pid_file=$topdir/backup/xtrabackup_debug_sync
+
+# Wait for xtrabackup to suspend
+i=0
+while [ ! -r "$pid_file" ]
+do
+    sleep 1
+    i=$((i+1))
+    echo "Waited $i seconds for $pid_file to be created"
+done
+
+xb_pid=`cat $pid_file`
+
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF
+UPDATE payment SET amount = amount + 1;
+EOF
+
+checksum_a=`checksum_table sakila payment`
+
+# Resume xtrabackup
+vlog "Resuming xtrabackup"
+kill -SIGCONT $xb_pid
+
+run_cmd wait $job_pid
+
+if ! grep -q "Cloned .*film.ibd" $OUTFILE ; then
+	die "film.ibd has not been cloned"
+fi
+
+# The table is not written during the backup, so all of its extents are still
+# shared with the data file
+if ! filefrag -v $topdir/backup/sakila/film.ibd | grep -q shared ; then
+	filefrag -v $topdir/backup/sakila/film.ibd
+	die "film.ibd shares no extents with the data file"
+fi
+
+xtrabackup --prepare --target-dir=$topdir/backup
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/backup
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
+
+vlog "Checking that --reflink is rejected for streamed backups"
+run_cmd_expect_failure $XB_BIN $XB_ARGS --backup --reflink --stream=xbstream \
+	--target-dir=$topdir/backup2 > /dev/null
@@ -29,3 +29,29 @@ xtrabackup --datadir=$mysql_datadir --prepare --target-dir=$topdir/backup
 xtrabackup --stats --datadir=$topdir/backup
 
 vlog "stats did not fail"
+
+vlog "===> xtrabackup --stats --parallel=4"
+
+xtrabackup --stats --datadir=$topdir/backup > $topdir/stats1.txt
+xtrabackup --stats --datadir=$topdir/backup --parallel=4 \
+	   --read-buffer-size=1M > $topdir/stats4.txt
+
+diff -u $topdir/stats1.txt $topdir/stats4.txt || \
+	die "--stats with --parallel gives different statistics"
+
+vlog "===> xtrabackup --stats --stats-format=json"
+
+xtrabackup --stats --datadir=$topdir/backup --parallel=4 \
+	   --stats-format=json > $topdir/stats.json
+
+n_text=`grep -c "table: " $topdir/stats1.txt`
+n_json=`grep -c '"table": ' $topdir/stats.json`
+
+vlog "$n_text indexes in text output, $n_json indexes in JSON output"
+
+if [ "$n_text" != "$n_json" ] ; then
+	die "JSON statistics do not list all indexes"
+fi
+
+grep -q '"table": "sakila/payment", "index": "PRIMARY"' $topdir/stats.json || \
+	die "sakila/payment is not found in JSON statistics"
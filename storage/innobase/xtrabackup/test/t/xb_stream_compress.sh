@@ -2,8 +2,6 @@
 # Test streaming + compression
 ############################################################################
 
-require_qpress
-
 stream_format=xbstream
 stream_extract_cmd="xbstream -xv <"
 stream_uncompress_cmd="xtrabackup --decompress --target-dir=./"
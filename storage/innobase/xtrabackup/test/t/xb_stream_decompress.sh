@@ -0,0 +1,9 @@
+############################################################################
+# Test decompression of a compressed stream on extraction
+############################################################################
+
+stream_format=xbstream
+stream_extract_cmd="xbstream -xv --decompress --decompress-threads=4 <"
+xtrabackup_options="--compress --compress-threads=4 --compress-chunk-size=8K"
+
+. inc/xb_stream_common.sh
@@ -0,0 +1,81 @@
+############################################################################
+# Test sharded streaming in the 'xbstream' format
+############################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+checksum_a=`checksum_table sakila payment`
+
+backup_dir=$topdir/backup
+shard_dir=$topdir/shards
+
+mkdir -p $backup_dir $shard_dir
+
+vlog "Sharding into regular files"
+
+xtrabackup --backup --stream=xbstream --parallel=4 --stream-shards=3 \
+	   --stream-shard-path=$shard_dir/stream --target-dir=$backup_dir \
+	   > $topdir/stdout
+
+# Nothing must be written to the standard output
+if [ -s $topdir/stdout ]; then
+	die "Data has been written to the standard output"
+fi
+
+for i in 0 1 2; do
+	if [ ! -s $shard_dir/stream.$i ]; then
+		die "Shard $i is missing or empty"
+	fi
+done
+
+# Every shard is a valid stream on its own
+mkdir -p $topdir/shard0
+run_cmd xbstream -x -C $topdir/shard0 < $shard_dir/stream.0
+
+run_cmd xbstream -x -C $backup_dir --parallel=4 \
+	$shard_dir/stream.0 $shard_dir/stream.1 $shard_dir/stream.2
+
+xtrabackup --prepare --target-dir=$backup_dir
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$backup_dir
+
+start_server
+
+checksum_b=`checksum_table sakila payment`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	vlog "Checksums do not match: $checksum_a != $checksum_b"
+	exit -1
+fi
+
+vlog "Sharding into named pipes"
+
+rm -rf $backup_dir $shard_dir
+mkdir -p $backup_dir $shard_dir
+
+mkfifo $shard_dir/stream.0 $shard_dir/stream.1
+
+xbstream -x -C $backup_dir $shard_dir/stream.0 $shard_dir/stream.1 &
+xbstream_pid=$!
+
+xtrabackup --backup --stream=xbstream --stream-shards=2 \
+	   --stream-shard-path=$shard_dir/stream --target-dir=$backup_dir
+
+run_cmd wait $xbstream_pid
+
+xtrabackup --prepare --target-dir=$backup_dir
+
+# --stream-shards requires the xbstream format and a shard path
+run_cmd_expect_failure $XB_BIN $XB_ARGS --backup --stream=tar \
+	--stream-shards=2 --stream-shard-path=$shard_dir/stream \
+	--target-dir=$topdir/tar
+run_cmd_expect_failure $XB_BIN $XB_ARGS --backup --stream=xbstream \
+	--stream-shards=2 --target-dir=$topdir/noshardpath
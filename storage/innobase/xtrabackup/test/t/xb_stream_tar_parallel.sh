@@ -0,0 +1,23 @@
+############################################################################
+# Test parallel streaming in the TAR format. A small spool size makes the
+# copy threads both spool files and wait for the stream.
+############################################################################
+
+stream_extract_cmd="$TAR -ixvkf"
+
+stream_format=tar
+xtrabackup_options="--parallel=16 --stream-spool-size=65536"
+
+. inc/xb_stream_common.sh
+
+# Files were spooled, within the budget as the copy threads do not own the
+# stream while spooling
+grep -q "Spooled [1-9][0-9]* files while streaming" $OUTFILE || \
+	die "No files were spooled"
+
+peak=`sed -n 's/.*Spooled [0-9]* files while streaming, at most \([0-9]*\) bytes.*/\1/p' $OUTFILE`
+[ "$peak" -le 65536 ] || die "Spooled $peak bytes, more than the budget"
+
+# Files larger than the budget were streamed directly and restored
+size=`stat -c %s $topdir/backup/sakila/rental.ibd`
+[ "$size" -gt 65536 ] || die "rental.ibd is not larger than the budget"
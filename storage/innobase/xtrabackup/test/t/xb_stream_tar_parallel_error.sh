@@ -0,0 +1,33 @@
+############################################################################
+# Test that a parallel backup streamed in the TAR format fails instead of
+# hanging when the stream cannot be written. Once a write to the stream
+# fails, every file opened in it fails too, both for the files spooled and
+# for those streamed directly.
+############################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+mkdir -p $topdir/backup
+
+$XB_BIN $XB_ARGS --backup --stream=tar --parallel=16 \
+	--stream-spool-size=65536 --target-dir=$topdir/backup > /dev/full &
+
+job_pid=$!
+
+i=0
+while kill -0 $job_pid 2>/dev/null
+do
+	sleep 1
+	i=$((i+1))
+	if [ $i -gt 300 ]; then
+		kill -9 $job_pid
+		die "xtrabackup hangs after a stream error"
+	fi
+done
+
+run_cmd_expect_failure wait $job_pid
@@ -0,0 +1,14 @@
+############################################################################
+# Test local parallel backup with compression and encryption sharing a
+# single worker pool
+############################################################################
+
+encrypt_algo="AES256"
+encrypt_key="percona_xtrabackup_is_awesome___"
+
+xtrabackup_options="--parallel=4 --threads=2 --compress --compress-threads=4 --compress-chunk-size=8K --encrypt=$encrypt_algo --encrypt-key=$encrypt_key --encrypt-threads=4 --encrypt-chunk-size=8K"
+
+data_decrypt_cmd="xtrabackup --decrypt=${encrypt_algo} --encrypt-key=${encrypt_key} --parallel=4 --target-dir=./"
+data_decompress_cmd="xtrabackup --decompress --parallel=4 --target-dir=./"
+
+. inc/xb_local.sh
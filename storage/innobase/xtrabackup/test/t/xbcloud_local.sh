@@ -0,0 +1,99 @@
+################################################################################
+# Test xbcloud with the local storage
+################################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+# A table spanning several segments
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF1
+CREATE TABLE payment_big LIKE payment;
+INSERT INTO payment_big SELECT * FROM payment;
+INSERT INTO payment_big SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_big;
+INSERT INTO payment_big SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_big;
+INSERT INTO payment_big SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_big;
+EOF1
+
+storage_dir=$topdir/storage
+xbcloud_args="--storage=local --local-dir=$storage_dir --local-latency=10 \
+	--parallel=4"
+
+vlog "take full backup"
+
+xtrabackup --backup --stream=xbstream --parallel=4 \
+	--target-dir=$topdir/backup | tee $topdir/full.xbs | \
+	run_cmd xbcloud put $xbcloud_args --segment-size=1M \
+	--upload-journal=$topdir/journal full_backup
+
+vlog "resume the upload of the same stream"
+
+run_cmd xbcloud put $xbcloud_args --segment-size=1M --resume \
+	--upload-journal=$topdir/journal full_backup \
+	< $topdir/full.xbs 2> $topdir/resume.log
+
+if grep -q "^uploading chunk" $topdir/resume.log ; then
+	die "resumed upload uploaded chunks again"
+fi
+
+vlog "resume with another segment size"
+
+run_cmd_expect_failure xbcloud put $xbcloud_args --segment-size=2M \
+	--resume --upload-journal=$topdir/journal full_backup \
+	< $topdir/full.xbs
+
+vlog "resume the upload with a stream of a smaller backup"
+
+# The stream of the new backup is segmented differently, the objects of
+# the first upload that it does not produce must be deleted
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF1
+TRUNCATE payment_big;
+INSERT INTO payment_big SELECT * FROM payment;
+EOF1
+
+checksum_a=`checksum_table sakila payment_big`
+
+xtrabackup --backup --stream=xbstream --parallel=4 \
+	--target-dir=$topdir/backup2 | \
+	run_cmd xbcloud put $xbcloud_args --segment-size=1M --resume \
+	--upload-journal=$topdir/journal full_backup 2> $topdir/resume2.log
+
+if ! grep -q "not a part of the resumed upload" $topdir/resume2.log ; then
+	die "objects of the previous upload are not deleted"
+fi
+
+vlog "download and prepare"
+
+mkdir $topdir/downloaded_full
+
+run_cmd xbcloud get $xbcloud_args full_backup | \
+	xbstream -xv -C $topdir/downloaded_full
+
+xtrabackup --prepare --target-dir=$topdir/downloaded_full
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/downloaded_full
+
+start_server
+
+checksum_b=`checksum_table sakila payment_big`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	die "Checksums do not match: $checksum_a != $checksum_b"
+fi
+
+vlog "delete"
+
+run_cmd xbcloud delete $xbcloud_args full_backup
+
+if [ -d $storage_dir/full_backup ]; then
+	die "backup is not deleted"
+fi
@@ -0,0 +1,85 @@
+################################################################################
+# Test resuming an interrupted xbcloud upload
+################################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF1
+CREATE TABLE payment_big LIKE payment;
+INSERT INTO payment_big SELECT * FROM payment;
+EOF1
+
+for i in 1 2 3 4
+do
+	run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF1
+INSERT INTO payment_big SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_big;
+EOF1
+done
+
+checksum_a=`checksum_table sakila payment_big`
+
+storage_dir=$topdir/storage
+xbcloud_args="--storage=local --local-dir=$storage_dir --parallel=4 \
+	--segment-size=1M"
+
+xtrabackup --backup --stream=xbstream --parallel=4 \
+	--target-dir=$topdir/backup > $topdir/full.xbs
+
+vlog "interrupt the upload half way through the stream"
+
+half=$((`stat -c %s $topdir/full.xbs` / 2 + 1))
+
+run_cmd_expect_failure bash -c "head -c $half $topdir/full.xbs | \
+	xbcloud put $xbcloud_args full_backup"
+
+vlog "resume the upload"
+
+# The segments of the interrupted upload are only known from the listing,
+# as it was not journaled
+run_cmd xbcloud put $xbcloud_args --resume \
+	--upload-journal=$topdir/journal full_backup \
+	< $topdir/full.xbs 2> $topdir/resume.log
+
+if ! grep -q "^skipping chunk" $topdir/resume.log ; then
+	die "resumed upload did not skip the uploaded chunks"
+fi
+
+if ! grep -q "^uploading chunk" $topdir/resume.log ; then
+	die "resumed upload did not upload the rest of the stream"
+fi
+
+# Both the skipped and the uploaded segments are journaled
+for object in `cd $storage_dir && find full_backup -type f`
+do
+	if ! grep -q " $object\$" $topdir/journal ; then
+		die "$object is missing from the upload journal"
+	fi
+done
+
+vlog "download and restore"
+
+mkdir $topdir/downloaded_full
+
+run_cmd xbcloud get $xbcloud_args full_backup | \
+	xbstream -xv -C $topdir/downloaded_full
+
+xtrabackup --prepare --target-dir=$topdir/downloaded_full
+
+stop_server
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/downloaded_full
+
+start_server
+
+checksum_b=`checksum_table sakila payment_big`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	die "Checksums do not match: $checksum_a != $checksum_b"
+fi
@@ -0,0 +1,83 @@
+################################################################################
+# Test splitting the files of the xbstream input into segments with xbcloud
+################################################################################
+
+. inc/common.sh
+
+start_server --innodb_file_per_table
+
+load_dbase_schema sakila
+load_dbase_data sakila
+
+run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF1
+CREATE TABLE payment_big LIKE payment;
+INSERT INTO payment_big SELECT * FROM payment;
+EOF1
+
+for i in 1 2 3 4 5
+do
+	run_cmd $MYSQL $MYSQL_ARGS sakila <<EOF1
+INSERT INTO payment_big SELECT NULL, customer_id, staff_id, rental_id,
+  amount, payment_date, last_update FROM payment_big;
+EOF1
+done
+
+checksum_a=`checksum_table sakila payment_big`
+
+storage_dir=$topdir/storage
+xbcloud_args="--storage=local --local-dir=$storage_dir --parallel=4"
+
+xtrabackup --backup --stream=xbstream --parallel=4 \
+	--target-dir=$topdir/backup > $topdir/full.xbs
+
+stop_server
+
+for segment_size in 1M 1G
+do
+	vlog "upload with --segment-size=$segment_size"
+
+	run_cmd xbcloud put $xbcloud_args --segment-size=$segment_size \
+		backup_$segment_size < $topdir/full.xbs
+
+	mkdir $topdir/downloaded_$segment_size
+
+	run_cmd xbcloud get $xbcloud_args backup_$segment_size | \
+		xbstream -xv -C $topdir/downloaded_$segment_size
+done
+
+n_small=`ls $storage_dir/backup_1M/sakila | grep -c "^payment_big\.ibd\."`
+n_large=`ls $storage_dir/backup_1G/sakila | grep -c "^payment_big\.ibd\."`
+
+vlog "payment_big.ibd is stored in $n_small segments of 1M and $n_large of 1G"
+
+if [ $n_small -lt 2 ]; then
+	die "payment_big.ibd is not split into segments of 1M"
+fi
+
+if [ $n_large -ne 1 ]; then
+	die "payment_big.ibd is not uploaded as one segment of 1G"
+fi
+
+# Every segment of 1M but the last one of each file reaches the segment size
+for f in `ls $storage_dir/backup_1M/sakila/payment_big.ibd.* | sed '$d'`
+do
+	if [ `stat -c %s $f` -lt 1048576 ]; then
+		die "segment $f is smaller than 1M"
+	fi
+done
+
+diff -r $topdir/downloaded_1M $topdir/downloaded_1G || \
+	die "the backups uploaded with different segment sizes differ"
+
+xtrabackup --prepare --target-dir=$topdir/downloaded_1M
+
+rm -rf $mysql_datadir
+xtrabackup --copy-back --target-dir=$topdir/downloaded_1M
+
+start_server
+
+checksum_b=`checksum_table sakila payment_big`
+
+if [ "$checksum_a" != "$checksum_b" ]; then
+	die "Checksums do not match: $checksum_a != $checksum_b"
+fi
@@ -0,0 +1,76 @@
+########################################################################
+# xbstream format version 2: CRC-32C checksums and the stream index
+########################################################################
+
+src_dir=$topdir/src
+mkdir -p $src_dir/db $topdir/v1 $topdir/v2 $topdir/member $topdir/piped
+
+dd if=/dev/urandom of=$src_dir/db/t1.ibd bs=1M count=24 2>/dev/null
+dd if=/dev/urandom of=$src_dir/db/t2.ibd bs=1K count=100 2>/dev/null
+touch $src_dir/empty
+
+cd $src_dir
+
+# Both versions can be created and extracted
+run_cmd xbstream -c db/t1.ibd db/t2.ibd empty > $topdir/v1.xbs
+run_cmd xbstream -c --stream-version=2 db/t1.ibd db/t2.ibd empty \
+	> $topdir/v2.xbs
+
+# Version 1 is the default
+head -c 8 $topdir/v1.xbs | grep -q XBSTCK01 || die "Default version is not 1"
+
+# Streams written to pipes do not have an index
+xbstream -c --stream-version=2 db/t1.ibd db/t2.ibd empty | \
+	cat > $topdir/piped.xbs
+
+cd - >/dev/null
+
+run_cmd xbstream -x -C $topdir/v1 < $topdir/v1.xbs
+run_cmd xbstream -x -C $topdir/v2 $topdir/v2.xbs
+run_cmd xbstream -x -C $topdir/piped < $topdir/piped.xbs
+
+for dir in v1 v2 piped; do
+	diff -r $src_dir $topdir/$dir || die "Extracted files differ ($dir)"
+done
+
+# Listing with and without the index
+for f in v1 v2 piped; do
+	run_cmd xbstream -t $topdir/$f.xbs | sort > $topdir/$f.list
+	diff -u $topdir/$f.list - <<EOF2 || die "Unexpected list of files ($f)"
+db/t1.ibd
+db/t2.ibd
+empty
+EOF2
+done
+
+# Single file extraction, with the index and by scanning the stream
+run_cmd xbstream -x -C $topdir/member --member=db/t2.ibd $topdir/v2.xbs
+cmp $src_dir/db/t2.ibd $topdir/member/db/t2.ibd || die "db/t2.ibd differs"
+[ ! -e $topdir/member/db/t1.ibd ] || die "db/t1.ibd must not be extracted"
+
+rm -rf $topdir/member/*
+run_cmd xbstream -x -C $topdir/member --member=db/t1.ibd < $topdir/v1.xbs
+cmp $src_dir/db/t1.ibd $topdir/member/db/t1.ibd || die "db/t1.ibd differs"
+
+run_cmd_expect_failure xbstream -x -C $topdir/member --member=missing \
+	$topdir/v2.xbs
+
+# A corrupted payload is detected with CRC-32C
+cp $topdir/v2.xbs $topdir/corrupted.xbs
+printf 'X' | dd of=$topdir/corrupted.xbs bs=1 seek=1000 conv=notrunc \
+	2>/dev/null
+mkdir -p $topdir/corrupted
+run_cmd_expect_failure xbstream -x -C $topdir/corrupted \
+	$topdir/corrupted.xbs
+
+# xbcloud stores the files of a stream with an index, not the index itself
+storage_dir=$topdir/storage
+xbcloud_args="--storage=local --local-dir=$storage_dir"
+mkdir -p $topdir/cloud
+
+run_cmd xbcloud put $xbcloud_args v2_backup < $topdir/v2.xbs
+[ -z "`ls -a $storage_dir/v2_backup | grep '^\.[0-9]'`" ] || \
+	die "The stream index is stored as a file"
+run_cmd xbcloud get $xbcloud_args v2_backup | \
+	xbstream -x -C $topdir/cloud
+diff -r $src_dir $topdir/cloud || die "Extracted files differ (cloud)"